@@ -0,0 +1,757 @@
+/*
+Benchmark suite for libcstr.
+
+Build it with optimizations enabled from the root of the repository:
+
+    cc -O2 -o cstr_bench bench/cstr_bench.c
+    cl /O2 bench\cstr_bench.c
+
+Usage:
+
+    cstr_bench [--json] [--filter <text>] [--size <bytes>] [--reps <count>] [--warmup <count>] [file ...]
+
+    --json      Output results as JSON instead of a table. Use this for tracking results over time.
+    --filter    Only run benchmarks whose name, or the name of the corpus, contains the given text.
+    --size      The size in bytes of each of the synthetic corpora. Defaults to 1MB.
+    --reps      The number of timed samples to take for each benchmark. Defaults to 15.
+    --warmup    The number of untimed runs to do before sampling. Defaults to 3.
+
+Every benchmark is run against a set of synthetic corpora which are generated from a fixed seed so that results are reproducible between runs and machines:
+
+    ascii       English-like ASCII text.
+    latin       Mostly ASCII text with accented Latin characters (2 byte sequences).
+    cjk         CJK ideographs and punctuation (3 byte sequences).
+    emoji       Emoji heavy text (4 byte sequences).
+    invalid     Latin text with ill-formed UTF-8 sequences scattered throughout.
+    c-source    C source code. Used by the lexer.
+    kv-config   Key/value configuration text. Used by the lexer and key/value parsers.
+
+Any files given on the command line are added as additional corpora so real-world data can be measured. Files ending in .c, .h, .cpp or .hpp are also used as
+C source, and files ending in .cfg, .conf, .kv, .ini or .txt are also used as key/value configs.
+
+Each sample runs the benchmark enough times to take at least a couple of milliseconds. The reported time per operation is the median of all samples, and the
+minimum, 90th and 99th percentiles are reported alongside it. What counts as an operation depends on the benchmark. For conversions it's a conversion of the
+entire corpus, for the lexer it's a single token, for the key/value parsers it's a single pair, etc. Throughput is always in terms of the input corpus.
+*/
+#include "cstr_bench_common.h"
+
+#define BENCH_DEFAULT_SIZE      (1024*1024)
+#define BENCH_DEFAULT_REPS      15
+#define BENCH_DEFAULT_WARMUP    3
+#define BENCH_MAX_REPS          1000
+#define BENCH_MAX_CORPORA       64
+
+
+
+/**************************************************************************************************************************************************************
+
+Corpora
+
+**************************************************************************************************************************************************************/
+typedef struct
+{
+    char name[64];
+    int kinds;                  /* BENCH_CORPUS_* */
+    char* pUTF8;                /* Always null terminated. */
+    size_t utf8Len;
+    cstr_utf16* pUTF16;         /* The corpus converted to UTF-16 and UTF-32 for the benchmarks that need it as input. Invalid code points are replaced. */
+    size_t utf16Len;
+    cstr_utf32* pUTF32;
+    size_t utf32Len;
+} bench_corpus;
+
+static void bench_corpus_finalize(bench_corpus* pCorpus)
+{
+    size_t utf16Len;
+    size_t utf32Len;
+
+    pCorpus->pUTF8[pCorpus->utf8Len] = '\0';
+
+    if (utf8_to_utf16_len(&utf16Len, pCorpus->pUTF8, pCorpus->utf8Len, NULL, 0) != 0 || utf8_to_utf32_len(&utf32Len, pCorpus->pUTF8, pCorpus->utf8Len, NULL, 0) != 0) {
+        printf("Failed to convert corpus \"%s\".\n", pCorpus->name);
+        exit(1);
+    }
+
+    pCorpus->pUTF16 = (cstr_utf16*)malloc((utf16Len + 1) * sizeof(cstr_utf16));
+    pCorpus->pUTF32 = (cstr_utf32*)malloc((utf32Len + 1) * sizeof(cstr_utf32));
+    if (pCorpus->pUTF16 == NULL || pCorpus->pUTF32 == NULL) {
+        printf("Out of memory.\n");
+        exit(1);
+    }
+
+    utf8_to_utf16ne(pCorpus->pUTF16, utf16Len + 1, &pCorpus->utf16Len, pCorpus->pUTF8, pCorpus->utf8Len, NULL, 0);
+    utf8_to_utf32ne(pCorpus->pUTF32, utf32Len + 1, &pCorpus->utf32Len, pCorpus->pUTF8, pCorpus->utf8Len, NULL, 0);
+}
+
+static void bench_corpus_init_synthetic(bench_corpus* pCorpus, const bench_generator* pGenerator, size_t size)
+{
+    memset(pCorpus, 0, sizeof(*pCorpus));
+    sprintf(pCorpus->name, "%.63s", pGenerator->pName);
+    pCorpus->kinds = pGenerator->kinds;
+    pCorpus->pUTF8 = bench_generate(pGenerator, size, &pCorpus->utf8Len);
+
+    bench_corpus_finalize(pCorpus);
+}
+
+static int bench_has_extension(const char* pPath, const char* pExtension)
+{
+    size_t pathLen = strlen(pPath);
+    size_t extensionLen = strlen(pExtension);
+
+    return pathLen > extensionLen && strcmp(pPath + pathLen - extensionLen, pExtension) == 0;
+}
+
+static int bench_corpus_init_file(bench_corpus* pCorpus, const char* pFilePath)
+{
+    FILE* pFile;
+    long fileSize;
+    const char* pFileName;
+
+    pFile = fopen(pFilePath, "rb");
+    if (pFile == NULL) {
+        return ENOENT;
+    }
+
+    memset(pCorpus, 0, sizeof(*pCorpus));
+
+    fseek(pFile, 0, SEEK_END);
+    fileSize = ftell(pFile);
+    fseek(pFile, 0, SEEK_SET);
+
+    pCorpus->pUTF8 = (char*)malloc((size_t)fileSize + 1);
+    if (pCorpus->pUTF8 == NULL) {
+        fclose(pFile);
+        return ENOMEM;
+    }
+
+    pCorpus->utf8Len = fread(pCorpus->pUTF8, 1, (size_t)fileSize, pFile);
+    fclose(pFile);
+
+    pFileName = pFilePath + strlen(pFilePath);
+    while (pFileName > pFilePath && pFileName[-1] != '/' && pFileName[-1] != '\\') {
+        pFileName -= 1;
+    }
+
+    sprintf(pCorpus->name, "file:%.58s", pFileName);
+
+    pCorpus->kinds = BENCH_CORPUS_TEXT;
+    if (bench_has_extension(pFilePath, ".c") || bench_has_extension(pFilePath, ".h") || bench_has_extension(pFilePath, ".cpp") || bench_has_extension(pFilePath, ".hpp")) {
+        pCorpus->kinds |= BENCH_CORPUS_SOURCE;
+    }
+    if (bench_has_extension(pFilePath, ".cfg") || bench_has_extension(pFilePath, ".conf") || bench_has_extension(pFilePath, ".kv") || bench_has_extension(pFilePath, ".ini") || bench_has_extension(pFilePath, ".txt")) {
+        pCorpus->kinds |= BENCH_CORPUS_CONFIG;
+    }
+
+    bench_corpus_finalize(pCorpus);
+    return 0;
+}
+
+static void bench_corpus_uninit(bench_corpus* pCorpus)
+{
+    free(pCorpus->pUTF8);
+    free(pCorpus->pUTF16);
+    free(pCorpus->pUTF32);
+}
+
+
+
+/**************************************************************************************************************************************************************
+
+Benchmarks
+
+Each benchmark runs once over the corpus and returns the number of operations it performed. Anything that needs to be prepared ahead of time, such as output
+buffers, is done in the setup callback so it's not included in the timing.
+
+**************************************************************************************************************************************************************/
+typedef struct
+{
+    const bench_corpus* pCorpus;
+    void* pOutput;              /* Large enough for the corpus converted to any encoding. */
+    cstr_kvdoc doc;
+    const char** ppKeys;        /* For lookups. These are full paths, including the section. */
+    size_t* pKeyLens;
+    size_t keyCount;
+    size_t bytesPerRun;         /* The number of input bytes processed by each run. Set by benchmarks that only process part of the corpus. */
+    size_t sink;                /* Results are accumulated into this so the compiler can't optimize away the work. */
+} bench_context;
+
+typedef struct
+{
+    const char* pName;
+    int kinds;                  /* The kinds of corpora this benchmark applies to. */
+    int (* setup)(bench_context* pContext);
+    size_t (* run)(bench_context* pContext);
+    int reportsThroughput;
+} bench_desc;
+
+static int bench_setup_output(bench_context* pContext)
+{
+    pContext->pOutput = malloc((pContext->pCorpus->utf32Len + 1) * sizeof(cstr_utf32) + pContext->pCorpus->utf8Len * 3 + 16);
+    return (pContext->pOutput != NULL) ? 0 : ENOMEM;
+}
+
+static int bench_on_pair_collect(void* pUserData, const char* pSection, size_t sectionLen, const char* pKey, size_t keyLen, const char* pValue, size_t valueLen, size_t lineNumber)
+{
+    bench_context* pContext = (bench_context*)pUserData;
+    char* pPath;
+
+    (void)pValue;
+    (void)valueLen;
+    (void)lineNumber;
+
+    /* Quoted keys are stored without the quotes. */
+    if (keyLen >= 2 && (pKey[0] == '\"' || pKey[0] == '\'')) {
+        pKey   += 1;
+        keyLen -= 2;
+    }
+
+    pPath = (char*)malloc(sectionLen + 1 + keyLen + 1);
+    if (pPath == NULL) {
+        return ENOMEM;
+    }
+
+    if (sectionLen > 0) {
+        memcpy(pPath, pSection, sectionLen);
+        pPath[sectionLen] = '.';
+        memcpy(pPath + sectionLen + 1, pKey, keyLen);
+        pContext->pKeyLens[pContext->keyCount] = sectionLen + 1 + keyLen;
+    } else {
+        memcpy(pPath, pKey, keyLen);
+        pContext->pKeyLens[pContext->keyCount] = keyLen;
+    }
+
+    pContext->ppKeys[pContext->keyCount] = pPath;
+    pContext->keyCount += 1;
+
+    return 0;
+}
+
+static int bench_setup_kvdoc(bench_context* pContext)
+{
+    int result;
+
+    result = cstr_kvdoc_init(pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, &pContext->doc);
+    if (result != 0) {
+        return result;
+    }
+
+    pContext->ppKeys   = (const char**)malloc(pContext->doc.entryCount * sizeof(*pContext->ppKeys) + 1);
+    pContext->pKeyLens = (size_t*)malloc(pContext->doc.entryCount * sizeof(*pContext->pKeyLens) + 1);
+    if (pContext->ppKeys == NULL || pContext->pKeyLens == NULL) {
+        return ENOMEM;
+    }
+
+    return cstr_keyvalue_parse(pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, bench_on_pair_collect, pContext);
+}
+
+static void bench_context_uninit(bench_context* pContext)
+{
+    size_t iKey;
+
+    for (iKey = 0; iKey < pContext->keyCount; iKey += 1) {
+        free((void*)pContext->ppKeys[iKey]);
+    }
+
+    free(pContext->ppKeys);
+    free(pContext->pKeyLens);
+    free(pContext->pOutput);
+
+    if (pContext->doc.pText != NULL) {
+        cstr_kvdoc_uninit(&pContext->doc);
+    }
+}
+
+
+/* Standard Library Replacements */
+static size_t bench_run_utf8_strlen(bench_context* pContext)
+{
+    pContext->sink += utf8_strlen(pContext->pCorpus->pUTF8);
+    return 1;
+}
+
+
+/* Dynamic Strings */
+static size_t bench_run_cstr8_newn(bench_context* pContext)
+{
+    cstr8 str = cstr8_newn(pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len);
+    pContext->sink += cstr8_len(str);
+    cstr8_free(str);
+    return 1;
+}
+
+static size_t bench_run_cstr8_catn(bench_context* pContext)
+{
+    /* Builds a copy of the corpus by appending it in small pieces. This measures the growth policy as much as the copy itself. */
+    const size_t pieceLen = 24;
+    size_t off;
+    size_t opCount = 0;
+    cstr8 str = cstr8_new("");
+
+    for (off = 0; off < pContext->pCorpus->utf8Len; off += pieceLen) {
+        size_t len = pContext->pCorpus->utf8Len - off;
+        if (len > pieceLen) {
+            len = pieceLen;
+        }
+
+        str = cstr8_catn(str, pContext->pCorpus->pUTF8 + off, len);
+        opCount += 1;
+    }
+
+    pContext->sink += cstr8_len(str);
+    cstr8_free(str);
+
+    return opCount;
+}
+
+static size_t bench_run_cstr8_findn(bench_context* pContext)
+{
+    /* The needle never appears in any of the corpora so this is always a full scan. */
+    pContext->sink += cstr8_findn(pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, "#!needle!#", 10);
+    return 1;
+}
+
+static size_t bench_run_cstr8_replace_all(bench_context* pContext)
+{
+    /* Replacing is quadratic in the number of matches so this is limited to the start of the corpus to keep the run time reasonable. */
+    size_t len = (pContext->pCorpus->utf8Len < 65536) ? pContext->pCorpus->utf8Len : 65536;
+    cstr8 str = cstr8_newn(pContext->pCorpus->pUTF8, len);
+
+    pContext->bytesPerRun = len;
+    str = cstr8_replace_all(str, "the", 3, "THE", 3);
+    pContext->sink += cstr8_len(str);
+    cstr8_free(str);
+    return 1;
+}
+
+
+/* Unicode Conversion */
+static size_t bench_run_utf8_to_utf16_len(bench_context* pContext)
+{
+    size_t len = 0;
+    utf8_to_utf16_len(&len, pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, NULL, 0);
+    pContext->sink += len;
+    return 1;
+}
+
+static size_t bench_run_utf8_to_utf16ne(bench_context* pContext)
+{
+    size_t len = 0;
+    utf8_to_utf16ne((cstr_utf16*)pContext->pOutput, pContext->pCorpus->utf16Len + 1, &len, pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, NULL, 0);
+    pContext->sink += len;
+    return 1;
+}
+
+static size_t bench_run_utf8_to_utf32_len(bench_context* pContext)
+{
+    size_t len = 0;
+    utf8_to_utf32_len(&len, pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, NULL, 0);
+    pContext->sink += len;
+    return 1;
+}
+
+static size_t bench_run_utf8_to_utf32ne(bench_context* pContext)
+{
+    size_t len = 0;
+    utf8_to_utf32ne((cstr_utf32*)pContext->pOutput, pContext->pCorpus->utf32Len + 1, &len, pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, NULL, 0);
+    pContext->sink += len;
+    return 1;
+}
+
+static size_t bench_run_utf16ne_to_utf8(bench_context* pContext)
+{
+    size_t len = 0;
+    utf16ne_to_utf8((cstr_utf8*)pContext->pOutput, pContext->pCorpus->utf8Len * 3 + 1, &len, pContext->pCorpus->pUTF16, pContext->pCorpus->utf16Len, NULL, 0);
+    pContext->sink += len;
+    return 1;
+}
+
+static size_t bench_run_utf16ne_to_utf32ne(bench_context* pContext)
+{
+    size_t len = 0;
+    utf16ne_to_utf32ne((cstr_utf32*)pContext->pOutput, pContext->pCorpus->utf32Len + 1, &len, pContext->pCorpus->pUTF16, pContext->pCorpus->utf16Len, NULL, 0);
+    pContext->sink += len;
+    return 1;
+}
+
+static size_t bench_run_utf32ne_to_utf8(bench_context* pContext)
+{
+    size_t len = 0;
+    utf32ne_to_utf8((cstr_utf8*)pContext->pOutput, pContext->pCorpus->utf8Len * 3 + 1, &len, pContext->pCorpus->pUTF32, pContext->pCorpus->utf32Len, NULL, 0);
+    pContext->sink += len;
+    return 1;
+}
+
+static size_t bench_run_utf32ne_to_utf16ne(bench_context* pContext)
+{
+    size_t len = 0;
+    utf32ne_to_utf16ne((cstr_utf16*)pContext->pOutput, pContext->pCorpus->utf16Len + 1, &len, pContext->pCorpus->pUTF32, pContext->pCorpus->utf32Len, NULL, 0);
+    pContext->sink += len;
+    return 1;
+}
+
+
+/* Utilities */
+static size_t bench_run_utf8_next_line(bench_context* pContext)
+{
+    const char* pText = pContext->pCorpus->pUTF8;
+    size_t textLen = pContext->pCorpus->utf8Len;
+    size_t lineCount = 0;
+
+    while (textLen > 0) {
+        size_t thisLineLen;
+        size_t nextLineOff = utf8_next_line(pText, textLen, &thisLineLen);
+        if (nextLineOff == 0) {
+            break;  /* Stopped at an invalid code point or null terminator. */
+        }
+
+        pContext->sink += thisLineLen;
+        pText     += nextLineOff;
+        textLen   -= nextLineOff;
+        lineCount += 1;
+    }
+
+    return lineCount;
+}
+
+static size_t bench_run_utf8_next_whitespace(bench_context* pContext)
+{
+    const char* pText = pContext->pCorpus->pUTF8;
+    size_t textLen = pContext->pCorpus->utf8Len;
+    size_t wordCount = 0;
+
+    while (textLen > 0) {
+        size_t wordLen = utf8_next_whitespace(pText, textLen);
+        if (wordLen == cstr_npos) {
+            break;
+        }
+
+        /* Step over the whitespace character itself. */
+        wordLen += utf8_ltrim_offset(pText + wordLen, textLen - wordLen);
+        if (wordLen == 0) {
+            break;
+        }
+
+        pText     += wordLen;
+        textLen   -= wordLen;
+        wordCount += 1;
+    }
+
+    pContext->sink += wordCount;
+    return wordCount;
+}
+
+
+/* Lexer */
+static size_t bench_run_cstr_lexer_next(bench_context* pContext)
+{
+    cstr_lexer lexer;
+    size_t tokenCount = 0;
+
+    cstr_lexer_init(pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, &lexer);
+    while (cstr_lexer_next(&lexer) == 0) {
+        tokenCount += 1;
+    }
+
+    pContext->sink += lexer.lineNumber;
+    return tokenCount;
+}
+
+
+/* Key/Value Parser */
+static size_t bench_run_cstr_keyvalue_parser_next(bench_context* pContext)
+{
+    cstr_keyvalue_parser parser;
+    size_t pairCount = 0;
+
+    cstr_keyvalue_parser_init(pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, &parser);
+    while (cstr_keyvalue_parser_next(&parser) == 0) {
+        pairCount += 1;
+    }
+
+    pContext->sink += pairCount;
+    return pairCount;
+}
+
+static int bench_on_pair_count(void* pUserData, const char* pSection, size_t sectionLen, const char* pKey, size_t keyLen, const char* pValue, size_t valueLen, size_t lineNumber)
+{
+    (void)pSection;
+    (void)sectionLen;
+    (void)pKey;
+    (void)keyLen;
+    (void)pValue;
+    (void)valueLen;
+    (void)lineNumber;
+
+    *(size_t*)pUserData += 1;
+    return 0;
+}
+
+static size_t bench_run_cstr_keyvalue_parse(bench_context* pContext)
+{
+    size_t pairCount = 0;
+
+    cstr_keyvalue_parse(pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, bench_on_pair_count, &pairCount);
+
+    pContext->sink += pairCount;
+    return pairCount;
+}
+
+
+/* Key/Value Documents */
+static size_t bench_run_cstr_kvdoc_init(bench_context* pContext)
+{
+    cstr_kvdoc doc;
+    size_t entryCount = 0;
+
+    if (cstr_kvdoc_init(pContext->pCorpus->pUTF8, pContext->pCorpus->utf8Len, &doc) == 0) {
+        entryCount = doc.entryCount;
+        cstr_kvdoc_uninit(&doc);
+    }
+
+    pContext->sink += entryCount;
+    return (entryCount > 0) ? entryCount : 1;
+}
+
+static size_t bench_run_cstr_kvdoc_find(bench_context* pContext)
+{
+    size_t iKey;
+
+    for (iKey = 0; iKey < pContext->keyCount; iKey += 1) {
+        pContext->sink += (size_t)cstr_kvdoc_find(&pContext->doc, pContext->ppKeys[iKey], pContext->pKeyLens[iKey]);
+    }
+
+    return (pContext->keyCount > 0) ? pContext->keyCount : 1;
+}
+
+
+static const bench_desc g_benchDescs[] = {
+    {"utf8_strlen",                 BENCH_CORPUS_TEXT,      NULL,               bench_run_utf8_strlen,                  1},
+    {"cstr8_newn",                  BENCH_CORPUS_TEXT,      NULL,               bench_run_cstr8_newn,                   1},
+    {"cstr8_catn",                  BENCH_CORPUS_TEXT,      NULL,               bench_run_cstr8_catn,                   1},
+    {"cstr8_findn",                 BENCH_CORPUS_TEXT,      NULL,               bench_run_cstr8_findn,                  1},
+    {"cstr8_replace_all",           BENCH_CORPUS_TEXT,      NULL,               bench_run_cstr8_replace_all,            1},
+    {"utf8_to_utf16_len",           BENCH_CORPUS_TEXT,      NULL,               bench_run_utf8_to_utf16_len,            1},
+    {"utf8_to_utf16ne",             BENCH_CORPUS_TEXT,      bench_setup_output, bench_run_utf8_to_utf16ne,              1},
+    {"utf8_to_utf32_len",           BENCH_CORPUS_TEXT,      NULL,               bench_run_utf8_to_utf32_len,            1},
+    {"utf8_to_utf32ne",             BENCH_CORPUS_TEXT,      bench_setup_output, bench_run_utf8_to_utf32ne,              1},
+    {"utf16ne_to_utf8",             BENCH_CORPUS_TEXT,      bench_setup_output, bench_run_utf16ne_to_utf8,              1},
+    {"utf16ne_to_utf32ne",          BENCH_CORPUS_TEXT,      bench_setup_output, bench_run_utf16ne_to_utf32ne,           1},
+    {"utf32ne_to_utf8",             BENCH_CORPUS_TEXT,      bench_setup_output, bench_run_utf32ne_to_utf8,              1},
+    {"utf32ne_to_utf16ne",          BENCH_CORPUS_TEXT,      bench_setup_output, bench_run_utf32ne_to_utf16ne,           1},
+    {"utf8_next_line",              BENCH_CORPUS_TEXT,      NULL,               bench_run_utf8_next_line,               1},
+    {"utf8_next_whitespace",        BENCH_CORPUS_TEXT,      NULL,               bench_run_utf8_next_whitespace,         1},
+    {"cstr_lexer_next",             BENCH_CORPUS_SOURCE | BENCH_CORPUS_CONFIG, NULL, bench_run_cstr_lexer_next,         1},
+    {"cstr_keyvalue_parser_next",   BENCH_CORPUS_CONFIG,    NULL,               bench_run_cstr_keyvalue_parser_next,    1},
+    {"cstr_keyvalue_parse",         BENCH_CORPUS_CONFIG,    NULL,               bench_run_cstr_keyvalue_parse,          1},
+    {"cstr_kvdoc_init",             BENCH_CORPUS_CONFIG,    NULL,               bench_run_cstr_kvdoc_init,              1},
+    {"cstr_kvdoc_find",             BENCH_CORPUS_CONFIG,    bench_setup_kvdoc,  bench_run_cstr_kvdoc_find,              0}
+};
+
+
+
+/**************************************************************************************************************************************************************
+
+Runner
+
+**************************************************************************************************************************************************************/
+typedef struct
+{
+    double nsPerOpMin;
+    double nsPerOpMedian;
+    double nsPerOpP90;
+    double nsPerOpP99;
+    double gbPerSecond;         /* Based on the median. Zero if the benchmark doesn't report throughput. */
+    size_t opsPerRun;
+    size_t runsPerSample;
+} bench_result;
+
+static void bench_run(const bench_desc* pDesc, bench_context* pContext, int warmupCount, int repCount, bench_result* pResult)
+{
+    double pSamples[BENCH_MAX_REPS];
+    size_t runsPerSample = 1;
+    size_t opsPerRun = 0;
+    double t;
+    int iRep;
+
+    for (iRep = 0; iRep < warmupCount; iRep += 1) {
+        opsPerRun = pDesc->run(pContext);
+    }
+
+    /* Work out how many runs are needed to make each sample long enough to be measured accurately. */
+    for (;;) {
+        size_t iRun;
+
+        t = bench_now();
+        for (iRun = 0; iRun < runsPerSample; iRun += 1) {
+            opsPerRun = pDesc->run(pContext);
+        }
+        t = bench_now() - t;
+
+        if (t >= BENCH_MIN_SAMPLE_TIME || runsPerSample >= ((size_t)1 << 20)) {
+            break;
+        }
+
+        runsPerSample *= 2;
+    }
+
+    for (iRep = 0; iRep < repCount; iRep += 1) {
+        size_t iRun;
+
+        t = bench_now();
+        for (iRun = 0; iRun < runsPerSample; iRun += 1) {
+            pDesc->run(pContext);
+        }
+        t = bench_now() - t;
+
+        pSamples[iRep] = (t * 1e9) / ((double)runsPerSample * (double)opsPerRun);
+    }
+
+    qsort(pSamples, (size_t)repCount, sizeof(double), bench_compare_doubles);
+
+    pResult->nsPerOpMin    = pSamples[0];
+    pResult->nsPerOpMedian = bench_percentile(pSamples, (size_t)repCount, 50);
+    pResult->nsPerOpP90    = bench_percentile(pSamples, (size_t)repCount, 90);
+    pResult->nsPerOpP99    = bench_percentile(pSamples, (size_t)repCount, 99);
+    pResult->opsPerRun     = opsPerRun;
+    pResult->runsPerSample = runsPerSample;
+    pResult->gbPerSecond   = 0;
+
+    if (pDesc->reportsThroughput) {
+        double secondsPerRun = (pResult->nsPerOpMedian * (double)opsPerRun) * 1e-9;
+        size_t bytesPerRun = (pContext->bytesPerRun != 0) ? pContext->bytesPerRun : pContext->pCorpus->utf8Len;
+        pResult->gbPerSecond = ((double)bytesPerRun / secondsPerRun) * 1e-9;
+    }
+}
+
+static void bench_print_usage(void)
+{
+    printf("Usage: cstr_bench [--json] [--filter <text>] [--size <bytes>] [--reps <count>] [--warmup <count>] [file ...]\n");
+}
+
+int main(int argc, char** argv)
+{
+    bench_corpus corpora[BENCH_MAX_CORPORA];
+    size_t corpusCount = 0;
+    size_t corpusSize = BENCH_DEFAULT_SIZE;
+    int repCount = BENCH_DEFAULT_REPS;
+    int warmupCount = BENCH_DEFAULT_WARMUP;
+    int outputJSON = 0;
+    const char* pFilter = NULL;
+    size_t iCorpus;
+    size_t iDesc;
+    size_t resultCount = 0;
+    size_t sink = 0;
+    int iArg;
+
+    for (iArg = 1; iArg < argc; iArg += 1) {
+        if (strcmp(argv[iArg], "--json") == 0) {
+            outputJSON = 1;
+        } else if (strcmp(argv[iArg], "--filter") == 0 && iArg + 1 < argc) {
+            pFilter = argv[++iArg];
+        } else if (strcmp(argv[iArg], "--size") == 0 && iArg + 1 < argc) {
+            corpusSize = (size_t)strtoul(argv[++iArg], NULL, 10);
+        } else if (strcmp(argv[iArg], "--reps") == 0 && iArg + 1 < argc) {
+            repCount = atoi(argv[++iArg]);
+        } else if (strcmp(argv[iArg], "--warmup") == 0 && iArg + 1 < argc) {
+            warmupCount = atoi(argv[++iArg]);
+        } else if (strcmp(argv[iArg], "--help") == 0 || argv[iArg][0] == '-') {
+            bench_print_usage();
+            return (strcmp(argv[iArg], "--help") == 0) ? 0 : 1;
+        } else if (corpusCount < BENCH_MAX_CORPORA - CSTR_COUNTOF(g_benchGenerators)) {
+            if (bench_corpus_init_file(&corpora[corpusCount], argv[iArg]) != 0) {
+                printf("Failed to load \"%s\".\n", argv[iArg]);
+                return 1;
+            }
+            corpusCount += 1;
+        }
+    }
+
+    if (repCount < 1 || repCount > BENCH_MAX_REPS || warmupCount < 0 || corpusSize < 64) {
+        bench_print_usage();
+        return 1;
+    }
+
+    for (iCorpus = 0; iCorpus < CSTR_COUNTOF(g_benchGenerators); iCorpus += 1) {
+        bench_corpus_init_synthetic(&corpora[corpusCount++], &g_benchGenerators[iCorpus], corpusSize);
+    }
+
+    if (outputJSON) {
+        printf("{\n  \"reps\": %d,\n  \"warmup\": %d,\n  \"corpora\": [", repCount, warmupCount);
+        for (iCorpus = 0; iCorpus < corpusCount; iCorpus += 1) {
+            printf("%s\n    {\"name\": ", (iCorpus > 0) ? "," : "");
+            bench_print_json_string(corpora[iCorpus].name);
+            printf(", \"bytes\": %lu}", (unsigned long)corpora[iCorpus].utf8Len);
+        }
+        printf("\n  ],\n  \"results\": [");
+    } else {
+        printf("%-28s %-16s %12s %12s %12s %12s %10s\n", "benchmark", "corpus", "ns/op", "min", "p90", "p99", "GB/s");
+    }
+
+    for (iDesc = 0; iDesc < CSTR_COUNTOF(g_benchDescs); iDesc += 1) {
+        const bench_desc* pDesc = &g_benchDescs[iDesc];
+
+        for (iCorpus = 0; iCorpus < corpusCount; iCorpus += 1) {
+            bench_context context;
+            bench_result result;
+
+            if ((pDesc->kinds & corpora[iCorpus].kinds) == 0) {
+                continue;
+            }
+
+            if (pFilter != NULL && strstr(pDesc->pName, pFilter) == NULL && strstr(corpora[iCorpus].name, pFilter) == NULL) {
+                continue;
+            }
+
+            memset(&context, 0, sizeof(context));
+            context.pCorpus = &corpora[iCorpus];
+
+            if (pDesc->setup != NULL && pDesc->setup(&context) != 0) {
+                bench_context_uninit(&context);
+                continue;   /* Not applicable to this corpus. */
+            }
+
+            bench_run(pDesc, &context, warmupCount, repCount, &result);
+            sink += context.sink;
+            bench_context_uninit(&context);
+
+            if (outputJSON) {
+                printf("%s\n    {\"benchmark\": ", (resultCount > 0) ? "," : "");
+                bench_print_json_string(pDesc->pName);
+                printf(", \"corpus\": ");
+                bench_print_json_string(corpora[iCorpus].name);
+                printf(", \"ops_per_run\": %lu, \"runs_per_sample\": %lu, \"ns_per_op\": %.3f, \"ns_per_op_min\": %.3f, \"ns_per_op_p90\": %.3f, \"ns_per_op_p99\": %.3f",
+                    (unsigned long)result.opsPerRun, (unsigned long)result.runsPerSample, result.nsPerOpMedian, result.nsPerOpMin, result.nsPerOpP90, result.nsPerOpP99);
+                if (pDesc->reportsThroughput) {
+                    printf(", \"gb_per_second\": %.4f}", result.gbPerSecond);
+                } else {
+                    printf(", \"gb_per_second\": null}");
+                }
+            } else {
+                printf("%-28s %-16s %12.1f %12.1f %12.1f %12.1f", pDesc->pName, corpora[iCorpus].name, result.nsPerOpMedian, result.nsPerOpMin, result.nsPerOpP90, result.nsPerOpP99);
+                if (pDesc->reportsThroughput) {
+                    printf(" %10.3f\n", result.gbPerSecond);
+                } else {
+                    printf(" %10s\n", "-");
+                }
+                fflush(stdout);
+            }
+
+            resultCount += 1;
+        }
+    }
+
+    if (outputJSON) {
+        printf("\n  ]\n}\n");
+    }
+
+    for (iCorpus = 0; iCorpus < corpusCount; iCorpus += 1) {
+        bench_corpus_uninit(&corpora[iCorpus]);
+    }
+
+    /* Only here to make sure the results of each benchmark are used. */
+    if (sink == 0) {
+        fprintf(stderr, "\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,391 @@
+/*
+Shared code for the libcstr benchmark programs. This contains the timer, the synthetic corpus generators and the statistics helpers. It's included by each
+of the benchmark programs which are otherwise self contained. See cstr_bench.c for details.
+*/
+#ifndef cstr_bench_common_h
+#define cstr_bench_common_h
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L /* For clock_gettime(). */
+#endif
+
+#define LIBCSTR_IMPLEMENTATION
+#include "../libcstr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define BENCH_MIN_SAMPLE_TIME   0.002   /* In seconds. Each sample repeats the benchmark until it takes at least this long. */
+
+#define BENCH_CORPUS_TEXT       (1 << 0)
+#define BENCH_CORPUS_SOURCE     (1 << 1)
+#define BENCH_CORPUS_CONFIG     (1 << 2)
+
+
+static double bench_now(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+#endif
+}
+
+
+
+/**************************************************************************************************************************************************************
+
+Corpora
+
+**************************************************************************************************************************************************************/
+typedef struct
+{
+    char* pData;
+    size_t len;
+    size_t cap;
+} bench_buffer;
+
+static cstr_uint32 g_benchRandomState;
+
+static void bench_random_seed(cstr_uint32 seed)
+{
+    g_benchRandomState = (seed != 0) ? seed : 1;
+}
+
+static cstr_uint32 bench_random(void)
+{
+    /* xorshift32. This needs to be the same on every platform so the corpora are reproducible. */
+    cstr_uint32 x = g_benchRandomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_benchRandomState = x;
+
+    return x;
+}
+
+static cstr_uint32 bench_random_range(cstr_uint32 lo, cstr_uint32 hi)
+{
+    return lo + (bench_random() % (hi - lo + 1));
+}
+
+static void bench_buffer_init(bench_buffer* pBuffer, size_t cap)
+{
+    pBuffer->pData = (char*)malloc(cap + 1);
+    pBuffer->len   = 0;
+    pBuffer->cap   = cap;
+
+    if (pBuffer->pData == NULL) {
+        printf("Out of memory.\n");
+        exit(1);
+    }
+}
+
+static int bench_buffer_full(const bench_buffer* pBuffer)
+{
+    return pBuffer->len >= pBuffer->cap;
+}
+
+static void bench_buffer_append(bench_buffer* pBuffer, const char* pData, size_t len)
+{
+    /* Data that doesn't fit is dropped in its entirety so that a multi-byte sequence is never split. */
+    if (pBuffer->len + len > pBuffer->cap) {
+        pBuffer->cap = pBuffer->len;
+        return;
+    }
+
+    memcpy(pBuffer->pData + pBuffer->len, pData, len);
+    pBuffer->len += len;
+}
+
+static void bench_buffer_append_string(bench_buffer* pBuffer, const char* pString)
+{
+    bench_buffer_append(pBuffer, pString, strlen(pString));
+}
+
+static void bench_buffer_append_code_point(bench_buffer* pBuffer, cstr_utf32 cp)
+{
+    char utf8[4];
+    size_t len;
+
+    if (cp < 0x80) {
+        utf8[0] = (char)cp;
+        len = 1;
+    } else if (cp < 0x800) {
+        utf8[0] = (char)(0xC0 | (cp >> 6));
+        utf8[1] = (char)(0x80 | (cp & 0x3F));
+        len = 2;
+    } else if (cp < 0x10000) {
+        utf8[0] = (char)(0xE0 | (cp >> 12));
+        utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (cp & 0x3F));
+        len = 3;
+    } else {
+        utf8[0] = (char)(0xF0 | (cp >> 18));
+        utf8[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (cp & 0x3F));
+        len = 4;
+    }
+
+    bench_buffer_append(pBuffer, utf8, len);
+}
+
+static const char* g_benchWords[] = {
+    "the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "string", "library", "buffer", "length", "capacity", "convert", "encoding", "character",
+    "a", "of", "and", "to", "in", "is", "that", "for", "it", "with", "as", "was", "on", "be", "at", "by", "this", "had", "not", "are", "but", "from", "or"
+};
+
+/* Written with escapes so the source file doesn't depend on the compiler's source character set. */
+static const char* g_benchLatinWords[] = {
+    "caf\xC3\xA9", "na\xC3\xAFve", "\xC3\xBC""ber", "Stra\xC3\x9F""e", "gar\xC3\xA7on", "se\xC3\xB1or", "fa\xC3\xA7""ade", "d\xC3\xA9j\xC3\xA0",
+    "vu", "\xC3\x86r\xC3\xB8", "sm\xC3\xB6rg\xC3\xA5sbord", "cr\xC3\xA8me", "br\xC3\xBBl\xC3\xA9""e", "pi\xC3\xB1""ata", "jalape\xC3\xB1o", "fianc\xC3\xA9""e",
+    "the", "and", "of", "to", "with", "from", "\xC3\xBC""ber", "tr\xC3\xA8s",
+    "bien", "o\xC3\xB9", "\xC3\xAAtre", "f\xC3\xBCr", "sch\xC3\xB6n", "gro\xC3\x9F""e", "a\xC3\xB1o", "ni\xC3\xB1o"
+};
+
+static void bench_generate_words(bench_buffer* pBuffer, const char** ppWords, size_t wordCount)
+{
+    size_t lineLen = 0;
+
+    while (!bench_buffer_full(pBuffer)) {
+        const char* pWord = ppWords[bench_random() % wordCount];
+
+        bench_buffer_append_string(pBuffer, pWord);
+        lineLen += strlen(pWord) + 1;
+
+        if ((bench_random() % 12) == 0) {
+            bench_buffer_append_string(pBuffer, (bench_random() % 2) ? "." : ",");
+        }
+
+        if (lineLen > 80) {
+            bench_buffer_append_string(pBuffer, "\n");
+            lineLen = 0;
+        } else {
+            bench_buffer_append_string(pBuffer, " ");
+        }
+    }
+}
+
+static void bench_generate_ascii(bench_buffer* pBuffer)
+{
+    bench_generate_words(pBuffer, g_benchWords, CSTR_COUNTOF(g_benchWords));
+}
+
+static void bench_generate_latin(bench_buffer* pBuffer)
+{
+    bench_generate_words(pBuffer, g_benchLatinWords, CSTR_COUNTOF(g_benchLatinWords));
+}
+
+static void bench_generate_cjk(bench_buffer* pBuffer)
+{
+    while (!bench_buffer_full(pBuffer)) {
+        cstr_uint32 r = bench_random() % 100;
+
+        if (r < 4) {
+            bench_buffer_append_code_point(pBuffer, 0x3002);   /* Ideographic full stop. */
+        } else if (r < 8) {
+            bench_buffer_append_code_point(pBuffer, 0xFF0C);   /* Fullwidth comma. */
+        } else if (r < 9) {
+            bench_buffer_append_string(pBuffer, "\n");
+        } else {
+            bench_buffer_append_code_point(pBuffer, bench_random_range(0x4E00, 0x9FFF));
+        }
+    }
+}
+
+static void bench_generate_emoji(bench_buffer* pBuffer)
+{
+    while (!bench_buffer_full(pBuffer)) {
+        cstr_uint32 r = bench_random() % 100;
+
+        if (r < 15) {
+            bench_buffer_append_string(pBuffer, g_benchWords[bench_random() % CSTR_COUNTOF(g_benchWords)]);
+            bench_buffer_append_string(pBuffer, " ");
+        } else if (r < 17) {
+            bench_buffer_append_string(pBuffer, "\n");
+        } else if (r < 30) {
+            bench_buffer_append_code_point(pBuffer, bench_random_range(0x1F300, 0x1F5FF));
+            bench_buffer_append_code_point(pBuffer, 0x200D);   /* Zero width joiner. */
+            bench_buffer_append_code_point(pBuffer, bench_random_range(0x1F600, 0x1F64F));
+        } else {
+            bench_buffer_append_code_point(pBuffer, bench_random_range(0x1F600, 0x1F64F));
+        }
+    }
+}
+
+static void bench_generate_invalid(bench_buffer* pBuffer)
+{
+    /* Ill-formed sequences: lone continuation bytes, overlong encodings, surrogates, truncated sequences and bytes that never appear in UTF-8. */
+    static const char* ppInvalid[] = {
+        "\x80", "\xBF", "\xC0\xAF", "\xE0\x80\xAF", "\xED\xA0\x80", "\xC3", "\xE2\x82", "\xF0\x9F\x98", "\xF8\x88\x80\x80\x80", "\xFE", "\xFF", "\xF4\x90\x80\x80"
+    };
+
+    size_t lineLen = 0;
+
+    while (!bench_buffer_full(pBuffer)) {
+        const char* pWord = g_benchLatinWords[bench_random() % CSTR_COUNTOF(g_benchLatinWords)];
+
+        bench_buffer_append_string(pBuffer, pWord);
+        lineLen += strlen(pWord) + 1;
+
+        if ((bench_random() % 4) == 0) {
+            bench_buffer_append_string(pBuffer, ppInvalid[bench_random() % CSTR_COUNTOF(ppInvalid)]);
+        }
+
+        if (lineLen > 80) {
+            bench_buffer_append_string(pBuffer, "\n");
+            lineLen = 0;
+        } else {
+            bench_buffer_append_string(pBuffer, " ");
+        }
+    }
+
+    /* The converters report EINVAL for a sequence that is truncated by the end of the input. Make sure the corpus ends on a complete code point. */
+    while (pBuffer->len > 0 && (unsigned char)pBuffer->pData[pBuffer->len - 1] >= 0x80) {
+        pBuffer->len -= 1;
+    }
+}
+
+static void bench_generate_c_source(bench_buffer* pBuffer)
+{
+    char line[256];
+    cstr_uint32 iFunction = 0;
+
+    while (!bench_buffer_full(pBuffer)) {
+        cstr_uint32 a = bench_random() % 1000;
+        cstr_uint32 b = bench_random() % 1000;
+
+        sprintf(line, "/*\nComputes something useful. This is function number %u.\n*/\n", (unsigned int)iFunction);
+        bench_buffer_append_string(pBuffer, line);
+        sprintf(line, "static int bench_function_%u(const char* pText, size_t textLen, int flags)\n{\n", (unsigned int)iFunction);
+        bench_buffer_append_string(pBuffer, line);
+        sprintf(line, "    int result = 0x%X;\n    size_t i;\n\n", (unsigned int)a);
+        bench_buffer_append_string(pBuffer, line);
+        sprintf(line, "    for (i = 0; i < textLen; i += 1) {\n        if (pText[i] == '\\n' && (flags & %u) != 0) {\n", (unsigned int)(b % 32));
+        bench_buffer_append_string(pBuffer, line);
+        sprintf(line, "            result += (int)(i * %u) >> 2;   // Accumulate.\n        } else {\n            result ^= %u.%ue3f;\n        }\n    }\n\n", (unsigned int)b, (unsigned int)a, (unsigned int)(b % 10));
+        bench_buffer_append_string(pBuffer, line);
+        sprintf(line, "    printf(\"function %%d returned %%d\\n\", %u, result);\n    return result;\n}\n\n", (unsigned int)iFunction);
+        bench_buffer_append_string(pBuffer, line);
+
+        iFunction += 1;
+    }
+}
+
+static void bench_generate_kv_config(bench_buffer* pBuffer)
+{
+    char line[256];
+    cstr_uint32 iPair = 0;
+
+    while (!bench_buffer_full(pBuffer)) {
+        cstr_uint32 r = bench_random() % 100;
+
+        if ((iPair % 200) == 0) {
+            sprintf(line, "\n[section-%u]\n", (unsigned int)(iPair / 200));
+        } else if (r < 40) {
+            sprintf(line, "key-%u = \"value number %u\"\n", (unsigned int)iPair, (unsigned int)bench_random());
+        } else if (r < 70) {
+            sprintf(line, "option_%u %s;\n", (unsigned int)iPair, g_benchWords[bench_random() % CSTR_COUNTOF(g_benchWords)]);
+        } else if (r < 85) {
+            sprintf(line, "group.item-%u = '%s %s'   // Trailing comment.\n", (unsigned int)iPair, g_benchWords[bench_random() % CSTR_COUNTOF(g_benchWords)], g_benchWords[bench_random() % CSTR_COUNTOF(g_benchWords)]);
+        } else {
+            sprintf(line, "/* Setting %u. */\n\"quoted key %u\" = enabled\n", (unsigned int)iPair, (unsigned int)iPair);
+        }
+
+        bench_buffer_append_string(pBuffer, line);
+        iPair += 1;
+    }
+}
+
+typedef struct
+{
+    const char* pName;
+    int kinds;                  /* BENCH_CORPUS_* */
+    void (* generate)(bench_buffer* pBuffer);
+    cstr_uint32 seed;           /* Each corpus has its own seed so that adding a new one doesn't change the others. */
+} bench_generator;
+
+static const bench_generator g_benchGenerators[] = {
+    {"ascii",     BENCH_CORPUS_TEXT,                       bench_generate_ascii,     0x1234567},
+    {"latin",     BENCH_CORPUS_TEXT,                       bench_generate_latin,     0x2345678},
+    {"cjk",       BENCH_CORPUS_TEXT,                       bench_generate_cjk,       0x3456789},
+    {"emoji",     BENCH_CORPUS_TEXT,                       bench_generate_emoji,     0x456789A},
+    {"invalid",   BENCH_CORPUS_TEXT,                       bench_generate_invalid,   0x56789AB},
+    {"c-source",  BENCH_CORPUS_TEXT | BENCH_CORPUS_SOURCE, bench_generate_c_source,  0x6789ABC},
+    {"kv-config", BENCH_CORPUS_TEXT | BENCH_CORPUS_CONFIG, bench_generate_kv_config, 0x789ABCD}
+};
+
+/* Generates a corpus of approximately the given size. The returned buffer is null terminated and must be freed with free(). */
+static char* bench_generate(const bench_generator* pGenerator, size_t size, size_t* pLen)
+{
+    bench_buffer buffer;
+
+    bench_random_seed(pGenerator->seed);
+    bench_buffer_init(&buffer, size);
+    pGenerator->generate(&buffer);
+
+    buffer.pData[buffer.len] = '\0';
+    *pLen = buffer.len;
+
+    return buffer.pData;
+}
+
+
+
+/**************************************************************************************************************************************************************
+
+Statistics and Output
+
+**************************************************************************************************************************************************************/
+static int bench_compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static double bench_percentile(const double* pSorted, size_t count, double percentile)
+{
+    /* Nearest rank. */
+    size_t rank = (size_t)(percentile / 100.0 * (double)count + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > count) {
+        rank = count;
+    }
+
+    return pSorted[rank - 1];
+}
+
+static void bench_print_json_string(const char* pString)
+{
+    putchar('\"');
+    for (; *pString != '\0'; pString += 1) {
+        if (*pString == '\"' || *pString == '\\') {
+            putchar('\\');
+        }
+        putchar(*pString);
+    }
+    putchar('\"');
+}
+
+#endif  /* cstr_bench_common_h */
@@ -0,0 +1,627 @@
+/*
+Transcoding throughput matrix for libcstr.
+
+This runs every Unicode conversion function, and every `_len` function, across each class of input and a range of input sizes, both sized and null
+terminated, and with and without CSTR_ERROR_ON_INVALID_CODE_POINT. Build it with optimizations enabled from the root of the repository:
+
+    cc -O2 -o cstr_bench_transcode bench/cstr_bench_transcode.c
+    cl /O2 bench\cstr_bench_transcode.c
+
+To also measure iconv for comparison, define BENCH_WITH_ICONV and link against iconv if it's not part of your C library:
+
+    cc -O2 -DBENCH_WITH_ICONV -o cstr_bench_transcode bench/cstr_bench_transcode.c [-liconv]
+
+iconv is only run for sized input without flags, and not for the invalid class because it stops at the first invalid sequence.
+
+Usage:
+
+    cstr_bench_transcode [--json] [--filter <text>] [--class <name>] [--max-size <bytes>] [--reps <count>]
+
+    --json      Output results as JSON instead of tables.
+    --filter    Only run functions whose name contains the given text.
+    --class     Only run the given input class. One of ascii, latin, cjk, emoji or invalid.
+    --max-size  The largest input size to run. Sizes go from 64 bytes up to this in steps of 16x. Defaults to 4MB. The largest supported size is 64MB.
+    --reps      The number of timed samples to take for each cell. Defaults to 5.
+
+The results are printed as one table for each combination of input class, termination and flags. Each row is a function and each column is an input size.
+Sizes are in terms of the UTF-8 form of the input, and each cell is the median throughput in GB/s in terms of the bytes of the input encoding. A cell is "-"
+if the function returned an error, which is expected for invalid input when CSTR_ERROR_ON_INVALID_CODE_POINT is set.
+*/
+#include "cstr_bench_common.h"
+
+#if defined(BENCH_WITH_ICONV)
+#include <iconv.h>
+#endif
+
+#define BENCH_DEFAULT_MAX_SIZE  (4*1024*1024)
+#define BENCH_LARGEST_SIZE      (64*1024*1024)
+#define BENCH_DEFAULT_REPS      5
+#define BENCH_MAX_REPS          1000
+#define BENCH_MAX_SIZES         8
+
+typedef enum
+{
+    bench_encoding_utf8 = 0,
+    bench_encoding_utf16ne,
+    bench_encoding_utf16le,
+    bench_encoding_utf16be,
+    bench_encoding_utf32ne,
+    bench_encoding_utf32le,
+    bench_encoding_utf32be,
+    bench_encoding_count
+} bench_encoding;
+
+static size_t bench_encoding_unit_size(bench_encoding encoding)
+{
+    if (encoding == bench_encoding_utf8) {
+        return 1;
+    }
+    if (encoding <= bench_encoding_utf16be) {
+        return 2;
+    }
+
+    return 4;
+}
+
+typedef errno_t (* bench_convert_proc)(void* pOutput, size_t outputCapInBytes, size_t* pOutputLen, const void* pInput, size_t inputLen, cstr_uint32 flags);
+
+typedef struct
+{
+    const char* pName;
+    bench_encoding input;
+    bench_convert_proc convert;
+} bench_transcoder;
+
+
+/*
+Adapters so every function can be called through the same signature. `_len` functions ignore the output buffer. The output capacity is in bytes and is
+converted to units of the output encoding by the adapter.
+*/
+#define BENCH_CONVERT(name, inputType, outputType) \
+    static errno_t bench_##name(void* pOutput, size_t outputCapInBytes, size_t* pOutputLen, const void* pInput, size_t inputLen, cstr_uint32 flags) \
+    { \
+        return name((outputType*)pOutput, outputCapInBytes / sizeof(outputType), pOutputLen, (const inputType*)pInput, inputLen, NULL, flags); \
+    }
+
+#define BENCH_LENGTH(name, inputType) \
+    static errno_t bench_##name(void* pOutput, size_t outputCapInBytes, size_t* pOutputLen, const void* pInput, size_t inputLen, cstr_uint32 flags) \
+    { \
+        (void)pOutput; \
+        (void)outputCapInBytes; \
+        return name(pOutputLen, (const inputType*)pInput, inputLen, NULL, flags); \
+    }
+
+BENCH_CONVERT(utf8_to_utf16ne,      cstr_utf8,  cstr_utf16)
+BENCH_CONVERT(utf8_to_utf16le,      cstr_utf8,  cstr_utf16)
+BENCH_CONVERT(utf8_to_utf16be,      cstr_utf8,  cstr_utf16)
+BENCH_CONVERT(utf8_to_utf16,        cstr_utf8,  cstr_utf16)
+BENCH_CONVERT(utf8_to_utf32ne,      cstr_utf8,  cstr_utf32)
+BENCH_CONVERT(utf8_to_utf32le,      cstr_utf8,  cstr_utf32)
+BENCH_CONVERT(utf8_to_utf32be,      cstr_utf8,  cstr_utf32)
+BENCH_CONVERT(utf8_to_utf32,        cstr_utf8,  cstr_utf32)
+BENCH_CONVERT(utf16ne_to_utf8,      cstr_utf16, cstr_utf8)
+BENCH_CONVERT(utf16le_to_utf8,      cstr_utf16, cstr_utf8)
+BENCH_CONVERT(utf16be_to_utf8,      cstr_utf16, cstr_utf8)
+BENCH_CONVERT(utf16_to_utf8,        cstr_utf16, cstr_utf8)
+BENCH_CONVERT(utf16ne_to_utf32ne,   cstr_utf16, cstr_utf32)
+BENCH_CONVERT(utf16le_to_utf32le,   cstr_utf16, cstr_utf32)
+BENCH_CONVERT(utf16be_to_utf32be,   cstr_utf16, cstr_utf32)
+BENCH_CONVERT(utf16_to_utf32,       cstr_utf16, cstr_utf32)
+BENCH_CONVERT(utf32ne_to_utf8,      cstr_utf32, cstr_utf8)
+BENCH_CONVERT(utf32le_to_utf8,      cstr_utf32, cstr_utf8)
+BENCH_CONVERT(utf32be_to_utf8,      cstr_utf32, cstr_utf8)
+BENCH_CONVERT(utf32_to_utf8,        cstr_utf32, cstr_utf8)
+BENCH_CONVERT(utf32ne_to_utf16ne,   cstr_utf32, cstr_utf16)
+BENCH_CONVERT(utf32le_to_utf16le,   cstr_utf32, cstr_utf16)
+BENCH_CONVERT(utf32be_to_utf16be,   cstr_utf32, cstr_utf16)
+BENCH_CONVERT(utf32_to_utf16,       cstr_utf32, cstr_utf16)
+
+BENCH_LENGTH(utf8_to_utf16_len,         cstr_utf8)
+BENCH_LENGTH(utf8_to_utf16ne_len,       cstr_utf8)
+BENCH_LENGTH(utf8_to_utf16le_len,       cstr_utf8)
+BENCH_LENGTH(utf8_to_utf16be_len,       cstr_utf8)
+BENCH_LENGTH(utf8_to_utf32_len,         cstr_utf8)
+BENCH_LENGTH(utf8_to_utf32ne_len,       cstr_utf8)
+BENCH_LENGTH(utf8_to_utf32le_len,       cstr_utf8)
+BENCH_LENGTH(utf8_to_utf32be_len,       cstr_utf8)
+BENCH_LENGTH(utf16ne_to_utf8_len,       cstr_utf16)
+BENCH_LENGTH(utf16le_to_utf8_len,       cstr_utf16)
+BENCH_LENGTH(utf16be_to_utf8_len,       cstr_utf16)
+BENCH_LENGTH(utf16_to_utf8_len,         cstr_utf16)
+BENCH_LENGTH(utf16ne_to_utf32_len,      cstr_utf16)
+BENCH_LENGTH(utf16le_to_utf32_len,      cstr_utf16)
+BENCH_LENGTH(utf16be_to_utf32_len,      cstr_utf16)
+BENCH_LENGTH(utf16ne_to_utf32ne_len,    cstr_utf16)
+BENCH_LENGTH(utf16le_to_utf32le_len,    cstr_utf16)
+BENCH_LENGTH(utf16be_to_utf32be_len,    cstr_utf16)
+BENCH_LENGTH(utf16_to_utf32_len,        cstr_utf16)
+BENCH_LENGTH(utf32ne_to_utf8_len,       cstr_utf32)
+BENCH_LENGTH(utf32le_to_utf8_len,       cstr_utf32)
+BENCH_LENGTH(utf32be_to_utf8_len,       cstr_utf32)
+BENCH_LENGTH(utf32_to_utf8_len,         cstr_utf32)
+BENCH_LENGTH(utf32ne_to_utf16_len,      cstr_utf32)
+BENCH_LENGTH(utf32le_to_utf16_len,      cstr_utf32)
+BENCH_LENGTH(utf32be_to_utf16_len,      cstr_utf32)
+BENCH_LENGTH(utf32ne_to_utf16ne_len,    cstr_utf32)
+BENCH_LENGTH(utf32le_to_utf16le_len,    cstr_utf32)
+BENCH_LENGTH(utf32be_to_utf16be_len,    cstr_utf32)
+BENCH_LENGTH(utf32_to_utf16_len,        cstr_utf32)
+
+
+#if defined(BENCH_WITH_ICONV)
+/*
+iconv doesn't support null terminated input or a flag for replacing invalid code points so it's only run for sized input without the flag. The descriptors
+are opened once up front so that iconv_open() isn't part of the timing, and the shift state is reset before each conversion.
+*/
+typedef struct
+{
+    const char* pTo;
+    const char* pFrom;
+    iconv_t cd;
+} bench_iconv_descriptor;
+
+static bench_iconv_descriptor g_benchIconv[] = {
+    {"UTF-16LE", "UTF-8",    (iconv_t)-1},
+    {"UTF-32LE", "UTF-8",    (iconv_t)-1},
+    {"UTF-8",    "UTF-16LE", (iconv_t)-1},
+    {"UTF-8",    "UTF-32LE", (iconv_t)-1}
+};
+
+static void bench_iconv_open_all(void)
+{
+    size_t i;
+
+    for (i = 0; i < CSTR_COUNTOF(g_benchIconv); i += 1) {
+        g_benchIconv[i].cd = iconv_open(g_benchIconv[i].pTo, g_benchIconv[i].pFrom);
+    }
+}
+
+static void bench_iconv_close_all(void)
+{
+    size_t i;
+
+    for (i = 0; i < CSTR_COUNTOF(g_benchIconv); i += 1) {
+        if (g_benchIconv[i].cd != (iconv_t)-1) {
+            iconv_close(g_benchIconv[i].cd);
+            g_benchIconv[i].cd = (iconv_t)-1;
+        }
+    }
+}
+
+static errno_t bench_iconv(iconv_t cd, void* pOutput, size_t outputCapInBytes, const void* pInput, size_t inputLenInBytes)
+{
+    char* pIn = (char*)pInput;
+    char* pOut = (char*)pOutput;
+    size_t inLeft = inputLenInBytes;
+    size_t outLeft = outputCapInBytes;
+    size_t result;
+
+    if (cd == (iconv_t)-1) {
+        return EINVAL;
+    }
+
+    iconv(cd, NULL, NULL, NULL, NULL);
+    result = iconv(cd, &pIn, &inLeft, &pOut, &outLeft);
+
+    return (result == (size_t)-1) ? CSTR_ECODEPOINT : 0;
+}
+
+#define BENCH_ICONV(name, descriptorIndex, inputUnitSize) \
+    static errno_t bench_##name(void* pOutput, size_t outputCapInBytes, size_t* pOutputLen, const void* pInput, size_t inputLen, cstr_uint32 flags) \
+    { \
+        (void)pOutputLen; \
+        if (inputLen == (size_t)-1 || flags != 0) { \
+            return ENOSYS; \
+        } \
+        return bench_iconv(g_benchIconv[descriptorIndex].cd, pOutput, outputCapInBytes, pInput, inputLen * inputUnitSize); \
+    }
+
+BENCH_ICONV(iconv_utf8_to_utf16le,  0, 1)
+BENCH_ICONV(iconv_utf8_to_utf32le,  1, 1)
+BENCH_ICONV(iconv_utf16le_to_utf8,  2, 2)
+BENCH_ICONV(iconv_utf32le_to_utf8,  3, 4)
+#endif
+
+static const bench_transcoder g_benchTranscoders[] = {
+    {"utf8_to_utf16ne",         bench_encoding_utf8,    bench_utf8_to_utf16ne},
+    {"utf8_to_utf16le",         bench_encoding_utf8,    bench_utf8_to_utf16le},
+    {"utf8_to_utf16be",         bench_encoding_utf8,    bench_utf8_to_utf16be},
+    {"utf8_to_utf16",           bench_encoding_utf8,    bench_utf8_to_utf16},
+    {"utf8_to_utf32ne",         bench_encoding_utf8,    bench_utf8_to_utf32ne},
+    {"utf8_to_utf32le",         bench_encoding_utf8,    bench_utf8_to_utf32le},
+    {"utf8_to_utf32be",         bench_encoding_utf8,    bench_utf8_to_utf32be},
+    {"utf8_to_utf32",           bench_encoding_utf8,    bench_utf8_to_utf32},
+    {"utf8_to_utf16_len",       bench_encoding_utf8,    bench_utf8_to_utf16_len},
+    {"utf8_to_utf16ne_len",     bench_encoding_utf8,    bench_utf8_to_utf16ne_len},
+    {"utf8_to_utf16le_len",     bench_encoding_utf8,    bench_utf8_to_utf16le_len},
+    {"utf8_to_utf16be_len",     bench_encoding_utf8,    bench_utf8_to_utf16be_len},
+    {"utf8_to_utf32_len",       bench_encoding_utf8,    bench_utf8_to_utf32_len},
+    {"utf8_to_utf32ne_len",     bench_encoding_utf8,    bench_utf8_to_utf32ne_len},
+    {"utf8_to_utf32le_len",     bench_encoding_utf8,    bench_utf8_to_utf32le_len},
+    {"utf8_to_utf32be_len",     bench_encoding_utf8,    bench_utf8_to_utf32be_len},
+#if defined(BENCH_WITH_ICONV)
+    {"iconv UTF-8 to UTF-16LE", bench_encoding_utf8,    bench_iconv_utf8_to_utf16le},
+    {"iconv UTF-8 to UTF-32LE", bench_encoding_utf8,    bench_iconv_utf8_to_utf32le},
+#endif
+
+    {"utf16ne_to_utf8",         bench_encoding_utf16ne, bench_utf16ne_to_utf8},
+    {"utf16_to_utf8",           bench_encoding_utf16ne, bench_utf16_to_utf8},
+    {"utf16ne_to_utf32ne",      bench_encoding_utf16ne, bench_utf16ne_to_utf32ne},
+    {"utf16_to_utf32",          bench_encoding_utf16ne, bench_utf16_to_utf32},
+    {"utf16ne_to_utf8_len",     bench_encoding_utf16ne, bench_utf16ne_to_utf8_len},
+    {"utf16_to_utf8_len",       bench_encoding_utf16ne, bench_utf16_to_utf8_len},
+    {"utf16ne_to_utf32_len",    bench_encoding_utf16ne, bench_utf16ne_to_utf32_len},
+    {"utf16ne_to_utf32ne_len",  bench_encoding_utf16ne, bench_utf16ne_to_utf32ne_len},
+    {"utf16_to_utf32_len",      bench_encoding_utf16ne, bench_utf16_to_utf32_len},
+    {"utf16le_to_utf8",         bench_encoding_utf16le, bench_utf16le_to_utf8},
+    {"utf16le_to_utf32le",      bench_encoding_utf16le, bench_utf16le_to_utf32le},
+    {"utf16le_to_utf8_len",     bench_encoding_utf16le, bench_utf16le_to_utf8_len},
+    {"utf16le_to_utf32_len",    bench_encoding_utf16le, bench_utf16le_to_utf32_len},
+    {"utf16le_to_utf32le_len",  bench_encoding_utf16le, bench_utf16le_to_utf32le_len},
+#if defined(BENCH_WITH_ICONV)
+    {"iconv UTF-16LE to UTF-8", bench_encoding_utf16le, bench_iconv_utf16le_to_utf8},
+#endif
+    {"utf16be_to_utf8",         bench_encoding_utf16be, bench_utf16be_to_utf8},
+    {"utf16be_to_utf32be",      bench_encoding_utf16be, bench_utf16be_to_utf32be},
+    {"utf16be_to_utf8_len",     bench_encoding_utf16be, bench_utf16be_to_utf8_len},
+    {"utf16be_to_utf32_len",    bench_encoding_utf16be, bench_utf16be_to_utf32_len},
+    {"utf16be_to_utf32be_len",  bench_encoding_utf16be, bench_utf16be_to_utf32be_len},
+
+    {"utf32ne_to_utf8",         bench_encoding_utf32ne, bench_utf32ne_to_utf8},
+    {"utf32_to_utf8",           bench_encoding_utf32ne, bench_utf32_to_utf8},
+    {"utf32ne_to_utf16ne",      bench_encoding_utf32ne, bench_utf32ne_to_utf16ne},
+    {"utf32_to_utf16",          bench_encoding_utf32ne, bench_utf32_to_utf16},
+    {"utf32ne_to_utf8_len",     bench_encoding_utf32ne, bench_utf32ne_to_utf8_len},
+    {"utf32_to_utf8_len",       bench_encoding_utf32ne, bench_utf32_to_utf8_len},
+    {"utf32ne_to_utf16_len",    bench_encoding_utf32ne, bench_utf32ne_to_utf16_len},
+    {"utf32ne_to_utf16ne_len",  bench_encoding_utf32ne, bench_utf32ne_to_utf16ne_len},
+    {"utf32_to_utf16_len",      bench_encoding_utf32ne, bench_utf32_to_utf16_len},
+    {"utf32le_to_utf8",         bench_encoding_utf32le, bench_utf32le_to_utf8},
+    {"utf32le_to_utf16le",      bench_encoding_utf32le, bench_utf32le_to_utf16le},
+    {"utf32le_to_utf8_len",     bench_encoding_utf32le, bench_utf32le_to_utf8_len},
+    {"utf32le_to_utf16_len",    bench_encoding_utf32le, bench_utf32le_to_utf16_len},
+    {"utf32le_to_utf16le_len",  bench_encoding_utf32le, bench_utf32le_to_utf16le_len},
+#if defined(BENCH_WITH_ICONV)
+    {"iconv UTF-32LE to UTF-8", bench_encoding_utf32le, bench_iconv_utf32le_to_utf8},
+#endif
+    {"utf32be_to_utf8",         bench_encoding_utf32be, bench_utf32be_to_utf8},
+    {"utf32be_to_utf16be",      bench_encoding_utf32be, bench_utf32be_to_utf16be},
+    {"utf32be_to_utf8_len",     bench_encoding_utf32be, bench_utf32be_to_utf8_len},
+    {"utf32be_to_utf16_len",    bench_encoding_utf32be, bench_utf32be_to_utf16_len},
+    {"utf32be_to_utf16be_len",  bench_encoding_utf32be, bench_utf32be_to_utf16be_len}
+};
+
+
+
+/**************************************************************************************************************************************************************
+
+Inputs
+
+**************************************************************************************************************************************************************/
+typedef struct
+{
+    void* pData;                /* Null terminated. */
+    size_t len;                 /* In units of the encoding, not including the null terminator. */
+} bench_input;
+
+static size_t bench_utf8_prefix_len(const char* pUTF8, size_t utf8Len, size_t size)
+{
+    /* The prefix needs to end on an ASCII character so that it never ends in the middle of a sequence, including ill-formed ones. */
+    if (size >= utf8Len) {
+        return utf8Len;
+    }
+
+    while (size > 0 && (unsigned char)pUTF8[size - 1] >= 0x80) {
+        size -= 1;
+    }
+
+    return size;
+}
+
+static void bench_input_init(bench_input* pInput, bench_encoding encoding, const char* pUTF8, size_t utf8Len)
+{
+    size_t unitSize = bench_encoding_unit_size(encoding);
+    size_t len = 0;
+
+    if (encoding == bench_encoding_utf8) {
+        len = utf8Len;
+    } else if (unitSize == 2) {
+        utf8_to_utf16_len(&len, pUTF8, utf8Len, NULL, 0);
+    } else {
+        utf8_to_utf32_len(&len, pUTF8, utf8Len, NULL, 0);
+    }
+
+    pInput->len   = len;
+    pInput->pData = malloc((len + 1) * unitSize);
+    if (pInput->pData == NULL) {
+        printf("Out of memory.\n");
+        exit(1);
+    }
+
+    /*
+    Most invalid sequences are replaced when converting from UTF-8, but encoded surrogates are passed through, so the UTF-16 and UTF-32 input of the invalid
+    class contains unpaired surrogates.
+    */
+    switch (encoding)
+    {
+        case bench_encoding_utf8:    memcpy(pInput->pData, pUTF8, utf8Len); ((char*)pInput->pData)[utf8Len] = '\0'; break;
+        case bench_encoding_utf16ne: utf8_to_utf16ne((cstr_utf16*)pInput->pData, len + 1, NULL, pUTF8, utf8Len, NULL, 0); break;
+        case bench_encoding_utf16le: utf8_to_utf16le((cstr_utf16*)pInput->pData, len + 1, NULL, pUTF8, utf8Len, NULL, 0); break;
+        case bench_encoding_utf16be: utf8_to_utf16be((cstr_utf16*)pInput->pData, len + 1, NULL, pUTF8, utf8Len, NULL, 0); break;
+        case bench_encoding_utf32ne: utf8_to_utf32ne((cstr_utf32*)pInput->pData, len + 1, NULL, pUTF8, utf8Len, NULL, 0); break;
+        case bench_encoding_utf32le: utf8_to_utf32le((cstr_utf32*)pInput->pData, len + 1, NULL, pUTF8, utf8Len, NULL, 0); break;
+        case bench_encoding_utf32be: utf8_to_utf32be((cstr_utf32*)pInput->pData, len + 1, NULL, pUTF8, utf8Len, NULL, 0); break;
+        default: break;
+    }
+}
+
+static void bench_input_uninit(bench_input* pInput)
+{
+    free(pInput->pData);
+    pInput->pData = NULL;
+}
+
+
+
+/**************************************************************************************************************************************************************
+
+Runner
+
+**************************************************************************************************************************************************************/
+static double bench_run_cell(const bench_transcoder* pTranscoder, const bench_input* pInput, void* pOutput, size_t outputCapInBytes, int nullTerminated, cstr_uint32 flags, int repCount, errno_t* pResult)
+{
+    double pSamples[BENCH_MAX_REPS];
+    size_t inputLen = nullTerminated ? (size_t)-1 : pInput->len;
+    size_t inputBytes = pInput->len * bench_encoding_unit_size(pTranscoder->input);
+    size_t runsPerSample = 1;
+    size_t outputLen;
+    double t;
+    int iRep;
+
+    /* Warm up, and make sure the output buffer is in memory. */
+    *pResult = pTranscoder->convert(pOutput, outputCapInBytes, &outputLen, pInput->pData, inputLen, flags);
+    if (*pResult != 0) {
+        return 0;
+    }
+
+    for (;;) {
+        size_t iRun;
+
+        t = bench_now();
+        for (iRun = 0; iRun < runsPerSample; iRun += 1) {
+            pTranscoder->convert(pOutput, outputCapInBytes, &outputLen, pInput->pData, inputLen, flags);
+        }
+        t = bench_now() - t;
+
+        if (t >= BENCH_MIN_SAMPLE_TIME || runsPerSample >= ((size_t)1 << 24)) {
+            break;
+        }
+
+        runsPerSample *= 2;
+    }
+
+    for (iRep = 0; iRep < repCount; iRep += 1) {
+        size_t iRun;
+
+        t = bench_now();
+        for (iRun = 0; iRun < runsPerSample; iRun += 1) {
+            pTranscoder->convert(pOutput, outputCapInBytes, &outputLen, pInput->pData, inputLen, flags);
+        }
+        t = bench_now() - t;
+
+        pSamples[iRep] = ((double)inputBytes * (double)runsPerSample / t) * 1e-9;
+    }
+
+    qsort(pSamples, (size_t)repCount, sizeof(double), bench_compare_doubles);
+    return bench_percentile(pSamples, (size_t)repCount, 50);
+}
+
+static void bench_print_usage(void)
+{
+    printf("Usage: cstr_bench_transcode [--json] [--filter <text>] [--class <name>] [--max-size <bytes>] [--reps <count>]\n");
+}
+
+int main(int argc, char** argv)
+{
+    size_t pSizes[BENCH_MAX_SIZES];
+    size_t sizeCount = 0;
+    size_t maxSize = BENCH_DEFAULT_MAX_SIZE;
+    int repCount = BENCH_DEFAULT_REPS;
+    int outputJSON = 0;
+    const char* pFilter = NULL;
+    const char* pClass = NULL;
+    size_t resultCount = 0;
+    size_t rowCount;
+    size_t iGenerator;
+    size_t iSize;
+    size_t iTranscoder;
+    int iArg;
+    int nullTerminated;
+    int errorOnInvalid;
+    void* pOutput;
+    size_t outputCapInBytes;
+
+    for (iArg = 1; iArg < argc; iArg += 1) {
+        if (strcmp(argv[iArg], "--json") == 0) {
+            outputJSON = 1;
+        } else if (strcmp(argv[iArg], "--filter") == 0 && iArg + 1 < argc) {
+            pFilter = argv[++iArg];
+        } else if (strcmp(argv[iArg], "--class") == 0 && iArg + 1 < argc) {
+            pClass = argv[++iArg];
+        } else if (strcmp(argv[iArg], "--max-size") == 0 && iArg + 1 < argc) {
+            maxSize = (size_t)strtoul(argv[++iArg], NULL, 10);
+        } else if (strcmp(argv[iArg], "--reps") == 0 && iArg + 1 < argc) {
+            repCount = atoi(argv[++iArg]);
+        } else {
+            bench_print_usage();
+            return (strcmp(argv[iArg], "--help") == 0) ? 0 : 1;
+        }
+    }
+
+    if (repCount < 1 || repCount > BENCH_MAX_REPS || maxSize < 64 || maxSize > BENCH_LARGEST_SIZE) {
+        bench_print_usage();
+        return 1;
+    }
+
+    for (iSize = 64; iSize <= maxSize && sizeCount < BENCH_MAX_SIZES; iSize *= 16) {
+        pSizes[sizeCount++] = iSize;
+    }
+
+    /*
+    The output buffer needs to be big enough for the largest input converted to any encoding. Every UTF-8 byte is at most one UTF-16 or UTF-32 code unit, and
+    every code unit of the other encodings is at most 3 bytes of UTF-8, including replacement characters.
+    */
+    outputCapInBytes = (pSizes[sizeCount - 1] + 1) * 4;
+    pOutput = malloc(outputCapInBytes);
+    if (pOutput == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+#if defined(BENCH_WITH_ICONV)
+    bench_iconv_open_all();
+#endif
+
+    if (outputJSON) {
+        printf("{\n  \"reps\": %d,\n  \"results\": [", repCount);
+    }
+
+    for (iGenerator = 0; iGenerator < CSTR_COUNTOF(g_benchGenerators); iGenerator += 1) {
+        const bench_generator* pGenerator = &g_benchGenerators[iGenerator];
+        char* pCorpus;
+        size_t corpusLen;
+
+        /* Only the plain text classes are relevant to transcoding. */
+        if (pGenerator->kinds != BENCH_CORPUS_TEXT) {
+            continue;
+        }
+
+        if (pClass != NULL && strcmp(pClass, pGenerator->pName) != 0) {
+            continue;
+        }
+
+        pCorpus = bench_generate(pGenerator, pSizes[sizeCount - 1], &corpusLen);
+
+        for (nullTerminated = 0; nullTerminated <= 1; nullTerminated += 1) {
+            for (errorOnInvalid = 0; errorOnInvalid <= 1; errorOnInvalid += 1) {
+                cstr_uint32 flags = errorOnInvalid ? CSTR_ERROR_ON_INVALID_CODE_POINT : 0;
+                double pResults[CSTR_COUNTOF(g_benchTranscoders)][BENCH_MAX_SIZES];
+                errno_t pErrors[CSTR_COUNTOF(g_benchTranscoders)][BENCH_MAX_SIZES];
+
+                /* Run column by column so only one set of inputs needs to exist at a time. This matters for the larger sizes. */
+                for (iSize = 0; iSize < sizeCount; iSize += 1) {
+                    size_t utf8Len = bench_utf8_prefix_len(pCorpus, corpusLen, pSizes[iSize]);
+                    bench_input input;
+                    bench_encoding currentEncoding = bench_encoding_count;
+
+                    input.pData = NULL;
+
+                    for (iTranscoder = 0; iTranscoder < CSTR_COUNTOF(g_benchTranscoders); iTranscoder += 1) {
+                        const bench_transcoder* pTranscoder = &g_benchTranscoders[iTranscoder];
+
+                        pErrors[iTranscoder][iSize] = ENOSYS;
+                        pResults[iTranscoder][iSize] = 0;
+
+                        if (pFilter != NULL && strstr(pTranscoder->pName, pFilter) == NULL) {
+                            continue;
+                        }
+
+                        /*
+                        iconv stops at the first invalid sequence where libcstr replaces it and keeps going, so on invalid input the two wouldn't be
+                        converting the same amount of data.
+                        */
+                        if (strncmp(pTranscoder->pName, "iconv", 5) == 0 && strcmp(pGenerator->pName, "invalid") == 0) {
+                            continue;
+                        }
+
+                        /* The transcoders are grouped by their input encoding so this is only done once for each encoding. */
+                        if (pTranscoder->input != currentEncoding) {
+                            bench_input_uninit(&input);
+                            bench_input_init(&input, pTranscoder->input, pCorpus, utf8Len);
+                            currentEncoding = pTranscoder->input;
+                        }
+
+                        pResults[iTranscoder][iSize] = bench_run_cell(pTranscoder, &input, pOutput, outputCapInBytes, nullTerminated, flags, repCount, &pErrors[iTranscoder][iSize]);
+                    }
+
+                    bench_input_uninit(&input);
+                }
+
+                /* Output. Functions that were filtered out, or that don't support this mode, are left as ENOSYS. */
+                rowCount = 0;
+                for (iTranscoder = 0; iTranscoder < CSTR_COUNTOF(g_benchTranscoders); iTranscoder += 1) {
+                    if (pErrors[iTranscoder][0] != ENOSYS) {
+                        rowCount += 1;
+                    }
+                }
+
+                if (!outputJSON && rowCount > 0) {
+                    printf("\n%s, %s, %s (GB/s)\n", pGenerator->pName, nullTerminated ? "null terminated" : "sized", errorOnInvalid ? "CSTR_ERROR_ON_INVALID_CODE_POINT" : "no flags");
+                    printf("%-26s", "");
+                    for (iSize = 0; iSize < sizeCount; iSize += 1) {
+                        if (pSizes[iSize] >= 1024*1024) {
+                            printf(" %9luMB", (unsigned long)(pSizes[iSize] / (1024*1024)));
+                        } else if (pSizes[iSize] >= 1024) {
+                            printf(" %9luKB", (unsigned long)(pSizes[iSize] / 1024));
+                        } else {
+                            printf(" %10luB", (unsigned long)pSizes[iSize]);
+                        }
+                    }
+                    printf("\n");
+                }
+
+                for (iTranscoder = 0; iTranscoder < CSTR_COUNTOF(g_benchTranscoders); iTranscoder += 1) {
+                    const bench_transcoder* pTranscoder = &g_benchTranscoders[iTranscoder];
+
+                    if (pErrors[iTranscoder][0] == ENOSYS) {
+                        continue;
+                    }
+
+                    if (!outputJSON) {
+                        printf("%-26s", pTranscoder->pName);
+                    }
+
+                    for (iSize = 0; iSize < sizeCount; iSize += 1) {
+                        if (outputJSON) {
+                            printf("%s\n    {\"function\": ", (resultCount > 0) ? "," : "");
+                            bench_print_json_string(pTranscoder->pName);
+                            printf(", \"class\": ");
+                            bench_print_json_string(pGenerator->pName);
+                            printf(", \"size\": %lu, \"null_terminated\": %s, \"error_on_invalid\": %s, ", (unsigned long)pSizes[iSize], nullTerminated ? "true" : "false", errorOnInvalid ? "true" : "false");
+                            if (pErrors[iTranscoder][iSize] == 0) {
+                                printf("\"gb_per_second\": %.4f, \"error\": 0}", pResults[iTranscoder][iSize]);
+                            } else {
+                                printf("\"gb_per_second\": null, \"error\": %d}", (int)pErrors[iTranscoder][iSize]);
+                            }
+                            resultCount += 1;
+                        } else {
+                            if (pErrors[iTranscoder][iSize] == 0) {
+                                printf(" %11.3f", pResults[iTranscoder][iSize]);
+                            } else {
+                                printf(" %11s", "-");
+                            }
+                        }
+                    }
+
+                    if (!outputJSON) {
+                        printf("\n");
+                        fflush(stdout);
+                    }
+                }
+            }
+        }
+
+        free(pCorpus);
+    }
+
+    if (outputJSON) {
+        printf("\n  ]\n}\n");
+    }
+
+#if defined(BENCH_WITH_ICONV)
+    bench_iconv_close_all();
+#endif
+
+    free(pOutput);
+    return 0;
+}
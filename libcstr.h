@@ -28,6 +28,8 @@ The library is made up of three main parts:
          * strcat_s()  -> utf8_strcat_s()
          * strncat_s() -> utf8_strncat_s()
          * atoi_s()    -> utf8_atoi_s()
+         * strcmp()    -> utf8_strcmp()
+         * strncmp()   -> utf8_strncmp()
 
     2) Dynamically allocated strings via the `cstr` type. These are null terminated and compatible with `char*` and `const char*` strings, but also include
        some prefixed data containing the length of the string and the capacity of the internal buffer. See the documentation in the Dynamic Strings section
@@ -188,6 +190,12 @@ CSTR_API int utf8_strncpy_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src,
 CSTR_API int utf8_strcat_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src);
 CSTR_API int utf8_strncat_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src, size_t count);
 CSTR_API int utf8_itoa_s(int value, cstr_utf8* dst, size_t dstCap, int radix);
+CSTR_API int utf8_strcmp(const cstr_utf8* str1, const cstr_utf8* str2);                     /* Compares bytes as unsigned which for UTF-8 is the same as code point order. */
+CSTR_API int utf8_strncmp(const cstr_utf8* str1, const cstr_utf8* str2, size_t count);
+CSTR_API int utf8_compare_n(const cstr_utf8* str1, size_t str1Len, const cstr_utf8* str2, size_t str2Len, size_t* pDiffOffset);  /* Lengths can be (size_t)-1 if null terminated. A string comes before any longer string it's a prefix of. `pDiffOffset` receives the offset of the first difference and can be NULL. */
+CSTR_API size_t utf8_common_prefix_len(const cstr_utf8* str1, size_t str1Len, const cstr_utf8* str2, size_t str2Len);
+CSTR_API int utf8_strnatcmp(const cstr_utf8* str1, const cstr_utf8* str2);                  /* Natural order. Runs of digits are compared by value so "v1.9" comes before "v1.10". */
+CSTR_API int utf8_strnatcasecmp(const cstr_utf8* str1, const cstr_utf8* str2);              /* The same as utf8_strnatcmp(), but ignores the case of ASCII letters. */
 /*
 CSTR_API int utf8_snprintf(cstr_utf8* dst, size_t dstCap, const cstr_utf8* fmt, ...);
 CSTR_API int utf8_vsnprintf(cstr_utf8* dst, size_t dstCap, const cstr_utf8* fmt, va_list args);
@@ -209,16 +217,16 @@ is used.
 Below is the memory layout of a `cstr` string.
 
     ```
-                                  +---------------------------------------------------------------------------------------------------+
-                                  | `cstr_cap()`                                                                                      |
-                                  +------------------------------------------------------------------------------+                    |
-                                  | `cstr_len()`                                                                 |                    |
-    +--------------+--------------+------------------------------------------------------------------------------+--------------------+-----------------+
-    | Cap (size_t) | Len (size_t) | .............................. String Content .............................. | Extra Space ('\0') | Null Terminator |         
-    +--------------+--------------+------------------------------------------------------------------------------+--------------------+-----------------+
-    ^                             ^ <-- `cstr` starts here                                                                                              ^
-    +-----------------------------+---------------------------------------------------------------------------------------------------------------------+
-            Prefixed Data                                                 C Style, Null Terminated String Data
+                                                                                       +---------------------------------------------------------+
+                                                                                       | `cstr_cap()`                                            |
+                                                                                       +----------------------------------------+                |
+                                                                                       | `cstr_len()`                           |                |
+    +-------------------+----------------+---------------+--------------+--------------+----------------------------------------+----------------+-----+
+    | Refcount (uint32) | Flags (uint32) | Hash (uint64) | Cap (size_t) | Len (size_t) | ........... String Content ........... | Extra ('\0')   | \0  |
+    +-------------------+----------------+---------------+--------------+--------------+----------------------------------------+----------------+-----+
+    ^                                                                                  ^ <-- `cstr` starts here                                        ^
+    +----------------------------------------------------------------------------------+---------------------------------------------------------------+
+                                       Prefixed Data                                                 C Style, Null Terminated String Data
     ```
 
 The allocation of extra space is mainly just to optimize memory allocations and avoid excessive resizing of the internal buffer. Note that the first byte of
@@ -226,6 +234,18 @@ the extra space is always '\0', thus null terminating the string content. The il
 it is _not_ included in the value returned by `cstr_cap()` nor `cstr_len()` and to also show that the null terminator is always explicitly included as it's
 possible (and likely) that the extra space can be zero bytes in length.
 
+The flags and hash are used for caching information about the content of the string so it doesn't need to be recomputed. The flags record whether or not
+the content is known to be ASCII or valid UTF-8, and whether or not the hash is valid. See the Hashing section for details on the hash, which is not present
+when CSTR_NO_HASH_CACHE is defined. The cache follows the same rules as the hash. It's only written when the string has a single owner, it's cleared by any
+function that modifies the string, and `cstr_mark_modified()` must be called after modifying the content directly. Copies of a string inherit the cache, and
+operations that can't invalidate what's known, such as trimming an ASCII string, keep it.
+
+Conversions from a string that is known to be ASCII can skip decoding entirely by passing in CSTR_INPUT_IS_ASCII:
+
+    ```c
+    utf8_to_utf16(pUTF16, utf16Cap, &utf16Len, str, cstr_len(str), NULL, cstr_is_ascii(str) ? CSTR_INPUT_IS_ASCII : 0);
+    ```
+
 Whenever the string is modified, a copy of the new string is returned. Below is a usage example:
 
     ```c
@@ -240,6 +260,45 @@ Whenever the string is modified, a copy of the new string is returned. Below is
     cstr_free(myString);        // Always free the string when you're finished with it.
     ```
 
+Strings are reference counted which means the same string can be given to multiple owners without copying the content. Use `cstr_retain()` to add an owner
+and `cstr_free()` or `cstr_release()` to remove one. The memory is freed when the last owner releases it. The functions that modify a string are copy-on-write.
+If the string has more than one owner, the modification is done on a new copy and the caller's reference to the shared string is released. This is why the
+return value of a modifying function must always replace the input string, even for functions like `cstr_trim()` which never need to reallocate:
+
+    ```c
+    cstr a = cstr_new("Hello");
+    cstr b = cstr_retain(a);    // `a` and `b` point to the same memory. No data is copied.
+
+    b = cstr_cat(b, ", World"); // `b` is shared so it's copied before appending. `a` is still "Hello".
+
+    cstr_free(a);
+    cstr_free(b);
+    ```
+
+Retaining and releasing are atomic and can be done from any thread. Modifying functions must only be used by an owner of the string, and must not be used on
+the same reference from multiple threads at the same time. This is the same rule that applies to any other object.
+
+By default the string content has whatever alignment CSTR_MALLOC gives the allocation, offset by the size of the prefixed data, and nothing can be read past
+the null terminator and the extra space. Define CSTR_ALIGNMENT to 16, 32, 64 or 128 to align the content of every dynamic string, including interned strings,
+to that many bytes, and to follow the capacity with CSTR_TAIL_PADDING bytes of zeroed padding. CSTR_TAIL_PADDING is equal to the alignment. This makes it
+safe to read the content with full width vector loads, including the last block which can be loaded in full and then masked against the length. The bytes
+between the null terminator and the end of the capacity can be read, but their values are unspecified. This costs up to twice the alignment in extra memory
+for each string. It works with any allocator because the content is aligned within the allocation rather than relying on the alignment of CSTR_MALLOC.
+
+    ```c
+    #define CSTR_ALIGNMENT 32
+    #define LIBCSTR_IMPLEMENTATION
+    #include "libcstr.h"
+
+    ...
+
+    // No scalar tail is needed. The last block can be loaded in full because the content is followed by at least 32 readable bytes.
+    for (i = 0; i < cstr_len(str); i += 32) {
+        __m256i block = _mm256_load_si256((const __m256i*)(str + i));
+        ...
+    }
+    ```
+
 
 API Reference
 -------------
@@ -253,7 +312,30 @@ cstr cstr_alloc(size_t len)
         cstr_setn(str, str, strLen);        // Set the length of the string by calling cstr_setn() on the same string, passing in an explicit length.
 
 void cstr_free(cstr str)
-    Frees a `cstr` string.
+    Releases a reference to a `cstr` string. The memory is freed when the last reference is released.
+
+cstr cstr_retain(cstr str)
+    Adds a reference to a `cstr` string and returns `str`. Each call must be paired with a call to `cstr_free()` or `cstr_release()`. This does not copy any
+    data and is safe to call from any thread. Returns NULL if `str` is NULL.
+
+void cstr_release(cstr str)
+    The same as `cstr_free()`. Use whichever reads better.
+
+cstr_bool32 cstr_is_shared(cstr str)
+    Returns whether or not the string has more than one owner. Note that in multi-threaded programs this can change at any time if another owner releases
+    their reference.
+
+cstr cstr_make_unique(cstr str)
+    Returns a string that is owned only by the caller. If the string is shared, a copy is returned and the caller's reference to the shared string is released.
+    Otherwise the string is returned as-is. Returns NULL if out of memory.
+
+cstr_bool32 cstr_is_ascii(cstr str)
+    Returns whether or not every byte in the string is ASCII. The result is cached in the string so this is constant time after the first call. Returns
+    CSTR_FALSE if `str` is NULL.
+
+cstr_bool32 cstr_is_valid_utf8(cstr str)
+    Returns whether or not the string is valid UTF-8. The result is cached in the string so this is constant time after the first call. Strings that are known
+    to be ASCII are always valid. Returns CSTR_FALSE if `str` is NULL.
 
 cstr cstr_newn(const char* pOther, size_t otherLen)
     Creates a new string, initialized with the content of another string of a specified length. Returns NULL if out of memory or `pOther` is NULL.
@@ -317,6 +399,19 @@ typedef cstr_utf32* cstr32;
 typedef wchar_t*    cstrw;
 typedef cstr8       cstr;
 
+#ifndef CSTR_ALIGNMENT
+#define CSTR_ALIGNMENT      0
+#endif
+
+#if CSTR_ALIGNMENT > 0
+    #if CSTR_ALIGNMENT < 16 || CSTR_ALIGNMENT > 128 || (CSTR_ALIGNMENT & (CSTR_ALIGNMENT - 1)) != 0
+        #error "CSTR_ALIGNMENT must be 16, 32, 64 or 128."
+    #endif
+    #define CSTR_TAIL_PADDING   CSTR_ALIGNMENT
+#else
+    #define CSTR_TAIL_PADDING   0
+#endif
+
 #ifndef CSTR_NO_UTF8
 CSTR_API cstr8 cstr8_alloc(size_t len);
 CSTR_API void cstr8_free(cstr8 str);
@@ -345,6 +440,13 @@ CSTR_API cstr8 cstr8_new_trim(const char* pOther);
 CSTR_API cstr8 cstr8_newn_trim(const char* pOther, size_t otherLen);
 CSTR_API cstr8 cstr8_trim(cstr8 str);
 CSTR_API cstr8 cstr8_remove_at(cstr8 str, size_t index);
+CSTR_API cstr8 cstr8_retain(cstr8 str);
+CSTR_API void cstr8_release(cstr8 str);
+CSTR_API cstr_bool32 cstr8_is_shared(cstr8 str);
+CSTR_API cstr8 cstr8_make_unique(cstr8 str);
+CSTR_API void cstr8_mark_modified(cstr8 str);
+CSTR_API cstr_bool32 cstr8_is_ascii(cstr8 str);
+CSTR_API cstr_bool32 cstr8_is_valid_utf8(cstr8 str);
 
 #define cstr_alloc                  cstr8_alloc
 #define cstr_free                   cstr8_free
@@ -373,9 +475,399 @@ CSTR_API cstr8 cstr8_remove_at(cstr8 str, size_t index);
 #define cstr_newn_trim              cstr8_newn_trim
 #define cstr_trim                   cstr8_trim
 #define cstr_remove_at              cstr8_remove_at
+#define cstr_retain                 cstr8_retain
+#define cstr_release                cstr8_release
+#define cstr_is_shared              cstr8_is_shared
+#define cstr_make_unique            cstr8_make_unique
+#define cstr_mark_modified          cstr8_mark_modified
+#define cstr_is_ascii               cstr8_is_ascii
+#define cstr_is_valid_utf8          cstr8_is_valid_utf8
+#endif
+
+
+/**************************************************************************************************************************************************************
+
+Hashing
+=======
+`cstr_hash64()` is a fast, general purpose 64-bit hash for use with hash tables. It is not a cryptographic hash and should not be used where an attacker can
+choose the input, unless the seed is random and kept secret. The output is the same on all platforms. It processes 48 bytes per iteration across three
+independent lanes so the multiplies can overlap.
+
+`cstr_hash()` returns the hash of a dynamic string. The result is cached in the prefixed data of the string so hashing the same string again, such as when a
+key is used for many lookups, costs the same as reading the length. The cache is cleared by every function that modifies the string. If you modify the
+content of a string directly through the pointer, call `cstr_mark_modified()` afterwards. The cached hash adds 8 bytes to the prefixed data of every string.
+Define CSTR_NO_HASH_CACHE to remove it, in which case `cstr_hash()` will compute the hash every time it is called.
+
+The hash is only cached when the string has a single owner. Strings that are shared between owners are hashed every time, except for interned strings which
+always have their hash cached from the moment they're created.
+
+    ```c
+    cstr key = cstr_new("window-title");
+    cstr_uint64 hash = cstr_hash(key); // Computed and cached.
+
+    hash = cstr_hash(key);             // Read from the cache.
+    ```
+
+
+API Reference
+-------------
+cstr_uint64 cstr_hash64(const void* pData, size_t dataSize, cstr_uint64 seed)
+    Computes the 64-bit hash of the given data. `pData` can be NULL if `dataSize` is 0.
+
+cstr_uint64 cstr_hash(cstr str)
+    Retrieves the hash of a dynamic string. This is the same as `cstr_hash64(str, cstr_len(str), 0)`. Returns the hash of an empty string if `str` is NULL.
+
+void cstr_mark_modified(cstr str)
+    Clears any information that has been cached about the content of a string. Call this after modifying the content of a string directly.
+
+**************************************************************************************************************************************************************/
+CSTR_API cstr_uint64 cstr_hash64(const void* pData, size_t dataSize, cstr_uint64 seed);
+
+#ifndef CSTR_NO_UTF8
+CSTR_API cstr_uint64 cstr8_hash(cstr8 str);
+
+#define cstr_hash                   cstr8_hash
+#endif
+
+
+/**************************************************************************************************************************************************************
+
+String Views
+============
+A view is a pointer and a length referring to a range of bytes in some other string. Views are not null terminated and do not own their memory so they're
+cheap to create and pass around by value. Use them for breaking a string down into pieces without allocating memory and without having to measure the length
+of each piece with `strlen()`:
+
+    ```c
+    cstr_view remaining = cstr_view_init("name = value ; other = thing", (size_t)-1);
+    cstr_view token;
+
+    while (cstr_view_split(&remaining, cstr_view_init(";", 1), &token)) {
+        size_t eq = cstr_view_find(token, cstr_view_init("=", 1));
+        if (eq != cstr_npos) {
+            cstr_view key   = cstr_view_trim(cstr_view_substr(token, 0, eq));
+            cstr_view value = cstr_view_trim(cstr_view_substr(token, eq + 1, (size_t)-1));
+            printf("%.*s: %.*s\n", (int)key.len, key.p, (int)value.len, value.p);
+        }
+    }
+    ```
+
+A view must not outlive the string it refers to. A view of a dynamic string is invalidated when the string is modified or freed. To make an owned copy of a
+view, use `cstr_newn(view.p, view.len)`.
+
+A view with a NULL pointer is a null view. It is returned by functions that fail to find what they were looking for and is distinct from an empty view, which
+has a length of 0 but a valid pointer. Null views can be passed into any of the functions below and are treated as empty.
+
+
+API Reference
+-------------
+cstr_view cstr_view_init(const char* pStr, size_t len)
+    Creates a view of `len` bytes starting at `pStr`. `len` can be (size_t)-1 if `pStr` is null terminated. Returns a null view if `pStr` is NULL.
+
+cstr_view cstr_view_from_cstr(cstr str)
+    Creates a view of a dynamic string. This is constant time because the length is read from the string. Returns a null view if `str` is NULL.
+
+cstr_view cstr_view_substr(cstr_view view, size_t offset, size_t len)
+    Creates a view of a sub-range of another view. The range is clamped to the end of the view. `len` can be (size_t)-1 to select everything after `offset`.
+
+cstr_view cstr_view_substr_tagged(cstr_view view, const char* pTagBeg, const char* pTagEnd)
+    The same as `cstr_substr_tagged()`, except the result is a view and the input doesn't need to be null terminated. The tags are included in the result.
+    Returns a null view if either tag could not be found.
+
+cstr_view cstr_view_trim(cstr_view view)
+cstr_view cstr_view_ltrim(cstr_view view)
+cstr_view cstr_view_rtrim(cstr_view view)
+    Removes whitespace from both ends, the start or the end of a view. This uses the same definition of whitespace as `cstr_trim()`.
+
+size_t cstr_view_find(cstr_view view, cstr_view other)
+size_t cstr_view_find_last(cstr_view view, cstr_view other)
+    Finds the offset of the first or last occurrence of `other` in `view`. Returns cstr_npos if it could not be found or if `other` is empty.
+
+cstr_bool32 cstr_view_split(cstr_view* pRemaining, cstr_view delimiter, cstr_view* pToken)
+    Outputs the next token from `pRemaining`, which is the text up to the next occurrence of `delimiter`, and advances `pRemaining` past the delimiter. Returns
+    CSTR_FALSE when there are no more tokens. The last token is the text after the last delimiter, which may be empty. Once the last token has been output,
+    `pRemaining` is set to a null view. If `delimiter` is empty the whole view is output as a single token.
+
+cstr_bool32 cstr_view_equal(cstr_view a, cstr_view b)
+    Returns whether or not two views have the same content.
+
+
+Splitting
+---------
+`cstr_view_split()` is convenient for short strings, but it searches for the delimiter from scratch for each token. For large inputs use a split iterator.
+It scans the input in blocks of 64 bytes, building a bit mask of the delimiter positions in each block with SSE2 where available, and then outputs tokens by
+walking the bits. The delimiter can be a single byte, a set of bytes, or a multi-byte separator:
+
+    ```c
+    cstr_split_iterator iterator;
+    cstr_view token;
+
+    utf8_split_init(&iterator, pText, textLen, " \t\r\n", 4, CSTR_SPLIT_ANY_OF | CSTR_SPLIT_SKIP_EMPTY);
+    while (utf8_split_next(&iterator, &token)) {
+        printf("%.*s\n", (int)token.len, token.p);
+    }
+    ```
+
+By default, the tokens follow the same rules as `cstr_view_split()`. Empty tokens are output between adjacent delimiters, the text after the last delimiter
+is always output as the last token, and an empty input is output as a single empty token. Sets of up to 8 bytes are matched with SIMD. Larger sets use a
+lookup table. With a multi-byte separator, the first byte is matched with SIMD and the rest are compared at each candidate.
+
+Use `utf8_split_all()` to output every token to an array in one call, or `cstr_array_append_split()` to copy them into a string array.
+
+
+cstr_uint32 flags for splitting:
+
+    CSTR_SPLIT_ANY_OF
+        The delimiter is a set of bytes. A token ends at any of them. Without this flag, the delimiter is matched as a whole.
+
+    CSTR_SPLIT_SKIP_EMPTY
+        Empty tokens are not output. Use this with CSTR_SPLIT_ANY_OF for splitting by whitespace.
+
+
+int utf8_split_init(cstr_split_iterator* pIterator, const cstr_utf8* pStr, size_t len, const cstr_utf8* pDelimiter, size_t delimiterLen, cstr_uint32 flags)
+    Initializes an iterator over the tokens of `pStr`. `len` and `delimiterLen` can be (size_t)-1 if the string is null terminated. The iterator refers to
+    the delimiter without copying it, so it must remain valid while the iterator is in use. An empty delimiter outputs the whole string as a single token.
+    Returns EINVAL if `pIterator` is NULL or `pStr` is NULL and `len` is not zero.
+
+cstr_bool32 utf8_split_next(cstr_split_iterator* pIterator, cstr_view* pToken)
+    Outputs the next token. Returns CSTR_FALSE when there are no more tokens, in which case `pToken` is set to a null view.
+
+int utf8_split_all(const cstr_utf8* pStr, size_t len, const cstr_utf8* pDelimiter, size_t delimiterLen, cstr_uint32 flags, cstr_view* pTokens, size_t tokenCap, size_t* pTokenCount)
+    Splits a string and outputs up to `tokenCap` tokens to `pTokens`. `pTokenCount` receives the total number of tokens. Set `pTokens` to NULL to only count
+    them. Returns ENOMEM if there are more than `tokenCap` tokens, in which case the first `tokenCap` are still output.
+
+**************************************************************************************************************************************************************/
+#ifndef CSTR_NO_UTF8
+typedef struct
+{
+    const char* p;
+    size_t len;
+} cstr_view;
+
+CSTR_API cstr_view cstr_view_init(const char* pStr, size_t len);
+CSTR_API cstr_view cstr_view_from_cstr(cstr8 str);
+CSTR_API cstr_view cstr_view_substr(cstr_view view, size_t offset, size_t len);
+CSTR_API cstr_view cstr_view_substr_tagged(cstr_view view, const char* pTagBeg, const char* pTagEnd);
+CSTR_API cstr_view cstr_view_trim(cstr_view view);
+CSTR_API cstr_view cstr_view_ltrim(cstr_view view);
+CSTR_API cstr_view cstr_view_rtrim(cstr_view view);
+CSTR_API size_t cstr_view_find(cstr_view view, cstr_view other);
+CSTR_API size_t cstr_view_find_last(cstr_view view, cstr_view other);
+CSTR_API cstr_bool32 cstr_view_split(cstr_view* pRemaining, cstr_view delimiter, cstr_view* pToken);
+CSTR_API cstr_bool32 cstr_view_equal(cstr_view a, cstr_view b);
+
+#define CSTR_SPLIT_ANY_OF               (1 << 0)
+#define CSTR_SPLIT_SKIP_EMPTY           (1 << 1)
+
+typedef struct
+{
+    const char* pStr;
+    size_t len;
+    size_t cursor;                  /* The start of the next token. Greater than `len` when there are no more tokens. */
+    const char* pDelimiter;
+    size_t delimiterLen;
+    cstr_uint32 flags;
+    cstr_uint32 setCount;           /* The number of bytes in `set`, or 0 if there are too many in which case `table` is used. */
+    cstr_uint8 set[8];              /* The bytes that are matched with SIMD. For a multi-byte separator this is only the first byte. */
+    cstr_uint32 table[8];           /* A bit for each of the 256 byte values that can start a delimiter. */
+    cstr_uint64 mask;               /* A bit for each possible delimiter in the current block that hasn't been processed yet. */
+    size_t maskBase;                /* The offset of the first byte of the current block. */
+    size_t nextBlock;               /* The offset of the next block to scan. */
+} cstr_split_iterator;
+
+CSTR_API int utf8_split_init(cstr_split_iterator* pIterator, const cstr_utf8* pStr, size_t len, const cstr_utf8* pDelimiter, size_t delimiterLen, cstr_uint32 flags);
+CSTR_API cstr_bool32 utf8_split_next(cstr_split_iterator* pIterator, cstr_view* pToken);
+CSTR_API int utf8_split_all(const cstr_utf8* pStr, size_t len, const cstr_utf8* pDelimiter, size_t delimiterLen, cstr_uint32 flags, cstr_view* pTokens, size_t tokenCap, size_t* pTokenCount);
 #endif
 
 
+/**************************************************************************************************************************************************************
+
+Statistics
+==========
+When the library is compiled with CSTR_STATS defined, it keeps a set of counters that describe how much work string operations are doing. This is useful for
+finding code that reallocates or copies more than it should. When CSTR_STATS is not defined, the instrumentation compiles to nothing and there is no overhead.
+
+    ```c
+    #define CSTR_STATS
+    #define LIBCSTR_IMPLEMENTATION
+    #include "libcstr.h"
+
+    ...
+
+    cstr_stats stats;
+
+    cstr_stats_reset();
+    do_some_string_work();
+    cstr_stats_snapshot(&stats, NULL);
+
+    printf("%u reallocs, %u bytes copied\n", (unsigned int)stats.reallocCount, (unsigned int)stats.bytesCopied);
+    ```
+
+The counters are kept for each thread and in aggregate across all threads. The per-thread counters are only ever touched by their own thread. The aggregate
+counters are updated atomically. Per-thread counters require compiler support for thread local storage. On compilers without it, the per-thread counters
+are shared between threads and will be inaccurate in multi-threaded programs.
+
+Only the dynamic string and Unicode conversion APIs are instrumented. Below is what each counter measures:
+
+    allocCount          The number of strings allocated with `cstr_alloc()`. This includes those allocated internally by `cstr_newn()`, etc.
+    reallocCount        The number of times the buffer of a string was resized.
+    freeCount           The number of strings freed with `cstr_free()`.
+    bytesAllocated      The total number of bytes requested for string buffers by allocations and reallocations, including the prefixed data.
+    bytesCopied         The number of bytes copied into strings by operations such as `cstr_newn()`, `cstr_setn()` and `cstr_catn()`.
+    bytesMoved          The number of bytes moved within strings by operations such as `cstr_trim()` and `cstr_remove_at()`.
+    slackBytes          The unused capacity, `cstr_cap() - cstr_len()`, of each string at the time it was freed.
+    conversionBytesIn   The number of bytes consumed by Unicode conversions. This does not include `_len()` functions.
+    conversionBytesOut  The number of bytes output by Unicode conversions, not including the null terminator.
+
+
+API Reference
+-------------
+int cstr_stats_snapshot(cstr_stats* pThreadStats, cstr_stats* pGlobalStats)
+    Retrieves a copy of the counters for the calling thread and in aggregate across all threads. Either parameter can be NULL. Returns ENOSYS if the library
+    was not compiled with CSTR_STATS, in which case the output structures will be zeroed.
+
+void cstr_stats_reset(void)
+    Resets the counters for the calling thread and the aggregate counters to zero. The counters of other threads are not affected.
+
+**************************************************************************************************************************************************************/
+typedef struct
+{
+    cstr_uint64 allocCount;
+    cstr_uint64 reallocCount;
+    cstr_uint64 freeCount;
+    cstr_uint64 bytesAllocated;
+    cstr_uint64 bytesCopied;
+    cstr_uint64 bytesMoved;
+    cstr_uint64 slackBytes;
+    cstr_uint64 conversionBytesIn;
+    cstr_uint64 conversionBytesOut;
+} cstr_stats;
+
+CSTR_API int cstr_stats_snapshot(cstr_stats* pThreadStats, cstr_stats* pGlobalStats);
+CSTR_API void cstr_stats_reset(void);
+
+
+/**************************************************************************************************************************************************************
+
+Allocation Tracing
+==================
+When the library is compiled with CSTR_TRACE defined, a callback can be installed which receives an event for every allocation, reallocation and free of a
+dynamic string. This is used for finding the places in a program that churn through strings so they can be fixed with things like reserving capacity
+up-front. When CSTR_TRACE is not defined the instrumentation compiles to nothing.
+
+Each event includes the name of the operation that triggered it, such as "newn", "catn", "catv" or "replace_range". Where an operation is implemented in
+terms of other operations, the outermost one is reported. For example, `cstr_replace_range()` uses `cstr_newn()` and `cstr_catn()` internally, but its
+events will report "replace_range". Each event also includes the tag that was set with `cstr_trace_set_tag()` on the calling thread. Use this to label the
+call sites in your own code:
+
+    ```c
+    const char* pPrevTag = cstr_trace_set_tag("config loader");
+    {
+        load_config();  // All string allocations in here will be tagged with "config loader".
+    }
+    cstr_trace_set_tag(pPrevTag);
+    ```
+
+The tag is not copied so it needs to remain valid for as long as it might be referenced by an event or an aggregator. String literals are best.
+
+A built-in aggregator is included which groups events by tag and operation. To use it, pass `cstr_trace_aggregator_on_event()` in as the callback and a
+pointer to the aggregator as the user data, and then call `cstr_trace_aggregator_get_top()` to get the top N call sites by bytes or by count:
+
+    ```c
+    cstr_trace_aggregator aggregator;
+    cstr_trace_report_entry top[10];
+    size_t topCount;
+    size_t i;
+
+    cstr_trace_aggregator_init(&aggregator);
+    cstr_trace_set_callback(cstr_trace_aggregator_on_event, &aggregator);
+    {
+        do_some_string_work();
+    }
+    cstr_trace_set_callback(NULL, NULL);
+
+    topCount = cstr_trace_aggregator_get_top(&aggregator, CSTR_TRACE_SORT_BY_BYTES, top, 10);
+    for (i = 0; i < topCount; i += 1) {
+        printf("%s %s: %u allocations, %u bytes\n", top[i].pTag, top[i].pOperation, (unsigned int)top[i].count, (unsigned int)top[i].bytes);
+    }
+
+    cstr_trace_aggregator_uninit(&aggregator);
+    ```
+
+The aggregator is thread safe. The callback itself is global and can be called from any thread. It should be set while no other threads are using strings.
+
+
+API Reference
+-------------
+int cstr_trace_set_callback(cstr_trace_proc onEvent, void* pUserData)
+    Sets the callback that receives allocation events. Set `onEvent` to NULL to disable tracing. Returns ENOSYS if the library was not compiled with
+    CSTR_TRACE.
+
+const char* cstr_trace_set_tag(const char* pTag)
+    Sets the tag of the calling thread, returning the previous tag so it can be restored afterwards. Set `pTag` to NULL to clear the tag.
+
+int cstr_trace_aggregator_init(cstr_trace_aggregator* pAggregator)
+    Initializes an aggregator. Returns EINVAL if `pAggregator` is NULL.
+
+void cstr_trace_aggregator_uninit(cstr_trace_aggregator* pAggregator)
+    Frees the memory used by an aggregator.
+
+void cstr_trace_aggregator_on_event(void* pUserData, const cstr_trace_event* pEvent)
+    The callback to pass into `cstr_trace_set_callback()` for the aggregator. `pUserData` must be a pointer to the aggregator.
+
+size_t cstr_trace_aggregator_get_top(cstr_trace_aggregator* pAggregator, int sortBy, cstr_trace_report_entry* pEntries, size_t entryCap)
+    Retrieves the top `entryCap` call sites sorted by either CSTR_TRACE_SORT_BY_BYTES or CSTR_TRACE_SORT_BY_COUNT, in descending order. Returns the number of
+    entries that were output. The `count` of an entry is the number of allocations and reallocations, and `bytes` is the sum of their sizes. Frees are
+    counted separately in `freeCount`.
+
+**************************************************************************************************************************************************************/
+typedef enum
+{
+    cstr_trace_event_type_alloc,
+    cstr_trace_event_type_realloc,
+    cstr_trace_event_type_free
+} cstr_trace_event_type;
+
+typedef struct
+{
+    cstr_trace_event_type type;
+    const char* pOperation;     /* The name of the operation that triggered the event, such as "newn" or "catn". */
+    const char* pTag;           /* The tag set with cstr_trace_set_tag(). Can be NULL. */
+    size_t size;                /* The size of the allocation in bytes, including the prefixed data. 0 for frees. */
+    size_t oldSize;             /* The size of the allocation before the event. 0 for allocations. */
+} cstr_trace_event;
+
+typedef void (* cstr_trace_proc)(void* pUserData, const cstr_trace_event* pEvent);
+
+#define CSTR_TRACE_SORT_BY_BYTES    0
+#define CSTR_TRACE_SORT_BY_COUNT    1
+
+typedef struct
+{
+    const char* pTag;
+    const char* pOperation;
+    cstr_uint64 count;
+    cstr_uint64 bytes;
+    cstr_uint64 freeCount;
+} cstr_trace_report_entry;
+
+typedef struct
+{
+    cstr_trace_report_entry* pEntries;
+    size_t entryCount;
+    size_t entryCap;
+    volatile cstr_uint32 lock;
+} cstr_trace_aggregator;
+
+CSTR_API int cstr_trace_set_callback(cstr_trace_proc onEvent, void* pUserData);
+CSTR_API const char* cstr_trace_set_tag(const char* pTag);
+CSTR_API int cstr_trace_aggregator_init(cstr_trace_aggregator* pAggregator);
+CSTR_API void cstr_trace_aggregator_uninit(cstr_trace_aggregator* pAggregator);
+CSTR_API void cstr_trace_aggregator_on_event(void* pUserData, const cstr_trace_event* pEvent);
+CSTR_API size_t cstr_trace_aggregator_get_top(cstr_trace_aggregator* pAggregator, int sortBy, cstr_trace_report_entry* pEntries, size_t entryCap);
+
+
 /**************************************************************************************************************************************************************
 
 Unicode
@@ -430,6 +922,11 @@ available flags and their meaning:
         If set, return an error if an invalid code point is encounted. If this is unset the invalid code point will be replaced wht the replacement which is
         defined by CSTR_UNICODE_REPLACEMENT_CODE_POINT.
 
+    CSTR_INPUT_IS_ASCII
+        Only used by conversions from UTF-8. If set, the caller is guaranteeing that the input contains only ASCII characters. Decoding and validation are
+        skipped and each byte is converted directly to a single code unit, and the `_len()` functions return the input length without reading the input. Use
+        `utf8_is_ascii()` or `cstr_is_ascii()` to check. The output is undefined if the input is not ASCII.
+
 Errors are returned via an errno_t code. This can be any of the standard result tokens that appear on almost all platforms, such as `ENOMEM` and `EINVAL`. In
 addition to these codes, the following custom codes may also be returned:
 
@@ -496,6 +993,8 @@ errno_t cstr_*_to_*([encoding-type]* pOutput, size_t outputCap, size_t* pOutputL
     the end of the last good code point and start of the errneous code point. Use this to determine where you got up to in processing and the location of the
     erroneous code point.
 
+    If `outputCap` is 0, `ENOMEM` is returned and nothing is written to the output buffer.
+
 
 errno_t cstr_*_to_*_len(size_t* pOutputLen, const [encoding-type]* pInput, size_t inputLen, size_t* pInputLenProcessed, cstr_uint32 flags)
 
@@ -552,6 +1051,8 @@ should be unlikely as they all seems to be positive in all of the implementation
 #define CSTR_SUCCESS    0       /* No error. */
 #define CSTR_EBOM       -16384  /* Invalid BOM */
 #define CSTR_ECODEPOINT -16385  /* Invalid code point. */
+#define CSTR_ESTALE     -16386  /* Cached data is out of date with respect to its source. */
+#define CSTR_ECORRUPT   -16387  /* Cached data failed validation. */
 
 #define CSTR_UNICODE_MIN_CODE_POINT                         0x000000
 #define CSTR_UNICODE_MAX_CODE_POINT                         0x10FFFF
@@ -562,6 +1063,7 @@ should be unlikely as they all seems to be positive in all of the implementation
 
 #define CSTR_FORBID_BOM                                     (1 << 1)
 #define CSTR_ERROR_ON_INVALID_CODE_POINT                    (1 << 2)
+#define CSTR_INPUT_IS_ASCII                                 (1 << 3)
 
 CSTR_API cstr_bool32 utf16_is_bom_le(const cstr_uint8 bom[2]);
 CSTR_API cstr_bool32 utf16_is_bom_be(const cstr_uint8 bom[2]);
@@ -665,6 +1167,8 @@ CSTR_API cstr_bool32 utf32_is_null_or_whitespace(const cstr_utf32* pUTF32, size_
 
 /* UTF-8 */
 CSTR_API cstr_bool32 utf8_is_null_or_whitespace(const cstr_utf8* pUTF8, size_t utf8Len);
+CSTR_API cstr_bool32 utf8_is_ascii(const cstr_utf8* pUTF8, size_t utf8Len);    /* Returns CSTR_FALSE if pUTF8 is NULL. */
+CSTR_API cstr_bool32 utf8_is_valid(const cstr_utf8* pUTF8, size_t utf8Len);    /* Strict RFC 3629 validation. Overlong forms and surrogates are invalid. */
 CSTR_API size_t utf8_next_whitespace(const cstr_utf8* pUTF8, size_t utf8Len);
 CSTR_API size_t utf8_ltrim_offset(const cstr_utf8* pUTF8, size_t utf8Len);
 CSTR_API size_t utf8_rtrim_offset(const cstr_utf8* pUTF8, size_t utf8Len);
@@ -753,5189 +1257,13612 @@ Key/Value Parser
 typedef struct
 {
     cstr_lexer lexer;
-    const char* pKey;
+    const char* pSection;   /* The name of the most recent [section] header, without the brackets. NULL if no section has been started. */
+    size_t sectionLen;
+    const char* pKey;       /* Dotted keys such as `a.b.c` are returned as a single key. */
     size_t keyLen;
     const char* pValue;
     size_t valueLen;
+    size_t lineNumber;      /* One based line number of the key. */
 } cstr_keyvalue_parser;
 
 CSTR_API int cstr_keyvalue_parser_init(const char* pText, size_t textLen, cstr_keyvalue_parser* pParser);
 CSTR_API int cstr_keyvalue_parser_next(cstr_keyvalue_parser* pParser);
 
+/*
+Callback based key/value parsing. This recognises exactly the same grammar as cstr_keyvalue_parser_next(), but scans the text directly rather than going
+through the lexer one token at a time which makes it several times faster. The lexer is only used for the rare cases such as section headers, non-ASCII
+identifiers and syntax errors.
 
-#ifdef __cplusplus
-}
-#endif
-#endif  /* libcstr_h */
+The callback is fired once for each pair in the order they appear. Keys and values are pointers into the original text and are returned exactly as they
+appear, including the quotes of string keys and values. Use cstr_lexer_transform_string() to unescape them. The section is the name of the most recent
+[section] header, or NULL if there hasn't been one. Returning non-zero from the callback stops parsing and that value is returned by cstr_keyvalue_parse().
 
+    ```c
+    static int on_pair(void* pUserData, const char* pSection, size_t sectionLen, const char* pKey, size_t keyLen, const char* pValue, size_t valueLen, size_t lineNumber)
+    {
+        printf("%d: %.*s = %.*s\n", (int)lineNumber, (int)keyLen, pKey, (int)valueLen, pValue);
+        return 0;
+    }
 
-/************************************************************************************************************************************************************
-*************************************************************************************************************************************************************
+    result = cstr_keyvalue_parse(pText, textLen, on_pair, NULL);
+    ```
 
-IMPLEMENTATION
+Returns 0 if the entire text was parsed, EINVAL if there is a syntax error.
+*/
+typedef int (* cstr_keyvalue_pair_proc)(void* pUserData, const char* pSection, size_t sectionLen, const char* pKey, size_t keyLen, const char* pValue, size_t valueLen, size_t lineNumber);
 
-*************************************************************************************************************************************************************
-************************************************************************************************************************************************************/
-#if defined(LIBCSTR_IMPLEMENTATION)
-#ifndef libcstr_c
-#define libcstr_c
+CSTR_API int cstr_keyvalue_parse(const char* pText, size_t textLen, cstr_keyvalue_pair_proc onPair, void* pUserData);
 
-/* CPU Architecture */
-#if defined(__x86_64__) || defined(_M_X64)
-    #define CSTR_X64
-#elif defined(__i386) || defined(_M_IX86)
-    #define CSTR_X86
-#elif defined(__arm__) || defined(_M_ARM)
-    #define CSTR_ARM
-#endif
 
-#if defined(_MSC_VER) && _MSC_VER >= 1300
-    #define CSTR_HAS_BYTESWAP16_INTRINSIC
-    #define CSTR_HAS_BYTESWAP32_INTRINSIC
-    #define CSTR_HAS_BYTESWAP64_INTRINSIC
-#elif defined(__clang__)
-    #if __has_builtin(__builtin_bswap16)
-        #define CSTR_HAS_BYTESWAP16_INTRINSIC
-    #endif
-    #if __has_builtin(__builtin_bswap32)
-        #define CSTR_HAS_BYTESWAP32_INTRINSIC
-    #endif
-    #if __has_builtin(__builtin_bswap64)
-        #define CSTR_HAS_BYTESWAP64_INTRINSIC
-    #endif
-#elif defined(__GNUC__)
-    #if ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 3))
-        #define CSTR_HAS_BYTESWAP32_INTRINSIC
-        #define CSTR_HAS_BYTESWAP64_INTRINSIC
-    #endif
-    #if ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
-        #define CSTR_HAS_BYTESWAP16_INTRINSIC
-    #endif
-#endif
 
-#include <stdio.h>  /* For sprintf() */
+/**************************************************************************************************************************************************************
 
-#if !defined(CSTR_MALLOC) || !defined(CSTR_CALLOC) || !defined(CSTR_REALLOC) || !defined(CSTR_FREE)
-#include <stdlib.h> /* For malloc(), calloc(), realloc(), free() */
-#endif
-#ifndef CSTR_MALLOC
-#define CSTR_MALLOC(sz) malloc((sz))
-#endif
-#ifndef CSTR_CALLOC
-#define CSTR_CALLOC(sz) calloc((sz), 1)
-#endif
-#ifndef CSTR_REALLOC
-#define CSTR_REALLOC(p, sz) realloc((p), (sz))
-#endif
-#ifndef CSTR_FREE
-#define CSTR_FREE(p) free((p))
-#endif
+CSV Parser
 
-#ifndef CSTR_ASSERT
-#include <assert.h>
-#define CSTR_ASSERT(condition) assert(condition);
-#endif
+**************************************************************************************************************************************************************/
+/*
+A parser for comma or tab separated values as described by RFC 4180. It's designed for large files. The text is scanned in blocks of 64 bytes, using SSE2
+where available, to build bit masks of the quotes, delimiters and newlines in each block. The quoted regions are resolved for the whole block at once with a
+prefix XOR of the quote mask, which leaves a mask of the delimiters and newlines that actually separate fields. Rows are then output by walking the bits.
 
-#ifndef CSTR_COPY_MEMORY
-#include <string.h> /* For memcpy() */
-#define CSTR_COPY_MEMORY(dst, src, sz)  memcpy((dst), (src), (sz))
-#endif
-#ifndef CSTR_MOVE_MEMORY
-#include <string.h> /* For memmove() */
-#define CSTR_MOVE_MEMORY(dst, src, sz)  memmove((dst), (src), (sz))
-#endif
-#ifndef CSTR_ZERO_MEMORY
-#include <string.h> /* For memset() */
-#define CSTR_ZERO_MEMORY(dst, sz)       memset((dst), 0, (sz))
-#endif
-#define CSTR_ZERO_OBJECT(dst)           CSTR_ZERO_MEMORY((dst), sizeof(*(dst)))
+    ```c
+    cstr_csv_parser parser;
+    cstr_csv_field fields[64];
+    size_t fieldCount;
 
-#define CSTR_COUNTOF(p)                 (sizeof(p) / sizeof((p)[0]))
+    cstr_csv_parser_init(pText, textLen, ',', &parser);
+    while (cstr_csv_parser_next(&parser, fields, 64, &fieldCount) == 0) {
+        printf("%d: %.*s\n", (int)parser.lineNumber, (int)fields[0].len, fields[0].p);
+    }
+    ```
 
-#define CSTR_HEADER_SIZE_IN_BYTES       (sizeof(size_t) + sizeof(size_t))
+Fields are pointers into the original text. The surrounding quotes of a quoted field are excluded, but any doubled quotes inside it are not unescaped. These
+fields have CSTR_CSV_FIELD_ESCAPED set and can be unescaped with cstr_csv_field_unescape() when they're needed. Fields without the flag can be used as is.
 
+Rows end with "\n" or "\r\n". Newlines inside quoted fields are part of the field. Empty lines are skipped. A row can have more fields than the capacity of
+the array that's passed in, in which case the extra fields are skipped but still counted in the output count, so compare it against the capacity.
 
-static CSTR_INLINE cstr_bool32 cstr_is_little_endian()
-{
-#if defined(CSTR_X86) || defined(CSTR_X64)
-    return CSTR_TRUE;
-#elif defined(__BYTE_ORDER) && defined(__LITTLE_ENDIAN) && __BYTE_ORDER == __LITTLE_ENDIAN
-    return CSTR_TRUE;
-#else
-    int n = 1;
-    return (*(char*)&n) == 1;
-#endif
-}
+cstr_csv_parser_next() returns 0 when a row was output, ENOMEM when there are no more rows, which is the same as the key/value parser, and EINVAL if there
+is a quoted field that is not terminated, or that has something other than a delimiter or a newline after its closing quote. A quote in the middle of an
+unquoted field is not valid and the result is unspecified.
 
-static CSTR_INLINE cstr_bool32 cstr_is_big_endian()
-{
-    return !cstr_is_little_endian();
-}
+Large files can be parsed on multiple threads. cstr_csv_find_chunks() splits the text into chunks that each start at the beginning of a row. This takes quoted
+newlines into account. Each chunk can then be given to its own parser on a separate thread. The line numbers reported by each parser are relative to the
+start of its chunk.
 
-static CSTR_INLINE cstr_uint16 cstr_swap_endian_uint16(cstr_uint16 n)
-{
-#ifdef CSTR_HAS_BYTESWAP16_INTRINSIC
-    #if defined(_MSC_VER)
-        return _byteswap_ushort(n);
-    #elif defined(__GNUC__) || defined(__clang__)
-        return __builtin_bswap16(n);
-    #else
-        #error "This compiler does not support the byte swap intrinsic."
-    #endif
-#else
-    return ((n & 0xFF00) >> 8) |
-           ((n & 0x00FF) << 8);
-#endif
-}
+    ```c
+    size_t offsets[MAX_THREADS + 1];
 
-static CSTR_INLINE cstr_uint32 cstr_swap_endian_uint32(cstr_uint32 n)
-{
-#ifdef CSTR_HAS_BYTESWAP32_INTRINSIC
-    #if defined(_MSC_VER)
-        return _byteswap_ulong(n);
-    #elif defined(__GNUC__) || defined(__clang__)
-        return __builtin_bswap32(n);
-    #else
-        #error "This compiler does not support the byte swap intrinsic."
-    #endif
-#else
-    return ((n & 0xFF000000) >> 24) |
-           ((n & 0x00FF0000) >>  8) |
-           ((n & 0x0000FF00) <<  8) |
-           ((n & 0x000000FF) << 24);
-#endif
-}
+    cstr_csv_find_chunks(pText, textLen, threadCount, offsets);
 
+    // On thread i.
+    cstr_csv_parser_init(pText + offsets[i], offsets[i + 1] - offsets[i], ',', &parser);
+    ```
+*/
+#define CSTR_CSV_FIELD_QUOTED           (1 << 0)    /* The field was surrounded by quotes. */
+#define CSTR_CSV_FIELD_ESCAPED          (1 << 1)    /* The field contains doubled quotes and needs to be unescaped with cstr_csv_field_unescape(). */
 
-static CSTR_INLINE cstr_uint16 cstr_be2host_16(cstr_uint16 n)
+typedef struct
 {
-    if (cstr_is_little_endian()) {
-        return cstr_swap_endian_uint16(n);
-    }
-
-    return n;
-}
+    const char* p;
+    size_t len;
+    cstr_uint32 flags;
+} cstr_csv_field;
 
-static CSTR_INLINE cstr_uint32 cstr_be2host_32(cstr_uint32 n)
+typedef struct
 {
-    if (cstr_is_little_endian()) {
-        return cstr_swap_endian_uint32(n);
-    }
-
-    return n;
-}
+    const char* pText;
+    size_t textLen;
+    char delimiter;
+    size_t cursor;              /* The start of the next field. */
+    size_t lineNumber;          /* One based line number of the start of the most recent row. */
+    cstr_uint64 structural;     /* The delimiters and newlines outside of quotes in the current block that haven't been processed yet. */
+    cstr_uint64 newlines;       /* Every newline in the current block, including those inside quotes. Used for line numbers. */
+    cstr_uint64 quoteCarry;     /* All bits set if the end of the most recently scanned block is inside quotes. */
+    size_t blockBase;
+    size_t nextBlock;
+    size_t newlineCount;        /* The number of newlines before the current block. */
+} cstr_csv_parser;
 
-static CSTR_INLINE cstr_uint16 cstr_le2host_16(cstr_uint16 n)
-{
-    if (!cstr_is_little_endian()) {
-        return cstr_swap_endian_uint16(n);
-    }
+CSTR_API int cstr_csv_parser_init(const char* pText, size_t textLen, char delimiter, cstr_csv_parser* pParser);
+CSTR_API int cstr_csv_parser_next(cstr_csv_parser* pParser, cstr_csv_field* pFields, size_t fieldCap, size_t* pFieldCount);
+CSTR_API int cstr_csv_field_unescape(const cstr_csv_field* pField, char* pDst, size_t dstCap, size_t* pDstLen);    /* `pDst` can be NULL to measure. Can be done in place. */
+CSTR_API void cstr_csv_find_chunks(const char* pText, size_t textLen, size_t chunkCount, size_t* pOffsets);          /* `pOffsets` must have room for `chunkCount + 1` offsets. */
 
-    return n;
-}
 
-static CSTR_INLINE cstr_uint32 cstr_le2host_32(cstr_uint32 n)
-{
-    if (!cstr_is_little_endian()) {
-        return cstr_swap_endian_uint32(n);
-    }
 
-    return n;
-}
+/**************************************************************************************************************************************************************
 
+Key/Value Documents
+===================
+A key/value document is a parsed, indexed view of some key/value text (the same grammar as the key/value parser above). The document does not copy any of the
+text. Instead, keys and values are stored as pointers into the original text and unescaping of string values is deferred until a value is actually requested.
+Lookups are done with a hash table that's built once at load time.
 
-static CSTR_INLINE cstr_uint16 cstr_host2be_16(cstr_uint16 n)
-{
-    if (cstr_is_little_endian()) {
-        return cstr_swap_endian_uint16(n);
-    }
+A document can be initialized from text that's already in memory, or directly from a file. When loading from a file, the file is memory mapped read-only and
+parsed in place which means loading costs a single sequential read of the file and no copies. If memory mapping is not available on the target platform, or
+CSTR_NO_MMAP is defined, the file is read into a heap allocated buffer instead.
 
-    return n;
-}
+    ```c
+    cstr_kvdoc doc;
+    cstr value;
 
-static CSTR_INLINE cstr_uint32 cstr_host2be_32(cstr_uint32 n)
-{
-    if (cstr_is_little_endian()) {
-        return cstr_swap_endian_uint32(n);
+    if (cstr_kvdoc_open_file("config.txt", &doc) != 0) {
+        return;
     }
 
-    return n;
-}
-
-static CSTR_INLINE cstr_uint16 cstr_host2le_16(cstr_uint16 n)
-{
-    if (!cstr_is_little_endian()) {
-        return cstr_swap_endian_uint16(n);
+    if (cstr_kvdoc_get_value(&doc, "window-title", (size_t)-1, &value) == 0) {
+        printf("%s\n", value);
+        cstr_free(value);
     }
 
-    return n;
-}
-
-static CSTR_INLINE cstr_uint32 cstr_host2le_32(cstr_uint32 n)
-{
-    if (!cstr_is_little_endian()) {
-        return cstr_swap_endian_uint32(n);
-    }
+    cstr_kvdoc_uninit(&doc);
+    ```
 
-    return n;
-}
+Keys can be grouped with `[section]` headers and with dotted keys such as `a.b.c`. Every key after a section header belongs to that section until the next
+header, and an empty header `[]` switches back to the top level. The full path of a key is the section name and the key joined with a dot, so the following
+two documents define the same key, `server.http.port`:
 
+    ```
+    [server.http]
+    port 8080
+    ```
 
-CSTR_API size_t utf8_strlen(const cstr_utf8* src)
-{
-    const cstr_utf8* end;
+    ```
+    server.http.port 8080
+    ```
 
-    CSTR_ASSERT(src != NULL);
-    
-    end = src;
-    while (end[0] != '\0') {
-        end += 1;
-    }
+Paths are split on dots into a tree of nodes which can be walked without having to compare key prefixes. Enumerating the children or the whole subtree of a
+node costs time proportional to the size of that subtree rather than the size of the document:
 
-    return end - src;
-}
+    ```c
+    const cstr_kvdoc_node* pServer = cstr_kvdoc_find_node(&doc, "server", (size_t)-1);
+    const cstr_kvdoc_node* pNode;
 
-CSTR_API cstr_utf8* utf8_strcpy(cstr_utf8* dst, const cstr_utf8* src)
-{
-    char* dstorig;
+    for (pNode = cstr_kvdoc_node_first_child(&doc, pServer); pNode != NULL; pNode = cstr_kvdoc_node_next_sibling(&doc, pNode)) {
+        printf("%.*s\n", (int)pNode->nameLen, pNode->pName);
+    }
+    ```
 
-    CSTR_ASSERT(dst != NULL);
-    CSTR_ASSERT(src != NULL);
+Nodes are created for every segment of a path, including sections and intermediate segments that have no value of their own. Use
+`cstr_kvdoc_node_get_entry()` to find out whether a node has a value.
 
-    dstorig = dst;
+A parsed document can be saved to a binary cache file with `cstr_kvdoc_save_binary()` and loaded again with `cstr_kvdoc_load_binary()`. The cache contains the
+original text, the entries, the node tree, both hash tables and the decoded form of every value, so loading it does no lexing, hashing or unescaping. The file
+is memory mapped and only the entry and node arrays are converted from offsets to pointers. The content is checksummed, and the size and modification time of
+the source file are recorded so a cache that's out of date can be detected:
 
-    /* No, we're not using this garbage: while (*dst++ = *src++); */
-    for (;;) {
-        *dst = *src;
-        if (*src == '\0') {
-            break;
+    ```c
+    if (cstr_kvdoc_load_binary("config.bin", "config.txt", &doc) != 0) {
+        if (cstr_kvdoc_open_file("config.txt", &doc) != 0) {
+            return;
         }
 
-        dst += 1;
-        src += 1;
+        cstr_kvdoc_save_binary(&doc, "config.bin", "config.txt");
     }
+    ```
 
-    return dstorig;
-}
+The cache is intended to be used on the machine that created it. Caches written by a different version of the format or on a machine with a different byte
+order are treated as out of date.
 
-CSTR_API int utf8_strcpy_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src)
-{
-    size_t i;
 
-    if (dst == 0) {
-        return EINVAL;
-    }
-    if (dstCap == 0) {
-        return ERANGE;
-    }
-    if (src == 0) {
-        dst[0] = '\0';
-        return EINVAL;
-    }
+API Reference
+-------------
+int cstr_kvdoc_init(const char* pText, size_t textLen, cstr_kvdoc* pDoc)
+    Parses the given text and builds the lookup index. The text is not copied and must remain valid for the life of the document. `textLen` can be `(size_t)-1`
+    in which case the text is assumed to be null terminated. Returns 0 on success, `EINVAL` if there is a syntax error or `ENOMEM` if out of memory.
 
-    for (i = 0; i < dstCap && src[i] != '\0'; ++i) {
-        dst[i] = src[i];
-    }
+int cstr_kvdoc_open_file(const char* pFilePath, cstr_kvdoc* pDoc)
+    Memory maps the given file and parses it in place. The mapping is owned by the document and is unmapped by `cstr_kvdoc_uninit()`. Returns 0 on success,
+    `ENOENT` if the file could not be opened, or any of the errors returned by `cstr_kvdoc_init()`.
 
-    if (i < dstCap) {
-        dst[i] = '\0';
-        return 0;
-    }
+void cstr_kvdoc_uninit(cstr_kvdoc* pDoc)
+    Frees the memory owned by the document and unmaps the file if it was loaded with `cstr_kvdoc_open_file()`.
 
-    dst[0] = '\0';
-    return ERANGE;
-}
+const cstr_kvdoc_entry* cstr_kvdoc_find(const cstr_kvdoc* pDoc, const char* pKey, size_t keyLen)
+    Finds the entry associated with the given key. Returns NULL if the key does not exist. If the same key appears multiple times in the document, the last
+    occurrence is returned. Keys that are quoted in the text are compared without the quotes, but escape sequences are not transformed. Keys inside a section
+    are found by their full path, such as "section.key".
 
-CSTR_API int utf8_strncpy_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src, size_t count)
-{
-    size_t maxcount;
-    size_t i;
+int cstr_kvdoc_get_value(const cstr_kvdoc* pDoc, const char* pKey, size_t keyLen, cstr* pValue)
+    Retrieves the value associated with the given key as a new string with quotes removed and escape sequences transformed. The returned string must be freed
+    with `cstr_free()`. Returns `ENOENT` if the key does not exist.
 
-    if (dst == 0) {
-        return EINVAL;
-    }
-    if (dstCap == 0) {
-        return EINVAL;
-    }
-    if (src == 0) {
-        dst[0] = '\0';
-        return EINVAL;
-    }
+int cstr_kvdoc_entry_get_value(const cstr_kvdoc_entry* pEntry, cstr* pValue)
+    Same as `cstr_kvdoc_get_value()`, but for an entry that has already been retrieved with `cstr_kvdoc_find()` or by iterating over `pEntries`.
 
-    maxcount = count;
-    if (count == ((size_t)-1) || count >= dstCap) {        /* -1 = _TRUNCATE */
-        maxcount = dstCap - 1;
-    }
+const cstr_kvdoc_node* cstr_kvdoc_find_node(const cstr_kvdoc* pDoc, const char* pPath, size_t pathLen)
+    Finds the node at the given dotted path. An empty path returns the root node. Returns NULL if no key in the document starts with the given path.
 
-    for (i = 0; i < maxcount && src[i] != '\0'; ++i) {
-        dst[i] = src[i];
-    }
+const cstr_kvdoc_node* cstr_kvdoc_node_first_child(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode)
+const cstr_kvdoc_node* cstr_kvdoc_node_next_sibling(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode)
+    Used to iterate over the immediate children of a node. Children are in the order they first appear in the document. Returns NULL when there are no more.
 
-    if (src[i] == '\0' || i == count || count == ((size_t)-1)) {
-        dst[i] = '\0';
-        return 0;
-    }
+const cstr_kvdoc_node* cstr_kvdoc_node_next(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode, const cstr_kvdoc_node* pRoot)
+    Used to iterate over every node in the subtree of `pRoot` in depth first order, not including `pRoot` itself. Start with `pNode` set to `pRoot`. Returns
+    NULL when the subtree has been exhausted.
 
-    dst[0] = '\0';
-    return ERANGE;
-}
+const cstr_kvdoc_entry* cstr_kvdoc_node_get_entry(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode)
+    Retrieves the entry whose full path ends at the given node, or NULL if the node is only a section or an intermediate segment of a longer key.
 
-CSTR_API int utf8_strcat_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src)
-{
-    char* dstorig;
+int cstr_kvdoc_save_binary(const cstr_kvdoc* pDoc, const char* pFilePath, const char* pSourceFilePath)
+    Saves the document to a binary cache file. `pSourceFilePath` is the text file the document was loaded from, and its size and modification time are stored
+    in the cache. This should be called straight after loading the source file. It can be NULL in which case the cache cannot be validated against a source
+    file when it's loaded. The cache is written to a temporary file first and then renamed so that a process that has the old cache mapped is not affected.
+    Returns 0 on success, `ENOENT` if the source file does not exist, `ERANGE` if the document is larger than the 4GB limit of the format, or `EIO` if the
+    file could not be written.
 
-    if (dst == 0) {
-        return EINVAL;
-    }
-    if (dstCap == 0) {
-        return ERANGE;
-    }
-    if (src == 0) {
-        dst[0] = '\0';
-        return EINVAL;
-    }
+int cstr_kvdoc_load_binary(const char* pFilePath, const char* pSourceFilePath, cstr_kvdoc* pDoc)
+    Loads a document from a cache file created with `cstr_kvdoc_save_binary()`. If `pSourceFilePath` is not NULL, its size and modification time must match
+    what was recorded when the cache was saved. Returns 0 on success, `ENOENT` if either file does not exist, `CSTR_ESTALE` if the cache is out of date or was
+    written by an incompatible version, and `CSTR_ECORRUPT` if the cache is truncated or the checksum does not match. On POSIX platforms the modification time
+    has a resolution of one second. The loaded document behaves exactly like one loaded with `cstr_kvdoc_open_file()`, including with `cstr_kvdoc_reload()`.
 
-    dstorig = dst;
+int cstr_kvdoc_reload(cstr_kvdoc* pDoc, const char* pNewText, size_t newTextLen, cstr_kvdoc_changes* pChanges)
+    Replaces the content of the document with new text and reports which keys were added, removed or modified. This is intended for live reloading where the new
+    text is usually a small edit of the old text. Entries in the leading and trailing regions that are byte-for-byte identical between the old and new text are
+    reused without being parsed again and only keys that appear in the changed region are compared. The existing hash table allocation is reused. If only
+    values were edited the node tree is kept, otherwise it is rebuilt.
 
-    while (dstCap > 0 && dst[0] != '\0') {
-        dst    += 1;
-        dstCap -= 1;
-    }
+    The old text must still be valid when this is called, but can be released as soon as it returns. If the document was loaded with `cstr_kvdoc_open_file()`,
+    the file is unmapped once the new text has been loaded. The new text has the same lifetime requirements as the text passed to `cstr_kvdoc_init()`.
 
-    if (dstCap == 0) {
-        return EINVAL;  /* Unterminated. */
-    }
+    `pChanges` can be NULL if you don't need the list of changes. Otherwise it must be uninitialized with `cstr_kvdoc_changes_uninit()`. For added and modified
+    keys, `pEntry` points to the new entry in the document. For removed keys `pEntry` is NULL and `pSection` and `pKey` point to memory owned by the change
+    list. If an error is returned the document is left unchanged.
 
-    while (dstCap > 0 && src[0] != '\0') {
-        *dst++ = *src++;
-        dstCap -= 1;
-    }
+void cstr_kvdoc_changes_uninit(cstr_kvdoc_changes* pChanges)
+    Frees the memory owned by a change list returned by `cstr_kvdoc_reload()`.
 
-    if (dstCap > 0) {
-        dst[0] = '\0';
-    } else {
-        dstorig[0] = '\0';
-        return ERANGE;
-    }
+**************************************************************************************************************************************************************/
+typedef struct
+{
+    const char* pSection;   /* Points into the document text. NULL or empty if the key is not inside a section. */
+    size_t sectionLen;
+    const char* pKey;       /* Points into the document text. Surrounding quotes are not included. */
+    size_t keyLen;
+    const char* pValue;     /* Points into the document text. This is the raw token, including quotes if the value is a string. */
+    size_t valueLen;
+    const char* pDecodedValue;  /* The value with quotes removed and escapes transformed. Only set for documents loaded from a binary cache, otherwise NULL. */
+    size_t decodedValueLen;
+    size_t lineNumber;      /* One based line number of the key. */
+    cstr_uint32 keyHash;    /* Hash of the full path, including the section. */
+} cstr_kvdoc_entry;
 
-    return 0;
-}
+typedef struct
+{
+    const char* pName;      /* A single segment of a path. Points into the document text. */
+    size_t nameLen;
+    cstr_uint32 nameHash;
+    cstr_uint32 parent;     /* Index of the parent node. The root node is always at index 0. */
+    cstr_uint32 firstChild; /* Index of the first child, or 0 if there are no children. */
+    cstr_uint32 lastChild;
+    cstr_uint32 nextSibling;/* Index of the next sibling, or 0 if this is the last child. */
+    cstr_uint32 entry;      /* Index of the entry plus one, or 0 if no key ends at this node. */
+} cstr_kvdoc_node;
 
-CSTR_API int utf8_strncat_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src, size_t count)
+typedef struct
 {
-    char* dstorig;
+    const char* pText;
+    size_t textLen;
+    cstr_kvdoc_entry* pEntries; /* Entries in the order they appear in the text. */
+    size_t entryCount;
+    size_t entryCap;
+    cstr_uint32* pIndex;        /* Open addressing hash table. Each slot is an index into pEntries plus one. Zero means the slot is empty. */
+    size_t indexCap;            /* Always a power of two. */
+    cstr_kvdoc_node* pNodes;    /* The path hierarchy. The root node is at index 0. */
+    size_t nodeCount;
+    size_t nodeCap;
+    cstr_uint32* pNodeIndex;    /* Open addressing hash table keyed on the parent node and name. Each slot is an index into pNodes plus one. */
+    size_t nodeIndexCap;        /* Always a power of two. */
+    struct
+    {
+        void* pData;            /* Base address of the mapping, or the heap buffer if memory mapping is unavailable. */
+        size_t sizeInBytes;
+        void* hMapping;         /* Win32 only. The handle returned by CreateFileMapping(). */
+        cstr_bool32 isHeap;
+    } file;
+} cstr_kvdoc;
 
-    if (dst == 0) {
-        return EINVAL;
-    }
-    if (dstCap == 0) {
-        return ERANGE;
-    }
-    if (src == 0) {
-        return EINVAL;
-    }
+typedef enum
+{
+    cstr_kvdoc_change_type_added,
+    cstr_kvdoc_change_type_removed,
+    cstr_kvdoc_change_type_modified
+} cstr_kvdoc_change_type;
 
-    dstorig = dst;
+typedef struct
+{
+    cstr_kvdoc_change_type type;
+    const char* pSection;
+    size_t sectionLen;
+    const char* pKey;
+    size_t keyLen;
+    const cstr_kvdoc_entry* pEntry; /* The entry in the reloaded document. NULL for removed keys. */
+} cstr_kvdoc_change;
 
-    while (dstCap > 0 && dst[0] != '\0') {
-        dst    += 1;
-        dstCap -= 1;
-    }
+typedef struct
+{
+    cstr_kvdoc_change* pChanges;
+    size_t count;
+    size_t cap;
+    char* pRemovedKeyData;          /* Storage for the sections and keys of removed entries since the old text may no longer exist. */
+} cstr_kvdoc_changes;
+
+CSTR_API int cstr_kvdoc_init(const char* pText, size_t textLen, cstr_kvdoc* pDoc);
+CSTR_API int cstr_kvdoc_open_file(const char* pFilePath, cstr_kvdoc* pDoc);
+CSTR_API void cstr_kvdoc_uninit(cstr_kvdoc* pDoc);
+CSTR_API const cstr_kvdoc_entry* cstr_kvdoc_find(const cstr_kvdoc* pDoc, const char* pKey, size_t keyLen);
+CSTR_API int cstr_kvdoc_get_value(const cstr_kvdoc* pDoc, const char* pKey, size_t keyLen, cstr* pValue);
+CSTR_API int cstr_kvdoc_entry_get_value(const cstr_kvdoc_entry* pEntry, cstr* pValue);
+CSTR_API const cstr_kvdoc_node* cstr_kvdoc_find_node(const cstr_kvdoc* pDoc, const char* pPath, size_t pathLen);
+CSTR_API const cstr_kvdoc_node* cstr_kvdoc_node_first_child(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode);
+CSTR_API const cstr_kvdoc_node* cstr_kvdoc_node_next_sibling(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode);
+CSTR_API const cstr_kvdoc_node* cstr_kvdoc_node_next(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode, const cstr_kvdoc_node* pRoot);
+CSTR_API const cstr_kvdoc_entry* cstr_kvdoc_node_get_entry(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode);
+CSTR_API int cstr_kvdoc_save_binary(const cstr_kvdoc* pDoc, const char* pFilePath, const char* pSourceFilePath);
+CSTR_API int cstr_kvdoc_load_binary(const char* pFilePath, const char* pSourceFilePath, cstr_kvdoc* pDoc);
+CSTR_API int cstr_kvdoc_reload(cstr_kvdoc* pDoc, const char* pNewText, size_t newTextLen, cstr_kvdoc_changes* pChanges);
+CSTR_API void cstr_kvdoc_changes_uninit(cstr_kvdoc_changes* pChanges);
 
-    if (dstCap == 0) {
-        return EINVAL;  /* Unterminated. */
-    }
 
-    if (count == ((size_t)-1)) {        /* _TRUNCATE */
-        count = dstCap - 1;
-    }
+/**************************************************************************************************************************************************************
 
-    while (dstCap > 0 && src[0] != '\0' && count > 0) {
-        *dst++ = *src++;
-        dstCap -= 1;
-        count  -= 1;
-    }
+String Interning
+================
+An interner maps the content of a string to a single canonical copy of it. Interning the same content twice returns the same `cstr`, so two interned
+strings can be tested for equality by comparing their pointers. Each unique string is also given a 32-bit ID which can be used in place of the string in
+tables and serialized data. IDs are assigned sequentially starting from 0 in the order strings are first interned.
 
-    if (dstCap > 0) {
-        dst[0] = '\0';
-    } else {
-        dstorig[0] = '\0';
-        return ERANGE;
-    }
+    ```c
+    cstr_interner interner;
+    cstr a;
+    cstr b;
+    cstr_uint32 id;
 
-    return 0;
-}
+    cstr_interner_init(&interner);
 
-CSTR_API int utf8_itoa_s(int value, cstr_utf8* dst, size_t dstCap, int radix)
-{
-    int sign;
-    unsigned int valueU;
-    char* dstEnd;
+    cstr_interner_intern(&interner, "hello", (size_t)-1, &a, &id);
+    cstr_interner_intern(&interner, "hello", (size_t)-1, &b, NULL);
 
-    if (dst == NULL || dstCap == 0) {
-        return EINVAL;
-    }
-    if (radix < 2 || radix > 36) {
-        dst[0] = '\0';
-        return EINVAL;
+    if (a == b) {
+        printf("%s has ID %u\n", a, (unsigned int)id);  // Always true.
     }
 
-    sign = (value < 0 && radix == 10) ? -1 : 1;     /* The negative sign is only used when the base is 10. */
+    cstr_interner_uninit(&interner);
+    ```
 
-    if (value < 0) {
-        valueU = -value;
-    } else {
-        valueU = value;
-    }
+Interned strings are owned by the interner and remain valid until it is uninitialized. They are normal dynamic strings and can be passed into any function
+that takes a `cstr`. They can be retained and released, but they must never be modified in place. Functions that modify a string, like `cstr_cat()`, will
+make a copy rather than modifying the interned string because interned strings are always treated as shared. There is no need to free an interned string.
 
-    dstEnd = dst;
-    do
-    {
-        int remainder = valueU % radix;
-        if (remainder > 9) {
-            *dstEnd = (char)((remainder - 10) + 'a');
-        } else {
-            *dstEnd = (char)(remainder + '0');
-        }
+The interner is thread safe. Lookups of strings that have already been interned do not take any locks. The table is split into a number of shards, each with
+its own lock, so threads inserting different strings will rarely contend with each other. String data is stored in large blocks that are allocated by each
+shard so that interning a string does not require its own heap allocation.
 
-        dstEnd += 1;
-        dstCap -= 1;
-        valueU /= radix;
-    } while (dstCap > 0 && valueU > 0);
+Use `cstr_interner_intern_bulk()` to intern many strings at once. It groups the strings by shard so each lock is only taken once per batch.
 
-    if (dstCap == 0) {
-        dst[0] = '\0';
-        return EINVAL;  /* Ran out of room in the output buffer. */
-    }
 
-    if (sign < 0) {
-        *dstEnd++ = '-';
-        dstCap -= 1;
-    }
+API Reference
+-------------
+int cstr_interner_init(cstr_interner* pInterner)
+    Initializes an interner. Returns EINVAL if `pInterner` is NULL.
 
-    if (dstCap == 0) {
-        dst[0] = '\0';
-        return EINVAL;  /* Ran out of room in the output buffer. */
-    }
+void cstr_interner_uninit(cstr_interner* pInterner)
+    Frees all memory used by the interner. Every string returned by the interner will be invalidated. No other thread can be using the interner when this is
+    called.
 
-    *dstEnd = '\0';
+int cstr_interner_intern(cstr_interner* pInterner, const char* pStr, size_t len, cstr* pInterned, cstr_uint32* pID)
+    Retrieves the canonical string for the given content, inserting it if necessary. `len` can be (size_t)-1 if `pStr` is null terminated. Either of the
+    output parameters can be NULL. Returns ENOMEM if a new string could not be allocated and ERANGE if the ID space has been exhausted.
 
+int cstr_interner_intern_bulk(cstr_interner* pInterner, const char* const* ppStrs, const size_t* pLens, size_t count, cstr* pInterned, cstr_uint32* pIDs)
+    Interns `count` strings. `pLens` can be NULL if every string is null terminated, and individual lengths can be (size_t)-1. `pInterned` and `pIDs` can
+    be NULL. If an error is returned, some of the strings may have already been interned, but the outputs for those strings are still set.
 
-    /* At this point the string will be reversed. */
-    dstEnd -= 1;
-    while (dst < dstEnd) {
-        char temp = *dst;
-        *dst = *dstEnd;
-        *dstEnd = temp;
+int cstr_interner_find(const cstr_interner* pInterner, const char* pStr, size_t len, cstr* pInterned, cstr_uint32* pID)
+    Looks up a string without inserting it. Returns ENOENT if the string has not been interned. Does not take any locks.
 
-        dst += 1;
-        dstEnd -= 1;
-    }
+cstr cstr_interner_get(const cstr_interner* pInterner, cstr_uint32 id)
+    Retrieves the string with the given ID. Returns NULL if the ID is not valid. Does not take any locks.
 
-    return 0;
-}
+cstr_uint32 cstr_interner_id_of(cstr interned)
+    Retrieves the ID of a string that was returned by an interner. This is constant time. The string must have come from an interner.
 
+cstr_uint32 cstr_interner_get_count(const cstr_interner* pInterner)
+    Retrieves the number of unique strings that have been interned.
 
-CSTR_API size_t utf16_strlen(const cstr_utf16* src)
-{
-    const cstr_utf16* end;
+**************************************************************************************************************************************************************/
+#ifndef CSTR_NO_UTF8
+#ifndef CSTR_INTERNER_SHARD_COUNT
+#define CSTR_INTERNER_SHARD_COUNT       16
+#endif
 
-    CSTR_ASSERT(src != NULL);
-    
-    end = src;
-    while (end[0] != '\0') {
-        end += 1;
-    }
+#define CSTR_INTERNER_INVALID_ID        0xFFFFFFFF
+#define CSTR_INTERNER_ID_BLOCK_COUNT    23  /* Enough blocks to cover every 32-bit ID. See cstr_interner_get_id_location(). */
 
-    return end - src;
-}
+typedef struct
+{
+    void* volatile pTable;          /* The current hash table. Readers load this without taking the lock. */
+    void* pRetiredTables;           /* Tables that were replaced when growing. They can't be freed until uninit because readers may still be using them. */
+    void* pBlocks;                  /* The blocks of string data. */
+    size_t count;
+    volatile cstr_uint32 lock;
+} cstr_interner_shard;
 
-CSTR_API size_t utf32_strlen(const cstr_utf32* src)
+typedef struct
 {
-    const cstr_utf32* end;
+    cstr_interner_shard shards[CSTR_INTERNER_SHARD_COUNT];
+    void* volatile pIDBlocks[CSTR_INTERNER_ID_BLOCK_COUNT];  /* Maps IDs to strings. Each block is twice the size of the previous one and is never moved. */
+    volatile cstr_uint32 nextID;
+    volatile cstr_uint32 count;
+    volatile cstr_uint32 idLock;
+} cstr_interner;
+
+CSTR_API int cstr_interner_init(cstr_interner* pInterner);
+CSTR_API void cstr_interner_uninit(cstr_interner* pInterner);
+CSTR_API int cstr_interner_intern(cstr_interner* pInterner, const char* pStr, size_t len, cstr* pInterned, cstr_uint32* pID);
+CSTR_API int cstr_interner_intern_bulk(cstr_interner* pInterner, const char* const* ppStrs, const size_t* pLens, size_t count, cstr* pInterned, cstr_uint32* pIDs);
+CSTR_API int cstr_interner_find(const cstr_interner* pInterner, const char* pStr, size_t len, cstr* pInterned, cstr_uint32* pID);
+CSTR_API cstr cstr_interner_get(const cstr_interner* pInterner, cstr_uint32 id);
+CSTR_API cstr_uint32 cstr_interner_id_of(cstr interned);
+CSTR_API cstr_uint32 cstr_interner_get_count(const cstr_interner* pInterner);
+#endif
 
-    CSTR_ASSERT(src != NULL);
-    
-    end = src;
-    while (end[0] != '\0') {
-        end += 1;
-    }
 
-    return end - src;
-}
+/**************************************************************************************************************************************************************
 
+String Arrays
+=============
+A string array holds a list of strings in two allocations: one buffer containing the content of every string packed back to back, and one array of offsets
+into that buffer. This is much more compact than an array of separately allocated `cstr` strings, and because the strings are next to each other in memory,
+iterating over them is cache friendly. For short strings the overhead is 9 bytes per string, compared to the prefixed data, the pointer and the heap
+allocation overhead of a `cstr`.
 
+    ```c
+    cstr_array array;
+    size_t i;
 
+    cstr_array_init(&array);
+    cstr_array_append_split(&array, "pear,apple,orange", (size_t)-1, cstr_view_init(",", 1));
+    cstr_array_append(&array, "banana", (size_t)-1);
+    cstr_array_sort(&array);
 
-#ifndef CSTR_NO_UTF8
-int cstr8_vscprintf(const char* pFormat, va_list args)
-{
-#if defined(_MSC_VER)
-    #if _MSC_VER > 1200
-        return _vscprintf(pFormat, args);
-    #else
-        /*
-        We need to emulate _vscprintf() for the VC6 build. This can be made more efficient, but since it's only VC6 I'm happy to keep this simple. In the VC6
-        build we can implement this in terms of _vsnprintf().
-        */
-        int result;
-        char* pTempBuffer = NULL;
-        size_t tempBufferCap = 1024;
+    for (i = 0; i < cstr_array_get_count(&array); i += 1) {
+        printf("%s\n", cstr_array_get(&array, i).p);
+    }
 
-        if (pFormat == NULL) {
-            errno = EINVAL;
-            return -1;
-        }
+    cstr_array_uninit(&array);
+    ```
 
-	    for (;;) {
-            char* pNewTempBuffer = (char*)CSTR_REALLOC(pTempBuffer, tempBufferCap, NULL);    /* TODO: Add support for custom memory allocators? */
-            if (pNewTempBuffer == NULL) {
-                CSTR_FREE(pTempBuffer, NULL);
-                errno = ENOMEM;
-                return -1;  /* Out of memory. */
-            }
+Items are retrieved as views. Each string is stored with a null terminator which means the pointer of a view returned by `cstr_array_get()` can also be used
+as a normal C string. The views are invalidated when the array is modified because the buffer may be reallocated. Strings can contain null bytes, but then
+the view must be used with its length.
 
-            pTempBuffer = pNewTempBuffer;
+Sorting reorders the strings by their bytes with `cstr_sort()`. See the Sorting section for details. The content buffer is rebuilt in the new order so that
+iterating over a sorted array is still sequential in memory.
 
-            result = _vsnprintf(pTempBuffer, tempBufferCap, pFormat, args);
-            CSTR_FREE(pTempBuffer, NULL);
-        
-            if (result != -1) {
-                break;  /* Got it. */
-            }
+An array can be serialized to a flat buffer and loaded back with `cstr_array_deserialize()`. The format is the same on all platforms. The content buffer is
+stored as is so a serialized array costs only the content plus 8 bytes per string.
 
-            /* Buffer wasn't big enough. Ideally it'd be nice to use an error code to know the reason for sure, but this is reliable enough. */
-            tempBufferCap *= 2;
-	    }
 
-        return result;
-    #endif
-#else
-    return vsnprintf(NULL, 0, pFormat, args);
-#endif
-}
+API Reference
+-------------
+int cstr_array_init(cstr_array* pArray)
+    Initializes an empty array. This does not allocate any memory. Returns EINVAL if `pArray` is NULL.
 
-static int cstr8_vsprintf(char* pOutput, const char* pFormat, va_list args)
-{
-    /* WARNING: This should only be used by first measuring the output string by setting pOutput to NULL. */
+void cstr_array_uninit(cstr_array* pArray)
+    Frees the memory used by the array.
 
-    if (pOutput == NULL) {
-        return cstr8_vscprintf(pFormat, args);
-    } else {
-    #if (!defined(_MSC_VER) || _MSC_VER >= 1900) && !defined(__STRICT_ANSI__)
-        return vsnprintf(pOutput, (size_t)-1, pFormat, args);   /* We're lying about the length here. We should only be calling this internally, and only when computing the length beforehand, so it should be safe. */
-    #else
-        return vsprintf(pOutput, pFormat, args);
-    #endif
-    }
-}
+int cstr_array_reserve(cstr_array* pArray, size_t count, size_t dataSize)
+    Makes sure the array has room for a total of `count` strings containing a total of `dataSize` bytes, not counting null terminators, so that appending up
+    to that amount does not need to allocate. Returns ENOMEM if out of memory.
 
-static CSTR_INLINE size_t cstr8_allocation_size(size_t cap)
-{
-    return CSTR_HEADER_SIZE_IN_BYTES + cap + 1; /* +1 for null terminator. */
-}
+int cstr_array_append(cstr_array* pArray, const char* pStr, size_t len)
+    Appends a copy of a string to the end of the array. `len` can be (size_t)-1 if `pStr` is null terminated. Returns ENOMEM if out of memory.
 
-static CSTR_INLINE void* cstr8_to_allocation_address(cstr8 str)
-{
-    return str - CSTR_HEADER_SIZE_IN_BYTES;
-}
+int cstr_array_append_split(cstr_array* pArray, const char* pStr, size_t len, cstr_view delimiter)
+    Splits a string with the same rules as `cstr_view_split()` and appends every token. The content buffer is resized at most once. Returns ENOMEM if out of
+    memory, in which case some of the tokens may have been appended.
 
-static CSTR_INLINE cstr8 cstr8_from_allocation_address(void* pAllocationAddress)
-{
-    return (char*)pAllocationAddress + CSTR_HEADER_SIZE_IN_BYTES;
-}
+size_t cstr_array_get_count(const cstr_array* pArray)
+    Retrieves the number of strings in the array.
 
-static CSTR_INLINE void cstr8_set_cap(cstr8 str, size_t cap)
-{
-    ((size_t*)cstr8_to_allocation_address(str))[0] = cap;
-}
+cstr_view cstr_array_get(const cstr_array* pArray, size_t index)
+    Retrieves a view of the string at the given index. The view is null terminated. Returns a null view if the index is out of range.
 
-static CSTR_INLINE size_t cstr8_get_cap(cstr8 str)
-{
-    return ((size_t*)cstr8_to_allocation_address(str))[0];
-}
+void cstr_array_clear(cstr_array* pArray)
+    Removes every string from the array without freeing any memory.
 
-static CSTR_INLINE void cstr8_set_len(cstr8 str, size_t len)
-{
-    ((size_t*)cstr8_to_allocation_address(str))[1] = len;
-}
+int cstr_array_sort(cstr_array* pArray)
+    Sorts the strings in the array in byte order. Returns ENOMEM if the temporary memory needed for sorting could not be allocated, in which case the array is
+    left unchanged.
 
-static CSTR_INLINE size_t cstr8_get_len(cstr8 str)
-{
-    return ((size_t*)cstr8_to_allocation_address(str))[1];
-}
+int cstr_array_serialize(const cstr_array* pArray, void* pDst, size_t dstCap, size_t* pSize)
+    Writes the array to a buffer. `pSize` receives the number of bytes required. `pDst` can be NULL to only retrieve the size. Returns ENOMEM if `dstCap` is
+    too small.
 
-static cstr8 cstr8_realloc(cstr8 str, size_t cap)
+int cstr_array_deserialize(cstr_array* pArray, const void* pData, size_t dataSize)
+    Replaces the content of an array with an array that was written with `cstr_array_serialize()`. Returns EINVAL if the data is malformed and ENOMEM if
+    out of memory. The array is left unchanged if an error is returned.
+
+**************************************************************************************************************************************************************/
+#ifndef CSTR_NO_UTF8
+typedef struct
 {
-    void* addr = CSTR_REALLOC(cstr8_to_allocation_address(str), cstr8_allocation_size(cap));
-    if (addr == NULL) {
-        return NULL;    /* Failed */
-    }
+    char* pData;                    /* The content of every string, each followed by a null terminator. */
+    size_t dataSize;
+    size_t dataCap;
+    size_t* pOffsets;               /* `count + 1` entries. String `i` starts at `pOffsets[i]` and its null terminator is at `pOffsets[i + 1] - 1`. */
+    size_t count;
+    size_t countCap;
+} cstr_array;
+
+CSTR_API int cstr_array_init(cstr_array* pArray);
+CSTR_API void cstr_array_uninit(cstr_array* pArray);
+CSTR_API int cstr_array_reserve(cstr_array* pArray, size_t count, size_t dataSize);
+CSTR_API int cstr_array_append(cstr_array* pArray, const char* pStr, size_t len);
+CSTR_API int cstr_array_append_split(cstr_array* pArray, const char* pStr, size_t len, cstr_view delimiter);
+CSTR_API size_t cstr_array_get_count(const cstr_array* pArray);
+CSTR_API cstr_view cstr_array_get(const cstr_array* pArray, size_t index);
+CSTR_API void cstr_array_clear(cstr_array* pArray);
+CSTR_API int cstr_array_sort(cstr_array* pArray);
+CSTR_API int cstr_array_serialize(const cstr_array* pArray, void* pDst, size_t dstCap, size_t* pSize);
+CSTR_API int cstr_array_deserialize(cstr_array* pArray, const void* pData, size_t dataSize);
+#endif
 
-    cstr8_set_cap(cstr8_from_allocation_address(addr), cap);
 
-    return cstr8_from_allocation_address(addr);
-}
+/**************************************************************************************************************************************************************
 
-CSTR_API cstr8 cstr8_alloc(size_t len)
-{
-    char* str;
+Sorting
+=======
+`cstr_sort()` sorts an array of views in byte order, the same as `memcmp()` with shorter strings ordered before longer strings that start with the same bytes.
+It's much faster than `qsort()` with `strcmp()` for large arrays. The first 8 bytes of each string are loaded as an integer so that most comparisons are a
+single integer comparison rather than a call to `memcmp()`. Large groups of strings are split with an MSD radix sort on those bytes, one byte at a time, and
+smaller groups are finished with a three-way quicksort on the whole 8 bytes. When a group of strings shares the same 8 bytes, the next 8 bytes are loaded
+and the process repeats, so common prefixes are never compared more than once.
 
-    str = (char*)CSTR_CALLOC(cstr8_allocation_size(len));
-    if (str == NULL) {
-        return NULL;    /* Out of memory. */
-    }
+    ```c
+    cstr_view views[3];
+    views[0] = cstr_view_init("pear",   (size_t)-1);
+    views[1] = cstr_view_init("apple",  (size_t)-1);
+    views[2] = cstr_view_init("orange", (size_t)-1);
 
-    return str + CSTR_HEADER_SIZE_IN_BYTES;
-}
+    cstr_sort(views, 3);
+    ```
 
-CSTR_API void cstr8_free(cstr8 str)
-{
-    if (str == NULL) {
-        return;
-    }
+Use `cstr_sort_strings()` to sort an array of `cstr` strings and `cstr_array_sort()` to sort a string array. Both use the same algorithm.
 
-    CSTR_FREE(cstr8_to_allocation_address(str));
-}
+The library does not create threads, but sorting can be spread over your own threads. `cstr_sort_partition()` groups the views by their first byte, without
+allocating any memory, after which each group is independent and can be sorted from a different thread with `cstr_sort_ex()`. The groups are already in the
+correct order relative to each other so there is no merge step:
 
-CSTR_API cstr8 cstr8_newn(const char* pOther, size_t otherLen)
-{
-    cstr8 str;
+    ```c
+    size_t offsets[CSTR_SORT_PARTITION_COUNT + 1];
+    cstr_uint32 i;
 
-    if (pOther == NULL) {
-        return NULL;
-    }
+    cstr_sort_partition(pViews, count, offsets);
 
-    if (otherLen == (size_t)-1) {
-        otherLen = utf8_strlen(pOther);
-    }
-
-    str = cstr8_alloc(otherLen);
-    if (str == NULL) {
-        return NULL;    /* Out of memory. */
+    for (i = 1; i < CSTR_SORT_PARTITION_COUNT; i += 1) {   // Partition 0 contains empty strings and is already sorted.
+        // Do this on a worker thread. Every string in the partition has the same first byte so pass in a depth of 1.
+        cstr_sort_ex(pViews + offsets[i], offsets[i + 1] - offsets[i], 1);
     }
+    ```
 
-    utf8_strncpy_s(str, otherLen+1, pOther, otherLen);  /* We've already calculated the length. No need for the added overhead of using the _s() version. */
+Sorting allocates a temporary array with 24 bytes for each string, plus the same again when radix sorting large arrays.
 
-    cstr8_set_cap(str, otherLen);
-    cstr8_set_len(str, otherLen);
 
-    return str;
-}
+API Reference
+-------------
+int cstr_sort(cstr_view* pViews, size_t count)
+    Sorts an array of views. Returns ENOMEM if the temporary memory could not be allocated, in which case the array is left unchanged.
 
-CSTR_API cstr8 cstr8_new(const char* pOther)
-{
-    if (pOther == NULL) {
-        return NULL;
-    }
+int cstr_sort_ex(cstr_view* pViews, size_t count, size_t depth)
+    The same as `cstr_sort()`, except every view is known to start with the same `depth` bytes, so those bytes are skipped. Every view must be at least `depth`
+    bytes long.
 
-    return cstr8_newn(pOther, utf8_strlen(pOther));
-}
+void cstr_sort_partition(cstr_view* pViews, size_t count, size_t pOffsets[CSTR_SORT_PARTITION_COUNT + 1])
+    Reorders the views so they're grouped by their first byte, in order. Partition 0 contains the empty strings. Partition `b + 1` contains the strings that
+    start with the byte `b`. Partition `i` starts at `pOffsets[i]` and ends at `pOffsets[i + 1]`. This does not allocate any memory.
 
-CSTR_API cstr8 cstr8_newv(const char* pFormat, va_list args)
-{
-    va_list args2;
-    size_t  len;
-    cstr8   str;
+int cstr_sort_strings(cstr* pStrs, size_t count)
+    Sorts an array of dynamic strings by their content. The strings themselves are not modified, only their order in the array. NULL strings are treated as
+    empty. Returns ENOMEM if the temporary memory could not be allocated, in which case the array is left unchanged.
 
-    if (pFormat == NULL) {
-        return NULL;
-    }
+**************************************************************************************************************************************************************/
+#ifndef CSTR_NO_UTF8
+#define CSTR_SORT_PARTITION_COUNT       257
 
-#if !defined(_MSC_VER) || _MSC_VER >= 1800
-    va_copy(args2, args);
-#else
-    args2 = args;
+CSTR_API int cstr_sort(cstr_view* pViews, size_t count);
+CSTR_API int cstr_sort_ex(cstr_view* pViews, size_t count, size_t depth);
+CSTR_API void cstr_sort_partition(cstr_view* pViews, size_t count, size_t pOffsets[CSTR_SORT_PARTITION_COUNT + 1]);
+CSTR_API int cstr_sort_strings(cstr* pStrs, size_t count);
 #endif
 
-    len = cstr8_vsprintf(NULL, pFormat, args2);
-    if (len < 0) {
-        return NULL;
-    }
-
-    str = cstr8_alloc(len);
-    if (str == NULL) {
-        return str; /* Out of memory. */
-    }
-
-    cstr8_vsprintf(str, pFormat, args);
-
-    cstr8_set_cap(str, len);
-    cstr8_set_len(str, len);
 
-    va_end(args2);
+/**************************************************************************************************************************************************************
 
-    return str;
-}
+Escaping
+========
+These functions convert text to and from the escaped forms used by other formats, and binary data to and from base64 and hex. The escaping and encoding
+functions append to a dynamic string and the unescaping and decoding functions write to a buffer, which can be the input itself because the output is never
+longer than the input.
 
-CSTR_API cstr cstr8_newf(const char* pFormat, ...)
-{
-    va_list args;
-    cstr8 str;
+The input is scanned with SSE2 where available for the bytes that need to be escaped, and the runs of bytes in between are copied in bulk. The escaping
+functions measure the output first so the string is only resized once.
 
-    if (pFormat == NULL) {
-        return NULL;
-    }
+    ```c
+    cstr json = cstr_new("{\"name\":\"");
+    json = cstr_cat_json_escaped(json, pName, (size_t)-1);
+    json = cstr_cat(json, "\"}");
+    ```
 
-    va_start(args, pFormat);
-    str = cstr8_newv(pFormat, args);
-    va_end(args);
 
-    return str;
-}
+JSON
+----
+`cstr_cat_json_escaped()` escapes `"`, `\` and control characters. The control characters that have a short escape, such as `\n`, use it and the others use
+`\u00XX`. Everything else, including non-ASCII characters, is copied as is. The surrounding quotes are not added.
 
-CSTR_API cstr8 cstr8_setn(cstr8 str, const char* pOther, size_t otherLen)
-{
-    if (pOther == NULL) {
-        pOther   = "";
-        otherLen = 0;
-    }
+`utf8_json_unescape()` accepts every escape in RFC 8259. A `\uXXXX` escape is output as UTF-8 and a surrogate pair is combined into a single code point. A
+surrogate without its other half is replaced with CSTR_UNICODE_REPLACEMENT_CODE_POINT, or CSTR_ECODEPOINT is returned if CSTR_ERROR_ON_INVALID_CODE_POINT
+is set.
 
-    if (str == NULL) {
-        return cstr8_newn(pOther, otherLen);
-    }  else {
-        if (otherLen == (size_t)-1) {
-            otherLen = utf8_strlen(pOther);
-        }
 
-        if (str != pOther) {
-            size_t cap = cstr8_get_cap(str);
+API Reference
+-------------
+cstr cstr_cat_json_escaped(cstr str, const char* pSrc, size_t srcLen)
+    Appends `pSrc` to `str` with the characters that are not allowed in a JSON string escaped. `srcLen` can be (size_t)-1 if `pSrc` is null terminated.
+    `pSrc` can point into `str`. Returns NULL if an error occurs, otherwise the returned string should replace the input string.
 
-            if (cap < otherLen) {
-                cap = otherLen;
-                str = cstr8_realloc(str, cap);
-                if (str == NULL) {
-                    return NULL;    /* Out of memory. Return NULL. The caller can worry about memory management if it's important to them. */
-                }
-            }
+errno_t utf8_json_unescape(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
+    Unescapes the content of a JSON string, not including the quotes. `pDst` can be NULL to only measure the output, and can be the same as `pSrc`. The output
+    is null terminated if there is room for it. Returns ENOMEM if `dstCap` is too small and EINVAL if there is an invalid escape.
 
-            CSTR_COPY_MEMORY(str, pOther, otherLen);
-        } else {
-            /* str and pOther are the same string. No need for a data copy, but we do need to set the length (calculated at the top if pOther is null terminated). */
-        }
-        
-        str[otherLen] = '\0';
-        cstr8_set_len(str, otherLen);
 
-        return str;
-    }
-}
+HTML and XML
+------------
+`cstr_cat_html_escaped()` replaces `&`, `<`, `>`, `"` and `'` with `&amp;`, `&lt;`, `&gt;`, `&quot;` and `&#39;`. The result is safe to use in both element
+content and quoted attribute values, in HTML and XML. Use this instead of a chain of `cstr_replace_all()` calls, which builds a new string for every match.
 
-CSTR_API cstr8 cstr8_set(cstr8 str, const char* pOther)
-{
-    if (pOther == NULL) {
-        pOther = "";
-    }
+`utf8_xml_unescape()` decodes the five entities predefined by XML, `&amp;`, `&lt;`, `&gt;`, `&quot;` and `&apos;`, and numeric character references in
+decimal, `&#233;`, or hex, `&#xE9;`, which are output as UTF-8. Other named entities, such as the many extra ones defined by HTML, are not supported. A
+numeric reference to a surrogate or a value above the Unicode range is replaced with CSTR_UNICODE_REPLACEMENT_CODE_POINT, or CSTR_ECODEPOINT is returned if
+CSTR_ERROR_ON_INVALID_CODE_POINT is set.
 
-    return cstr8_setn(str, pOther, utf8_strlen(pOther));
-}
 
+API Reference
+-------------
+cstr cstr_cat_html_escaped(cstr str, const char* pSrc, size_t srcLen)
+    Appends `pSrc` to `str` with the characters that are special in HTML and XML replaced with entities. `srcLen` can be (size_t)-1 if `pSrc` is null
+    terminated. `pSrc` can point into `str`. Returns NULL if an error occurs, otherwise the returned string should replace the input string.
 
-CSTR_API cstr8 cstr8_catn(cstr8 str, const char* pOther, size_t otherLen)
-{
-    if (pOther == NULL) {
-        return str;
-    }
+errno_t utf8_xml_unescape(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
+    Decodes the entities and character references in `pSrc`. `pDst` can be NULL to only measure the output, and can be the same as `pSrc`. The output is null
+    terminated if there is room for it. Returns ENOMEM if `dstCap` is too small and EINVAL if there is an `&` that doesn't start a supported entity.
 
-    if (str == NULL) {
-        return cstr8_newn(pOther, otherLen);
-    } else {
-        size_t cap = cstr8_get_cap(str);
-        size_t len = cstr8_get_len(str);
 
-        if (otherLen == (size_t)-1) {
-            otherLen = utf8_strlen(pOther);
-        }
+URLs
+----
+`cstr_cat_url_encoded()` percent-encodes every byte that isn't allowed in a given component of a URI as defined by RFC 3986. The unreserved characters,
+`A-Z a-z 0-9 - . _ ~`, are never encoded. Each component allows some extra characters on top of those:
 
-        if (cap < len + otherLen) {
-            cap = len + otherLen;
-            str = cstr8_realloc(str, cap);
-            if (str == NULL) {
-                return NULL;
-            }
-        }
+    CSTR_URL_COMPONENT_UNRESERVED
+        Nothing extra. Use this for the keys and values of a query string, or whenever the output must not contain any delimiters.
 
-        CSTR_COPY_MEMORY(str + len, pOther, otherLen);
-        str[len + otherLen] = '\0';
+    CSTR_URL_COMPONENT_PATH_SEGMENT
+        A single segment of a path. `! $ & ' ( ) * + , ; = : @` are allowed.
 
-        cstr8_set_len(str, len + otherLen);
+    CSTR_URL_COMPONENT_PATH
+        The same as a path segment, plus `/`.
 
-        return str;
-    }
-}
+    CSTR_URL_COMPONENT_QUERY
+    CSTR_URL_COMPONENT_FRAGMENT
+        The same as a path, plus `?`.
 
-CSTR_API cstr8 cstr8_cat(cstr8 str, const char* pOther)
-{
-    if (pOther == NULL) {
-        return str;
-    }
+Use `cstr_cat_url_encoded_ex()` to specify your own set of extra characters. The CSTR_URL_SPACE_AS_PLUS flag outputs spaces as `+` instead of `%20`, as
+used by HTML forms. It can be combined with any component, though `+` itself is then encoded.
 
-    return cstr8_catn(str, pOther, utf8_strlen(pOther));
-}
+`utf8_url_decode()` decodes percent-encoded bytes. With CSTR_URL_SPACE_AS_PLUS it also decodes `+` to a space. The decoded bytes are output as they are, so
+call `utf8_is_valid()` on the result if it needs to be valid UTF-8.
 
-CSTR_API cstr8 cstr8_catv(cstr8 str, const char* pFormat, va_list args)
-{
-    va_list args2;
-    size_t  len;
-    char*   formatted;
-    cstr8   newstr;
 
-    if (pFormat == NULL) {
-        return NULL;
-    }
+API Reference
+-------------
+cstr cstr_cat_url_encoded(cstr str, const char* pSrc, size_t srcLen, cstr_uint32 component)
+    Appends `pSrc` to `str` with the bytes that aren't allowed in `component` percent-encoded. `component` is one of the components above and can be combined
+    with CSTR_URL_SPACE_AS_PLUS. `srcLen` can be (size_t)-1 if `pSrc` is null terminated. `pSrc` can point into `str`. Returns NULL if an error occurs,
+    otherwise the returned string should replace the input string.
 
-#if !defined(_MSC_VER) || _MSC_VER >= 1800
-    va_copy(args2, args);
-#else
-    args2 = args;
-#endif
+cstr cstr_cat_url_encoded_ex(cstr str, const char* pSrc, size_t srcLen, const char* pSafe, cstr_uint32 flags)
+    The same as `cstr_cat_url_encoded()`, except the bytes in the null terminated string `pSafe` are not encoded in addition to the unreserved characters.
+    `pSafe` can be NULL. `%` is always encoded.
 
-    len = cstr8_vsprintf(NULL, pFormat, args2);
-    if (len < 0) {
-        return NULL;
-    }
+errno_t utf8_url_decode(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
+    Decodes percent-encoded bytes. `flags` can be 0 or CSTR_URL_SPACE_AS_PLUS. `pDst` can be NULL to only measure the output, and can be the same as `pSrc` to
+    decode in place. The output is null terminated if there is room for it. Returns ENOMEM if `dstCap` is too small and EINVAL if a `%` is not followed by
+    two hex digits.
 
-    formatted = (char*)CSTR_MALLOC(len + 1);
-    if (formatted == NULL) {
-        return NULL;    /* Out of memory. */
-    }
 
-    cstr8_vsprintf(formatted, pFormat, args);
+Base64 and Hex
+--------------
+`cstr_cat_base64()` and `cstr_cat_hex()` encode binary data. The length of the output is calculated up front so the string is resized once and the output is
+written directly into it. Base64 uses the standard alphabet from RFC 4648, or the URL and filename safe alphabet with CSTR_BASE64_URL. Hex encoding uses SSE2
+where available to convert 16 bytes at a time. Base64 is encoded and decoded one group of 3 bytes or 4 characters at a time through lookup tables.
 
-    newstr = cstr8_catn(str, formatted, len);
-    CSTR_FREE(formatted);
+The decoding functions are strict by default. Any character outside of the alphabet is an error, as are leftover bits that aren't zero, which means there is
+only one valid encoding of any given data. Padding is optional when decoding base64, but if it's there it must be correct. Set the
+CSTR_DECODE_IGNORE_WHITESPACE flag to skip over spaces, tabs and new lines, such as in base64 that has been wrapped at 76 characters.
 
-    if (newstr == NULL) {
-        return NULL;
-    }
+    ```c
+    cstr encoded = cstr_cat_base64(NULL, pData, dataSize, 0);
 
-    va_end(args2);
-    return newstr;
-}
+    size_t decodedSize;
+    utf8_base64_decode(NULL, 0, &decodedSize, encoded, cstr_len(encoded), 0);    // Measure.
+    ```
 
-CSTR_API cstr8 cstr8_catf(cstr8 str, const char* pFormat, ...)
-{
-    va_list args;
 
-    if (pFormat == NULL) {
-        return NULL;
-    }
+cstr_uint32 flags for base64 and hex:
 
-    va_start(args, pFormat);
-    str = cstr8_catv(str, pFormat, args);
-    va_end(args);
+    CSTR_BASE64_URL
+        Use `-` and `_` instead of `+` and `/`.
 
-    return str;
-}
+    CSTR_BASE64_NO_PADDING
+        Don't output padding when encoding.
 
+    CSTR_HEX_UPPERCASE
+        Output `A-F` instead of `a-f` when encoding. Both are always accepted when decoding.
 
+    CSTR_DECODE_IGNORE_WHITESPACE
+        Skip over whitespace when decoding instead of returning an error.
 
-CSTR_API size_t cstr8_len(cstr8 str)
-{
-    if (str == NULL) {
-        return 0;
-    }
 
-    return cstr8_get_len(str);
-}
+API Reference
+-------------
+cstr cstr_cat_base64(cstr str, const void* pData, size_t dataSize, cstr_uint32 flags)
+cstr cstr_cat_hex(cstr str, const void* pData, size_t dataSize, cstr_uint32 flags)
+    Appends the base64 or hex encoding of `pData` to `str`. `pData` can point into `str`. Returns NULL if an error occurs, otherwise the returned string should
+    replace the input string.
 
-CSTR_API size_t cstr8_cap(cstr8 str)
-{
-    if (str == NULL) {
-        return 0;
-    }
+errno_t utf8_base64_decode(void* pDst, size_t dstCap, size_t* pDstSize, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
+errno_t utf8_hex_decode(void* pDst, size_t dstCap, size_t* pDstSize, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
+    Decodes base64 or hex. `srcLen` can be (size_t)-1 if `pSrc` is null terminated. `pDst` can be NULL to only measure the output, and can be the same as
+    `pSrc` to decode in place. The output is binary and is not null terminated. Returns ENOMEM if `dstCap` is too small and EINVAL if the input is invalid.
 
-    return cstr8_get_cap(str);
-}
+**************************************************************************************************************************************************************/
+#ifndef CSTR_NO_UTF8
+CSTR_API cstr8 cstr8_cat_json_escaped(cstr8 str, const char* pSrc, size_t srcLen);
+CSTR_API errno_t utf8_json_unescape(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags);
+CSTR_API cstr8 cstr8_cat_html_escaped(cstr8 str, const char* pSrc, size_t srcLen);
+CSTR_API errno_t utf8_xml_unescape(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags);
+
+#define CSTR_URL_COMPONENT_UNRESERVED       0
+#define CSTR_URL_COMPONENT_PATH_SEGMENT     1
+#define CSTR_URL_COMPONENT_PATH             2
+#define CSTR_URL_COMPONENT_QUERY            3
+#define CSTR_URL_COMPONENT_FRAGMENT         4
+#define CSTR_URL_COMPONENT_MASK             0xFF
+#define CSTR_URL_SPACE_AS_PLUS              (1 << 8)
+
+CSTR_API cstr8 cstr8_cat_url_encoded(cstr8 str, const char* pSrc, size_t srcLen, cstr_uint32 component);
+CSTR_API cstr8 cstr8_cat_url_encoded_ex(cstr8 str, const char* pSrc, size_t srcLen, const char* pSafe, cstr_uint32 flags);
+CSTR_API errno_t utf8_url_decode(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags);
+
+#define CSTR_BASE64_URL                     (1 << 0)
+#define CSTR_BASE64_NO_PADDING              (1 << 1)
+#define CSTR_HEX_UPPERCASE                  (1 << 2)
+#define CSTR_DECODE_IGNORE_WHITESPACE       (1 << 3)
+
+CSTR_API cstr8 cstr8_cat_base64(cstr8 str, const void* pData, size_t dataSize, cstr_uint32 flags);
+CSTR_API errno_t utf8_base64_decode(void* pDst, size_t dstCap, size_t* pDstSize, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags);
+CSTR_API cstr8 cstr8_cat_hex(cstr8 str, const void* pData, size_t dataSize, cstr_uint32 flags);
+CSTR_API errno_t utf8_hex_decode(void* pDst, size_t dstCap, size_t* pDstSize, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags);
+
+#define cstr_cat_json_escaped       cstr8_cat_json_escaped
+#define cstr_cat_html_escaped       cstr8_cat_html_escaped
+#define cstr_cat_url_encoded        cstr8_cat_url_encoded
+#define cstr_cat_url_encoded_ex     cstr8_cat_url_encoded_ex
+#define cstr_cat_base64             cstr8_cat_base64
+#define cstr_cat_hex                cstr8_cat_hex
+#endif
 
 
-CSTR_API size_t cstr8_find(const char* str, const char* other)
-{
-    return cstr8_findn(str, (size_t)-1, other, (size_t)-1);
+#ifdef __cplusplus
 }
+#endif
+#endif  /* libcstr_h */
 
-CSTR_API size_t cstr8_findn(const char* str, size_t strLen, const char* other, size_t otherLen)
-{
-    size_t strOff;
-
-    if (str == NULL || other == NULL) {
-        return cstr_npos;
-    }
 
-    if (strLen == (size_t)-1) {
-        strLen = utf8_strlen(str);
-    }
+/************************************************************************************************************************************************************
+*************************************************************************************************************************************************************
 
-    if (otherLen == (size_t)-1) {
-        otherLen = utf8_strlen(other);
-    }
+IMPLEMENTATION
 
-    if (strLen == 0 || otherLen == 0) {
-        return cstr_npos;
-    }
+*************************************************************************************************************************************************************
+************************************************************************************************************************************************************/
+#if defined(LIBCSTR_IMPLEMENTATION)
+#ifndef libcstr_c
+#define libcstr_c
 
-    strOff = 0;
-    while ((strLen - strOff) >= otherLen) {
-        cstr_bool32 found = CSTR_TRUE;
-        size_t i;
-        for (i = 0; i < otherLen; i += 1) {
-            if (str[strOff + i] != other[i]) {
-                found = CSTR_FALSE;
-                break;
-            }
-        }
+/* CPU Architecture */
+#if defined(__x86_64__) || defined(_M_X64)
+    #define CSTR_X64
+#elif defined(__i386) || defined(_M_IX86)
+    #define CSTR_X86
+#elif defined(__arm__) || defined(_M_ARM)
+    #define CSTR_ARM
+#endif
 
-        if (found) {
-            return strOff;
-        }
+/* Platform */
+#if defined(_WIN32)
+    #define CSTR_WIN32
+#elif defined(__unix__) || defined(__unix) || defined(__APPLE__)
+    #define CSTR_POSIX
+#endif
 
-        strOff += 1;
-    }
+/* SSE2 is always available on x64. On 32-bit x86 it needs to have been enabled in the compiler. Define CSTR_NO_SSE2 to use the portable code paths instead. */
+#if !defined(CSTR_NO_SSE2)
+    #if defined(CSTR_X64) || (defined(CSTR_X86) && (defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)))
+        #define CSTR_SUPPORT_SSE2
+    #endif
+#endif
 
-    /* Getting here means we didn't find the other string at all. */
-    return cstr_npos;
-}
+/* Memory mapped files are used by the key/value document loader. Define CSTR_NO_MMAP to always read files into a heap allocated buffer instead. */
+#if !defined(CSTR_NO_MMAP) && (defined(CSTR_WIN32) || defined(CSTR_POSIX))
+    #define CSTR_HAS_MMAP
+#endif
 
-CSTR_API size_t cstr8_find_last(const char* str, const char* other)
-{
-    return cstr8_findn_last(str, (size_t)-1, other, (size_t)-1);
-}
+#if defined(_MSC_VER) && _MSC_VER >= 1300
+    #define CSTR_HAS_BYTESWAP16_INTRINSIC
+    #define CSTR_HAS_BYTESWAP32_INTRINSIC
+    #define CSTR_HAS_BYTESWAP64_INTRINSIC
+#elif defined(__clang__)
+    #if __has_builtin(__builtin_bswap16)
+        #define CSTR_HAS_BYTESWAP16_INTRINSIC
+    #endif
+    #if __has_builtin(__builtin_bswap32)
+        #define CSTR_HAS_BYTESWAP32_INTRINSIC
+    #endif
+    #if __has_builtin(__builtin_bswap64)
+        #define CSTR_HAS_BYTESWAP64_INTRINSIC
+    #endif
+#elif defined(__GNUC__)
+    #if ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 3))
+        #define CSTR_HAS_BYTESWAP32_INTRINSIC
+        #define CSTR_HAS_BYTESWAP64_INTRINSIC
+    #endif
+    #if ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+        #define CSTR_HAS_BYTESWAP16_INTRINSIC
+    #endif
+#endif
 
-CSTR_API size_t cstr8_findn_last(const char* str, size_t strLen, const char* other, size_t otherLen)
-{
-    size_t last = cstr_npos;
-    size_t runningOffset = 0;
+#include <stdio.h>  /* For sprintf() */
 
-    if (str == NULL || other == NULL) {
-        return cstr_npos;
-    }
+#if defined(CSTR_SUPPORT_SSE2)
+    #include <emmintrin.h>
+#endif
 
-    if (strLen == (size_t)-1) {
-        strLen = utf8_strlen(str);
-    }
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+    #include <intrin.h> /* For _umul128() and _BitScanForward() */
+#endif
 
-    if (otherLen == (size_t)-1) {
-        otherLen = utf8_strlen(other);
-    }
+/*
+Vectorized loops over null terminated strings load whole blocks which can read past the null terminator. A block is never loaded if it would cross a page
+boundary so this can't fault, but tools like address sanitizer will report it. Define CSTR_NO_OVERREAD to use loops that stop at the terminator instead. This
+is done automatically when compiling with address sanitizer. Functions that are given a length never read past it regardless of this option.
+*/
+#if !defined(CSTR_NO_OVERREAD)
+    #if defined(__SANITIZE_ADDRESS__)
+        #define CSTR_NO_OVERREAD
+    #elif defined(__has_feature)
+        #if __has_feature(address_sanitizer)
+            #define CSTR_NO_OVERREAD
+        #endif
+    #endif
+#endif
 
-    if (strLen == 0 || otherLen == 0) {
-        return cstr_npos;
-    }
+#if defined(CSTR_WIN32)
+    #include <windows.h>
+#elif defined(CSTR_POSIX)
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #if defined(CSTR_HAS_MMAP)
+        #include <sys/mman.h>
+    #endif
+#endif
 
-    for (;;) {
-        size_t next = cstr8_findn(str + runningOffset, strLen - runningOffset, other, otherLen);
-        if (next == cstr_npos) {
-            break;  /* Didn't find any new occurances. */
-        }
+#if !defined(CSTR_MALLOC) || !defined(CSTR_CALLOC) || !defined(CSTR_REALLOC) || !defined(CSTR_FREE)
+#include <stdlib.h> /* For malloc(), calloc(), realloc(), free() */
+#endif
+#ifndef CSTR_MALLOC
+#define CSTR_MALLOC(sz) malloc((sz))
+#endif
+#ifndef CSTR_CALLOC
+#define CSTR_CALLOC(sz) calloc((sz), 1)
+#endif
+#ifndef CSTR_REALLOC
+#define CSTR_REALLOC(p, sz) realloc((p), (sz))
+#endif
+#ifndef CSTR_FREE
+#define CSTR_FREE(p) free((p))
+#endif
 
-        last = runningOffset + next;
+#ifndef CSTR_ASSERT
+#include <assert.h>
+#define CSTR_ASSERT(condition) assert(condition);
+#endif
 
-        runningOffset += next + otherLen;
-    }
+#ifndef CSTR_COPY_MEMORY
+#include <string.h> /* For memcpy() */
+#define CSTR_COPY_MEMORY(dst, src, sz)  memcpy((dst), (src), (sz))
+#endif
+#ifndef CSTR_MOVE_MEMORY
+#include <string.h> /* For memmove() */
+#define CSTR_MOVE_MEMORY(dst, src, sz)  memmove((dst), (src), (sz))
+#endif
+#ifndef CSTR_COMPARE_MEMORY
+#include <string.h> /* For memcmp() */
+#define CSTR_COMPARE_MEMORY(a, b, sz)   memcmp((a), (b), (sz))
+#endif
+#ifndef CSTR_ZERO_MEMORY
+#include <string.h> /* For memset() */
+#define CSTR_ZERO_MEMORY(dst, sz)       memset((dst), 0, (sz))
+#endif
+#define CSTR_ZERO_OBJECT(dst)           CSTR_ZERO_MEMORY((dst), sizeof(*(dst)))
 
-    return last;
-}
+#define CSTR_COUNTOF(p)                 (sizeof(p) / sizeof((p)[0]))
 
+/* 64-bit constants are built from two halves because not all compilers we support accept 64-bit integer literals. */
+#define CSTR_UINT64(hi, lo)             ((((cstr_uint64)(hi)) << 32) | (cstr_uint64)(lo))
 
-CSTR_API const char* cstr8_substr_tagged(const char* str, const char* pTagBeg, const char* pTagEnd, size_t* pLen)
+/* The prefixed data of a dynamic string. The refcount is first so that it's at a fixed offset regardless of the size of size_t. */
+typedef struct
 {
-    size_t offsetBeg;
-    size_t offsetEnd;
-
-    if (pLen != NULL) {
-        *pLen = 0;
-    }
+    volatile cstr_uint32 refcount;
+    cstr_uint32 flags;              /* CSTR8_FLAG_*. Describes information about the content that has been cached. Cleared whenever the content changes. */
+#if !defined(CSTR_NO_HASH_CACHE)
+    cstr_uint64 hash;               /* Only valid when CSTR8_FLAG_HASH_VALID is set. */
+#endif
+    size_t cap;
+    size_t len;
+} cstr8_header;
 
-    if (pTagBeg == NULL || pTagBeg[0] == '\0') {
-        offsetBeg = 0;
-    } else {
-        offsetBeg = cstr8_find(str, pTagBeg);
-        if (offsetBeg == cstr_npos) {
-            return NULL; /* Could not find the begin tag in the other string. */
-        }
-    }
+#define CSTR8_FLAG_HASH_VALID           0x00000001
+#define CSTR8_FLAG_ASCII_KNOWN          0x00000002  /* Set when CSTR8_FLAG_ASCII is meaningful. */
+#define CSTR8_FLAG_ASCII                0x00000004
+#define CSTR8_FLAG_UTF8_KNOWN           0x00000008  /* Set when CSTR8_FLAG_UTF8 is meaningful. */
+#define CSTR8_FLAG_UTF8                 0x00000010  /* The content is valid UTF-8. */
 
-    if (pTagEnd == NULL || pTagEnd[0] == '\0') {
-        offsetEnd = utf8_strlen(str);
-    } else {
-        offsetEnd = cstr8_find(str + offsetBeg + utf8_strlen(pTagBeg), pTagEnd);
-        if (offsetEnd == cstr_npos) {
-            return NULL; /* Could not find the end tag in the other string. */
-        } else {
-            offsetEnd += offsetBeg + utf8_strlen(pTagBeg) + utf8_strlen(pTagEnd);
-        }
-    }
+#define CSTR_HEADER_SIZE_IN_BYTES       sizeof(cstr8_header)
 
-    if (pLen != NULL) {
-        *pLen = (offsetEnd - offsetBeg);
-    }
 
-    return str + offsetBeg;
+static CSTR_INLINE cstr_bool32 cstr_is_little_endian()
+{
+#if defined(CSTR_X86) || defined(CSTR_X64)
+    return CSTR_TRUE;
+#elif defined(__BYTE_ORDER) && defined(__LITTLE_ENDIAN) && __BYTE_ORDER == __LITTLE_ENDIAN
+    return CSTR_TRUE;
+#else
+    int n = 1;
+    return (*(char*)&n) == 1;
+#endif
 }
 
-CSTR_API cstr8 cstr8_new_substr_tagged(const char* str, const char* pTagBeg, const char* pTagEnd)
+static CSTR_INLINE cstr_bool32 cstr_is_big_endian()
 {
-    size_t len;
-    str = cstr8_substr_tagged(str, pTagBeg, pTagEnd, &len);
-    if (str == NULL) {
-        return NULL;
-    }
+    return !cstr_is_little_endian();
+}
 
-    return cstr8_newn(str, len);
+static CSTR_INLINE cstr_uint16 cstr_swap_endian_uint16(cstr_uint16 n)
+{
+#ifdef CSTR_HAS_BYTESWAP16_INTRINSIC
+    #if defined(_MSC_VER)
+        return _byteswap_ushort(n);
+    #elif defined(__GNUC__) || defined(__clang__)
+        return __builtin_bswap16(n);
+    #else
+        #error "This compiler does not support the byte swap intrinsic."
+    #endif
+#else
+    return ((n & 0xFF00) >> 8) |
+           ((n & 0x00FF) << 8);
+#endif
 }
 
-static cstr8 cstr8_replace_range_ex(cstr8 str, size_t replaceOffset, size_t replaceLen, const char* pOther, size_t otherLen, const char* pOtherPrepend, const char* pOtherAppend)
+static CSTR_INLINE cstr_uint32 cstr_swap_endian_uint32(cstr_uint32 n)
 {
-    cstr8 newStr;
+#ifdef CSTR_HAS_BYTESWAP32_INTRINSIC
+    #if defined(_MSC_VER)
+        return _byteswap_ulong(n);
+    #elif defined(__GNUC__) || defined(__clang__)
+        return __builtin_bswap32(n);
+    #else
+        #error "This compiler does not support the byte swap intrinsic."
+    #endif
+#else
+    return ((n & 0xFF000000) >> 24) |
+           ((n & 0x00FF0000) >>  8) |
+           ((n & 0x0000FF00) <<  8) |
+           ((n & 0x000000FF) << 24);
+#endif
+}
 
-    if (str == NULL || replaceOffset + replaceLen > cstr8_len(str)) {
-        return str;
-    }
+static CSTR_INLINE cstr_uint64 cstr_swap_endian_uint64(cstr_uint64 n)
+{
+#ifdef CSTR_HAS_BYTESWAP64_INTRINSIC
+    #if defined(_MSC_VER)
+        return _byteswap_uint64(n);
+    #elif defined(__GNUC__) || defined(__clang__)
+        return __builtin_bswap64(n);
+    #else
+        #error "This compiler does not support the byte swap intrinsic."
+    #endif
+#else
+    return ((cstr_uint64)cstr_swap_endian_uint32((cstr_uint32)n) << 32) | (cstr_uint64)cstr_swap_endian_uint32((cstr_uint32)(n >> 32));
+#endif
+}
 
-    if (replaceLen == 0) {
-        return str; /* Nothing to replace. */
-    }
 
-    /* We can allow pOther to be NULL in which case it can be the same as a remove. */
-    if (pOther == NULL) {
-        pOther = "";
+/* The input must not be zero. */
+static CSTR_INLINE cstr_uint32 cstr_ctz32(cstr_uint32 n)
+{
+#if defined(_MSC_VER) && _MSC_VER >= 1400
+    unsigned long index;
+    _BitScanForward(&index, n);
+    return (cstr_uint32)index;
+#elif defined(__GNUC__) || defined(__clang__)
+    return (cstr_uint32)__builtin_ctz(n);
+#else
+    cstr_uint32 count = 0;
+    while ((n & 1) == 0) {
+        n >>= 1;
+        count += 1;
     }
+    return count;
+#endif
+}
 
-    if (otherLen == (size_t)-1) {
-        otherLen = utf8_strlen(pOther);
+static CSTR_INLINE cstr_uint32 cstr_ctz64(cstr_uint64 n)
+{
+    if ((cstr_uint32)n != 0) {
+        return cstr_ctz32((cstr_uint32)n);
+    } else {
+        return cstr_ctz32((cstr_uint32)(n >> 32)) + 32;
     }
+}
 
-    
-    /* The string is split into 3 sections: the part before the replace, the replacement itself, and the part after the replacement. */
+static CSTR_INLINE cstr_uint32 cstr_popcount64(cstr_uint64 n)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (cstr_uint32)__builtin_popcountll(n);
+#else
+    n = n - ((n >> 1) & CSTR_UINT64(0x55555555, 0x55555555));
+    n = (n & CSTR_UINT64(0x33333333, 0x33333333)) + ((n >> 2) & CSTR_UINT64(0x33333333, 0x33333333));
+    n = (n + (n >> 4)) & CSTR_UINT64(0x0F0F0F0F, 0x0F0F0F0F);
+    return (cstr_uint32)((n * CSTR_UINT64(0x01010101, 0x01010101)) >> 56);
+#endif
+}
 
-    /* Pre-replacement. */
-    newStr = cstr8_newn(str, replaceOffset);
 
-    /* Replacement. */
-    if (pOtherPrepend != NULL) { newStr = cstr8_cat(newStr, pOtherPrepend); }
-    newStr = cstr8_catn(newStr, pOther, otherLen);
-    if (pOtherAppend  != NULL) { newStr = cstr8_cat(newStr, pOtherAppend ); }
+static CSTR_INLINE cstr_uint16 cstr_be2host_16(cstr_uint16 n)
+{
+    if (cstr_is_little_endian()) {
+        return cstr_swap_endian_uint16(n);
+    }
 
-    /* Post-replacement. */
-    newStr = cstr8_catn(newStr, str + (replaceOffset + replaceLen), cstr8_len(str) - (replaceOffset + replaceLen));
+    return n;
+}
 
-    if (newStr == NULL) {
-        return NULL;
+static CSTR_INLINE cstr_uint32 cstr_be2host_32(cstr_uint32 n)
+{
+    if (cstr_is_little_endian()) {
+        return cstr_swap_endian_uint32(n);
     }
 
-    /* We're done. Only free the old string if we actually have a new string. */
-    cstr8_free(str);
-    return newStr;
+    return n;
 }
 
-CSTR_API cstr8 cstr8_replace_range(cstr8 str, size_t replaceOffset, size_t replaceLength, const char* pOther, size_t otherLength)
+static CSTR_INLINE cstr_uint64 cstr_be2host_64(cstr_uint64 n)
 {
-    return cstr8_replace_range_ex(str, replaceOffset, replaceLength, pOther, otherLength, NULL, NULL);
+    if (cstr_is_little_endian()) {
+        return cstr_swap_endian_uint64(n);
+    }
+
+    return n;
 }
 
-CSTR_API cstr8 cstr8_replace_range_tagged(cstr8 str, const char* pTagBeg, const char* pTagEnd, const char* pOther, const char* pOtherTagBeg, const char* pOtherTagEnd, cstr_bool32 keepTagsOnSeparateLines)
+static CSTR_INLINE cstr_uint16 cstr_le2host_16(cstr_uint16 n)
 {
-    size_t strOffsetBeg;
-    size_t strOffsetEnd;
-    size_t otherSubstrLen;
-    const char* pOtherSubstr;
-    const char* pOtherNewLines = NULL;
+    if (!cstr_is_little_endian()) {
+        return cstr_swap_endian_uint16(n);
+    }
 
-    if (str == NULL || pOther == NULL) {
-        return str;
+    return n;
+}
+
+static CSTR_INLINE cstr_uint32 cstr_le2host_32(cstr_uint32 n)
+{
+    if (!cstr_is_little_endian()) {
+        return cstr_swap_endian_uint32(n);
     }
 
-    if (pTagBeg == NULL || pTagBeg[0] == '\0') {
-        strOffsetBeg = 0;
-    } else {
-        strOffsetBeg = cstr8_find(str, pTagBeg);
-        if (strOffsetBeg == cstr_npos) {
-            return str; /* Could not find begin tag. */
-        } else {
-            strOffsetBeg += utf8_strlen(pTagBeg);   /* Don't want to replace the tag itself. */
-        }
-    }
+    return n;
+}
 
-    if (pTagEnd == NULL || pTagEnd[0] == '\0') {
-        strOffsetEnd = cstr8_len(str);
-    } else {
-        strOffsetEnd = cstr8_find(str + strOffsetBeg, pTagEnd);
-        if (strOffsetEnd == cstr_npos) {
-            return str; /* Could not find end tag. */
-        } else {
-            strOffsetEnd += strOffsetBeg;   /* When we searched for the string we started from the end of the beginning tag. Need to normalize the end offset. */
-        }
-    }
 
-    pOtherSubstr = cstr8_substr_tagged(pOther, pOtherTagBeg, pOtherTagEnd, &otherSubstrLen);
-    if (pOtherSubstr == NULL) {
-        return str; /* Failed to retrieve the substring of the other string. */
+static CSTR_INLINE cstr_uint16 cstr_host2be_16(cstr_uint16 n)
+{
+    if (cstr_is_little_endian()) {
+        return cstr_swap_endian_uint16(n);
     }
 
-    if (keepTagsOnSeparateLines) {
-        pOtherNewLines = "\n";
+    return n;
+}
+
+static CSTR_INLINE cstr_uint32 cstr_host2be_32(cstr_uint32 n)
+{
+    if (cstr_is_little_endian()) {
+        return cstr_swap_endian_uint32(n);
     }
 
-    return cstr8_replace_range_ex(str, strOffsetBeg, strOffsetEnd - strOffsetBeg, pOtherSubstr, otherSubstrLen, pOtherNewLines, pOtherNewLines);
+    return n;
 }
 
-CSTR_API cstr8 cstr8_replace_all(cstr8 str, const char* pQuery, size_t queryLen, const char* pReplacement, size_t replacementLen)
+static CSTR_INLINE cstr_uint16 cstr_host2le_16(cstr_uint16 n)
 {
-    size_t offset = 0;
-
-    if (str == NULL || pQuery == NULL || pReplacement == NULL) {
-        return str;
+    if (!cstr_is_little_endian()) {
+        return cstr_swap_endian_uint16(n);
     }
 
-    if (queryLen == (size_t)-1) {
-        queryLen = utf8_strlen(pQuery);
-    }
+    return n;
+}
 
-    if (replacementLen == (size_t)-1) {
-        replacementLen = utf8_strlen(pReplacement);
+static CSTR_INLINE cstr_uint32 cstr_host2le_32(cstr_uint32 n)
+{
+    if (!cstr_is_little_endian()) {
+        return cstr_swap_endian_uint32(n);
     }
 
-    /* We keep looping until there's no more occurrances. */
-    for (;;) {
-        size_t location;
+    return n;
+}
 
-        location = cstr8_findn(str + offset, cstr8_len(str) - offset, pQuery, queryLen);
-        if (location == cstr_npos) {
-            break;  /* We're done */
-        }
 
-        /* Getting here means we found one. We just need to replace a range. */
-        str = cstr8_replace_range(str, offset + location, queryLen, pReplacement, replacementLen);
-        if (str == NULL) {
-            return NULL;    /* Out of memory. */
-        }
+CSTR_API size_t utf8_strlen(const cstr_utf8* src)
+{
+    const cstr_utf8* end;
 
-        offset += location + replacementLen;   /* Progress past the replacement. */
+    CSTR_ASSERT(src != NULL);
+    
+    end = src;
+    while (end[0] != '\0') {
+        end += 1;
     }
 
-    return str;
+    return end - src;
 }
 
-CSTR_API cstr8 cstr8_new_trim(const char* pOther)
+CSTR_API cstr_utf8* utf8_strcpy(cstr_utf8* dst, const cstr_utf8* src)
 {
-    if (pOther == NULL) {
-        return NULL;
-    }
+    char* dstorig;
 
-    return cstr8_newn_trim(pOther, (size_t)-1);
-}
+    CSTR_ASSERT(dst != NULL);
+    CSTR_ASSERT(src != NULL);
 
-CSTR_API cstr8 cstr8_newn_trim(const char* pOther, size_t otherLen)
-{
-    size_t loff;
-    size_t roff;
+    dstorig = dst;
 
-    if (pOther == NULL) {
-        return NULL;
-    }
+    /* No, we're not using this garbage: while (*dst++ = *src++); */
+    for (;;) {
+        *dst = *src;
+        if (*src == '\0') {
+            break;
+        }
 
-    loff = utf8_ltrim_offset(pOther, otherLen);
-    roff = utf8_rtrim_offset(pOther, otherLen);
+        dst += 1;
+        src += 1;
+    }
 
-    return cstr_newn(pOther + loff, roff - loff);
+    return dstorig;
 }
 
-CSTR_API cstr8 cstr8_trim(cstr8 str)
+CSTR_API int utf8_strcpy_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src)
 {
-    size_t loff;
-    size_t roff;
+    size_t i;
 
-    /* The length of the string will never expand which simplifies our memory management. */
-    loff = utf8_ltrim_offset(str, cstr8_len(str));
-    roff = utf8_rtrim_offset(str, cstr8_len(str));
+    if (dst == 0) {
+        return EINVAL;
+    }
+    if (dstCap == 0) {
+        return ERANGE;
+    }
+    if (src == 0) {
+        dst[0] = '\0';
+        return EINVAL;
+    }
 
-    CSTR_MOVE_MEMORY(str, str + loff, (roff - loff));   /* Left trim by moving the string down). */
-    cstr8_set_len(str, roff - loff);                    /* Set the length before the right trim. */
-    str[cstr8_get_len(str)] = '\0';                     /* Right trim by setting the null terminator. */
+    for (i = 0; i < dstCap && src[i] != '\0'; ++i) {
+        dst[i] = src[i];
+    }
 
-    return str;
+    if (i < dstCap) {
+        dst[i] = '\0';
+        return 0;
+    }
+
+    dst[0] = '\0';
+    return ERANGE;
 }
 
-CSTR_API cstr8 cstr8_remove_at(cstr8 str, size_t index)
+CSTR_API int utf8_strncpy_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src, size_t count)
 {
-    if (str == NULL) {
-        return NULL;
-    }
+    size_t maxcount;
+    size_t i;
 
-    if (index >= cstr8_len(str)) {
-        return str; /* Out of bounds. */
+    if (dst == 0) {
+        return EINVAL;
+    }
+    if (dstCap == 0) {
+        return EINVAL;
+    }
+    if (src == 0) {
+        dst[0] = '\0';
+        return EINVAL;
     }
-    
-    CSTR_MOVE_MEMORY(str + index, str + index + 1, cstr8_len(str) - index); /* This will also move the null terminator. */
-    cstr8_set_len(str, cstr8_len(str) - 1);
-
-    return str;
-}
-#endif /* CSTR_NO_UTF8 */
 
+    maxcount = count;
+    if (count == ((size_t)-1) || count >= dstCap) {        /* -1 = _TRUNCATE */
+        maxcount = dstCap - 1;
+    }
 
-/**************************************************************************************************************************************************************
+    for (i = 0; i < maxcount && src[i] != '\0'; ++i) {
+        dst[i] = src[i];
+    }
 
-Unicode
+    if (src[i] == '\0' || i == count || count == ((size_t)-1)) {
+        dst[i] = '\0';
+        return 0;
+    }
 
-**************************************************************************************************************************************************************/
-static CSTR_INLINE cstr_bool32 cstr_is_invalid_utf8_octet(cstr_utf8 utf8)
-{
-    /* RFC 3629 - Section 1: The octet values C0, C1, F5 to FF never appear. */
-    return (cstr_uint8)utf8 == 0xC0 || (cstr_uint8)utf8 == 0xC1 || (cstr_uint8)utf8 >= 0xF5;
+    dst[0] = '\0';
+    return ERANGE;
 }
 
-static CSTR_INLINE void utf32_cp_to_utf16_pair(cstr_utf32 utf32cp, cstr_utf16* pUTF16)
+CSTR_API int utf8_strcat_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src)
 {
-    /* RFC 2781 - Section 2.1 */
-    cstr_utf32 u;
+    char* dstorig;
 
-    CSTR_ASSERT(utf32cp >= 0x10000);
+    if (dst == 0) {
+        return EINVAL;
+    }
+    if (dstCap == 0) {
+        return ERANGE;
+    }
+    if (src == 0) {
+        dst[0] = '\0';
+        return EINVAL;
+    }
 
-    u = utf32cp - 0x10000;
-    pUTF16[0] = (cstr_utf16)(0xD800 | ((u & 0xFFC00) >> 10));
-    pUTF16[1] = (cstr_utf16)(0xDC00 | ((u & 0x003FF) >>  0));
-}
+    dstorig = dst;
 
-static CSTR_INLINE cstr_utf32 utf16_pair_to_utf32_cp(const cstr_utf16* pUTF16)
-{
-    /* RFC 2781 - Section 2.1 */
-    CSTR_ASSERT(pUTF16 != NULL);
+    while (dstCap > 0 && dst[0] != '\0') {
+        dst    += 1;
+        dstCap -= 1;
+    }
 
-    return (((cstr_utf32)(pUTF16[0] & 0x003FF) << 10) | ((cstr_utf32)(pUTF16[1] & 0x003FF) << 0)) + 0x10000;
-}
+    if (dstCap == 0) {
+        return EINVAL;  /* Unterminated. */
+    }
 
-static CSTR_INLINE cstr_bool32 cstr_is_cp_in_surrogate_pair_range(cstr_utf32 utf32)
-{
-    return utf32 >= 0xD800 && utf32 <= 0xDFFF;
-}
+    while (dstCap > 0 && src[0] != '\0') {
+        *dst++ = *src++;
+        dstCap -= 1;
+    }
 
-static CSTR_INLINE cstr_bool32 cstr_is_valid_code_point(cstr_utf32 utf32)
-{
-    return utf32 <= CSTR_UNICODE_MAX_CODE_POINT && !cstr_is_cp_in_surrogate_pair_range(utf32);
+    if (dstCap > 0) {
+        dst[0] = '\0';
+    } else {
+        dstorig[0] = '\0';
+        return ERANGE;
+    }
+
+    return 0;
 }
 
-static CSTR_INLINE size_t utf32_cp_to_utf8_len(cstr_utf32 utf32)
+CSTR_API int utf8_strncat_s(cstr_utf8* dst, size_t dstCap, const cstr_utf8* src, size_t count)
 {
-    /* This API assumes the the UTF-32 code point is valid. */
-    CSTR_ASSERT(utf32 <= CSTR_UNICODE_MAX_CODE_POINT);
-    CSTR_ASSERT(cstr_is_cp_in_surrogate_pair_range(utf32) == CSTR_FALSE);
+    char* dstorig;
 
-    if (utf32 <= 0x7F) {
-        return 1;
-    }
-    if (utf32 <= 0x7FF) {
-        return 2;
+    if (dst == 0) {
+        return EINVAL;
     }
-    if (utf32 <= 0xFFFF) {
-        return 3;
+    if (dstCap == 0) {
+        return ERANGE;
     }
-    if (utf32 <= 0x10FFFF) {
-        return 4;
+    if (src == 0) {
+        return EINVAL;
     }
 
-    /* Invalid. This function assume's the UTF-32 code point is valid so do an assert. */
-    CSTR_ASSERT(CSTR_FALSE);
-    return 0; /* Invalid. */
-}
+    dstorig = dst;
 
-static CSTR_INLINE size_t utf32_cp_to_utf8(cstr_utf32 utf32, cstr_utf8* pUTF8, size_t utf8Cap)
-{
-    /* This API assumes the the UTF-32 code point is valid. */
-    CSTR_ASSERT(utf32 <= CSTR_UNICODE_MAX_CODE_POINT);
-    CSTR_ASSERT(cstr_is_cp_in_surrogate_pair_range(utf32) == CSTR_FALSE);
-    CSTR_ASSERT(utf8Cap > 0);
+    while (dstCap > 0 && dst[0] != '\0') {
+        dst    += 1;
+        dstCap -= 1;
+    }
 
-    if (utf32 <= 0x7F) {
-        if (utf8Cap >= 1) {
-            pUTF8[0] = (utf32 & 0x7F);
-            return 1;
-        }
+    if (dstCap == 0) {
+        return EINVAL;  /* Unterminated. */
     }
-    if (utf32 <= 0x7FF) {
-        if (utf8Cap >= 2) {
-            pUTF8[0] = 0xC0 | (cstr_utf8)((utf32 & 0x07C0) >> 6);
-            pUTF8[1] = 0x80 | (cstr_utf8) (utf32 & 0x003F);
-            return 2;
-        }
+
+    if (count == ((size_t)-1)) {        /* _TRUNCATE */
+        count = dstCap - 1;
     }
-    if (utf32 <= 0xFFFF) {
-        if (utf8Cap >= 3) {
-            pUTF8[0] = 0xE0 | (cstr_utf8)((utf32 & 0xF000) >> 12);
-            pUTF8[1] = 0x80 | (cstr_utf8)((utf32 & 0x0FC0) >>  6);
-            pUTF8[2] = 0x80 | (cstr_utf8) (utf32 & 0x003F);
-            return 3;
-        }
+
+    while (dstCap > 0 && src[0] != '\0' && count > 0) {
+        *dst++ = *src++;
+        dstCap -= 1;
+        count  -= 1;
     }
-    if (utf32 <= 0x10FFFF) {
-        if (utf8Cap >= 4) {
-            pUTF8[0] = 0xF0 | (cstr_utf8)((utf32 & 0x1C0000) >> 18);
-            pUTF8[1] = 0x80 | (cstr_utf8)((utf32 & 0x03F000) >> 12);
-            pUTF8[2] = 0x80 | (cstr_utf8)((utf32 & 0x000FC0) >>  6);
-            pUTF8[3] = 0x80 | (cstr_utf8) (utf32 & 0x00003F);
-            return 4;
-        }
+
+    if (dstCap > 0) {
+        dst[0] = '\0';
+    } else {
+        dstorig[0] = '\0';
+        return ERANGE;
     }
 
-    /* Getting here means there was not enough room in the output buffer. */
     return 0;
 }
 
-static CSTR_INLINE size_t utf32_cp_to_utf16_len(cstr_utf32 utf32)
+CSTR_API int utf8_itoa_s(int value, cstr_utf8* dst, size_t dstCap, int radix)
 {
-    /* This API assumes the the UTF-32 code point is valid. */
-    CSTR_ASSERT(utf32 <= CSTR_UNICODE_MAX_CODE_POINT);
-    CSTR_ASSERT(cstr_is_cp_in_surrogate_pair_range(utf32) == CSTR_FALSE);
+    int sign;
+    unsigned int valueU;
+    char* dstEnd;
 
-    if (utf32 <= 0xFFFF) {
-        return 1;
-    } else {
-        return 2;
+    if (dst == NULL || dstCap == 0) {
+        return EINVAL;
+    }
+    if (radix < 2 || radix > 36) {
+        dst[0] = '\0';
+        return EINVAL;
     }
 
-    /* Unreachable. */
-#if 0
-    /* Invalid. This function assume's the UTF-32 code point is valid so do an assert. */
-    CSTR_ASSERT(CSTR_FALSE);
-    return 0; /* Invalid. */
-#endif
-}
-
-static CSTR_INLINE size_t utf32_cp_to_utf16(cstr_utf32 utf32, cstr_utf16* pUTF16, size_t utf16Cap)
-{
-    /* This API assumes the the UTF-32 code point is valid. */
-    CSTR_ASSERT(utf32 <= CSTR_UNICODE_MAX_CODE_POINT);
-    CSTR_ASSERT(cstr_is_cp_in_surrogate_pair_range(utf32) == CSTR_FALSE);
-    CSTR_ASSERT(utf16Cap > 0);
+    sign = (value < 0 && radix == 10) ? -1 : 1;     /* The negative sign is only used when the base is 10. */
 
-    if (utf32 <= 0xFFFF) {
-        if (utf16Cap >= 1) {
-            pUTF16[0] = (cstr_utf16)utf32;
-            return 1;
-        }
+    if (value < 0) {
+        valueU = -value;
     } else {
-        if (utf16Cap >= 2) {
-            utf32_cp_to_utf16_pair(utf32, pUTF16);
-            return 2;
+        valueU = value;
+    }
+
+    dstEnd = dst;
+    do
+    {
+        int remainder = valueU % radix;
+        if (remainder > 9) {
+            *dstEnd = (char)((remainder - 10) + 'a');
+        } else {
+            *dstEnd = (char)(remainder + '0');
         }
+
+        dstEnd += 1;
+        dstCap -= 1;
+        valueU /= radix;
+    } while (dstCap > 0 && valueU > 0);
+
+    if (dstCap == 0) {
+        dst[0] = '\0';
+        return EINVAL;  /* Ran out of room in the output buffer. */
     }
 
-    /* Getting here means there was not enough room in the output buffer. */
-    return 0;
-}
+    if (sign < 0) {
+        *dstEnd++ = '-';
+        dstCap -= 1;
+    }
 
+    if (dstCap == 0) {
+        dst[0] = '\0';
+        return EINVAL;  /* Ran out of room in the output buffer. */
+    }
 
+    *dstEnd = '\0';
 
 
+    /* At this point the string will be reversed. */
+    dstEnd -= 1;
+    while (dst < dstEnd) {
+        char temp = *dst;
+        *dst = *dstEnd;
+        *dstEnd = temp;
 
-CSTR_API cstr_bool32 utf16_is_bom_le(const cstr_uint8 bom[2])
-{
-    /* RFC 2781 - Section 3.2 */
-    return bom[0] == 0xFF && bom[1] == 0xFE;
-}
+        dst += 1;
+        dstEnd -= 1;
+    }
 
-CSTR_API cstr_bool32 utf16_is_bom_be(const cstr_uint8 bom[2])
-{
-    /* RFC 2781 - Section 3.2 */
-    return bom[0] == 0xFE && bom[1] == 0xFF;
+    return 0;
 }
 
-CSTR_API cstr_bool32 utf32_is_bom_le(const cstr_uint8 bom[4])
-{
-    return bom[0] == 0xFF && bom[1] == 0xFE && bom[2] == 0x00 && bom[3] == 0x00;
-}
 
-CSTR_API cstr_bool32 utf32_is_bom_be(const cstr_uint8 bom[4])
+/* Returns the offset of the first byte that's different, or `len` if they're the same. */
+static size_t cstr_utf8_find_difference(const cstr_uint8* a, const cstr_uint8* b, size_t len)
 {
-    return bom[0] == 0x00 && bom[1] == 0x00 && bom[2] == 0xFE && bom[3] == 0xFF;
-}
+    size_t off = 0;
 
-CSTR_API cstr_bool32 utf8_has_bom(const cstr_uint8* pBytes, size_t len)
-{
-    if (pBytes == NULL) {
-        return CSTR_FALSE;
+#if defined(CSTR_SUPPORT_SSE2)
+    /* Two blocks are combined before testing. The exact position is found with the single block loop below. */
+    while (off + 32 <= len) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + off +  0)), _mm_loadu_si128((const __m128i*)(b + off +  0)));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + off + 16)), _mm_loadu_si128((const __m128i*)(b + off + 16)));
+        if (_mm_movemask_epi8(_mm_and_si128(eq0, eq1)) != 0xFFFF) {
+            break;
+        }
+
+        off += 32;
     }
 
-    if (len < 3) {
-        return CSTR_FALSE;
+    while (off + 16 <= len) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + off)), _mm_loadu_si128((const __m128i*)(b + off))));
+        if (mask != 0xFFFF) {
+            return off + cstr_ctz32((cstr_uint32)~mask & 0xFFFF);
+        }
+
+        off += 16;
     }
+#endif
 
-    return (pBytes[0] == 0xEF && pBytes[1] == 0xBB && pBytes[2] == 0xBF);
-}
+    while (off + 8 <= len) {
+        cstr_uint64 wordA;
+        cstr_uint64 wordB;
+        cstr_uint64 diff;
+
+        CSTR_COPY_MEMORY(&wordA, a + off, 8);
+        CSTR_COPY_MEMORY(&wordB, b + off, 8);
+        diff = wordA ^ wordB;
+        if (diff != 0) {
+            if (!cstr_is_little_endian()) {
+                diff = cstr_swap_endian_uint64(diff);   /* So the first byte in memory is the lowest. */
+            }
 
-CSTR_API cstr_bool32 utf16_has_bom(const cstr_uint8* pBytes, size_t len)
-{
-    if (pBytes == NULL) {
-        return CSTR_FALSE;
+            return off + (cstr_ctz64(diff) >> 3);
+        }
+
+        off += 8;
     }
 
-    if (len < 2) {
-        return CSTR_FALSE;
+    while (off < len && a[off] == b[off]) {
+        off += 1;
     }
 
-    return utf16_is_bom_le(pBytes) || utf16_is_bom_be(pBytes);
+    return off;
 }
 
-CSTR_API cstr_bool32 utf32_has_bom(const cstr_uint8* pBytes, size_t len)
+/* Returns the offset of the first byte that's different or is the null terminator of `a`, or `count` if there is no such byte in the first `count` bytes. */
+static size_t cstr_utf8_find_difference_or_null(const cstr_uint8* a, const cstr_uint8* b, size_t count)
 {
-    if (pBytes == NULL) {
-        return CSTR_FALSE;
-    }
+    size_t off = 0;
 
-    if (len < 4) {
-        return CSTR_FALSE;
-    }
+#if defined(CSTR_SUPPORT_SSE2) && !defined(CSTR_NO_OVERREAD)
+    const __m128i zero = _mm_setzero_si128();
 
-    return utf32_is_bom_le(pBytes) || utf32_is_bom_be(pBytes);
-}
+    while (count - off >= 16) {
+        __m128i blockA;
+        __m128i blockB;
+        int mask;
 
+        /* Step one byte at a time when a block load would cross a page boundary. Pages are at least 4KB on every supported platform. */
+        if (((size_t)(a + off) & 4095) > 4096 - 16 || ((size_t)(b + off) & 4095) > 4096 - 16) {
+            if (a[off] != b[off] || a[off] == 0) {
+                return off;
+            }
 
-CSTR_API void utf16_swap_endian(cstr_utf16* pUTF16, size_t count)
-{
-    if (count == (size_t)-1) {
-        size_t i;
-        for (i = 0; i < count; ++i) {
-            pUTF16[i] = cstr_swap_endian_uint16(pUTF16[i]);
+            off += 1;
+            continue;
         }
-    } else {
-        while (pUTF16[0] != 0) {
-            pUTF16[0] = cstr_swap_endian_uint16(pUTF16[0]);
-            pUTF16 += 1;
+
+        blockA = _mm_loadu_si128((const __m128i*)(a + off));
+        blockB = _mm_loadu_si128((const __m128i*)(b + off));
+        mask   = (~_mm_movemask_epi8(_mm_cmpeq_epi8(blockA, blockB)) | _mm_movemask_epi8(_mm_cmpeq_epi8(blockA, zero))) & 0xFFFF;
+        if (mask != 0) {
+            return off + cstr_ctz32((cstr_uint32)mask);
         }
+
+        off += 16;
     }
-}
+#endif
 
-CSTR_API void utf32_swap_endian(cstr_utf32* pUTF32, size_t count)
-{
-    if (count == (size_t)-1) {
-        size_t i;
-        for (i = 0; i < count; ++i) {
-            pUTF32[i] = cstr_swap_endian_uint32(pUTF32[i]);
-        }
-    } else {
-        while (pUTF32[0] != 0) {
-            pUTF32[0] = cstr_swap_endian_uint32(pUTF32[0]);
-            pUTF32 += 1;
-        }
+    while (off < count && a[off] == b[off] && a[off] != 0) {
+        off += 1;
     }
+
+    return off;
 }
 
+CSTR_API int utf8_strcmp(const cstr_utf8* str1, const cstr_utf8* str2)
+{
+    const cstr_uint8* a = (const cstr_uint8*)str1;
+    const cstr_uint8* b = (const cstr_uint8*)str2;
+    size_t off;
 
-CSTR_API errno_t utf8_to_utf16_len(size_t* pUTF16Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+    CSTR_ASSERT(str1 != NULL);
+    CSTR_ASSERT(str2 != NULL);
+
+    off = cstr_utf8_find_difference_or_null(a, b, (size_t)-1);
+    return (int)a[off] - (int)b[off];
+}
+
+CSTR_API int utf8_strncmp(const cstr_utf8* str1, const cstr_utf8* str2, size_t count)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf16Len = 0;
+    const cstr_uint8* a = (const cstr_uint8*)str1;
+    const cstr_uint8* b = (const cstr_uint8*)str2;
+    size_t off;
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
-    }
+    CSTR_ASSERT(str1 != NULL || count == 0);
+    CSTR_ASSERT(str2 != NULL || count == 0);
 
-    if (pUTF8LenProcessed != NULL) {
-        *pUTF8LenProcessed = 0;
+    off = cstr_utf8_find_difference_or_null(a, b, count);
+    if (off == count) {
+        return 0;
     }
 
-    if (pUTF8 == NULL) {
-        return EINVAL;   /* Invalid input. */
+    return (int)a[off] - (int)b[off];
+}
+
+CSTR_API int utf8_compare_n(const cstr_utf8* str1, size_t str1Len, const cstr_utf8* str2, size_t str2Len, size_t* pDiffOffset)
+{
+    const cstr_uint8* a = (const cstr_uint8*)str1;
+    const cstr_uint8* b = (const cstr_uint8*)str2;
+    size_t len;
+    size_t off;
+
+    if (str1Len == (size_t)-1) {
+        str1Len = (str1 != NULL) ? utf8_strlen(str1) : 0;
+    }
+    if (str2Len == (size_t)-1) {
+        str2Len = (str2 != NULL) ? utf8_strlen(str2) : 0;
     }
 
-    if (utf8Len == 0 || pUTF8[0] == 0) {
-        return CSTR_SUCCESS;   /* Empty input string. Length is always 0. */
+    CSTR_ASSERT(str1 != NULL || str1Len == 0);
+    CSTR_ASSERT(str2 != NULL || str2Len == 0);
+
+    len = (str1Len < str2Len) ? str1Len : str2Len;
+    off = cstr_utf8_find_difference(a, b, len);
+
+    if (pDiffOffset != NULL) {
+        *pDiffOffset = off;
     }
 
-    /* Check for BOM. */
-    if (utf8_has_bom((const cstr_uint8*)pUTF8, utf8Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    if (off < len) {
+        return (int)a[off] - (int)b[off];
+    }
 
-        pUTF8 += 3; /* Skip past the BOM. */
-        if (utf8Len != (size_t)-1) {
-            utf8Len -= 3;
-        }
+    if (str1Len < str2Len) {
+        return -1;
+    }
+    if (str1Len > str2Len) {
+        return 1;
     }
 
-    if (utf8Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf8* pUTF8Original = pUTF8;
-        for (;;) {
-            if (pUTF8[0] == 0) {
-                break;  /* Reached the end of the null terminated string. */
-            }
+    return 0;
+}
 
-            if ((cstr_uint8)pUTF8[0] < 128) {   /* ASCII character. */
-                utf16Len += 1;
-                pUTF8    += 1;
-            } else {
-                if (cstr_is_invalid_utf8_octet(pUTF8[0])) {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        pUTF8    += 1;
-                    }
-                } else {
-                    if ((pUTF8[0] & 0xE0) == 0xC0) {
-                        if (pUTF8[1] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+CSTR_API size_t utf8_common_prefix_len(const cstr_utf8* str1, size_t str1Len, const cstr_utf8* str2, size_t str2Len)
+{
+    size_t off;
 
-                        utf16Len += 1;  /* Can be at most 1 UTF-16. */
-                        pUTF8    += 2;
-                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+    utf8_compare_n(str1, str1Len, str2, str2Len, &off);
+    return off;
+}
 
-                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
-                        pUTF8    += 3;
-                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
-                        cstr_uint32 cp;
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+static CSTR_INLINE cstr_bool32 cstr_is_ascii_digit(cstr_uint8 c)
+{
+    return c >= '0' && c <= '9';
+}
 
-                        cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        if (!cstr_is_valid_code_point(cp)) {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                pUTF8    += 4;
-                            }
-                        } else {
-                            utf16Len += 2;  /* Must be at least 2 UTF-16s */
-                            pUTF8    += 4;
-                        }
-                    } else {
-                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = CSTR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            pUTF8    += 1;
-                        }
-                    }
-                }
+static CSTR_INLINE cstr_uint8 cstr_ascii_to_lower(cstr_uint8 c)
+{
+    if (c >= 'A' && c <= 'Z') {
+        return (cstr_uint8)(c + ('a' - 'A'));
+    }
+
+    return c;
+}
+
+static int cstr_utf8_strnatcmp_internal(const cstr_uint8* a, const cstr_uint8* b, cstr_bool32 ignoreCase)
+{
+    int tieBreak = 0;   /* Numbers that only differ by leading zeros are equal in value. If nothing else differs, the one with fewer zeros comes first. */
+
+    for (;;) {
+        size_t off;
+
+        /* Identical bytes compare the same regardless of case or numbers, so they're skipped in bulk. */
+        off = cstr_utf8_find_difference_or_null(a, b, (size_t)-1);
+
+        /* If the difference is inside a run of digits, the whole run needs to be compared as a number so go back to the start of it. */
+        if (cstr_is_ascii_digit(a[off]) || cstr_is_ascii_digit(b[off])) {
+            while (off > 0 && cstr_is_ascii_digit(a[off - 1])) {
+                off -= 1;
             }
         }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        a += off;
+        b += off;
+
+        if (a[0] == '\0' && b[0] == '\0') {
+            return tieBreak;
         }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF8;
-        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
-            if ((cstr_uint8)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
-                utf16Len += 1;
-                iUTF8    += 1;
-            } else {
-                if (cstr_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        iUTF8    += 1;
-                    }
-                } else {
-                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
-                        if (iUTF8+1 > utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
 
-                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
-                        iUTF8    += 2;
-                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
-                        if (iUTF8+2 > utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+        if (cstr_is_ascii_digit(a[0]) && cstr_is_ascii_digit(b[0])) {
+            size_t zerosA = 0;
+            size_t zerosB = 0;
+            size_t lenA = 0;
+            size_t lenB = 0;
+            size_t i;
 
-                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
-                        iUTF8    += 3;
-                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
-                        cstr_uint32 cp;
-                        if (iUTF8+3 > utf8Len) {
-                            return EINVAL;
-                        }
+            while (a[zerosA] == '0') {
+                zerosA += 1;
+            }
+            while (b[zerosB] == '0') {
+                zerosB += 1;
+            }
+            while (cstr_is_ascii_digit(a[zerosA + lenA])) {
+                lenA += 1;
+            }
+            while (cstr_is_ascii_digit(b[zerosB + lenB])) {
+                lenB += 1;
+            }
 
-                        cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        if (!cstr_is_valid_code_point(cp)) {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                iUTF8    += 4;
-                            }
-                        } else {
-                            utf16Len += 2;  /* Must be at least 2 UTF-16s */
-                            iUTF8    += 4;
-                        }
-                    } else {
-                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = CSTR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            iUTF8    += 1;
-                        }
-                    }
+            /* Without leading zeros, a longer number is always bigger. Otherwise the first different digit decides. */
+            if (lenA != lenB) {
+                return (lenA < lenB) ? -1 : 1;
+            }
+
+            for (i = 0; i < lenA; i += 1) {
+                if (a[zerosA + i] != b[zerosB + i]) {
+                    return (int)a[zerosA + i] - (int)b[zerosB + i];
                 }
             }
-        }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = iUTF8;
+            if (tieBreak == 0 && zerosA != zerosB) {
+                tieBreak = (zerosA < zerosB) ? -1 : 1;
+            }
+
+            a += zerosA + lenA;
+            b += zerosB + lenB;
+        } else {
+            cstr_uint8 ca = a[0];
+            cstr_uint8 cb = b[0];
+
+            if (ignoreCase) {
+                ca = cstr_ascii_to_lower(ca);
+                cb = cstr_ascii_to_lower(cb);
+            }
+
+            if (ca != cb) {
+                return (int)ca - (int)cb;
+            }
+
+            a += 1;
+            b += 1;
         }
     }
+}
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = utf16Len;
-    }
+CSTR_API int utf8_strnatcmp(const cstr_utf8* str1, const cstr_utf8* str2)
+{
+    CSTR_ASSERT(str1 != NULL);
+    CSTR_ASSERT(str2 != NULL);
 
-    return result;
+    return cstr_utf8_strnatcmp_internal((const cstr_uint8*)str1, (const cstr_uint8*)str2, CSTR_FALSE);
 }
 
-CSTR_API errno_t utf8_to_utf16ne(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+CSTR_API int utf8_strnatcasecmp(const cstr_utf8* str1, const cstr_utf8* str2)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf16CapOriginal = utf16Cap;
+    CSTR_ASSERT(str1 != NULL);
+    CSTR_ASSERT(str2 != NULL);
 
-    if (pUTF16 == NULL) {
-        return utf8_to_utf16_len(pUTF16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
-    }
+    return cstr_utf8_strnatcmp_internal((const cstr_uint8*)str1, (const cstr_uint8*)str2, CSTR_TRUE);
+}
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
-    }
 
-    if (pUTF8LenProcessed != NULL) {
-        *pUTF8LenProcessed = 0;
-    }
+CSTR_API size_t utf16_strlen(const cstr_utf16* src)
+{
+    const cstr_utf16* end;
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
+    CSTR_ASSERT(src != NULL);
+    
+    end = src;
+    while (end[0] != '\0') {
+        end += 1;
     }
 
-    /* Check for BOM. */
-    if (utf8_has_bom((const cstr_uint8*)pUTF8, utf8Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;   /* Found a BOM, but it's forbidden. */
-        }
+    return end - src;
+}
 
-        pUTF8 += 3; /* Skip past the BOM. */
-        if (utf8Len != (size_t)-1) {
-            utf8Len -= 3;
-        }
+CSTR_API size_t utf32_strlen(const cstr_utf32* src)
+{
+    const cstr_utf32* end;
+
+    CSTR_ASSERT(src != NULL);
+    
+    end = src;
+    while (end[0] != '\0') {
+        end += 1;
     }
 
-    if (utf8Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf8* pUTF8Original = pUTF8;
-        while (pUTF8[0] != 0) {
-            if (utf16Cap == 1) {
-                result = ENOMEM;
-                break;
-            }
+    return end - src;
+}
 
-            if ((cstr_uint8)pUTF8[0] < 128) {   /* ASCII character. */
-                pUTF16[0] = pUTF8[0];
-                pUTF16   += 1;
-                utf16Cap -= 1;
-                pUTF8    += 1;
-            } else {
-                if (cstr_is_invalid_utf8_octet(pUTF8[0])) {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                        pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        pUTF8    += 1;
-                    }
-                } else {
-                    if ((pUTF8[0] & 0xE0) == 0xC0) {
-                        if (pUTF8[1] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
-
-                        pUTF16[0] = ((cstr_utf16)(pUTF8[0] & 0x1F) <<  6) | (pUTF8[1] & 0x3F);
-                        pUTF16   += 1;
-                        utf16Cap -= 1;
-                        pUTF8    += 2;
-                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
 
-                        pUTF16[0] = ((cstr_utf16)(pUTF8[0] & 0x0F) << 12) | ((cstr_utf16)(pUTF8[1] & 0x3F) << 6) | (pUTF8[2] & 0x3F);
-                        pUTF16   += 1;
-                        utf16Cap -= 1;
-                        pUTF8    += 3;
-                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
-                        if (utf16Cap < 2) {
-                            break;  /* No enough room. */
-                        } else {
-                            cstr_uint32 cp;
-                            if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
-                                result = EINVAL; /* Input string is too short. */
-                                break;
-                            }
 
-                            cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                            if (!cstr_is_valid_code_point(cp)) {
-                                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                    result = CSTR_ECODEPOINT;
-                                    break;
-                                } else {
-                                    /* Replacement. */
-                                    pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                                    pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                    utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                    pUTF8    += 4;
-                                }
-                            } else {
-                                utf32_cp_to_utf16_pair(cp, pUTF16);
-                                pUTF16   += 2;
-                                utf16Cap -= 2;
-                                pUTF8    += 4;
-                            }
-                        }
-                    } else {
-                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = CSTR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            pUTF8    += 1;
-                        }
-                    }
-                }
-            }
-        }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF8;
-        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
-            if (utf16Cap == 1) {
-                result = ENOMEM;
-                break;
-            }
+/* Thread local storage. On compilers without support for it, CSTR_THREAD_LOCAL is empty and the variable is shared between threads. */
+#if defined(_MSC_VER)
+    #define CSTR_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+    #define CSTR_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__) || defined(__clang__)
+    #define CSTR_THREAD_LOCAL __thread
+#endif
 
-            if ((cstr_uint8)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
-                pUTF16[0] = pUTF8[iUTF8+0];
-                pUTF16   += 1;
-                utf16Cap -= 1;
-                iUTF8    += 1;
-            } else {
-                if (cstr_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                        pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                        iUTF8    += 1;
-                    }
-                } else {
-                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
-                        if (iUTF8+1 > utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+#if defined(CSTR_THREAD_LOCAL)
+    #define CSTR_HAS_THREAD_LOCAL
+#else
+    #define CSTR_THREAD_LOCAL
+#endif
 
-                        pUTF16[0] = ((cstr_utf16)(pUTF8[iUTF8+0] & 0x1F) <<  6) | (pUTF8[iUTF8+1] & 0x3F);
-                        pUTF16   += 1;
-                        utf16Cap -= 1;
-                        iUTF8    += 2;
-                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
-                        if (iUTF8+2 > utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+/* Atomics. These fall back to plain operations on compilers without atomic intrinsics which is only safe for single threaded use. */
+static CSTR_INLINE cstr_uint32 cstr_atomic_exchange_32(volatile cstr_uint32* p, cstr_uint32 n)
+{
+#if defined(CSTR_WIN32)
+    return (cstr_uint32)InterlockedExchange((volatile LONG*)p, (LONG)n);
+#elif defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+    return __atomic_exchange_n(p, n, __ATOMIC_SEQ_CST);
+#elif defined(__GNUC__)
+    __sync_synchronize();
+    return __sync_lock_test_and_set(p, n);
+#else
+    cstr_uint32 old = *p;
+    *p = n;
+    return old;
+#endif
+}
 
-                        pUTF16[0] = ((cstr_utf16)(pUTF8[iUTF8+0] & 0x0F) << 12) | ((cstr_utf16)(pUTF8[iUTF8+1] & 0x3F) << 6) | (pUTF8[iUTF8+2] & 0x3F);
-                        pUTF16   += 1;
-                        utf16Cap -= 1;
-                        iUTF8    += 3;
-                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
-                        if (utf16Cap < 2) {
-                            break;  /* No enough room. */
-                        } else {
-                            cstr_uint32 cp;
-                            if (iUTF8+3 > utf8Len) {
-                                result = EINVAL;
-                                break;
-                            }
+static CSTR_INLINE cstr_uint32 cstr_atomic_load_32(volatile cstr_uint32* p)
+{
+#if defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+    return *p;  /* Aligned 32-bit reads are atomic on all supported platforms, and volatile reads have acquire semantics with MSVC. */
+#endif
+}
 
-                            cp = ((cstr_utf32)(pUTF8[iUTF8+0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[iUTF8+1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[iUTF8+2] & 0x3F) << 6) | (pUTF8[iUTF8+3] & 0x3F);
-                            if (!cstr_is_valid_code_point(cp)) {
-                                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                    result = CSTR_ECODEPOINT;
-                                    break;
-                                } else {
-                                    /* Replacement. */
-                                    pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                                    pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                    utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                                    iUTF8    += 4;
-                                }
-                            } else {
-                                utf32_cp_to_utf16_pair(cp, pUTF16);
-                                pUTF16   += 2;
-                                utf16Cap -= 2;
-                                iUTF8    += 4;
-                            }
-                        }
-                    } else {
-                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = CSTR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
-                            iUTF8    += 1;
-                        }
-                    }
-                }
-            }
-        }
+static CSTR_INLINE cstr_uint32 cstr_atomic_fetch_add_32(volatile cstr_uint32* p, cstr_uint32 n)
+{
+#if defined(CSTR_WIN32)
+    return (cstr_uint32)InterlockedExchangeAdd((volatile LONG*)p, (LONG)n);
+#elif defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+    return __atomic_fetch_add(p, n, __ATOMIC_ACQ_REL);
+#elif defined(__GNUC__)
+    return __sync_fetch_and_add(p, n);
+#else
+    cstr_uint32 old = *p;
+    *p = old + n;
+    return old;
+#endif
+}
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = iUTF8;
-        }
-    }
+static CSTR_INLINE cstr_uint64 cstr_atomic_fetch_add_64(volatile cstr_uint64* p, cstr_uint64 n)
+{
+#if defined(CSTR_WIN32)
+    return (cstr_uint64)InterlockedExchangeAdd64((volatile LONGLONG*)p, (LONGLONG)n);
+#elif defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+    return __atomic_fetch_add(p, n, __ATOMIC_RELAXED);
+#elif defined(__GNUC__)
+    return __sync_fetch_and_add(p, n);
+#else
+    cstr_uint64 old = *p;
+    *p = old + n;
+    return old;
+#endif
+}
 
-    /* Null terminate. */
-    if (utf16Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF16[0] = 0;
-    }
+static CSTR_INLINE cstr_uint64 cstr_atomic_exchange_64(volatile cstr_uint64* p, cstr_uint64 n)
+{
+#if defined(CSTR_WIN32)
+    return (cstr_uint64)InterlockedExchange64((volatile LONGLONG*)p, (LONGLONG)n);
+#elif defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+    return __atomic_exchange_n(p, n, __ATOMIC_RELAXED);
+#elif defined(__GNUC__)
+    return __sync_lock_test_and_set(p, n);
+#else
+    cstr_uint64 old = *p;
+    *p = n;
+    return old;
+#endif
+}
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = (utf16CapOriginal - utf16Cap);
-    }
 
-    return result;
+static CSTR_INLINE void* cstr_atomic_load_ptr(void* volatile* p)
+{
+#if defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#elif defined(CSTR_WIN32) && !defined(CSTR_X86) && !defined(CSTR_X64)
+    return InterlockedCompareExchangePointer(p, NULL, NULL);
+#elif defined(__GNUC__)
+    void* ptr = *p;
+    __sync_synchronize();
+    return ptr;
+#else
+    return *p;  /* Volatile reads have acquire semantics with MSVC on x86 and x64. */
+#endif
 }
 
-CSTR_API errno_t utf8_to_utf16le(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+static CSTR_INLINE void cstr_atomic_store_ptr(void* volatile* p, void* ptr)
 {
-    errno_t result;
-    size_t utf16Len;
+#if defined(__clang__) || (defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+    __atomic_store_n(p, ptr, __ATOMIC_RELEASE);
+#elif defined(CSTR_WIN32)
+    InterlockedExchangePointer(p, ptr);
+#elif defined(__GNUC__)
+    __sync_synchronize();
+    *p = ptr;
+#else
+    *p = ptr;
+#endif
+}
 
-    /* Always do a native endian conversion first, then byte swap if necessary. */
-    result = utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = utf16Len;
+/* Spinlocks are only used for protecting very short sections of code where taking a system mutex would dominate the cost of the work being done. */
+static void cstr_spinlock_lock(volatile cstr_uint32* pLock)
+{
+    while (cstr_atomic_exchange_32(pLock, 1) != 0) {
+        /* Spin. */
     }
+}
 
-    if (result != CSTR_SUCCESS) {
-        return result;
-    }
+static void cstr_spinlock_unlock(volatile cstr_uint32* pLock)
+{
+    cstr_atomic_exchange_32(pLock, 0);
+}
 
-    if (pUTF16 != NULL && !cstr_is_little_endian()) {
-        utf16_swap_endian(pUTF16, utf16Len);
-    }
 
-    return CSTR_SUCCESS;
-}
+#if defined(CSTR_STATS)
+static CSTR_THREAD_LOCAL cstr_stats g_cstrThreadStats;
+static volatile cstr_stats g_cstrStats;
 
-CSTR_API errno_t utf8_to_utf16be(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+static CSTR_INLINE void cstr_stats_add(cstr_uint64* pThreadCounter, volatile cstr_uint64* pGlobalCounter, cstr_uint64 n)
 {
-    errno_t result;
-    size_t utf16Len;
+    *pThreadCounter += n;
+    cstr_atomic_fetch_add_64(pGlobalCounter, n);
+}
 
-    /* Always do a native endian conversion first, then byte swap if necessary. */
-    result = utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#define CSTR_STATS_ADD(counter, n)  cstr_stats_add(&g_cstrThreadStats.counter, &g_cstrStats.counter, (cstr_uint64)(n))
+#else
+#define CSTR_STATS_ADD(counter, n)  ((void)0)
+#endif
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = utf16Len;
+CSTR_API int cstr_stats_snapshot(cstr_stats* pThreadStats, cstr_stats* pGlobalStats)
+{
+#if defined(CSTR_STATS)
+    if (pThreadStats != NULL) {
+        *pThreadStats = g_cstrThreadStats;
     }
 
-    if (result != CSTR_SUCCESS) {
-        return result;
+    if (pGlobalStats != NULL) {
+        /* Adding zero is used as an atomic load because a plain 64-bit read can tear on 32-bit platforms. */
+        pGlobalStats->allocCount         = cstr_atomic_fetch_add_64(&g_cstrStats.allocCount,         0);
+        pGlobalStats->reallocCount       = cstr_atomic_fetch_add_64(&g_cstrStats.reallocCount,       0);
+        pGlobalStats->freeCount          = cstr_atomic_fetch_add_64(&g_cstrStats.freeCount,          0);
+        pGlobalStats->bytesAllocated     = cstr_atomic_fetch_add_64(&g_cstrStats.bytesAllocated,     0);
+        pGlobalStats->bytesCopied        = cstr_atomic_fetch_add_64(&g_cstrStats.bytesCopied,        0);
+        pGlobalStats->bytesMoved         = cstr_atomic_fetch_add_64(&g_cstrStats.bytesMoved,         0);
+        pGlobalStats->slackBytes         = cstr_atomic_fetch_add_64(&g_cstrStats.slackBytes,         0);
+        pGlobalStats->conversionBytesIn  = cstr_atomic_fetch_add_64(&g_cstrStats.conversionBytesIn,  0);
+        pGlobalStats->conversionBytesOut = cstr_atomic_fetch_add_64(&g_cstrStats.conversionBytesOut, 0);
     }
 
-    if (pUTF16 != NULL && !cstr_is_big_endian()) {
-        utf16_swap_endian(pUTF16, utf16Len);
+    return 0;
+#else
+    if (pThreadStats != NULL) {
+        CSTR_ZERO_OBJECT(pThreadStats);
     }
 
-    return CSTR_SUCCESS;
+    if (pGlobalStats != NULL) {
+        CSTR_ZERO_OBJECT(pGlobalStats);
+    }
+
+    return ENOSYS;
+#endif
 }
 
-CSTR_API errno_t utf8_to_utf32_len(size_t* pUTF32Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+CSTR_API void cstr_stats_reset(void)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf32Len = 0;
+#if defined(CSTR_STATS)
+    CSTR_ZERO_OBJECT(&g_cstrThreadStats);
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
-    }
+    cstr_atomic_exchange_64(&g_cstrStats.allocCount,         0);
+    cstr_atomic_exchange_64(&g_cstrStats.reallocCount,       0);
+    cstr_atomic_exchange_64(&g_cstrStats.freeCount,          0);
+    cstr_atomic_exchange_64(&g_cstrStats.bytesAllocated,     0);
+    cstr_atomic_exchange_64(&g_cstrStats.bytesCopied,        0);
+    cstr_atomic_exchange_64(&g_cstrStats.bytesMoved,         0);
+    cstr_atomic_exchange_64(&g_cstrStats.slackBytes,         0);
+    cstr_atomic_exchange_64(&g_cstrStats.conversionBytesIn,  0);
+    cstr_atomic_exchange_64(&g_cstrStats.conversionBytesOut, 0);
+#endif
+}
 
-    if (pUTF8LenProcessed != NULL) {
-        *pUTF8LenProcessed = 0;
-    }
 
-    if (pUTF8 == NULL) {
-        return EINVAL;   /* Invalid input. */
-    }
+#if defined(CSTR_TRACE)
+static cstr_trace_proc g_cstrTraceProc;
+static void* g_cstrTraceUserData;
+static CSTR_THREAD_LOCAL const char* g_cstrTraceOperation;
+static CSTR_THREAD_LOCAL cstr_uint32 g_cstrTraceOperationDepth;
+#endif
+static CSTR_THREAD_LOCAL const char* g_cstrTraceTag;
 
-    if (utf8Len == 0 || pUTF8[0] == 0) {
-        return CSTR_SUCCESS;   /* Empty input string. Length is always 0. */
+#if defined(CSTR_TRACE)
+static void cstr_trace_emit(cstr_trace_event_type type, const char* pOperation, size_t size, size_t oldSize)
+{
+    cstr_trace_event event;
+    cstr_trace_proc onEvent = g_cstrTraceProc;
+
+    if (onEvent == NULL) {
+        return;
     }
 
-    /* Check for BOM. */
-    if (utf8_has_bom((const cstr_uint8*)pUTF8, utf8Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    event.type       = type;
+    event.pOperation = (g_cstrTraceOperation != NULL) ? g_cstrTraceOperation : pOperation;
+    event.pTag       = g_cstrTraceTag;
+    event.size       = size;
+    event.oldSize    = oldSize;
 
-        pUTF8 += 3; /* Skip past the BOM. */
-        if (utf8Len != (size_t)-1) {
-            utf8Len -= 3;
-        }
-    }
+    onEvent(g_cstrTraceUserData, &event);
+}
 
-    if (utf8Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf8* pUTF8Original = pUTF8;
-        while (pUTF8[0] != 0) {
-            utf32Len += 1;
-            if ((cstr_uint8)pUTF8[0] < 128) {   /* ASCII character. */
-                pUTF8 += 1;
-            } else {
-                if (cstr_is_invalid_utf8_octet(pUTF8[0])) {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF8 += 1;
-                    }
-                } else {
-                    if ((pUTF8[0] & 0xE0) == 0xC0) {
-                        if (pUTF8[1] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
-                        pUTF8 += 2;
-                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
-                        pUTF8 += 3;
-                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
-                        cstr_uint32 cp;
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
-                        cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        if (!cstr_is_valid_code_point(cp)) {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                            }
-                        }
-                        pUTF8 += 4;
-                    } else {
-                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = CSTR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF8 += 1;
-                        }
-                    }
-                }
-            }
-        }
+/* Operations that are implemented in terms of other operations are wrapped in these so that the outermost operation is the one that gets reported. */
+static void cstr_trace_begin_operation(const char* pOperation)
+{
+    if (g_cstrTraceOperationDepth == 0) {
+        g_cstrTraceOperation = pOperation;
+    }
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF8;
-        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
-            utf32Len += 1;
-            if ((cstr_uint8)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
-                iUTF8 += 1;
-            } else {
-                if (cstr_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        iUTF8 += 1;
-                    }
-                } else {
-                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
-                        if (iUTF8+1 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
-                        iUTF8 += 2;
-                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
-                        if (iUTF8+2 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
-                        iUTF8 += 3;
-                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
-                        cstr_uint32 cp;
-                        if (iUTF8+3 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
-                        cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        if (!cstr_is_valid_code_point(cp)) {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                            }
-                        }
+    g_cstrTraceOperationDepth += 1;
+}
 
-                        iUTF8 += 4;
-                    } else {
-                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = CSTR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            iUTF8 += 1;
-                        }
-                    }
-                }
-            }
-        }
+static void cstr_trace_end_operation(void)
+{
+    g_cstrTraceOperationDepth -= 1;
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = iUTF8;
-        }
+    if (g_cstrTraceOperationDepth == 0) {
+        g_cstrTraceOperation = NULL;
     }
+}
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = utf32Len;
-    }
+#define CSTR_TRACE_EVENT(type, pOperation, size, oldSize)   cstr_trace_emit(cstr_trace_event_type_##type, (pOperation), (size), (oldSize))
+#define CSTR_TRACE_BEGIN_OPERATION(pOperation)              cstr_trace_begin_operation(pOperation)
+#define CSTR_TRACE_END_OPERATION()                          cstr_trace_end_operation()
+#else
+#define CSTR_TRACE_EVENT(type, pOperation, size, oldSize)   ((void)sizeof(pOperation), (void)sizeof(size), (void)sizeof(oldSize))    /* Not evaluated. Avoids unused variable warnings. */
+#define CSTR_TRACE_BEGIN_OPERATION(pOperation)              ((void)0)
+#define CSTR_TRACE_END_OPERATION()                          ((void)0)
+#endif
 
-    return result;
+CSTR_API int cstr_trace_set_callback(cstr_trace_proc onEvent, void* pUserData)
+{
+#if defined(CSTR_TRACE)
+    g_cstrTraceUserData = pUserData;
+    g_cstrTraceProc     = onEvent;
+
+    return 0;
+#else
+    (void)onEvent;
+    (void)pUserData;
+
+    return ENOSYS;
+#endif
 }
 
+CSTR_API const char* cstr_trace_set_tag(const char* pTag)
+{
+    const char* pPrevTag = g_cstrTraceTag;
+    g_cstrTraceTag = pTag;
 
-CSTR_API errno_t utf8_to_utf32ne(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+    return pPrevTag;
+}
+
+CSTR_API int cstr_trace_aggregator_init(cstr_trace_aggregator* pAggregator)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf32CapOriginal = utf32Cap;
+    if (pAggregator == NULL) {
+        return EINVAL;
+    }
 
-    if (pUTF32 == NULL) {
-        return utf8_to_utf32_len(pUTF32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+    CSTR_ZERO_OBJECT(pAggregator);
+
+    return 0;
+}
+
+CSTR_API void cstr_trace_aggregator_uninit(cstr_trace_aggregator* pAggregator)
+{
+    if (pAggregator == NULL) {
+        return;
     }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
+    CSTR_FREE(pAggregator->pEntries);
+}
+
+static cstr_bool32 cstr_trace_names_equal(const char* pA, const char* pB)
+{
+    /* Names are almost always string literals so the pointer comparison will usually be enough. */
+    if (pA == pB) {
+        return CSTR_TRUE;
     }
 
-    if (pUTF8LenProcessed != NULL) {
-        *pUTF8LenProcessed = 0;
+    if (pA == NULL || pB == NULL) {
+        return CSTR_FALSE;
     }
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
+    while (pA[0] != '\0' && pA[0] == pB[0]) {
+        pA += 1;
+        pB += 1;
     }
 
-    /* Check for BOM. */
-    if (utf8_has_bom((const cstr_uint8*)pUTF8, utf8Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    return pA[0] == pB[0];
+}
 
-        pUTF8 += 3; /* Skip past the BOM. */
-        if (utf8Len != (size_t)-1) {
-            utf8Len -= 3;
-        }
+CSTR_API void cstr_trace_aggregator_on_event(void* pUserData, const cstr_trace_event* pEvent)
+{
+    cstr_trace_aggregator* pAggregator = (cstr_trace_aggregator*)pUserData;
+    cstr_trace_report_entry* pEntry = NULL;
+    size_t iEntry;
+
+    if (pAggregator == NULL || pEvent == NULL) {
+        return;
     }
 
-    if (utf8Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf8* pUTF8Original = pUTF8;
-        while (pUTF8[0] != 0) {
-            if (utf32Cap == 0) {
-                result = ENOMEM;
+    cstr_spinlock_lock(&pAggregator->lock);
+    {
+        /* The number of distinct call sites is expected to be small so a linear search is fine. */
+        for (iEntry = 0; iEntry < pAggregator->entryCount; iEntry += 1) {
+            if (cstr_trace_names_equal(pAggregator->pEntries[iEntry].pTag, pEvent->pTag) && cstr_trace_names_equal(pAggregator->pEntries[iEntry].pOperation, pEvent->pOperation)) {
+                pEntry = &pAggregator->pEntries[iEntry];
                 break;
             }
+        }
 
-            if ((cstr_uint8)pUTF8[0] < 128) {   /* ASCII character. */
-                pUTF32[0] = pUTF8[0];
-                pUTF8 += 1;
-            } else {
-                if (cstr_is_invalid_utf8_octet(pUTF8[0])) {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                        pUTF8 += 1;
-                    }
-                } else {
-                    if ((pUTF8[0] & 0xE0) == 0xC0) {
-                        if (pUTF8[1] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+        if (pEntry == NULL) {
+            if (pAggregator->entryCount == pAggregator->entryCap) {
+                size_t newCap = (pAggregator->entryCap == 0) ? 32 : pAggregator->entryCap * 2;
+                cstr_trace_report_entry* pNewEntries = (cstr_trace_report_entry*)CSTR_REALLOC(pAggregator->pEntries, newCap * sizeof(*pNewEntries));
+                if (pNewEntries == NULL) {
+                    cstr_spinlock_unlock(&pAggregator->lock);
+                    return; /* Out of memory. The event is dropped. */
+                }
 
-                        pUTF32[0] = ((cstr_utf16)(pUTF8[0] & 0x1F) <<  6) | (pUTF8[1] & 0x3F);
-                        pUTF8 += 2;
-                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+                pAggregator->pEntries = pNewEntries;
+                pAggregator->entryCap = newCap;
+            }
 
-                        pUTF32[0] = ((cstr_utf16)(pUTF8[0] & 0x0F) << 12) | ((cstr_utf16)(pUTF8[1] & 0x3F) << 6) | (pUTF8[2] & 0x3F);
-                        pUTF8 += 3;
-                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
-                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
-                            result = EINVAL; /* Input string is too short. */
-                            break;
-                        }
+            pEntry = &pAggregator->pEntries[pAggregator->entryCount];
+            pAggregator->entryCount += 1;
 
-                        pUTF32[0] = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
-                        pUTF8 += 4;
+            CSTR_ZERO_OBJECT(pEntry);
+            pEntry->pTag       = pEvent->pTag;
+            pEntry->pOperation = pEvent->pOperation;
+        }
 
-                        if (!cstr_is_valid_code_point(pUTF32[0])) {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;   /* No characters should be in the UTF-16 surrogate pair range. */
-                                break;
-                            } else {
-                                /* Replacement. */
-                                pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
-                    } else {
-                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = CSTR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            pUTF8 += 1;
-                        }
-                    }
-                }
-            }
-
-            pUTF32   += 1;
-            utf32Cap -= 1;
+        if (pEvent->type == cstr_trace_event_type_free) {
+            pEntry->freeCount += 1;
+        } else {
+            pEntry->count += 1;
+            pEntry->bytes += pEvent->size;
         }
+    }
+    cstr_spinlock_unlock(&pAggregator->lock);
+}
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF8;
-        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
-            if (utf32Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+static cstr_uint64 cstr_trace_report_entry_key(const cstr_trace_report_entry* pEntry, int sortBy)
+{
+    return (sortBy == CSTR_TRACE_SORT_BY_COUNT) ? pEntry->count : pEntry->bytes;
+}
 
-            if ((cstr_uint8)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
-                pUTF32[0] = pUTF8[iUTF8+0];
-                iUTF8 += 1;
-            } else {
-                if (cstr_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                        iUTF8 += 1;
-                    }
-                } else {
-                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
-                        if (iUTF8+1 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+CSTR_API size_t cstr_trace_aggregator_get_top(cstr_trace_aggregator* pAggregator, int sortBy, cstr_trace_report_entry* pEntries, size_t entryCap)
+{
+    size_t count = 0;
 
-                        pUTF32[0] = ((cstr_utf16)(pUTF8[iUTF8+0] & 0x1F) <<  6) | (pUTF8[iUTF8+1] & 0x3F);
-                        iUTF8 += 2;
-                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
-                        if (iUTF8+2 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+    if (pAggregator == NULL || pEntries == NULL) {
+        return 0;
+    }
 
-                        pUTF32[0] = ((cstr_utf16)(pUTF8[iUTF8+0] & 0x0F) << 12) | ((cstr_utf16)(pUTF8[iUTF8+1] & 0x3F) << 6) | (pUTF8[iUTF8+2] & 0x3F);
-                        iUTF8 += 3;
-                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
-                        if (iUTF8+3 >= utf8Len) {
-                            result = EINVAL;
-                            break;
-                        }
+    cstr_spinlock_lock(&pAggregator->lock);
+    {
+        /*
+        This is a selection of the top N without any extra memory. Each pass finds the largest entry that comes after the previous pick in the sort order. Ties
+        are broken by the index of the entry so that each entry is only picked once.
+        */
+        size_t prevIndex = 0;
+        cstr_uint64 prevKey = 0;
 
-                        pUTF32[0] = ((cstr_utf32)(pUTF8[iUTF8+0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[iUTF8+1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[iUTF8+2] & 0x3F) << 6) | (pUTF8[iUTF8+3] & 0x3F);
-                        iUTF8 += 4;
+        while (count < entryCap && count < pAggregator->entryCount) {
+            size_t bestIndex = cstr_npos;
+            cstr_uint64 bestKey = 0;
+            size_t iEntry;
 
-                        if (!cstr_is_valid_code_point(pUTF32[0])) {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
-                    } else {
-                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                            result = CSTR_ECODEPOINT;
-                            break;
-                        } else {
-                            /* Replacement. */
-                            pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            iUTF8 += 1;
-                        }
-                    }
+            for (iEntry = 0; iEntry < pAggregator->entryCount; iEntry += 1) {
+                cstr_uint64 key = cstr_trace_report_entry_key(&pAggregator->pEntries[iEntry], sortBy);
+
+                if (count > 0 && (key > prevKey || (key == prevKey && iEntry <= prevIndex))) {
+                    continue;   /* Already picked. */
+                }
+
+                if (bestIndex == cstr_npos || key > bestKey) {
+                    bestIndex = iEntry;
+                    bestKey   = key;
                 }
             }
 
-            pUTF32   += 1;
-            utf32Cap -= 1;
-        }
+            pEntries[count] = pAggregator->pEntries[bestIndex];
+            count += 1;
 
-        if (pUTF8LenProcessed != NULL) {
-            *pUTF8LenProcessed = iUTF8;
+            prevIndex = bestIndex;
+            prevKey   = bestKey;
         }
     }
+    cstr_spinlock_unlock(&pAggregator->lock);
 
-    /* Null terminate. */
-    if (utf32Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF32[0] = 0;
-    }
+    return count;
+}
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = (utf32CapOriginal - utf32Cap);
-    }
 
-    return result;
+/*
+Hashing. This is a wyhash style hash. Each step multiplies two 64-bit values into a 128-bit result and folds the two halves together with an XOR which mixes
+every input bit into every output bit. Input is read in little-endian order so the result is the same on all platforms.
+*/
+#define CSTR_HASH64_SECRET0     CSTR_UINT64(0x2D358DCC, 0xAA6C78A5)
+#define CSTR_HASH64_SECRET1     CSTR_UINT64(0x8BB84B93, 0x962EACC9)
+#define CSTR_HASH64_SECRET2     CSTR_UINT64(0x4B33A62E, 0xD433D4A3)
+#define CSTR_HASH64_SECRET3     CSTR_UINT64(0x4D5A2DA5, 0x1DE1AA47)
+
+static CSTR_INLINE void cstr_mul128(cstr_uint64* pA, cstr_uint64* pB)
+{
+#if defined(__SIZEOF_INT128__)
+    __extension__ unsigned __int128 r = (unsigned __int128)*pA * *pB;
+    *pA = (cstr_uint64)r;
+    *pB = (cstr_uint64)(r >> 64);
+#elif defined(_MSC_VER) && defined(CSTR_X64)
+    *pA = _umul128(*pA, *pB, pB);
+#else
+    cstr_uint64 ha = *pA >> 32, la = (cstr_uint32)*pA;
+    cstr_uint64 hb = *pB >> 32, lb = (cstr_uint32)*pB;
+    cstr_uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    cstr_uint64 t  = rl + (rm0 << 32);
+    cstr_uint64 lo = t + (rm1 << 32);
+    cstr_uint64 c  = (t < rl) + (lo < t);
+    *pA = lo;
+    *pB = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
 }
 
-CSTR_API errno_t utf8_to_utf32le(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+static CSTR_INLINE cstr_uint64 cstr_hash64_mix(cstr_uint64 a, cstr_uint64 b)
 {
-    errno_t result;
-    size_t utf32Len;
+    cstr_mul128(&a, &b);
+    return a ^ b;
+}
 
-    /* Always do a native endian conversion first, then byte swap if necessary. */
-    result = utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+static CSTR_INLINE cstr_uint64 cstr_hash64_read32(const cstr_uint8* p)
+{
+    cstr_uint32 n;
+    CSTR_COPY_MEMORY(&n, p, 4);
+    return cstr_le2host_32(n);
+}
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = utf32Len;
-    }
+static CSTR_INLINE cstr_uint64 cstr_hash64_read64(const cstr_uint8* p)
+{
+    return cstr_hash64_read32(p) | (cstr_hash64_read32(p + 4) << 32);
+}
 
-    if (result != CSTR_SUCCESS) {
-        return result;
-    }
+CSTR_API cstr_uint64 cstr_hash64(const void* pData, size_t dataSize, cstr_uint64 seed)
+{
+    const cstr_uint8* p = (const cstr_uint8*)pData;
+    cstr_uint64 a;
+    cstr_uint64 b;
 
-    if (pUTF32 != NULL && !cstr_is_little_endian()) {
-        utf32_swap_endian(pUTF32, utf32Len);
+    seed ^= cstr_hash64_mix(seed ^ CSTR_HASH64_SECRET0, CSTR_HASH64_SECRET1);
+
+    if (dataSize <= 16) {
+        if (dataSize >= 4) {
+            /* Two overlapping pairs of 32-bit reads cover every length from 4 to 16 without a loop. */
+            size_t offset = (dataSize >> 3) << 2;
+            a = (cstr_hash64_read32(p) << 32) | cstr_hash64_read32(p + offset);
+            b = (cstr_hash64_read32(p + dataSize - 4) << 32) | cstr_hash64_read32(p + dataSize - 4 - offset);
+        } else if (dataSize > 0) {
+            a = ((cstr_uint64)p[0] << 16) | ((cstr_uint64)p[dataSize >> 1] << 8) | p[dataSize - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t remaining = dataSize;
+
+        if (remaining > 48) {
+            /* Three independent lanes so the multiplies can run in parallel. */
+            cstr_uint64 seed1 = seed;
+            cstr_uint64 seed2 = seed;
+
+            do {
+                seed  = cstr_hash64_mix(cstr_hash64_read64(p +  0) ^ CSTR_HASH64_SECRET1, cstr_hash64_read64(p +  8) ^ seed );
+                seed1 = cstr_hash64_mix(cstr_hash64_read64(p + 16) ^ CSTR_HASH64_SECRET2, cstr_hash64_read64(p + 24) ^ seed1);
+                seed2 = cstr_hash64_mix(cstr_hash64_read64(p + 32) ^ CSTR_HASH64_SECRET3, cstr_hash64_read64(p + 40) ^ seed2);
+                p += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (remaining > 16) {
+            seed = cstr_hash64_mix(cstr_hash64_read64(p) ^ CSTR_HASH64_SECRET1, cstr_hash64_read64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+
+        /* The last 16 bytes, which may overlap with bytes that have already been processed. */
+        a = cstr_hash64_read64(p + remaining - 16);
+        b = cstr_hash64_read64(p + remaining - 8);
     }
 
-    return CSTR_SUCCESS;
+    a ^= CSTR_HASH64_SECRET1;
+    b ^= seed;
+    cstr_mul128(&a, &b);
+
+    return cstr_hash64_mix(a ^ CSTR_HASH64_SECRET0 ^ (cstr_uint64)dataSize, b ^ CSTR_HASH64_SECRET1);
 }
 
-CSTR_API errno_t utf8_to_utf32be(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+
+#ifndef CSTR_NO_UTF8
+int cstr8_vscprintf(const char* pFormat, va_list args)
 {
-    errno_t result;
-    size_t utf32Len;
+#if defined(_MSC_VER)
+    #if _MSC_VER > 1200
+        return _vscprintf(pFormat, args);
+    #else
+        /*
+        We need to emulate _vscprintf() for the VC6 build. This can be made more efficient, but since it's only VC6 I'm happy to keep this simple. In the VC6
+        build we can implement this in terms of _vsnprintf().
+        */
+        int result;
+        char* pTempBuffer = NULL;
+        size_t tempBufferCap = 1024;
 
-    /* Always do a native endian conversion first, then byte swap if necessary. */
-    result = utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+        if (pFormat == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = utf32Len;
-    }
+	    for (;;) {
+            char* pNewTempBuffer = (char*)CSTR_REALLOC(pTempBuffer, tempBufferCap, NULL);    /* TODO: Add support for custom memory allocators? */
+            if (pNewTempBuffer == NULL) {
+                CSTR_FREE(pTempBuffer, NULL);
+                errno = ENOMEM;
+                return -1;  /* Out of memory. */
+            }
+
+            pTempBuffer = pNewTempBuffer;
+
+            result = _vsnprintf(pTempBuffer, tempBufferCap, pFormat, args);
+            CSTR_FREE(pTempBuffer, NULL);
+        
+            if (result != -1) {
+                break;  /* Got it. */
+            }
+
+            /* Buffer wasn't big enough. Ideally it'd be nice to use an error code to know the reason for sure, but this is reliable enough. */
+            tempBufferCap *= 2;
+	    }
 
-    if (result != CSTR_SUCCESS) {
         return result;
-    }
+    #endif
+#else
+    return vsnprintf(NULL, 0, pFormat, args);
+#endif
+}
 
-    if (pUTF32 != NULL && !cstr_is_big_endian()) {
-        utf32_swap_endian(pUTF32, utf32Len);
+static int cstr8_vsprintf(char* pOutput, const char* pFormat, va_list args)
+{
+    /* WARNING: This should only be used by first measuring the output string by setting pOutput to NULL. */
+
+    if (pOutput == NULL) {
+        return cstr8_vscprintf(pFormat, args);
+    } else {
+    #if (!defined(_MSC_VER) || _MSC_VER >= 1900) && !defined(__STRICT_ANSI__)
+        return vsnprintf(pOutput, (size_t)-1, pFormat, args);   /* We're lying about the length here. We should only be calling this internally, and only when computing the length beforehand, so it should be safe. */
+    #else
+        return vsprintf(pOutput, pFormat, args);
+    #endif
     }
+}
 
-    return CSTR_SUCCESS;
+
+/*
+When CSTR_ALIGNMENT is enabled, the prefixed data is moved forward within the allocation so that the content lands on an alignment boundary. The number of
+bytes it was moved by is stored in the byte just before the prefixed data so the allocation address can be recovered. It's always at least 1 so that byte
+exists. CSTR_ALLOCATION_SLACK is the most it can be moved by.
+*/
+#if CSTR_ALIGNMENT > 0
+    #define CSTR_ALLOCATION_SLACK   CSTR_ALIGNMENT
+#else
+    #define CSTR_ALLOCATION_SLACK   0
+#endif
+
+static CSTR_INLINE size_t cstr8_allocation_size(size_t cap)
+{
+    return CSTR_ALLOCATION_SLACK + CSTR_HEADER_SIZE_IN_BYTES + cap + 1 + CSTR_TAIL_PADDING; /* +1 for null terminator. */
 }
 
-CSTR_API errno_t utf8_to_wchar_len(size_t* pWCHARLen, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+static CSTR_INLINE size_t cstr8_get_allocation_offset(cstr8 str)
 {
-#if CSTR_SIZEOF_WCHAR_T == 2
-    return utf8_to_utf16_len(pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#if CSTR_ALIGNMENT > 0
+    return ((const cstr_uint8*)str)[-(ptrdiff_t)CSTR_HEADER_SIZE_IN_BYTES - 1];
 #else
-    return utf8_to_utf32_len(pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+    (void)str;
+    return 0;
 #endif
 }
 
-CSTR_API errno_t utf8_to_wchar(wchar_t* pWCHAR, size_t wcharCap, size_t* pWCHARLen, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+static CSTR_INLINE size_t cstr8_calculate_allocation_offset(void* pAllocationAddress)
 {
-#if CSTR_SIZEOF_WCHAR_T == 2
-    return utf8_to_utf16((cstr_utf16*)pWCHAR, wcharCap, pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#if CSTR_ALIGNMENT > 0
+    size_t addr = (size_t)pAllocationAddress + CSTR_HEADER_SIZE_IN_BYTES + 1;
+    return ((addr + (CSTR_ALIGNMENT - 1)) & ~(size_t)(CSTR_ALIGNMENT - 1)) - (size_t)pAllocationAddress - CSTR_HEADER_SIZE_IN_BYTES;
 #else
-    return utf8_to_utf32((cstr_utf32*)pWCHAR, wcharCap, pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+    (void)pAllocationAddress;
+    return 0;
 #endif
 }
 
+static CSTR_INLINE void* cstr8_to_allocation_address(cstr8 str)
+{
+    return str - CSTR_HEADER_SIZE_IN_BYTES - cstr8_get_allocation_offset(str);
+}
 
+/* The allocation offset must already have been written if alignment is enabled. See cstr8_place_in_allocation(). */
+static CSTR_INLINE cstr8 cstr8_from_allocation_address(void* pAllocationAddress, size_t offset)
+{
+    return (char*)pAllocationAddress + offset + CSTR_HEADER_SIZE_IN_BYTES;
+}
 
-CSTR_API errno_t utf16_to_utf8_len_internal(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+static CSTR_INLINE cstr8 cstr8_place_in_allocation(void* pAllocationAddress)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf8Len = 0;
-    cstr_utf16 w1;
-    cstr_utf16 w2;
-    cstr_utf32 utf32;
+    size_t offset = cstr8_calculate_allocation_offset(pAllocationAddress);
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
-    }
+#if CSTR_ALIGNMENT > 0
+    ((cstr_uint8*)pAllocationAddress)[offset - 1] = (cstr_uint8)offset;
+#endif
 
-    if (pUTF16LenProcessed != NULL) {
-        *pUTF16LenProcessed = 0;
-    }
+    return cstr8_from_allocation_address(pAllocationAddress, offset);
+}
 
-    if (pUTF16 == NULL) {
-        return EINVAL; /* Invalid input. */
-    }
+static CSTR_INLINE cstr8_header* cstr8_get_header(cstr8 str)
+{
+    return (cstr8_header*)(str - CSTR_HEADER_SIZE_IN_BYTES);
+}
 
-    if (utf16Len == 0 || pUTF16[0] == 0) {
-        return CSTR_SUCCESS;  /* Empty input string. Length is always 0. */
-    }
+static CSTR_INLINE void cstr8_set_cap(cstr8 str, size_t cap)
+{
+    cstr8_get_header(str)->cap = cap;
+}
 
-    /* Check for BOM. */
-    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+static CSTR_INLINE size_t cstr8_get_cap(cstr8 str)
+{
+    return cstr8_get_header(str)->cap;
+}
 
-        pUTF16 += 1; /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
-    }
+static CSTR_INLINE void cstr8_set_len(cstr8 str, size_t len)
+{
+    /* Every operation that modifies a string sets the length so this is where the cached information about the content is invalidated. */
+    cstr8_get_header(str)->len   = len;
+    cstr8_get_header(str)->flags = 0;
+}
 
-    if (utf16Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf16* pUTF16Original = pUTF16;
-        while (pUTF16[0] != 0) {
-            if (isLE) {
-                w1 = cstr_le2host_16(pUTF16[0]);
-            } else {
-                w1 = cstr_be2host_16(pUTF16[0]);
-            }
-            
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                pUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (pUTF16[1] == 0) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = cstr_le2host_16(pUTF16[1]);
-                        } else {
-                            w2 = cstr_be2host_16(pUTF16[1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = utf16_pair_to_utf32_cp(pUTF16);
-                        } else {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
+static CSTR_INLINE size_t cstr8_get_len(cstr8 str)
+{
+    return cstr8_get_header(str)->len;
+}
 
-                        pUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+static CSTR_INLINE cstr_bool32 cstr8_is_shared_internal(cstr8 str)
+{
+    /*
+    If the count is 1, the caller is the only owner and no other thread can be changing it. If it's greater than 1, another owner may release their reference
+    at any time, but the worst case is an unnecessary copy.
+    */
+    return cstr_atomic_load_32(&cstr8_get_header(str)->refcount) > 1;
+}
 
-                    pUTF16 += 1;
-                }
-            }
+static cstr8 cstr8_realloc(cstr8 str, size_t cap, const char* pOperation)
+{
+    size_t oldCap = cstr8_get_cap(str);
+    size_t oldOffset = cstr8_get_allocation_offset(str);
+    size_t newOffset;
+    void* addr = CSTR_REALLOC(cstr8_to_allocation_address(str), cstr8_allocation_size(cap));
+    if (addr == NULL) {
+        return NULL;    /* Failed */
+    }
 
-            utf8Len += utf32_cp_to_utf8_len(utf32);
-        }
+    /* The new allocation can have a different alignment in which case the string needs to be moved to the new boundary. */
+    newOffset = cstr8_calculate_allocation_offset(addr);
+    if (newOffset != oldOffset) {
+        str = cstr8_from_allocation_address(addr, oldOffset);
+        CSTR_MOVE_MEMORY((char*)addr + newOffset, (char*)addr + oldOffset, CSTR_HEADER_SIZE_IN_BYTES + cstr8_get_len(str) + 1);
+        CSTR_STATS_ADD(bytesMoved, CSTR_HEADER_SIZE_IN_BYTES + cstr8_get_len(str) + 1);
+    }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF16;
-        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
-            if (isLE) {
-                w1 = cstr_le2host_16(pUTF16[iUTF16+0]);
-            } else {
-                w1 = cstr_be2host_16(pUTF16[iUTF16+0]);
-            }
+    str = cstr8_place_in_allocation(addr);
+    cstr8_set_cap(str, cap);
 
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                iUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (iUTF16+1 > utf16Len) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = cstr_le2host_16(pUTF16[iUTF16+1]);
-                        } else {
-                            w2 = cstr_be2host_16(pUTF16[iUTF16+1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
-                        } else {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
+#if CSTR_TAIL_PADDING > 0
+    CSTR_ZERO_MEMORY(str + cap + 1, CSTR_TAIL_PADDING);
+#endif
 
-                        iUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+    CSTR_STATS_ADD(reallocCount, 1);
+    CSTR_STATS_ADD(bytesAllocated, cstr8_allocation_size(cap));
+    CSTR_TRACE_EVENT(realloc, pOperation, cstr8_allocation_size(cap), cstr8_allocation_size(oldCap));
 
-                    iUTF16 += 1;
-                }
-            }
+    return str;
+}
 
-            utf8Len += utf32_cp_to_utf8_len(utf32);
-        }
+static cstr8 cstr8_alloc_ex(size_t len, const char* pOperation)
+{
+    char* str;
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = iUTF16;
-        }
+    str = (char*)CSTR_CALLOC(cstr8_allocation_size(len));
+    if (str == NULL) {
+        return NULL;    /* Out of memory. */
     }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = utf8Len;
-    }
+    str = cstr8_place_in_allocation(str);
+    cstr8_get_header(str)->refcount = 1;
+    cstr8_set_cap(str, len);
 
-    return result;
+    CSTR_STATS_ADD(allocCount, 1);
+    CSTR_STATS_ADD(bytesAllocated, cstr8_allocation_size(len));
+    CSTR_TRACE_EVENT(alloc, pOperation, cstr8_allocation_size(len), 0);
+
+    return str;
 }
 
-CSTR_API errno_t utf16ne_to_utf8_len(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+/* Creates a new string with a capacity of `cap` containing the first `len` bytes of `str`. `str` is left unchanged. */
+static cstr8 cstr8_copy_ex(cstr8 str, size_t cap, size_t len, const char* pOperation)
 {
-    if (cstr_is_little_endian()) {
-        return utf16le_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    } else {
-        return utf16be_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    cstr8 newStr;
+
+    if (cap < len) {
+        cap = len;
     }
-}
 
-CSTR_API errno_t utf16le_to_utf8_len(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
-{
-    return utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_TRUE);
+    newStr = cstr8_alloc_ex(cap, pOperation);
+    if (newStr == NULL) {
+        return NULL;    /* Out of memory. */
+    }
+
+    CSTR_COPY_MEMORY(newStr, str, len);
+    CSTR_STATS_ADD(bytesCopied, len);
+    newStr[len] = '\0';
+    cstr8_set_len(newStr, len);
+
+    /* An exact copy has the same content so it can inherit everything that's known about it. */
+    if (len == cstr8_get_len(str)) {
+        cstr8_get_header(newStr)->flags = cstr8_get_header(str)->flags;
+    #if !defined(CSTR_NO_HASH_CACHE)
+        cstr8_get_header(newStr)->hash  = cstr8_get_header(str)->hash;
+    #endif
+    }
+
+    return newStr;
 }
 
-CSTR_API errno_t utf16be_to_utf8_len(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+/*
+Returns a string that is owned only by the caller, copying it if it's shared and releasing the caller's reference to the shared string. This is what makes
+mutating operations copy-on-write. Only the first `len` bytes are preserved in the copy. Don't use this when an input to the operation could be pointing into
+`str` because it may be freed by the time this returns.
+*/
+static cstr8 cstr8_make_unique_ex(cstr8 str, size_t len, const char* pOperation)
 {
-    return utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_FALSE);
+    cstr8 newStr;
+
+    if (!cstr8_is_shared_internal(str)) {
+        return str;
+    }
+
+    newStr = cstr8_copy_ex(str, cstr8_get_cap(str), len, pOperation);
+    if (newStr == NULL) {
+        return NULL;    /* Out of memory. */
+    }
+
+    cstr8_free(str);
+    return newStr;
 }
 
-CSTR_API errno_t utf16_to_utf8_len(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+/*
+Prepares a string for an append of up to `extraLen` bytes which the caller writes directly after the existing content, after which the caller sets the new
+length. The returned string is owned only by the caller. If `*ppSrc` points into `str`, it's updated to point to the same position in the returned string.
+*/
+static cstr8 cstr8_reserve_append(cstr8 str, size_t extraLen, const char** ppSrc, const char* pOperation)
 {
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
-    }
+    size_t len;
+    size_t srcOffset = (size_t)-1;
 
-    /* Check for BOM. */
-    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
-        errno_t result;
-        size_t utf16LenProcessed;
+    if (str == NULL) {
+        return cstr8_alloc_ex(extraLen, pOperation);
+    }
 
-        cstr_bool32 isLE;
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    len = cstr8_get_len(str);
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = utf16_is_bom_le((const cstr_uint8*)pUTF16);
-        
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
+    if (ppSrc != NULL && *ppSrc >= str && *ppSrc <= str + len) {
+        srcOffset = (size_t)(*ppSrc - str);
+    }
 
-        if (isLE) {
-            result = utf16le_to_utf8_len(pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = utf16be_to_utf8_len(pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+    if (cstr8_is_shared_internal(str)) {
+        /* The copy has the same content so the source can be redirected to it before the shared string is released. */
+        cstr8 newStr = cstr8_copy_ex(str, len + extraLen, len, pOperation);
+        if (newStr == NULL) {
+            return NULL;    /* Out of memory. */
         }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+        cstr8_free(str);
+        str = newStr;
+    } else if (cstr8_get_cap(str) < len + extraLen) {
+        str = cstr8_realloc(str, len + extraLen, pOperation);
+        if (str == NULL) {
+            return NULL;    /* Out of memory. */
         }
+    }
 
-        return result;
+    if (srcOffset != (size_t)-1) {
+        *ppSrc = str + srcOffset;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return utf16ne_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    return str;
 }
 
-
-CSTR_API errno_t utf16_to_utf8_internal(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+CSTR_API cstr8 cstr8_alloc(size_t len)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf8CapOriginal = utf8Cap;
-    cstr_utf16 w1;
-    cstr_utf16 w2;
-    cstr_utf32 utf32;
-    size_t utf8cpLen;   /* Code point length in UTF-8 code units. */
+    return cstr8_alloc_ex(len, "alloc");
+}
 
-    if (pUTF8 == NULL) {
-        return utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, isLE);
+CSTR_API void cstr8_free(cstr8 str)
+{
+    if (str == NULL) {
+        return;
     }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+    /* The atomic decrement can be skipped when there's only a single owner because nothing else can be holding a reference. */
+    if (cstr8_is_shared_internal(str)) {
+        if (cstr_atomic_fetch_add_32(&cstr8_get_header(str)->refcount, (cstr_uint32)-1) != 1) {
+            return; /* Other owners still hold a reference. */
+        }
     }
 
-    if (pUTF16LenProcessed != NULL) {
-        *pUTF16LenProcessed = 0;
-    }
+    CSTR_STATS_ADD(freeCount, 1);
+    CSTR_STATS_ADD(slackBytes, cstr8_get_cap(str) - cstr8_get_len(str));
+    CSTR_TRACE_EVENT(free, "free", 0, cstr8_allocation_size(cstr8_get_cap(str)));
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
-    }
-
-    /* Check for BOM. */
-    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    CSTR_FREE(cstr8_to_allocation_address(str));
+}
 
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
+CSTR_API cstr8 cstr8_retain(cstr8 str)
+{
+    if (str == NULL) {
+        return NULL;
     }
 
-    if (utf16Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf16* pUTF16Original = pUTF16;
-        while (pUTF16[0] != 0) {
-            if (utf8Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
-
-            if (isLE) {
-                w1 = cstr_le2host_16(pUTF16[0]);
-            } else {
-                w1 = cstr_be2host_16(pUTF16[0]);
-            }
-            
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                pUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (pUTF16[1] == 0) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = cstr_le2host_16(pUTF16[1]);
-                        } else {
-                            w2 = cstr_be2host_16(pUTF16[1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = utf16_pair_to_utf32_cp(pUTF16);
-                        } else {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
+    cstr_atomic_fetch_add_32(&cstr8_get_header(str)->refcount, 1);
+    return str;
+}
 
-                        pUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+CSTR_API void cstr8_release(cstr8 str)
+{
+    cstr8_free(str);
+}
 
-                    pUTF16 += 1;
-                }
-            }
+CSTR_API cstr_bool32 cstr8_is_shared(cstr8 str)
+{
+    if (str == NULL) {
+        return CSTR_FALSE;
+    }
 
-            utf8cpLen = utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
-            if (utf8cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+    return cstr8_is_shared_internal(str);
+}
 
-            pUTF8   += utf8cpLen;
-            utf8Cap -= utf8cpLen;
-        }
+CSTR_API cstr8 cstr8_make_unique(cstr8 str)
+{
+    if (str == NULL) {
+        return NULL;
+    }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF16;
-        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
-            if (utf8Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+    return cstr8_make_unique_ex(str, cstr8_get_len(str), "make_unique");
+}
 
-            if (isLE) {
-                w1 = cstr_le2host_16(pUTF16[iUTF16+0]);
-            } else {
-                w1 = cstr_be2host_16(pUTF16[iUTF16+0]);
-            }
+CSTR_API void cstr8_mark_modified(cstr8 str)
+{
+    if (str == NULL) {
+        return;
+    }
 
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                iUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (iUTF16+1 > utf16Len) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = cstr_le2host_16(pUTF16[iUTF16+1]);
-                        } else {
-                            w2 = cstr_be2host_16(pUTF16[iUTF16+1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
-                        } else {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
+    cstr8_get_header(str)->flags = 0;
+}
 
-                        iUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+CSTR_API cstr_uint64 cstr8_hash(cstr8 str)
+{
+#if !defined(CSTR_NO_HASH_CACHE)
+    cstr8_header* pHeader;
+    cstr_uint64 hash;
 
-                    iUTF16 += 1;
-                }
-            }
+    if (str == NULL) {
+        return cstr_hash64(NULL, 0, 0);
+    }
 
-            utf8cpLen = utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
-            if (utf8cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+    pHeader = cstr8_get_header(str);
+    if ((pHeader->flags & CSTR8_FLAG_HASH_VALID) != 0) {
+        return pHeader->hash;
+    }
 
-            pUTF8   += utf8cpLen;
-            utf8Cap -= utf8cpLen;
-        }
+    hash = cstr_hash64(str, pHeader->len, 0);
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = iUTF16;
-        }
-    }
-    
-    /* Null terminate. */
-    if (utf8Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF8[0] = 0;
+    /* A shared string could be hashed by multiple threads at the same time so the cache is only written when the caller is the only owner. */
+    if (!cstr8_is_shared_internal(str)) {
+        pHeader->hash   = hash;
+        pHeader->flags |= CSTR8_FLAG_HASH_VALID;
     }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = (utf8CapOriginal - utf8Cap);
+    return hash;
+#else
+    if (str == NULL) {
+        return cstr_hash64(NULL, 0, 0);
     }
 
-    return result;
+    return cstr_hash64(str, cstr8_get_len(str), 0);
+#endif
 }
 
-CSTR_API errno_t utf16ne_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+#if defined(CSTR_SUPPORT_SSE2) && CSTR_ALIGNMENT >= 16
+/* The content of a dynamic string is aligned and padded so every block can be loaded in full. The bytes of the last block past the length are masked out. */
+static cstr_bool32 cstr8_is_ascii_padded(cstr8 str, size_t len)
 {
-    if (cstr_is_little_endian()) {
-        return utf16le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    } else {
-        return utf16be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    size_t off = 0;
+    int mask;
+
+    while (off + 64 <= len) {
+        __m128i a = _mm_load_si128((const __m128i*)(str + off +  0));
+        __m128i b = _mm_load_si128((const __m128i*)(str + off + 16));
+        __m128i c = _mm_load_si128((const __m128i*)(str + off + 32));
+        __m128i d = _mm_load_si128((const __m128i*)(str + off + 48));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0) {
+            return CSTR_FALSE;
+        }
+
+        off += 64;
     }
-}
 
-CSTR_API errno_t utf16le_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
-{
-    return utf16_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_TRUE);
-}
+    while (off + 16 <= len) {
+        if (_mm_movemask_epi8(_mm_load_si128((const __m128i*)(str + off))) != 0) {
+            return CSTR_FALSE;
+        }
 
-CSTR_API errno_t utf16be_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
-{
-    return utf16_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_FALSE);
+        off += 16;
+    }
+
+    if (off == len) {
+        return CSTR_TRUE;
+    }
+
+    mask = _mm_movemask_epi8(_mm_load_si128((const __m128i*)(str + off)));
+    return (mask & ((1 << (len - off)) - 1)) == 0;
 }
+#endif
 
-CSTR_API errno_t utf16_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+CSTR_API cstr_bool32 cstr8_is_ascii(cstr8 str)
 {
-    if (pUTF8 == NULL) {
-        return utf16_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    }
+    cstr8_header* pHeader;
+    cstr_bool32 isASCII;
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+    if (str == NULL) {
+        return CSTR_FALSE;
     }
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
+    pHeader = cstr8_get_header(str);
+    if ((pHeader->flags & CSTR8_FLAG_ASCII_KNOWN) != 0) {
+        return (pHeader->flags & CSTR8_FLAG_ASCII) != 0;
     }
 
-    /* Check for BOM. */
-    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
-        errno_t result;
-        size_t utf16LenProcessed;
+#if defined(CSTR_SUPPORT_SSE2) && CSTR_ALIGNMENT >= 16
+    isASCII = cstr8_is_ascii_padded(str, pHeader->len);
+#else
+    isASCII = utf8_is_ascii(str, pHeader->len);
+#endif
 
-        cstr_bool32 isLE;
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+    /* Same rule as the hash. Only the sole owner can write to the cache. */
+    if (!cstr8_is_shared_internal(str)) {
+        pHeader->flags |= CSTR8_FLAG_ASCII_KNOWN;
+        if (isASCII) {
+            pHeader->flags |= CSTR8_FLAG_ASCII | CSTR8_FLAG_UTF8_KNOWN | CSTR8_FLAG_UTF8;
         }
+    }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = utf16_is_bom_le((const cstr_uint8*)pUTF16);
-        
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
+    return isASCII;
+}
 
-        if (isLE) {
-            result = utf16le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = utf16be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+CSTR_API cstr_bool32 cstr8_is_valid_utf8(cstr8 str)
+{
+    cstr8_header* pHeader;
+    cstr_bool32 isValid;
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
-        }
+    if (str == NULL) {
+        return CSTR_FALSE;
+    }
 
-        return result;
+    pHeader = cstr8_get_header(str);
+    if ((pHeader->flags & CSTR8_FLAG_UTF8_KNOWN) != 0) {
+        return (pHeader->flags & CSTR8_FLAG_UTF8) != 0;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return utf16ne_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-}
+    isValid = utf8_is_valid(str, pHeader->len);
 
+    if (!cstr8_is_shared_internal(str)) {
+        pHeader->flags |= CSTR8_FLAG_UTF8_KNOWN;
+        if (isValid) {
+            pHeader->flags |= CSTR8_FLAG_UTF8;
+        }
+    }
 
-CSTR_API errno_t utf16_to_utf32_len_internal(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
-{
-    errno_t result = CSTR_SUCCESS;
-    size_t utf32Len = 0;
-    cstr_utf16 w1;
-    cstr_utf16 w2;
+    return isValid;
+}
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
-    }
+CSTR_API cstr8 cstr8_newn(const char* pOther, size_t otherLen)
+{
+    cstr8 str;
 
-    if (pUTF16LenProcessed != NULL) {
-        *pUTF16LenProcessed = 0;
+    if (pOther == NULL) {
+        return NULL;
     }
 
-    if (pUTF16 == NULL) {
-        return EINVAL; /* Invalid input. */
+    if (otherLen == (size_t)-1) {
+        otherLen = utf8_strlen(pOther);
     }
 
-    if (utf16Len == 0 || pUTF16[0] == 0) {
-        return CSTR_SUCCESS;  /* Empty input string. Length is always 0. */
+    str = cstr8_alloc_ex(otherLen, "newn");
+    if (str == NULL) {
+        return NULL;    /* Out of memory. */
     }
 
-    /* Check for BOM. */
-    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    utf8_strncpy_s(str, otherLen+1, pOther, otherLen);  /* We've already calculated the length. No need for the added overhead of using the _s() version. */
+    CSTR_STATS_ADD(bytesCopied, otherLen);
 
-        pUTF16 += 1; /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
-    }
+    cstr8_set_cap(str, otherLen);
+    cstr8_set_len(str, otherLen);
 
-    if (utf16Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf16* pUTF16Original = pUTF16;
-        while (pUTF16[0] != 0) {
-            if (isLE) {
-                w1 = cstr_le2host_16(pUTF16[0]);
-            } else {
-                w1 = cstr_be2host_16(pUTF16[0]);
-            }
-            
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                pUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (pUTF16[1] == 0) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = cstr_le2host_16(pUTF16[1]);
-                        } else {
-                            w2 = cstr_be2host_16(pUTF16[1]);
-                        }
-                    
-                        /* Check for invalid code point. */
-                        if (!(w2 >= 0xDC00 && w2 <= 0xDFFF)) {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            }
-                        }
+    return str;
+}
 
-                        pUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    }
+CSTR_API cstr8 cstr8_new(const char* pOther)
+{
+    if (pOther == NULL) {
+        return NULL;
+    }
 
-                    pUTF16 += 1;
-                }
-            }
+    return cstr8_newn(pOther, utf8_strlen(pOther));
+}
 
-            utf32Len += 1;
-        }
+CSTR_API cstr8 cstr8_newv(const char* pFormat, va_list args)
+{
+    va_list args2;
+    size_t  len;
+    cstr8   str;
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF16;
-        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
-            if (isLE) {
-                w1 = cstr_le2host_16(pUTF16[iUTF16+0]);
-            } else {
-                w1 = cstr_be2host_16(pUTF16[iUTF16+0]);
-            }
+    if (pFormat == NULL) {
+        return NULL;
+    }
 
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                iUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (iUTF16+1 > utf16Len) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = cstr_le2host_16(pUTF16[iUTF16+1]);
-                        } else {
-                            w2 = cstr_be2host_16(pUTF16[iUTF16+1]);
-                        }
-                    
-                        /* Check for invalid code point. */
-                        if (!(w2 >= 0xDC00 && w2 <= 0xDFFF)) {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            }
-                        }
+#if !defined(_MSC_VER) || _MSC_VER >= 1800
+    va_copy(args2, args);
+#else
+    args2 = args;
+#endif
 
-                        iUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    }
+    len = cstr8_vsprintf(NULL, pFormat, args2);
+    if (len < 0) {
+        return NULL;
+    }
 
-                    iUTF16 += 1;
-                }
-            }
+    str = cstr8_alloc_ex(len, "newv");
+    if (str == NULL) {
+        return str; /* Out of memory. */
+    }
 
-            utf32Len += 1;
-        }
+    cstr8_vsprintf(str, pFormat, args);
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = iUTF16;
-        }
-    }
+    cstr8_set_cap(str, len);
+    cstr8_set_len(str, len);
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = utf32Len;
-    }
+    va_end(args2);
 
-    return result;
+    return str;
 }
 
-CSTR_API errno_t utf16ne_to_utf32_len(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+CSTR_API cstr cstr8_newf(const char* pFormat, ...)
 {
-    if (cstr_is_little_endian()) {
-        return utf16le_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    } else {
-        return utf16be_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    va_list args;
+    cstr8 str;
+
+    if (pFormat == NULL) {
+        return NULL;
     }
-}
 
-CSTR_API errno_t utf16le_to_utf32_len(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
-{
-    return utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_TRUE);
-}
+    va_start(args, pFormat);
+    str = cstr8_newv(pFormat, args);
+    va_end(args);
 
-CSTR_API errno_t utf16be_to_utf32_len(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
-{
-    return utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_FALSE);
+    return str;
 }
 
-CSTR_API errno_t utf16_to_utf32_len(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+CSTR_API cstr8 cstr8_setn(cstr8 str, const char* pOther, size_t otherLen)
 {
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
+    if (pOther == NULL) {
+        pOther   = "";
+        otherLen = 0;
     }
 
-    /* Check for BOM. */
-    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
-        errno_t result;
-        size_t utf16LenProcessed;
-
-        cstr_bool32 isLE;
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+    if (str == NULL) {
+        return cstr8_newn(pOther, otherLen);
+    }  else {
+        if (otherLen == (size_t)-1) {
+            otherLen = utf8_strlen(pOther);
         }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = utf16_is_bom_le((const cstr_uint8*)pUTF16);
-        
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
+        if (str != pOther) {
+            if (cstr8_is_shared_internal(str)) {
+                /* Other owners must not see the change so a new string is created. pOther could be pointing into the shared string so it's released last. */
+                cstr8 newStr = cstr8_newn(pOther, otherLen);
+                if (newStr == NULL) {
+                    return NULL;    /* Out of memory. */
+                }
 
-        if (isLE) {
-            result = utf16le_to_utf32_len(pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+                cstr8_free(str);
+                return newStr;
+            }
+
+            if (cstr8_get_cap(str) < otherLen) {
+                str = cstr8_realloc(str, otherLen, "setn");
+                if (str == NULL) {
+                    return NULL;    /* Out of memory. Return NULL. The caller can worry about memory management if it's important to them. */
+                }
+            }
+
+            CSTR_COPY_MEMORY(str, pOther, otherLen);
+            CSTR_STATS_ADD(bytesCopied, otherLen);
         } else {
-            result = utf16be_to_utf32_len(pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+            /* str and pOther are the same string. No need for a data copy, but we do need to set the length (calculated at the top if pOther is null terminated). */
+            str = cstr8_make_unique_ex(str, otherLen, "setn");
+            if (str == NULL) {
+                return NULL;    /* Out of memory. */
+            }
         }
+        
+        str[otherLen] = '\0';
+        cstr8_set_len(str, otherLen);
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = utf16LenProcessed + 1;
-        }
+        return str;
+    }
+}
 
-        return result;
+CSTR_API cstr8 cstr8_set(cstr8 str, const char* pOther)
+{
+    if (pOther == NULL) {
+        pOther = "";
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return utf16ne_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    return cstr8_setn(str, pOther, utf8_strlen(pOther));
 }
 
 
-CSTR_API errno_t utf16_to_utf32_internal(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+CSTR_API cstr8 cstr8_catn(cstr8 str, const char* pOther, size_t otherLen)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf32CapOriginal = utf32Cap;
-    cstr_utf16 w1;
-    cstr_utf16 w2;
-    cstr_utf32 utf32;
-
-    if (pUTF32 == NULL) {
-        return utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, isLE);
-    }
-
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
-    }
-
-    if (pUTF16LenProcessed != NULL) {
-        *pUTF16LenProcessed = 0;
-    }
-
-    if (pUTF32 == NULL) {
-        return EINVAL;
+    if (pOther == NULL) {
+        return str;
     }
 
-    /* Check for BOM. */
-    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    if (str == NULL) {
+        return cstr8_newn(pOther, otherLen);
+    } else {
+        size_t len = cstr8_get_len(str);
 
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
+        if (otherLen == (size_t)-1) {
+            otherLen = utf8_strlen(pOther);
         }
-    }
-
-    if (utf16Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf16* pUTF16Original = pUTF16;
-        while (pUTF16[0] != 0) {
-            if (utf32Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
 
-            if (isLE) {
-                w1 = cstr_le2host_16(pUTF16[0]);
-            } else {
-                w1 = cstr_be2host_16(pUTF16[0]);
+        if (cstr8_is_shared_internal(str)) {
+            /* Other owners must not see the change so a new string is created. pOther could be pointing into the shared string so it's released last. */
+            cstr8 newStr = cstr8_copy_ex(str, len + otherLen, len, "catn");
+            if (newStr == NULL) {
+                return NULL;
             }
-            
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                pUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (pUTF16[1] == 0) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = cstr_le2host_16(pUTF16[1]);
-                        } else {
-                            w2 = cstr_be2host_16(pUTF16[1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = utf16_pair_to_utf32_cp(pUTF16);
-                        } else {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
 
-                        pUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+            CSTR_COPY_MEMORY(newStr + len, pOther, otherLen);
+            CSTR_STATS_ADD(bytesCopied, otherLen);
+            newStr[len + otherLen] = '\0';
+            cstr8_set_len(newStr, len + otherLen);
 
-                    pUTF16 += 1;
-                }
-            }
+            cstr8_free(str);
+            return newStr;
+        }
 
-            if (isLE) {
-                pUTF32[0] = cstr_host2le_32(utf32);
-            } else {
-                pUTF32[0] = cstr_host2be_32(utf32);
+        if (cstr8_get_cap(str) < len + otherLen) {
+            str = cstr8_realloc(str, len + otherLen, "catn");
+            if (str == NULL) {
+                return NULL;
             }
-            
-            pUTF32   += 1;
-            utf32Cap -= 1;
         }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF16;
-        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
-            if (utf32Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+        CSTR_COPY_MEMORY(str + len, pOther, otherLen);
+        CSTR_STATS_ADD(bytesCopied, otherLen);
+        str[len + otherLen] = '\0';
 
-            if (isLE) {
-                w1 = cstr_le2host_16(pUTF16[iUTF16+0]);
-            } else {
-                w1 = cstr_be2host_16(pUTF16[iUTF16+0]);
-            }
+        cstr8_set_len(str, len + otherLen);
 
-            if (w1 < 0xD800 || w1 > 0xDFFF) {
-                /* 1 UTF-16 code unit. */
-                utf32 = w1;
-                iUTF16 += 1;
-            } else {
-                /* 2 UTF-16 code units, or an error. */
-                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
-                    if (iUTF16+1 > utf16Len) {
-                        result = EINVAL; /* Ran out of input data. */
-                        break;
-                    } else {
-                        if (isLE) {
-                            w2 = cstr_le2host_16(pUTF16[iUTF16+1]);
-                        } else {
-                            w2 = cstr_be2host_16(pUTF16[iUTF16+1]);
-                        }
-                    
-                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
-                            utf32 = utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
-                        } else {
-                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                                result = CSTR_ECODEPOINT;
-                                break;
-                            } else {
-                                /* Replacement. */
-                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                            }
-                        }
+        return str;
+    }
+}
 
-                        iUTF16 += 2;
-                    }
-                } else {
-                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                        result = CSTR_ECODEPOINT;
-                        break;
-                    } else {
-                        /* Replacement. */
-                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                    }
+CSTR_API cstr8 cstr8_cat(cstr8 str, const char* pOther)
+{
+    if (pOther == NULL) {
+        return str;
+    }
 
-                    iUTF16 += 1;
-                }
-            }
+    return cstr8_catn(str, pOther, utf8_strlen(pOther));
+}
 
-            if (isLE) {
-                pUTF32[0] = cstr_host2le_32(utf32);
-            } else {
-                pUTF32[0] = cstr_host2be_32(utf32);
-            }
+CSTR_API cstr8 cstr8_catv(cstr8 str, const char* pFormat, va_list args)
+{
+    va_list args2;
+    size_t  len;
+    char*   formatted;
+    cstr8   newstr;
 
-            pUTF32   += 1;
-            utf32Cap -= 1;
-        }
+    if (pFormat == NULL) {
+        return NULL;
+    }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = iUTF16;
-        }
+#if !defined(_MSC_VER) || _MSC_VER >= 1800
+    va_copy(args2, args);
+#else
+    args2 = args;
+#endif
+
+    len = cstr8_vsprintf(NULL, pFormat, args2);
+    if (len < 0) {
+        return NULL;
     }
-    
-    /* Null terminate. */
-    if (utf32Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF32[0] = 0;
+
+    formatted = (char*)CSTR_MALLOC(len + 1);
+    if (formatted == NULL) {
+        return NULL;    /* Out of memory. */
     }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = (utf32CapOriginal - utf32Cap);
+    cstr8_vsprintf(formatted, pFormat, args);
+
+    CSTR_TRACE_BEGIN_OPERATION("catv");
+    newstr = cstr8_catn(str, formatted, len);
+    CSTR_TRACE_END_OPERATION();
+
+    CSTR_FREE(formatted);
+
+    if (newstr == NULL) {
+        return NULL;
     }
 
-    return result;
+    va_end(args2);
+    return newstr;
 }
 
-CSTR_API errno_t utf16ne_to_utf32ne(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+CSTR_API cstr8 cstr8_catf(cstr8 str, const char* pFormat, ...)
 {
-    if (cstr_is_little_endian()) {
-        return utf16le_to_utf32le(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
-    } else {
-        return utf16be_to_utf32be(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    va_list args;
+
+    if (pFormat == NULL) {
+        return NULL;
     }
-}
 
-CSTR_API errno_t utf16le_to_utf32le(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
-{
-    return utf16_to_utf32_internal(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_TRUE);
-}
+    va_start(args, pFormat);
+    str = cstr8_catv(str, pFormat, args);
+    va_end(args);
 
-CSTR_API errno_t utf16be_to_utf32be(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
-{
-    return utf16_to_utf32_internal(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_FALSE);
+    return str;
 }
 
-CSTR_API errno_t utf16_to_utf32(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+
+
+CSTR_API size_t cstr8_len(cstr8 str)
 {
-    if (pUTF32 == NULL) {
-        return utf16_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    if (str == NULL) {
+        return 0;
     }
 
-    if (pUTF32Len != NULL) {
-        *pUTF32Len = 0;
+    return cstr8_get_len(str);
+}
+
+CSTR_API size_t cstr8_cap(cstr8 str)
+{
+    if (str == NULL) {
+        return 0;
     }
 
-    if (pUTF32 == NULL) {
-        return EINVAL;
+    return cstr8_get_cap(str);
+}
+
+
+CSTR_API size_t cstr8_find(const char* str, const char* other)
+{
+    return cstr8_findn(str, (size_t)-1, other, (size_t)-1);
+}
+
+CSTR_API size_t cstr8_findn(const char* str, size_t strLen, const char* other, size_t otherLen)
+{
+    size_t strOff;
+
+    if (str == NULL || other == NULL) {
+        return cstr_npos;
     }
 
-    /* Check for BOM. */
-    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
-        errno_t result;
-        size_t utf16LenProcessed;
+    if (strLen == (size_t)-1) {
+        strLen = utf8_strlen(str);
+    }
 
-        cstr_bool32 isLE;
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    if (otherLen == (size_t)-1) {
+        otherLen = utf8_strlen(other);
+    }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = utf16_is_bom_le((const cstr_uint8*)pUTF16);
-        
-        pUTF16 += 1;    /* Skip past the BOM. */
-        if (utf16Len != (size_t)-1) {
-            utf16Len -= 1;
-        }
+    if (strLen == 0 || otherLen == 0) {
+        return cstr_npos;
+    }
 
-        if (isLE) {
-            result = utf16le_to_utf32le(pUTF32, utf32Cap, pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = utf16be_to_utf32be(pUTF32, utf32Cap, pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+    strOff = 0;
+    while ((strLen - strOff) >= otherLen) {
+        cstr_bool32 found = CSTR_TRUE;
+        size_t i;
+        for (i = 0; i < otherLen; i += 1) {
+            if (str[strOff + i] != other[i]) {
+                found = CSTR_FALSE;
+                break;
+            }
         }
 
-        if (pUTF16LenProcessed != NULL) {
-            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+        if (found) {
+            return strOff;
         }
 
-        return result;
+        strOff += 1;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return utf16ne_to_utf32ne(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    /* Getting here means we didn't find the other string at all. */
+    return cstr_npos;
 }
 
+CSTR_API size_t cstr8_find_last(const char* str, const char* other)
+{
+    return cstr8_findn_last(str, (size_t)-1, other, (size_t)-1);
+}
 
-CSTR_API errno_t utf32_to_utf8_len_internal(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+CSTR_API size_t cstr8_findn_last(const char* str, size_t strLen, const char* other, size_t otherLen)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf8Len = 0;
-    cstr_utf32 utf32;
+    size_t last = cstr_npos;
+    size_t runningOffset = 0;
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+    if (str == NULL || other == NULL) {
+        return cstr_npos;
     }
 
-    if (pUTF32LenProcessed != NULL) {
-        *pUTF32LenProcessed = 0;
+    if (strLen == (size_t)-1) {
+        strLen = utf8_strlen(str);
     }
 
-    if (pUTF32 == NULL) {
-        return EINVAL; /* Invalid input. */
+    if (otherLen == (size_t)-1) {
+        otherLen = utf8_strlen(other);
     }
 
-    if (utf32Len == 0 || pUTF32[0] == 0) {
-        return CSTR_SUCCESS;  /* Empty input string. Length is always 0. */
+    if (strLen == 0 || otherLen == 0) {
+        return cstr_npos;
     }
 
-    /* Check for BOM. */
-    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+    for (;;) {
+        size_t next = cstr8_findn(str + runningOffset, strLen - runningOffset, other, otherLen);
+        if (next == cstr_npos) {
+            break;  /* Didn't find any new occurances. */
         }
 
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
-    }
+        last = runningOffset + next;
 
-    if (utf32Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf32* pUTF32Original = pUTF32;
-        while (pUTF32[0] != 0) {
-            if (isLE) {
-                utf32 = cstr_le2host_32(pUTF32[0]);
-            } else {
-                utf32 = cstr_be2host_32(pUTF32[0]);
-            }
+        runningOffset += next + otherLen;
+    }
 
-            if (!cstr_is_valid_code_point(utf32)) {
-                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = CSTR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    return last;
+}
 
-            utf8Len += utf32_cp_to_utf8_len(utf32);
-            pUTF32  += 1;
-        }
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF32;
-        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
-            if (isLE) {
-                utf32 = cstr_le2host_32(pUTF32[iUTF32]);
-            } else {
-                utf32 = cstr_be2host_32(pUTF32[iUTF32]);
-            }
+CSTR_API const char* cstr8_substr_tagged(const char* str, const char* pTagBeg, const char* pTagEnd, size_t* pLen)
+{
+    size_t offsetBeg;
+    size_t offsetEnd;
 
-            if (!cstr_is_valid_code_point(utf32)) {
-                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = CSTR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    if (pLen != NULL) {
+        *pLen = 0;
+    }
 
-            utf8Len += utf32_cp_to_utf8_len(utf32);
+    if (pTagBeg == NULL || pTagBeg[0] == '\0') {
+        offsetBeg = 0;
+    } else {
+        offsetBeg = cstr8_find(str, pTagBeg);
+        if (offsetBeg == cstr_npos) {
+            return NULL; /* Could not find the begin tag in the other string. */
         }
+    }
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = iUTF32;
+    if (pTagEnd == NULL || pTagEnd[0] == '\0') {
+        offsetEnd = utf8_strlen(str);
+    } else {
+        offsetEnd = cstr8_find(str + offsetBeg + utf8_strlen(pTagBeg), pTagEnd);
+        if (offsetEnd == cstr_npos) {
+            return NULL; /* Could not find the end tag in the other string. */
+        } else {
+            offsetEnd += offsetBeg + utf8_strlen(pTagBeg) + utf8_strlen(pTagEnd);
         }
     }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = utf8Len;
+    if (pLen != NULL) {
+        *pLen = (offsetEnd - offsetBeg);
     }
 
-    return result;
+    return str + offsetBeg;
 }
 
-CSTR_API errno_t utf32ne_to_utf8_len(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+CSTR_API cstr8 cstr8_new_substr_tagged(const char* str, const char* pTagBeg, const char* pTagEnd)
 {
-    if (cstr_is_little_endian()) {
-        return utf32le_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    } else {
-        return utf32be_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    size_t len;
+    str = cstr8_substr_tagged(str, pTagBeg, pTagEnd, &len);
+    if (str == NULL) {
+        return NULL;
     }
-}
 
-CSTR_API errno_t utf32le_to_utf8_len(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
-{
-    return utf32_to_utf8_len_internal(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_TRUE);
+    return cstr8_newn(str, len);
 }
 
-CSTR_API errno_t utf32be_to_utf8_len(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+static cstr8 cstr8_replace_range_ex(cstr8 str, size_t replaceOffset, size_t replaceLen, const char* pOther, size_t otherLen, const char* pOtherPrepend, const char* pOtherAppend)
 {
-    return utf32_to_utf8_len_internal(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_FALSE);
-}
+    cstr8 newStr;
 
-CSTR_API errno_t utf32_to_utf8_len(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
-{
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+    if (str == NULL || replaceOffset + replaceLen > cstr8_len(str)) {
+        return str;
     }
 
-    /* Check for BOM. */
-    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
-        errno_t result;
-        size_t utf32LenProcessed;
+    if (replaceLen == 0) {
+        return str; /* Nothing to replace. */
+    }
 
-        cstr_bool32 isLE;
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    /* We can allow pOther to be NULL in which case it can be the same as a remove. */
+    if (pOther == NULL) {
+        pOther = "";
+    }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = utf32_is_bom_le((const cstr_uint8*)pUTF32);
-        
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+    if (otherLen == (size_t)-1) {
+        otherLen = utf8_strlen(pOther);
+    }
 
-        if (isLE) {
-            result = utf32le_to_utf8_len(pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = utf32be_to_utf8_len(pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+    
+    /* The string is split into 3 sections: the part before the replace, the replacement itself, and the part after the replacement. */
+    CSTR_TRACE_BEGIN_OPERATION("replace_range");
+    {
+        /* Pre-replacement. */
+        newStr = cstr8_newn(str, replaceOffset);
 
-        if (pUTF32LenProcessed) {
-            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
-        }
+        /* Replacement. */
+        if (pOtherPrepend != NULL) { newStr = cstr8_cat(newStr, pOtherPrepend); }
+        newStr = cstr8_catn(newStr, pOther, otherLen);
+        if (pOtherAppend  != NULL) { newStr = cstr8_cat(newStr, pOtherAppend ); }
 
-        return result;
+        /* Post-replacement. */
+        newStr = cstr8_catn(newStr, str + (replaceOffset + replaceLen), cstr8_len(str) - (replaceOffset + replaceLen));
+
+        /* We're done. Only free the old string if we actually have a new string. */
+        if (newStr != NULL) {
+            cstr8_free(str);
+        }
     }
+    CSTR_TRACE_END_OPERATION();
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return utf32ne_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    return newStr;
 }
 
+CSTR_API cstr8 cstr8_replace_range(cstr8 str, size_t replaceOffset, size_t replaceLength, const char* pOther, size_t otherLength)
+{
+    return cstr8_replace_range_ex(str, replaceOffset, replaceLength, pOther, otherLength, NULL, NULL);
+}
 
-CSTR_API errno_t utf32_to_utf8_internal(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+CSTR_API cstr8 cstr8_replace_range_tagged(cstr8 str, const char* pTagBeg, const char* pTagEnd, const char* pOther, const char* pOtherTagBeg, const char* pOtherTagEnd, cstr_bool32 keepTagsOnSeparateLines)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf8CapOriginal = utf8Cap;
-    size_t utf8cpLen;   /* Code point length in UTF-8 code units. */
-    cstr_utf32 utf32;
+    size_t strOffsetBeg;
+    size_t strOffsetEnd;
+    size_t otherSubstrLen;
+    const char* pOtherSubstr;
+    const char* pOtherNewLines = NULL;
 
-    if (pUTF8 == NULL) {
-        return utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, isLE);
+    if (str == NULL || pOther == NULL) {
+        return str;
     }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+    if (pTagBeg == NULL || pTagBeg[0] == '\0') {
+        strOffsetBeg = 0;
+    } else {
+        strOffsetBeg = cstr8_find(str, pTagBeg);
+        if (strOffsetBeg == cstr_npos) {
+            return str; /* Could not find begin tag. */
+        } else {
+            strOffsetBeg += utf8_strlen(pTagBeg);   /* Don't want to replace the tag itself. */
+        }
     }
 
-    if (pUTF32LenProcessed != NULL) {
-        *pUTF32LenProcessed = 0;
+    if (pTagEnd == NULL || pTagEnd[0] == '\0') {
+        strOffsetEnd = cstr8_len(str);
+    } else {
+        strOffsetEnd = cstr8_find(str + strOffsetBeg, pTagEnd);
+        if (strOffsetEnd == cstr_npos) {
+            return str; /* Could not find end tag. */
+        } else {
+            strOffsetEnd += strOffsetBeg;   /* When we searched for the string we started from the end of the beginning tag. Need to normalize the end offset. */
+        }
     }
 
-    if (pUTF8 == NULL) {
-        return EINVAL;
+    pOtherSubstr = cstr8_substr_tagged(pOther, pOtherTagBeg, pOtherTagEnd, &otherSubstrLen);
+    if (pOtherSubstr == NULL) {
+        return str; /* Failed to retrieve the substring of the other string. */
     }
 
-    /* Check for BOM. */
-    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
-
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+    if (keepTagsOnSeparateLines) {
+        pOtherNewLines = "\n";
     }
 
-    if (utf32Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf32* pUTF32Original = pUTF32;
-        while (pUTF32[0] != 0) {
-            if (utf8Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
-
-            if (isLE) {
-                utf32 = cstr_le2host_32(pUTF32[0]);
-            } else {
-                utf32 = cstr_be2host_32(pUTF32[0]);
-            }
-
-            if (!cstr_is_valid_code_point(utf32)) {
-                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = CSTR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
-
-            utf8cpLen = utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
-            if (utf8cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+    return cstr8_replace_range_ex(str, strOffsetBeg, strOffsetEnd - strOffsetBeg, pOtherSubstr, otherSubstrLen, pOtherNewLines, pOtherNewLines);
+}
 
-            pUTF8   += utf8cpLen;
-            utf8Cap -= utf8cpLen;
-            pUTF32  += 1;
-        }
+CSTR_API cstr8 cstr8_replace_all(cstr8 str, const char* pQuery, size_t queryLen, const char* pReplacement, size_t replacementLen)
+{
+    size_t offset = 0;
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF32;
-        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
-            if (utf8Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+    if (str == NULL || pQuery == NULL || pReplacement == NULL) {
+        return str;
+    }
 
-            if (isLE) {
-                utf32 = cstr_le2host_32(pUTF32[iUTF32]);
-            } else {
-                utf32 = cstr_be2host_32(pUTF32[iUTF32]);
-            }
+    if (queryLen == (size_t)-1) {
+        queryLen = utf8_strlen(pQuery);
+    }
 
-            if (!cstr_is_valid_code_point(utf32)) {
-                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = CSTR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    if (replacementLen == (size_t)-1) {
+        replacementLen = utf8_strlen(pReplacement);
+    }
 
-            utf8cpLen = utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
-            if (utf8cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+    /* We keep looping until there's no more occurrances. */
+    CSTR_TRACE_BEGIN_OPERATION("replace_all");
+    for (;;) {
+        size_t location;
 
-            pUTF8   += utf8cpLen;
-            utf8Cap -= utf8cpLen;
+        location = cstr8_findn(str + offset, cstr8_len(str) - offset, pQuery, queryLen);
+        if (location == cstr_npos) {
+            break;  /* We're done */
         }
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = iUTF32;
+        /* Getting here means we found one. We just need to replace a range. */
+        str = cstr8_replace_range(str, offset + location, queryLen, pReplacement, replacementLen);
+        if (str == NULL) {
+            break;  /* Out of memory. */
         }
-    }
-
-    /* Null terminate. */
-    if (utf8Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF8[0] = 0;
-    }
 
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = (utf8CapOriginal - utf8Cap);
+        offset += location + replacementLen;   /* Progress past the replacement. */
     }
+    CSTR_TRACE_END_OPERATION();
 
-    return result;
+    return str;
 }
 
-CSTR_API errno_t utf32ne_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+CSTR_API cstr8 cstr8_new_trim(const char* pOther)
 {
-    if (cstr_is_little_endian()) {
-        return utf32le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    } else {
-        return utf32be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    if (pOther == NULL) {
+        return NULL;
     }
-}
 
-CSTR_API errno_t utf32le_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
-{
-    return utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_TRUE);
+    return cstr8_newn_trim(pOther, (size_t)-1);
 }
 
-CSTR_API errno_t utf32be_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+CSTR_API cstr8 cstr8_newn_trim(const char* pOther, size_t otherLen)
 {
-    return utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_FALSE);
-}
+    size_t loff;
+    size_t roff;
 
-CSTR_API errno_t utf32_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
-{
-    if (pUTF8Len != NULL) {
-        *pUTF8Len = 0;
+    if (pOther == NULL) {
+        return NULL;
     }
 
-    /* Check for BOM. */
-    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
-        errno_t result;
-        size_t utf32LenProcessed;
-
-        cstr_bool32 isLE;
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    loff = utf8_ltrim_offset(pOther, otherLen);
+    roff = utf8_rtrim_offset(pOther, otherLen);
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = utf32_is_bom_le((const cstr_uint8*)pUTF32);
-        
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+    return cstr_newn(pOther + loff, roff - loff);
+}
 
-        if (isLE) {
-            result = utf32le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = utf32be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+CSTR_API cstr8 cstr8_trim(cstr8 str)
+{
+    size_t loff;
+    size_t roff;
+    cstr_uint32 knownFlags;
 
-        if (pUTF32LenProcessed) {
-            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
-        }
+    /* The length of the string will never expand which simplifies our memory management. */
+    loff = utf8_ltrim_offset(str, cstr8_len(str));
+    roff = utf8_rtrim_offset(str, cstr8_len(str));
 
-        return result;
+    str = cstr8_make_unique_ex(str, cstr8_len(str), "trim");
+    if (str == NULL) {
+        return NULL;    /* Out of memory. */
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return utf32ne_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32+1, utf32Len-1, pUTF32LenProcessed, flags);
-}
+    /* Trimming only removes whole code points so ASCII strings stay ASCII and valid UTF-8 stays valid. */
+    knownFlags = cstr8_get_header(str)->flags;
 
+    CSTR_MOVE_MEMORY(str, str + loff, (roff - loff));   /* Left trim by moving the string down). */
+    CSTR_STATS_ADD(bytesMoved, roff - loff);
+    cstr8_set_len(str, roff - loff);                    /* Set the length before the right trim. */
+    str[cstr8_get_len(str)] = '\0';                     /* Right trim by setting the null terminator. */
 
+    if ((knownFlags & CSTR8_FLAG_ASCII) != 0) {
+        cstr8_get_header(str)->flags |= CSTR8_FLAG_ASCII_KNOWN | CSTR8_FLAG_ASCII;
+    }
+    if ((knownFlags & CSTR8_FLAG_UTF8) != 0) {
+        cstr8_get_header(str)->flags |= CSTR8_FLAG_UTF8_KNOWN | CSTR8_FLAG_UTF8;
+    }
 
-CSTR_API errno_t utf32_to_utf16_len_internal(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
-{
-    errno_t result = CSTR_SUCCESS;
-    size_t utf16Len = 0;
-    cstr_utf32 utf32;
+    return str;
+}
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+CSTR_API cstr8 cstr8_remove_at(cstr8 str, size_t index)
+{
+    if (str == NULL) {
+        return NULL;
     }
 
-    if (pUTF32LenProcessed != NULL) {
-        *pUTF32LenProcessed = 0;
+    if (index >= cstr8_len(str)) {
+        return str; /* Out of bounds. */
     }
 
-    if (pUTF32 == NULL) {
-        return EINVAL; /* Invalid input. */
+    str = cstr8_make_unique_ex(str, cstr8_len(str), "remove_at");
+    if (str == NULL) {
+        return NULL;    /* Out of memory. */
     }
 
-    if (utf32Len == 0 || pUTF32[0] == 0) {
-        return CSTR_SUCCESS;  /* Empty input string. Length is always 0. */
-    }
+    CSTR_MOVE_MEMORY(str + index, str + index + 1, cstr8_len(str) - index); /* This will also move the null terminator. */
+    CSTR_STATS_ADD(bytesMoved, cstr8_len(str) - index);
 
-    /* Check for BOM. */
-    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    /* Removing a byte from an ASCII string leaves it as ASCII. The same is not true for UTF-8 because the byte might be part of a multi-byte code point. */
+    if ((cstr8_get_header(str)->flags & CSTR8_FLAG_ASCII) != 0) {
+        cstr8_set_len(str, cstr8_len(str) - 1);
+        cstr8_get_header(str)->flags |= CSTR8_FLAG_ASCII_KNOWN | CSTR8_FLAG_ASCII | CSTR8_FLAG_UTF8_KNOWN | CSTR8_FLAG_UTF8;
+    } else {
+        cstr8_set_len(str, cstr8_len(str) - 1);
+    }
 
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
-        }
+    return str;
+}
+
+CSTR_API cstr_view cstr_view_init(const char* pStr, size_t len)
+{
+    cstr_view view;
+
+    if (pStr == NULL) {
+        len = 0;
+    } else if (len == (size_t)-1) {
+        len = utf8_strlen(pStr);
     }
 
-    if (utf32Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf32* pUTF32Original = pUTF32;
-        while (pUTF32[0] != 0) {
-            if (isLE) {
-                utf32 = cstr_le2host_32(pUTF32[0]);
-            } else {
-                utf32 = cstr_be2host_32(pUTF32[0]);
-            }
+    view.p   = pStr;
+    view.len = len;
 
-            if (!cstr_is_valid_code_point(utf32)) {
-                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = CSTR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    return view;
+}
 
-            utf16Len += utf32_cp_to_utf16_len(utf32);
-            pUTF32   += 1;
-        }
+CSTR_API cstr_view cstr_view_from_cstr(cstr8 str)
+{
+    return cstr_view_init(str, (str != NULL) ? cstr8_get_len(str) : 0);
+}
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF32;
-        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
-            if (isLE) {
-                utf32 = cstr_le2host_32(pUTF32[iUTF32]);
-            } else {
-                utf32 = cstr_be2host_32(pUTF32[iUTF32]);
-            }
+CSTR_API cstr_view cstr_view_substr(cstr_view view, size_t offset, size_t len)
+{
+    if (offset > view.len) {
+        offset = view.len;
+    }
 
-            if (!cstr_is_valid_code_point(utf32)) {
-                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = CSTR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    if (len > view.len - offset) {
+        len = view.len - offset;
+    }
 
-            utf16Len += utf32_cp_to_utf16_len(utf32);
+    return cstr_view_init(view.p + offset, len);
+}
+
+CSTR_API cstr_view cstr_view_substr_tagged(cstr_view view, const char* pTagBeg, const char* pTagEnd)
+{
+    cstr_view tagBeg = cstr_view_init(pTagBeg, (size_t)-1);
+    cstr_view tagEnd = cstr_view_init(pTagEnd, (size_t)-1);
+    size_t offsetBeg;
+    size_t offsetEnd;
+
+    if (view.p == NULL) {
+        return cstr_view_init(NULL, 0);
+    }
+
+    if (tagBeg.len == 0) {
+        offsetBeg = 0;
+    } else {
+        offsetBeg = cstr_view_find(view, tagBeg);
+        if (offsetBeg == cstr_npos) {
+            return cstr_view_init(NULL, 0); /* Could not find the begin tag. */
         }
+    }
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = iUTF32;
+    if (tagEnd.len == 0) {
+        offsetEnd = view.len;
+    } else {
+        offsetEnd = cstr_view_find(cstr_view_substr(view, offsetBeg + tagBeg.len, (size_t)-1), tagEnd);
+        if (offsetEnd == cstr_npos) {
+            return cstr_view_init(NULL, 0); /* Could not find the end tag. */
         }
+
+        offsetEnd += offsetBeg + tagBeg.len + tagEnd.len;
     }
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = utf16Len;
+    return cstr_view_substr(view, offsetBeg, offsetEnd - offsetBeg);
+}
+
+CSTR_API cstr_view cstr_view_trim(cstr_view view)
+{
+    return cstr_view_rtrim(cstr_view_ltrim(view));
+}
+
+CSTR_API cstr_view cstr_view_ltrim(cstr_view view)
+{
+    if (view.p == NULL) {
+        return view;
     }
 
-    return result;
+    return cstr_view_substr(view, utf8_ltrim_offset(view.p, view.len), (size_t)-1);
 }
 
-errno_t utf32ne_to_utf16_len(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+CSTR_API cstr_view cstr_view_rtrim(cstr_view view)
 {
-    if (cstr_is_little_endian()) {
-        return utf32le_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    } else {
-        return utf32be_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    if (view.p == NULL) {
+        return view;
+    }
+
+    /* utf8_rtrim_offset() doesn't trim anything when the whole view is whitespace so that case needs to be handled explicitly. */
+    if (utf8_ltrim_offset(view.p, view.len) == view.len) {
+        return cstr_view_substr(view, 0, 0);
     }
+
+    return cstr_view_substr(view, 0, utf8_rtrim_offset(view.p, view.len));
 }
 
-CSTR_API errno_t utf32le_to_utf16_len(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+CSTR_API size_t cstr_view_find(cstr_view view, cstr_view other)
 {
-    return utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_TRUE);
+    if (view.p == NULL || other.p == NULL) {
+        return cstr_npos;
+    }
+
+    /* The lengths are always explicit. A length of (size_t)-1 can't be passed through because it would be interpreted as null terminated. */
+    if (view.len == 0 || other.len == 0) {
+        return cstr_npos;
+    }
+
+    return cstr8_findn(view.p, view.len, other.p, other.len);
 }
 
-CSTR_API errno_t utf32be_to_utf16_len(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+CSTR_API size_t cstr_view_find_last(cstr_view view, cstr_view other)
 {
-    return utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_FALSE);
+    if (view.p == NULL || other.p == NULL) {
+        return cstr_npos;
+    }
+
+    if (view.len == 0 || other.len == 0) {
+        return cstr_npos;
+    }
+
+    return cstr8_findn_last(view.p, view.len, other.p, other.len);
 }
 
-CSTR_API errno_t utf32_to_utf16_len(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+CSTR_API cstr_bool32 cstr_view_split(cstr_view* pRemaining, cstr_view delimiter, cstr_view* pToken)
 {
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+    size_t offset;
+
+    if (pToken != NULL) {
+        *pToken = cstr_view_init(NULL, 0);
     }
 
-    /* Check for BOM. */
-    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
-        errno_t result;
-        size_t utf32LenProcessed;
+    if (pRemaining == NULL || pRemaining->p == NULL) {
+        return CSTR_FALSE;
+    }
 
-        cstr_bool32 isLE;
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+    offset = cstr_view_find(*pRemaining, delimiter);
+    if (offset == cstr_npos) {
+        /* This is the last token. */
+        if (pToken != NULL) {
+            *pToken = *pRemaining;
         }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = utf32_is_bom_le((const cstr_uint8*)pUTF32);
-        
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
+        *pRemaining = cstr_view_init(NULL, 0);
+    } else {
+        if (pToken != NULL) {
+            *pToken = cstr_view_substr(*pRemaining, 0, offset);
         }
 
-        if (isLE) {
-            result = utf32le_to_utf16_len(pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = utf32be_to_utf16_len(pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        }
+        *pRemaining = cstr_view_substr(*pRemaining, offset + delimiter.len, (size_t)-1);
+    }
 
-        if (pUTF32LenProcessed) {
-            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
-        }
+    return CSTR_TRUE;
+}
 
-        return result;
+CSTR_API cstr_bool32 cstr_view_equal(cstr_view a, cstr_view b)
+{
+    if (a.len != b.len) {
+        return CSTR_FALSE;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return utf32ne_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    if (a.len == 0) {
+        return CSTR_TRUE;
+    }
+
+    return CSTR_COMPARE_MEMORY(a.p, b.p, a.len) == 0;
 }
 
 
-CSTR_API errno_t utf32_to_utf16_internal(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+/* Builds the mask of possible delimiters for a block of up to 64 bytes. */
+static cstr_uint64 cstr_split_scan_block(const cstr_split_iterator* pIterator, const cstr_uint8* pBlock, size_t len)
 {
-    errno_t result = CSTR_SUCCESS;
-    size_t utf16CapOriginal = utf16Cap;
-    size_t utf16cpLen;  /* Code point length in UTF-8 code units. */
-    cstr_utf32 utf32;
+    cstr_uint64 mask = 0;
+    size_t i;
 
-    if (pUTF16 == NULL) {
-        return utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, isLE);
+#if defined(CSTR_SUPPORT_SSE2)
+    if (len == 64 && pIterator->setCount > 0) {
+        __m128i blocks[4];
+        cstr_uint32 iBlock;
+        cstr_uint32 iSet;
+
+        blocks[0] = _mm_loadu_si128((const __m128i*)(pBlock +  0));
+        blocks[1] = _mm_loadu_si128((const __m128i*)(pBlock + 16));
+        blocks[2] = _mm_loadu_si128((const __m128i*)(pBlock + 32));
+        blocks[3] = _mm_loadu_si128((const __m128i*)(pBlock + 48));
+
+        for (iBlock = 0; iBlock < 4; iBlock += 1) {
+            __m128i matches = _mm_cmpeq_epi8(blocks[iBlock], _mm_set1_epi8((char)pIterator->set[0]));
+            for (iSet = 1; iSet < pIterator->setCount; iSet += 1) {
+                matches = _mm_or_si128(matches, _mm_cmpeq_epi8(blocks[iBlock], _mm_set1_epi8((char)pIterator->set[iSet])));
+            }
+
+            mask |= (cstr_uint64)(cstr_uint32)_mm_movemask_epi8(matches) << (iBlock * 16);
+        }
+
+        return mask;
     }
+#endif
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+    for (i = 0; i < len; i += 1) {
+        if ((pIterator->table[pBlock[i] >> 5] & (1U << (pBlock[i] & 31))) != 0) {
+            mask |= (cstr_uint64)1 << i;
+        }
     }
 
-    if (pUTF32LenProcessed != NULL) {
-        *pUTF32LenProcessed = 0;
+    return mask;
+}
+
+/* Returns the offset of the next possible delimiter at or after the cursor, or `len` if there are none. */
+static size_t cstr_split_next_candidate(cstr_split_iterator* pIterator)
+{
+    size_t offset;
+
+    for (;;) {
+        /* Bits before the cursor are for delimiters that have already been consumed, such as the bytes within a multi-byte separator. */
+        if (pIterator->mask != 0 && pIterator->cursor > pIterator->maskBase) {
+            size_t skip = pIterator->cursor - pIterator->maskBase;
+            if (skip >= 64) {
+                pIterator->mask = 0;
+            } else {
+                pIterator->mask &= ~(cstr_uint64)0 << skip;
+            }
+        }
+
+        if (pIterator->mask != 0) {
+            break;
+        }
+
+        if (pIterator->nextBlock >= pIterator->len) {
+            return pIterator->len;
+        }
+
+        pIterator->maskBase   = pIterator->nextBlock;
+        pIterator->mask       = cstr_split_scan_block(pIterator, (const cstr_uint8*)pIterator->pStr + pIterator->maskBase, (pIterator->len - pIterator->maskBase < 64) ? pIterator->len - pIterator->maskBase : 64);
+        pIterator->nextBlock += 64;
     }
 
-    if (pUTF16 == NULL) {
+    offset = pIterator->maskBase + cstr_ctz64(pIterator->mask);
+    pIterator->mask &= pIterator->mask - 1;
+
+    return offset;
+}
+
+CSTR_API int utf8_split_init(cstr_split_iterator* pIterator, const cstr_utf8* pStr, size_t len, const cstr_utf8* pDelimiter, size_t delimiterLen, cstr_uint32 flags)
+{
+    size_t i;
+
+    if (pIterator == NULL) {
         return EINVAL;
     }
 
-    /* Check for BOM. */
-    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+    CSTR_ZERO_OBJECT(pIterator);
 
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
+    if (pStr == NULL) {
+        if (len != 0 && len != (size_t)-1) {
+            return EINVAL;
         }
+
+        pStr = "";
+        len  = 0;
     }
 
-    if (utf32Len == (size_t)-1) {
-        /* Null terminated string. */
-        const cstr_utf32* pUTF32Original = pUTF32;
-        while (pUTF32[0] != 0) {
-            if (utf16Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
+    if (len == (size_t)-1) {
+        len = utf8_strlen(pStr);
+    }
 
-            if (isLE) {
-                utf32 = cstr_le2host_32(pUTF32[0]);
-            } else {
-                utf32 = cstr_be2host_32(pUTF32[0]);
-            }
+    if (pDelimiter == NULL) {
+        delimiterLen = 0;
+    } else if (delimiterLen == (size_t)-1) {
+        delimiterLen = utf8_strlen(pDelimiter);
+    }
 
-            if (!cstr_is_valid_code_point(utf32)) {
-                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = CSTR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
+    pIterator->pStr         = pStr;
+    pIterator->len          = len;
+    pIterator->pDelimiter   = pDelimiter;
+    pIterator->delimiterLen = delimiterLen;
+    pIterator->flags        = flags;
 
-            utf16cpLen = utf32_cp_to_utf16(utf32, pUTF16, utf16Cap);
-            if (utf16cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
+    /* Everything except the first byte of a multi-byte separator is compared when a candidate is found. */
+    for (i = 0; i < delimiterLen; i += 1) {
+        cstr_uint8 c = (cstr_uint8)pDelimiter[i];
 
-            if (isLE) {
-                if (utf16cpLen == 1) {
-                    pUTF16[0] = cstr_host2le_16(pUTF16[0]);
-                } else {
-                    pUTF16[0] = cstr_host2le_16(pUTF16[0]);
-                    pUTF16[1] = cstr_host2le_16(pUTF16[1]);
-                }
-            } else {
-                if (utf16cpLen == 1) {
-                    pUTF16[0] = cstr_host2be_16(pUTF16[0]);
-                } else {
-                    pUTF16[0] = cstr_host2be_16(pUTF16[0]);
-                    pUTF16[1] = cstr_host2be_16(pUTF16[1]);
+        if ((pIterator->table[c >> 5] & (1U << (c & 31))) == 0) {
+            pIterator->table[c >> 5] |= (1U << (c & 31));
+
+            if (pIterator->setCount <= CSTR_COUNTOF(pIterator->set)) {
+                if (pIterator->setCount < CSTR_COUNTOF(pIterator->set)) {
+                    pIterator->set[pIterator->setCount] = c;
                 }
-            }
 
-            pUTF16   += utf16cpLen;
-            utf16Cap -= utf16cpLen;
-            pUTF32   += 1;
+                pIterator->setCount += 1;   /* Goes one past the end of the set to indicate it's too big. */
+            }
         }
 
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
-        }
-    } else {
-        /* Fixed length string. */
-        size_t iUTF32;
-        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
-            if (utf16Cap == 0) {
-                result = ENOMEM;
-                break;
-            }
-
-            if (isLE) {
-                utf32 = cstr_le2host_32(pUTF32[iUTF32]);
-            } else {
-                utf32 = cstr_be2host_32(pUTF32[iUTF32]);
-            }
-
-            if (!cstr_is_valid_code_point(utf32)) {
-                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
-                    result = CSTR_ECODEPOINT;
-                    break;
-                } else {
-                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
-                }
-            }
-
-            utf16cpLen = utf32_cp_to_utf16(utf32, pUTF16, utf16Cap);
-            if (utf16cpLen == 0) {
-                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
-                break;
-            }
-
-            if (isLE) {
-                if (utf16cpLen == 1) {
-                    pUTF16[0] = cstr_host2le_16(pUTF16[0]);
-                } else {
-                    pUTF16[0] = cstr_host2le_16(pUTF16[0]);
-                    pUTF16[1] = cstr_host2le_16(pUTF16[1]);
-                }
-            } else {
-                if (utf16cpLen == 1) {
-                    pUTF16[0] = cstr_host2be_16(pUTF16[0]);
-                } else {
-                    pUTF16[0] = cstr_host2be_16(pUTF16[0]);
-                    pUTF16[1] = cstr_host2be_16(pUTF16[1]);
-                }
-            }
-
-            pUTF16   += utf16cpLen;
-            utf16Cap -= utf16cpLen;
-        }
-
-        if (pUTF32LenProcessed != NULL) {
-            *pUTF32LenProcessed = iUTF32;
+        if ((flags & CSTR_SPLIT_ANY_OF) == 0) {
+            break;
         }
     }
 
-    /* Null terminate. */
-    if (utf16Cap == 0) {
-        result = ENOMEM;    /* Not enough room in the output buffer. */
-    } else {
-        pUTF16[0] = 0;
+    if (pIterator->setCount > CSTR_COUNTOF(pIterator->set)) {
+        pIterator->setCount = 0;
     }
 
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = (utf16CapOriginal - utf16Cap);
+    /* Without a delimiter there's nothing to scan for and the whole string is the only token. */
+    if (delimiterLen == 0) {
+        pIterator->nextBlock = len;
     }
 
-    return result;
+    return 0;
 }
 
-CSTR_API errno_t utf32ne_to_utf16ne(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+CSTR_API cstr_bool32 utf8_split_next(cstr_split_iterator* pIterator, cstr_view* pToken)
 {
-    if (cstr_is_little_endian()) {
-        return utf32le_to_utf16le(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
-    } else {
-        return utf32be_to_utf16be(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    if (pToken != NULL) {
+        *pToken = cstr_view_init(NULL, 0);
     }
-}
 
-CSTR_API errno_t utf32le_to_utf16le(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
-{
-    return utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_TRUE);
-}
-
-CSTR_API errno_t utf32be_to_utf16be(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
-{
-    return utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_FALSE);
-}
-
-CSTR_API errno_t utf32_to_utf16(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
-{
-    if (pUTF16Len != NULL) {
-        *pUTF16Len = 0;
+    if (pIterator == NULL) {
+        return CSTR_FALSE;
     }
 
-    /* Check for BOM. */
-    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
-        errno_t result;
-        size_t utf32LenProcessed;
+    while (pIterator->cursor <= pIterator->len) {
+        size_t tokenBeg = pIterator->cursor;
+        size_t tokenEnd = cstr_split_next_candidate(pIterator);
 
-        cstr_bool32 isLE;
-        if ((flags & CSTR_FORBID_BOM) != 0) {
-            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
-        }
+        if (tokenEnd == pIterator->len) {
+            pIterator->cursor = pIterator->len + 1; /* This is the last token. */
+        } else if ((pIterator->flags & CSTR_SPLIT_ANY_OF) != 0) {
+            pIterator->cursor = tokenEnd + 1;
+        } else {
+            /* Only the first byte of the separator has been matched. */
+            if (pIterator->len - tokenEnd < pIterator->delimiterLen || CSTR_COMPARE_MEMORY(pIterator->pStr + tokenEnd + 1, pIterator->pDelimiter + 1, pIterator->delimiterLen - 1) != 0) {
+                continue;
+            }
 
-        /* With this function, we need to use the endian defined by the BOM. */
-        isLE = utf32_is_bom_le((const cstr_uint8*)pUTF32);
-        
-        pUTF32 += 1;    /* Skip past the BOM. */
-        if (utf32Len != (size_t)-1) {
-            utf32Len -= 1;
+            pIterator->cursor = tokenEnd + pIterator->delimiterLen;
         }
 
-        if (isLE) {
-            result = utf32le_to_utf16le(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
-        } else {
-            result = utf32be_to_utf16be(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        if (tokenEnd == tokenBeg && (pIterator->flags & CSTR_SPLIT_SKIP_EMPTY) != 0) {
+            continue;
         }
 
-        if (pUTF32LenProcessed) {
-            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        if (pToken != NULL) {
+            *pToken = cstr_view_init(pIterator->pStr + tokenBeg, tokenEnd - tokenBeg);
         }
 
-        return result;
+        return CSTR_TRUE;
     }
 
-    /* Getting here means there was no BOM, so assume native endian. */
-    return utf32ne_to_utf16ne(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, pUTF32LenProcessed, flags);
+    return CSTR_FALSE;
 }
 
-
-
-/**************************************************************************************************************************************************************
-
-Utilities
-
-**************************************************************************************************************************************************************/
-CSTR_API cstr_bool32 utf32_is_null_or_whitespace(const cstr_utf32* pUTF32, size_t utf32Len)
+CSTR_API int utf8_split_all(const cstr_utf8* pStr, size_t len, const cstr_utf8* pDelimiter, size_t delimiterLen, cstr_uint32 flags, cstr_view* pTokens, size_t tokenCap, size_t* pTokenCount)
 {
-    if (pUTF32 == NULL) {
-        return CSTR_TRUE;
+    cstr_split_iterator iterator;
+    cstr_view token;
+    size_t tokenCount = 0;
+    int result;
+
+    if (pTokenCount != NULL) {
+        *pTokenCount = 0;
     }
 
-    while (pUTF32[0] != 0 && utf32Len > 0) {
-        cstr_utf32 cp = pUTF32[0];
+    result = utf8_split_init(&iterator, pStr, len, pDelimiter, delimiterLen, flags);
+    if (result != 0) {
+        return result;
+    }
 
-        pUTF32   += 1;
-        utf32Len -= 1;
-        
-        if (cp >= 0x09 && cp <= 0x0D) {
-            continue;
+    while (utf8_split_next(&iterator, &token)) {
+        if (pTokens != NULL && tokenCount < tokenCap) {
+            pTokens[tokenCount] = token;
         }
 
-        if (cp >= 0x2000 && cp <= 0x200A) {
-            continue;
-        }
+        tokenCount += 1;
+    }
 
-        switch (cp) {
-            case 0x0020:
-            case 0x0085:
-            case 0x00A0:
-            case 0x1680:
-            case 0x2028:
-            case 0x2029:
-            case 0x202F:
-            case 0x205F:
-            case 0x3000:
-                continue;
+    if (pTokenCount != NULL) {
+        *pTokenCount = tokenCount;
+    }
 
-            default:
-                return CSTR_FALSE;
-        }
+    if (pTokens != NULL && tokenCount > tokenCap) {
+        return ENOMEM;
     }
 
-    /* Getting here means we reached the end of the string without finding anything other than whitespace which means the string is entire whitespace. */
-    return CSTR_TRUE;
+    return 0;
 }
+#endif /* CSTR_NO_UTF8 */
 
-CSTR_API cstr_bool32 utf32_is_newline(cstr_utf32 utf32)
-{
-    if (utf32 >= 0x0A && utf32 <= 0x0D) {
-        return CSTR_TRUE;
-    }
 
-    if (utf32 == 0x85) {
-        return CSTR_TRUE;
-    }
+/**************************************************************************************************************************************************************
 
-    if (utf32 >= 0x2028 && utf32 <= 0x2029) {
-        return CSTR_TRUE;
-    }
+Unicode
 
-    return CSTR_FALSE;
+**************************************************************************************************************************************************************/
+static CSTR_INLINE cstr_bool32 cstr_is_invalid_utf8_octet(cstr_utf8 utf8)
+{
+    /* RFC 3629 - Section 1: The octet values C0, C1, F5 to FF never appear. */
+    return (cstr_uint8)utf8 == 0xC0 || (cstr_uint8)utf8 == 0xC1 || (cstr_uint8)utf8 >= 0xF5;
 }
 
-CSTR_API cstr_bool32 utf8_is_null_or_whitespace(const cstr_utf8* pUTF8, size_t utf8Len)
+static CSTR_INLINE void utf32_cp_to_utf16_pair(cstr_utf32 utf32cp, cstr_utf16* pUTF16)
 {
-    if (pUTF8 == NULL) {
-        return CSTR_TRUE;
-    }
+    /* RFC 2781 - Section 2.1 */
+    cstr_utf32 u;
 
-    /* This could be faster, but it's practical. */
-    while (pUTF8[0] != '\0' && utf8Len > 0) {
-        cstr_utf32 utf32;
-        size_t utf8Processed;
-        int err;
+    CSTR_ASSERT(utf32cp >= 0x10000);
 
-        /* We expect ENOMEM to be returned, but we should still have a valid utf32 character. */
-        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
-        if (err != 0 && err != ENOMEM) {
-            break;
-        }
+    u = utf32cp - 0x10000;
+    pUTF16[0] = (cstr_utf16)(0xD800 | ((u & 0xFFC00) >> 10));
+    pUTF16[1] = (cstr_utf16)(0xDC00 | ((u & 0x003FF) >>  0));
+}
 
-        if (utf8Processed == 0) {
-            break;
-        }
+static CSTR_INLINE cstr_utf32 utf16_pair_to_utf32_cp(const cstr_utf16* pUTF16)
+{
+    /* RFC 2781 - Section 2.1 */
+    CSTR_ASSERT(pUTF16 != NULL);
 
-        if (utf32_is_null_or_whitespace(&utf32, 1) == CSTR_FALSE) {
-            return CSTR_FALSE;
-        }
+    return (((cstr_utf32)(pUTF16[0] & 0x003FF) << 10) | ((cstr_utf32)(pUTF16[1] & 0x003FF) << 0)) + 0x10000;
+}
 
-        pUTF8   += utf8Processed;
-        utf8Len -= utf8Processed;
-    }
+static CSTR_INLINE cstr_bool32 cstr_is_cp_in_surrogate_pair_range(cstr_utf32 utf32)
+{
+    return utf32 >= 0xD800 && utf32 <= 0xDFFF;
+}
 
-    return CSTR_TRUE;
+static CSTR_INLINE cstr_bool32 cstr_is_valid_code_point(cstr_utf32 utf32)
+{
+    return utf32 <= CSTR_UNICODE_MAX_CODE_POINT && !cstr_is_cp_in_surrogate_pair_range(utf32);
 }
 
-CSTR_API size_t utf8_next_whitespace(const cstr_utf8* pUTF8, size_t utf8Len)
+static CSTR_INLINE size_t utf32_cp_to_utf8_len(cstr_utf32 utf32)
 {
-    size_t utf8RunningOffset = 0;
+    /* This API assumes the the UTF-32 code point is valid. */
+    CSTR_ASSERT(utf32 <= CSTR_UNICODE_MAX_CODE_POINT);
+    CSTR_ASSERT(cstr_is_cp_in_surrogate_pair_range(utf32) == CSTR_FALSE);
 
-    if (pUTF8 == NULL) {
-        return cstr_npos;
+    if (utf32 <= 0x7F) {
+        return 1;
+    }
+    if (utf32 <= 0x7FF) {
+        return 2;
+    }
+    if (utf32 <= 0xFFFF) {
+        return 3;
+    }
+    if (utf32 <= 0x10FFFF) {
+        return 4;
     }
 
-    while (pUTF8[0] != '\0' && utf8Len > 0) {
-        cstr_utf32 utf32;
-        size_t utf8Processed;
-        int err;
-
-        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
-        if (err != 0 && err != ENOMEM) {
-            break;
-        }
+    /* Invalid. This function assume's the UTF-32 code point is valid so do an assert. */
+    CSTR_ASSERT(CSTR_FALSE);
+    return 0; /* Invalid. */
+}
 
-        if (utf8Processed == 0) {
-            break;
-        }
+static CSTR_INLINE size_t utf32_cp_to_utf8(cstr_utf32 utf32, cstr_utf8* pUTF8, size_t utf8Cap)
+{
+    /* This API assumes the the UTF-32 code point is valid. */
+    CSTR_ASSERT(utf32 <= CSTR_UNICODE_MAX_CODE_POINT);
+    CSTR_ASSERT(cstr_is_cp_in_surrogate_pair_range(utf32) == CSTR_FALSE);
+    CSTR_ASSERT(utf8Cap > 0);
 
-        if (utf32_is_null_or_whitespace(&utf32, 1) == CSTR_TRUE) {
-            return utf8RunningOffset;
+    if (utf32 <= 0x7F) {
+        if (utf8Cap >= 1) {
+            pUTF8[0] = (utf32 & 0x7F);
+            return 1;
+        }
+    }
+    if (utf32 <= 0x7FF) {
+        if (utf8Cap >= 2) {
+            pUTF8[0] = 0xC0 | (cstr_utf8)((utf32 & 0x07C0) >> 6);
+            pUTF8[1] = 0x80 | (cstr_utf8) (utf32 & 0x003F);
+            return 2;
+        }
+    }
+    if (utf32 <= 0xFFFF) {
+        if (utf8Cap >= 3) {
+            pUTF8[0] = 0xE0 | (cstr_utf8)((utf32 & 0xF000) >> 12);
+            pUTF8[1] = 0x80 | (cstr_utf8)((utf32 & 0x0FC0) >>  6);
+            pUTF8[2] = 0x80 | (cstr_utf8) (utf32 & 0x003F);
+            return 3;
+        }
+    }
+    if (utf32 <= 0x10FFFF) {
+        if (utf8Cap >= 4) {
+            pUTF8[0] = 0xF0 | (cstr_utf8)((utf32 & 0x1C0000) >> 18);
+            pUTF8[1] = 0x80 | (cstr_utf8)((utf32 & 0x03F000) >> 12);
+            pUTF8[2] = 0x80 | (cstr_utf8)((utf32 & 0x000FC0) >>  6);
+            pUTF8[3] = 0x80 | (cstr_utf8) (utf32 & 0x00003F);
+            return 4;
         }
-
-        utf8RunningOffset += utf8Processed;
-        pUTF8             += utf8Processed;
-        utf8Len           -= utf8Processed;
     }
 
-    return cstr_npos;
+    /* Getting here means there was not enough room in the output buffer. */
+    return 0;
 }
 
-
-CSTR_API size_t utf8_ltrim_offset(const cstr_utf8* pUTF8, size_t utf8Len)
+static CSTR_INLINE size_t utf32_cp_to_utf16_len(cstr_utf32 utf32)
 {
-    size_t utf8RunningOffset = 0;
+    /* This API assumes the the UTF-32 code point is valid. */
+    CSTR_ASSERT(utf32 <= CSTR_UNICODE_MAX_CODE_POINT);
+    CSTR_ASSERT(cstr_is_cp_in_surrogate_pair_range(utf32) == CSTR_FALSE);
 
-    if (pUTF8 == NULL) {
-        return cstr_npos;
+    if (utf32 <= 0xFFFF) {
+        return 1;
+    } else {
+        return 2;
     }
 
-    while (pUTF8[0] != '\0' && utf8Len > 0) {
-        cstr_utf32 utf32;
-        size_t utf8Processed;
-        int err;
+    /* Unreachable. */
+#if 0
+    /* Invalid. This function assume's the UTF-32 code point is valid so do an assert. */
+    CSTR_ASSERT(CSTR_FALSE);
+    return 0; /* Invalid. */
+#endif
+}
 
-        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
-        if (err != 0 && err != ENOMEM) {
-            break;
-        }
+static CSTR_INLINE size_t utf32_cp_to_utf16(cstr_utf32 utf32, cstr_utf16* pUTF16, size_t utf16Cap)
+{
+    /* This API assumes the the UTF-32 code point is valid. */
+    CSTR_ASSERT(utf32 <= CSTR_UNICODE_MAX_CODE_POINT);
+    CSTR_ASSERT(cstr_is_cp_in_surrogate_pair_range(utf32) == CSTR_FALSE);
+    CSTR_ASSERT(utf16Cap > 0);
 
-        if (utf8Processed == 0) {
-            break;
+    if (utf32 <= 0xFFFF) {
+        if (utf16Cap >= 1) {
+            pUTF16[0] = (cstr_utf16)utf32;
+            return 1;
         }
-
-        if (utf32_is_null_or_whitespace(&utf32, 1) == CSTR_FALSE) {
-            break;
+    } else {
+        if (utf16Cap >= 2) {
+            utf32_cp_to_utf16_pair(utf32, pUTF16);
+            return 2;
         }
-
-        utf8RunningOffset += utf8Processed;
-        pUTF8             += utf8Processed;
-        utf8Len           -= utf8Processed;
     }
 
-    return utf8RunningOffset;
+    /* Getting here means there was not enough room in the output buffer. */
+    return 0;
 }
 
-CSTR_API size_t utf8_rtrim_offset(const cstr_utf8* pUTF8, size_t utf8Len)
-{
-    size_t utf8RunningOffset = 0;
-    size_t utf8LastNonWhitespaceOffset = utf8Len;
-
-    if (pUTF8 == NULL) {
-        return cstr_npos;
-    }
-
-    for (;;) {
-        cstr_utf32 utf32;
-        size_t utf8Processed;
-        int err;
 
-        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
-        if (err != 0 && err != ENOMEM) {
-            break;
-        }
 
-        if (utf8Processed == 0) {
-            break;
-        }
 
-        utf8RunningOffset += utf8Processed;
 
-        if (utf32_is_null_or_whitespace(&utf32, 1) == CSTR_FALSE) {
-            utf8LastNonWhitespaceOffset = utf8RunningOffset;
-        }
+CSTR_API cstr_bool32 utf16_is_bom_le(const cstr_uint8 bom[2])
+{
+    /* RFC 2781 - Section 3.2 */
+    return bom[0] == 0xFF && bom[1] == 0xFE;
+}
 
-        pUTF8   += utf8Processed;
-        utf8Len -= utf8Processed;
-    }
+CSTR_API cstr_bool32 utf16_is_bom_be(const cstr_uint8 bom[2])
+{
+    /* RFC 2781 - Section 3.2 */
+    return bom[0] == 0xFE && bom[1] == 0xFF;
+}
 
-    return utf8LastNonWhitespaceOffset;
+CSTR_API cstr_bool32 utf32_is_bom_le(const cstr_uint8 bom[4])
+{
+    return bom[0] == 0xFF && bom[1] == 0xFE && bom[2] == 0x00 && bom[3] == 0x00;
 }
 
-CSTR_API size_t utf8_next_line(const cstr_utf8* pUTF8, size_t utf8Len, size_t* pThisLineLen)
+CSTR_API cstr_bool32 utf32_is_bom_be(const cstr_uint8 bom[4])
 {
-    size_t thisLen = 0;
-    size_t nextBeg = 0;
+    return bom[0] == 0x00 && bom[1] == 0x00 && bom[2] == 0xFE && bom[3] == 0xFF;
+}
 
-    if (pThisLineLen != NULL) {
-        *pThisLineLen = 0;
+CSTR_API cstr_bool32 utf8_has_bom(const cstr_uint8* pBytes, size_t len)
+{
+    if (pBytes == NULL) {
+        return CSTR_FALSE;
     }
 
-    if (pUTF8 == NULL) {
-        return cstr_npos;
+    if (len < 3) {
+        return CSTR_FALSE;
     }
 
-    /* This could be faster, but it's practical. */
-    while (pUTF8[0] != '\0' && utf8Len > 0) {
-        cstr_utf32 utf32;
-        size_t utf8Processed;
-        int err;
-
-        /* We expect ENOMEM to be returned, but we should still have a valid utf32 character. */
-        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
-        if (err != 0 && err != ENOMEM) {
-            break;
-        }
-
-        if (utf8Processed == 0) {
-            break;
-        }
-
-        nextBeg += utf8Processed;
+    return (pBytes[0] == 0xEF && pBytes[1] == 0xBB && pBytes[2] == 0xBF);
+}
 
-        if (utf32_is_newline(utf32) == CSTR_TRUE) {
-            /* Special case for \r\n. This needs to be treated as one line. The \r by itself should also be treated as a new line, however. */
-            if (utf8Len + utf8Processed > 0 && pUTF8[utf8Processed] == '\n') {
-                nextBeg += 1;
-            }
+CSTR_API cstr_bool32 utf16_has_bom(const cstr_uint8* pBytes, size_t len)
+{
+    if (pBytes == NULL) {
+        return CSTR_FALSE;
+    }
 
-            break;
-        }
+    if (len < 2) {
+        return CSTR_FALSE;
+    }
 
-        CSTR_ASSERT(utf8Len >= utf8Processed);  /* If there wasn't enough data in the UTF-8 string, utf8_to_utf32() should have failed. */
+    return utf16_is_bom_le(pBytes) || utf16_is_bom_be(pBytes);
+}
 
-        thisLen += utf8Processed;
-        pUTF8   += utf8Processed;
-        utf8Len -= utf8Processed;
+CSTR_API cstr_bool32 utf32_has_bom(const cstr_uint8* pBytes, size_t len)
+{
+    if (pBytes == NULL) {
+        return CSTR_FALSE;
     }
 
-    if (pThisLineLen != NULL) {
-        *pThisLineLen = thisLen;
+    if (len < 4) {
+        return CSTR_FALSE;
     }
 
-    return nextBeg;
+    return utf32_is_bom_le(pBytes) || utf32_is_bom_be(pBytes);
 }
 
 
-/**************************************************************************************************************************************************************
-
-Lexer
+CSTR_API void utf16_swap_endian(cstr_utf16* pUTF16, size_t count)
+{
+    if (count == (size_t)-1) {
+        size_t i;
+        for (i = 0; i < count; ++i) {
+            pUTF16[i] = cstr_swap_endian_uint16(pUTF16[i]);
+        }
+    } else {
+        while (pUTF16[0] != 0) {
+            pUTF16[0] = cstr_swap_endian_uint16(pUTF16[0]);
+            pUTF16 += 1;
+        }
+    }
+}
 
-**************************************************************************************************************************************************************/
-CSTR_API int cstr_lexer_init(const char* pText, size_t textLen, cstr_lexer* pLexer)
+CSTR_API void utf32_swap_endian(cstr_utf32* pUTF32, size_t count)
 {
-    if (pLexer == NULL) {
-        return EINVAL;  /* Invalid arguments. */
+    if (count == (size_t)-1) {
+        size_t i;
+        for (i = 0; i < count; ++i) {
+            pUTF32[i] = cstr_swap_endian_uint32(pUTF32[i]);
+        }
+    } else {
+        while (pUTF32[0] != 0) {
+            pUTF32[0] = cstr_swap_endian_uint32(pUTF32[0]);
+            pUTF32 += 1;
+        }
     }
+}
 
-    CSTR_ZERO_OBJECT(pLexer);
 
-    if (pText == NULL) {
-        return EINVAL;  
+CSTR_API errno_t utf8_to_utf16_len(size_t* pUTF16Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf16Len = 0;
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
     }
 
-    pLexer->pText      = pText;
-    pLexer->textLen    = textLen;
-    pLexer->textOff    = 0;
-    pLexer->lineNumber = 1;
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
 
-    /* We do not use the null terminator to know the end of the string so we need to calculate it now. */
-    if (pLexer->textLen == (size_t)-1) {
-        pLexer->textLen = utf8_strlen(pText);
+    if (pUTF8 == NULL) {
+        return EINVAL;   /* Invalid input. */
     }
 
-    return 0;
-}
+    if (utf8Len == 0 || pUTF8[0] == 0) {
+        return CSTR_SUCCESS;   /* Empty input string. Length is always 0. */
+    }
 
-static int cstr_lexer_set_token(cstr_lexer* pLexer, cstr_utf32 token, size_t tokenLen)
-{
-    CSTR_ASSERT(pLexer != NULL);
-
-    pLexer->token     = token;
-    pLexer->pTokenStr = pLexer->pText + pLexer->textOff;
-    pLexer->tokenLen  = tokenLen;
-    pLexer->textOff  += tokenLen;
-
-    if (token == cstr_token_type_newline) {
-        pLexer->lineNumber += 1;
-    }
-
-    /* We need to parse comments and strings to find line numbers. */
-    if (token == cstr_token_type_comment || token == cstr_token_type_string_double || token == cstr_token_type_string_single) {
-        const char* pRunningStr = pLexer->pTokenStr;
-        for (;;) {
-            size_t thisLineLen;
-            size_t nextLineOff = utf8_next_line(pRunningStr, pLexer->tokenLen - (pRunningStr - pLexer->pTokenStr), &thisLineLen);
-            if (nextLineOff == thisLineLen) {
-                break;  /* Reached the end. */
-            }
+    /* Check for BOM. */
+    if (utf8_has_bom((const cstr_uint8*)pUTF8, utf8Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
 
-            pRunningStr += nextLineOff;
-            pLexer->lineNumber += 1;
+        pUTF8 += 3; /* Skip past the BOM. */
+        if (utf8Len != (size_t)-1) {
+            utf8Len -= 3;
         }
     }
 
-    return 0;
-}
+    if ((flags & CSTR_INPUT_IS_ASCII) != 0) {
+        /* The caller has guaranteed the input is ASCII so every byte is exactly one code unit. */
+        if (utf8Len == (size_t)-1) {
+            utf8Len = utf8_strlen(pUTF8);
+        }
 
-static int cstr_lexer_set_single_char(cstr_lexer* pLexer, cstr_utf32 c)
-{
-    return cstr_lexer_set_token(pLexer, c, 1);
-}
+        utf16Len = utf8Len;
 
-static int cstr_lexer_set_error(cstr_lexer* pLexer, size_t tokenLen)
-{
-    cstr_lexer_set_token(pLexer, cstr_token_type_error, tokenLen);
-    return EINVAL;
-}
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = utf8Len;
+        }
+    } else if (utf8Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf8* pUTF8Original = pUTF8;
+        for (;;) {
+            if (pUTF8[0] == 0) {
+                break;  /* Reached the end of the null terminated string. */
+            }
 
-static size_t cstr_lexer_parse_integer_suffix(cstr_lexer* pLexer, size_t off) /* Returns the new offset. */
-{
-    const char* txt;
-    size_t len;
+            if ((cstr_uint8)pUTF8[0] < 128) {   /* ASCII character. */
+                utf16Len += 1;
+                pUTF8    += 1;
+            } else {
+                if (cstr_is_invalid_utf8_octet(pUTF8[0])) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                        pUTF8    += 1;
+                    }
+                } else {
+                    if ((pUTF8[0] & 0xE0) == 0xC0) {
+                        if (pUTF8[1] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
 
-    CSTR_ASSERT(pLexer != NULL);
+                        utf16Len += 1;  /* Can be at most 1 UTF-16. */
+                        pUTF8    += 2;
+                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
+                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
 
-    txt = pLexer->pText;
-    len = pLexer->textLen;
+                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
+                        pUTF8    += 3;
+                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
+                        cstr_uint32 cp;
+                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
 
-    if (off < len) {
-        if (txt[off] == 'u' || txt[off] == 'U') {
-            off += 1;
-            if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
-                off += 1;
-                if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
-                    off += 1;   /* Suffix is ull/ULL. */
-                } else {
-                    /* Suffix is ul/UL. */
-                }
-            } else {
-                /* Suffix is u/U. */
-            }
-        } else if (txt[off] == 'l' || txt[off] == 'L') {
-            off += 1;
-            if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
-                off += 1;
-                if (off < len && (txt[off] == 'u' || txt[off] == 'U')) {
-                    off += 1;   /* Suffix is llu/LLU. */
-                } else {
-                    /* Suffix is ll/LL. */
+                        cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
+                        if (!cstr_is_valid_code_point(cp)) {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                                pUTF8    += 4;
+                            }
+                        } else {
+                            utf16Len += 2;  /* Must be at least 2 UTF-16s */
+                            pUTF8    += 4;
+                        }
+                    } else {
+                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                            result = CSTR_ECODEPOINT;
+                            break;
+                        } else {
+                            /* Replacement. */
+                            utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                            pUTF8    += 1;
+                        }
+                    }
                 }
-            } else if (off < len && (txt[off] == 'u' || txt[off] == 'U')) {
-                off += 1;   /* Suffix is lu/LU. */
-            } else {
-                /* Suffix is l/L. */
             }
-        } else {
-            /* No suffix. */
         }
-    } else {
-        /* No suffix (EOF). */
-    }
 
-    return off;
-}
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF8;
+        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
+            if ((cstr_uint8)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
+                utf16Len += 1;
+                iUTF8    += 1;
+            } else {
+                if (cstr_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                        iUTF8    += 1;
+                    }
+                } else {
+                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
+                        if (iUTF8+1 > utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
 
-static size_t cstr_lexer_parse_float_suffix(cstr_lexer* pLexer, size_t off) /* Returns the new offset. */
-{
-    const char* txt;
-    size_t len;
+                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
+                        iUTF8    += 2;
+                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
+                        if (iUTF8+2 > utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
 
-    CSTR_ASSERT(pLexer != NULL);
+                        utf16Len += 1;  /* Can be at most 1 UTF-16.*/
+                        iUTF8    += 3;
+                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
+                        cstr_uint32 cp;
+                        if (iUTF8+3 > utf8Len) {
+                            return EINVAL;
+                        }
 
-    txt = pLexer->pText;
-    len = pLexer->textLen;
+                        cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
+                        if (!cstr_is_valid_code_point(cp)) {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                                iUTF8    += 4;
+                            }
+                        } else {
+                            utf16Len += 2;  /* Must be at least 2 UTF-16s */
+                            iUTF8    += 4;
+                        }
+                    } else {
+                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                            result = CSTR_ECODEPOINT;
+                            break;
+                        } else {
+                            /* Replacement. */
+                            utf16Len += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                            iUTF8    += 1;
+                        }
+                    }
+                }
+            }
+        }
 
-    /* Supported suffixes: 'f'/'F' (float), 'd'/'D' (double) and 'l'/'L' (long double). */
-    if (off < len) {
-        if (txt[off] == 'f' || txt[off] == 'F' || txt[off] == 'd' || txt[off] == 'D' || txt[off] == 'l' || txt[off] == 'L') {
-            off += 1;
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = iUTF8;
         }
-    } else {
-        /* No suffix (EOF). */
     }
 
-    return off;
-}
-
-static int cstr_lexer_parse_suffix_and_set_token(cstr_lexer* pLexer, cstr_utf32 token, size_t off)
-{
-    /* Get past the suffix first. */
-    if (token == cstr_token_type_float_literal_dec || token == cstr_token_type_float_literal_hex) {
-        /* Floating point suffix. */
-        off = cstr_lexer_parse_float_suffix(pLexer, off);
-    } else {
-        /* Assume an integer suffix. */
-        off = cstr_lexer_parse_integer_suffix(pLexer, off);
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
     }
 
-    return cstr_lexer_set_token(pLexer, token, (off - pLexer->textOff));
+    return result;
 }
 
-CSTR_API int cstr_lexer_next(cstr_lexer* pLexer)
+CSTR_API errno_t utf8_to_utf16ne(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
 {
-    int result;
-    const char* txt;
-    size_t off;
-    size_t len;
+    errno_t result = CSTR_SUCCESS;
+    size_t utf16CapOriginal = utf16Cap;
 
-    if (pLexer == NULL) {
-        return EINVAL;  /* Invalid arguments. */
+    if (pUTF16 == NULL) {
+        return utf8_to_utf16_len(pUTF16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
     }
 
-    /* We need to run this in a loop because we may be wanting to skip certain tokens such as whitespace, newlines and comments. */
-    for (;;) {
-        /*
-        When off == len, the end has been reached. The remaining number of bytes is (len - off). txt[off] is the current character. off is variable and can move forward
-        whereas len is constant and remains the same (it represents the length of the string and is required for calculating the number of bytes remaining).
-        */
-        txt = pLexer->pText;
-        off = pLexer->textOff;  /* Moves forward. */
-        len = pLexer->textLen;  /* Constant. */
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
 
-        if (off == len) {
-            cstr_lexer_set_token(pLexer, cstr_token_type_eof, 0);
-            return ENOMEM;  /* Out of input data. */
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (utf8_has_bom((const cstr_uint8*)pUTF8, utf8Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;   /* Found a BOM, but it's forbidden. */
         }
 
-        /* First check if we're on whitespace. */
-        {
-            size_t whitespaceLen = utf8_ltrim_offset(txt + off, (len - off));
-            if (whitespaceLen > 0) {
-                /* It's whitespace. Our lexer makes a distrinction between whitespace and new line characters so we need to check that too. */
-                size_t thisLineLen;
-                size_t nextLineOff = utf8_next_line(txt + off, (len - off), &thisLineLen);
-                if (thisLineLen > whitespaceLen) {
-                    /* There's no new line character within the whitespace area. */
-                    result = cstr_lexer_set_token(pLexer, cstr_token_type_whitespace, whitespaceLen);
-                    if (pLexer->options.skipWhitespace) {
-                        continue;
-                    } else {
-                        return result;
-                    }
-                } else {
-                    if (thisLineLen <= whitespaceLen) {
-                        /* There's a new line character within the whitespace area. */
-                        result = cstr_lexer_set_token(pLexer, cstr_token_type_whitespace, whitespaceLen);
-                        if (pLexer->options.skipWhitespace) {
-                            continue;
-                        } else {
-                            return result;
-                        }
-                    } else {
-                        CSTR_ASSERT(thisLineLen == 0);
-                        result = cstr_lexer_set_token(pLexer, cstr_token_type_newline, (nextLineOff - thisLineLen));
-                        if (pLexer->options.skipNewlines) {
-                            continue;
-                        } else {
-                            return result;
-                        }
-                    }
-                }
-            }
+        pUTF8 += 3; /* Skip past the BOM. */
+        if (utf8Len != (size_t)-1) {
+            utf8Len -= 3;
         }
+    }
 
-        /* It's not whitespace or a new line. */
-        if (txt[off] == '/') {
-            /* Might be an opening comment. */
-            if (((off+1) < len) && txt[off+1] == '*') {
-                /* It's a block comment. We need to include  */
-                size_t tokenLen;
-            
-                off += 2;
-                tokenLen = cstr8_findn(txt + off, (len - off), "*/", 2);
-                if (tokenLen == cstr_npos) {
-                    /* The closing token could not be found. Treat the entire rest of the file as a comment. */
-                    result = cstr_lexer_set_token(pLexer, cstr_token_type_comment, (len - off) + 2);  /* +2 for the opening. */
-                } else {
-                    /* We found the closing token. */
-                    result = cstr_lexer_set_token(pLexer, cstr_token_type_comment, tokenLen + 4);     /* +2 for the opening, +2 for the closing. */
-                }
+    /* The loops below always leave room for the null terminator which they can't do if there's no room at all. */
+    if (utf16Cap == 0) {
+        return ENOMEM;
+    }
 
-                if (pLexer->options.skipComments) {
-                    continue;
-                } else {
-                    return result;
-                }
-            } else if ((off+1 < len) && txt[off+1] == '/') {
-                /* It's a line comment. Note that we do *not* include the new line in the returned token. */
-                size_t thisLineLen;
-            
-                off += 2;
-                utf8_next_line(txt + off, (len - off), &thisLineLen);
-                result = cstr_lexer_set_token(pLexer, cstr_token_type_comment, thisLineLen + 2);      /* +2 for the opening. */
-                if (pLexer->options.skipComments) {
-                    continue;
-                } else {
-                    return result;
-                }
-            } else {
-                /* It's just a general token. */
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            }
+    if ((flags & CSTR_INPUT_IS_ASCII) != 0) {
+        /* The caller has guaranteed the input is ASCII so there is nothing to decode or validate. This loop is simple enough to be vectorized. */
+        size_t count;
+        size_t i;
+
+        if (utf8Len == (size_t)-1) {
+            utf8Len = utf8_strlen(pUTF8);
         }
 
-        /* It's not whitespace, new line nor a comment. Check if it's a string. We support both double and single quoted strings. */
-        if (txt[off] == '\"') {
-            off += 1;
-            for (; off < len; off += 1) {
-                if (txt[off] == '\"') {
-                    /* Could be the end of the string. Need to check that this double-quote is escaped. If so we continue, otherwise we have reached the end. */
-                    CSTR_ASSERT(off > 0);
-                    if (txt[off-1] != '\\') {
-                        /* It's not an escaped double quote which means we've reached the end. */
-                        off += 1;
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_string_double, (off - pLexer->textOff));
-                    }
-                }
-            }
+        count = utf8Len;
+        if (count >= utf16Cap) {
+            count = utf16Cap - 1;   /* Leave room for the null terminator. */
+            result = ENOMEM;
         }
 
-        if (txt[off] == '\'') {
-            off += 1;
-            for (; off < len; off += 1) {
-                if (txt[off] == '\'') {
-                    /* Could be the end of the string. Need to check that this double-quote is escaped. If so we continue, otherwise we have reached the end. */
-                    CSTR_ASSERT(off > 0);
-                    if (txt[off-1] != '\\') {
-                        /* It's not an escaped double quote which means we've reached the end. */
-                        off += 1;
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_string_double, (off - pLexer->textOff));
-                    }
-                }
-            }
+        for (i = 0; i < count; i += 1) {
+            pUTF16[i] = (cstr_utf16)pUTF8[i];
         }
 
-        /* It's not whitespace, new line, comment, nor a string. Check if it's a number. Using a switch here so we can do a convenient fall-through for handling the 0 special case. */
-        switch (txt[off]) {
-            case '0':
-            {
-                size_t tokenBeg = off;  /* <-- Will be used to calculate the length of the token. */
+        pUTF16   += count;
+        utf16Cap -= count;
 
-                if ((off+1) < len) {
-                    if (txt[off+1] == 'x' || txt[off+1] == 'X') {
-                        /* Hex integer or float literal. If we find a '.', 'p' or 'P' it means we're looking at a floating-point literal. */
-                        off += 2;   /* +1 for the '0' and +1 for the 'x/X'. */
-                        while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
-                            off += 1;
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = count;
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, count * sizeof(*pUTF8));
+    } else if (utf8Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf8* pUTF8Original = pUTF8;
+        while (pUTF8[0] != 0) {
+            if (utf16Cap == 1) {
+                result = ENOMEM;
+                break;
+            }
+
+            if ((cstr_uint8)pUTF8[0] < 128) {   /* ASCII character. */
+                pUTF16[0] = pUTF8[0];
+                pUTF16   += 1;
+                utf16Cap -= 1;
+                pUTF8    += 1;
+            } else {
+                if (cstr_is_invalid_utf8_octet(pUTF8[0])) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                        pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                        utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                        pUTF8    += 1;
+                    }
+                } else {
+                    if ((pUTF8[0] & 0xE0) == 0xC0) {
+                        if (pUTF8[1] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
                         }
 
-                        if (txt[off] == '.') {
-                            off += 1;
-                            while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
-                                off += 1;
-                            }
+                        pUTF16[0] = ((cstr_utf16)(pUTF8[0] & 0x1F) <<  6) | (pUTF8[1] & 0x3F);
+                        pUTF16   += 1;
+                        utf16Cap -= 1;
+                        pUTF8    += 2;
+                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
+                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
                         }
 
-                        /* If our next character is an 'p' or 'P' it means we're using scientific notation. */
-                        if (txt[off] == 'p' || txt[off] == 'P') {
-                            /* Scientific notation. */
-                            off += 1;
-                            if (off < len && (txt[off] == '-' || txt[off] == '+')) {
-                                off += 1;
+                        pUTF16[0] = ((cstr_utf16)(pUTF8[0] & 0x0F) << 12) | ((cstr_utf16)(pUTF8[1] & 0x3F) << 6) | (pUTF8[2] & 0x3F);
+                        pUTF16   += 1;
+                        utf16Cap -= 1;
+                        pUTF8    += 3;
+                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
+                        if (utf16Cap < 2) {
+                            break;  /* No enough room. */
+                        } else {
+                            cstr_uint32 cp;
+                            if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
+                                result = EINVAL; /* Input string is too short. */
+                                break;
                             }
 
-                            /* We must have at least one digit. */
-                            if ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F')) {
-                                off += 1;
+                            cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
+                            if (!cstr_is_valid_code_point(cp)) {
+                                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                    result = CSTR_ECODEPOINT;
+                                    break;
+                                } else {
+                                    /* Replacement. */
+                                    pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                                    pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                                    utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                                    pUTF8    += 4;
+                                }
                             } else {
-                                /* Invalid float literal. */
-                                return cstr_lexer_set_error(pLexer, (off - tokenBeg));
-                            }
-
-                            /* Now we just need to go until we hit the last digit. */
-                            while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
-                                off += 1;
+                                utf32_cp_to_utf16_pair(cp, pUTF16);
+                                pUTF16   += 2;
+                                utf16Cap -= 2;
+                                pUTF8    += 4;
                             }
                         }
-
-                        /* We've reached the end of the literal. Check for a suffix and set the token. */
-                        return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_float_literal_hex, off);
-                    } else if (txt[off+1] == 'b' || txt[off+1] == 'B') {
-                        /* Binary literal. */
-                        off += 2;   /* +1 for '0' and +1 for 'b/B'. */
-                        while (off < len && (txt[off] >= '0' && txt[off] <= '1')) {
-                            off += 1;
+                    } else {
+                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                            result = CSTR_ECODEPOINT;
+                            break;
+                        } else {
+                            /* Replacement. */
+                            pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                            utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                            pUTF8    += 1;
                         }
+                    }
+                }
+            }
+        }
 
-                        /* We've reached the end of the literal. */
-                        return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_integer_literal_bin, off);
-                    } else {
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, (pUTF8 - pUTF8Original) * sizeof(*pUTF8));
+    } else {
+        /* Fixed length string. */
+        size_t iUTF8;
+        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
+            if (utf16Cap == 1) {
+                result = ENOMEM;
+                break;
+            }
+
+            if ((cstr_uint8)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
+                pUTF16[0] = pUTF8[iUTF8+0];
+                pUTF16   += 1;
+                utf16Cap -= 1;
+                iUTF8    += 1;
+            } else {
+                if (cstr_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                        pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                        utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                        iUTF8    += 1;
+                    }
+                } else {
+                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
+                        if (iUTF8+1 > utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
+
+                        pUTF16[0] = ((cstr_utf16)(pUTF8[iUTF8+0] & 0x1F) <<  6) | (pUTF8[iUTF8+1] & 0x3F);
+                        pUTF16   += 1;
+                        utf16Cap -= 1;
+                        iUTF8    += 2;
+                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
+                        if (iUTF8+2 > utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
+
+                        pUTF16[0] = ((cstr_utf16)(pUTF8[iUTF8+0] & 0x0F) << 12) | ((cstr_utf16)(pUTF8[iUTF8+1] & 0x3F) << 6) | (pUTF8[iUTF8+2] & 0x3F);
+                        pUTF16   += 1;
+                        utf16Cap -= 1;
+                        iUTF8    += 3;
+                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
+                        if (utf16Cap < 2) {
+                            break;  /* No enough room. */
+                        } else {
+                            cstr_uint32 cp;
+                            if (iUTF8+3 > utf8Len) {
+                                result = EINVAL;
+                                break;
+                            }
+
+                            cp = ((cstr_utf32)(pUTF8[iUTF8+0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[iUTF8+1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[iUTF8+2] & 0x3F) << 6) | (pUTF8[iUTF8+3] & 0x3F);
+                            if (!cstr_is_valid_code_point(cp)) {
+                                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                    result = CSTR_ECODEPOINT;
+                                    break;
+                                } else {
+                                    /* Replacement. */
+                                    pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                                    pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                                    utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                                    iUTF8    += 4;
+                                }
+                            } else {
+                                utf32_cp_to_utf16_pair(cp, pUTF16);
+                                pUTF16   += 2;
+                                utf16Cap -= 2;
+                                iUTF8    += 4;
+                            }
+                        }
+                    } else {
+                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                            result = CSTR_ECODEPOINT;
+                            break;
+                        } else {
+                            /* Replacement. */
+                            pUTF16[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            pUTF16   += CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                            utf16Cap -= CSTR_UNICODE_REPLACEMENT_CODE_POINT_LENGTH_UTF16;
+                            iUTF8    += 1;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = iUTF8;
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, iUTF8 * sizeof(*pUTF8));
+    }
+
+    /* Null terminate. */
+    if (utf16Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF16[0] = 0;
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = (utf16CapOriginal - utf16Cap);
+    }
+
+    CSTR_STATS_ADD(conversionBytesOut, (utf16CapOriginal - utf16Cap) * sizeof(*pUTF16));
+
+    return result;
+}
+
+CSTR_API errno_t utf8_to_utf16le(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+    errno_t result;
+    size_t utf16Len;
+
+    /* Always do a native endian conversion first, then byte swap if necessary. */
+    result = utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
+    }
+
+    if (result != CSTR_SUCCESS) {
+        return result;
+    }
+
+    if (pUTF16 != NULL && !cstr_is_little_endian()) {
+        utf16_swap_endian(pUTF16, utf16Len);
+    }
+
+    return CSTR_SUCCESS;
+}
+
+CSTR_API errno_t utf8_to_utf16be(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+    errno_t result;
+    size_t utf16Len;
+
+    /* Always do a native endian conversion first, then byte swap if necessary. */
+    result = utf8_to_utf16ne(pUTF16, utf16Cap, &utf16Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
+    }
+
+    if (result != CSTR_SUCCESS) {
+        return result;
+    }
+
+    if (pUTF16 != NULL && !cstr_is_big_endian()) {
+        utf16_swap_endian(pUTF16, utf16Len);
+    }
+
+    return CSTR_SUCCESS;
+}
+
+CSTR_API errno_t utf8_to_utf32_len(size_t* pUTF32Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf32Len = 0;
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;   /* Invalid input. */
+    }
+
+    if (utf8Len == 0 || pUTF8[0] == 0) {
+        return CSTR_SUCCESS;   /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (utf8_has_bom((const cstr_uint8*)pUTF8, utf8Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF8 += 3; /* Skip past the BOM. */
+        if (utf8Len != (size_t)-1) {
+            utf8Len -= 3;
+        }
+    }
+
+    if ((flags & CSTR_INPUT_IS_ASCII) != 0) {
+        /* The caller has guaranteed the input is ASCII so every byte is exactly one code unit. */
+        if (utf8Len == (size_t)-1) {
+            utf8Len = utf8_strlen(pUTF8);
+        }
+
+        utf32Len = utf8Len;
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = utf8Len;
+        }
+    } else if (utf8Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf8* pUTF8Original = pUTF8;
+        while (pUTF8[0] != 0) {
+            utf32Len += 1;
+            if ((cstr_uint8)pUTF8[0] < 128) {   /* ASCII character. */
+                pUTF8 += 1;
+            } else {
+                if (cstr_is_invalid_utf8_octet(pUTF8[0])) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        pUTF8 += 1;
+                    }
+                } else {
+                    if ((pUTF8[0] & 0xE0) == 0xC0) {
+                        if (pUTF8[1] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
+                        pUTF8 += 2;
+                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
+                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
+                        pUTF8 += 3;
+                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
+                        cstr_uint32 cp;
+                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
+                        cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
+                        if (!cstr_is_valid_code_point(cp)) {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                            }
+                        }
+                        pUTF8 += 4;
+                    } else {
+                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                            result = CSTR_ECODEPOINT;
+                            break;
+                        } else {
+                            /* Replacement. */
+                            pUTF8 += 1;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF8;
+        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
+            utf32Len += 1;
+            if ((cstr_uint8)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
+                iUTF8 += 1;
+            } else {
+                if (cstr_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        iUTF8 += 1;
+                    }
+                } else {
+                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
+                        if (iUTF8+1 >= utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
+                        iUTF8 += 2;
+                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
+                        if (iUTF8+2 >= utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
+                        iUTF8 += 3;
+                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
+                        cstr_uint32 cp;
+                        if (iUTF8+3 >= utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
+                        cp = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
+                        if (!cstr_is_valid_code_point(cp)) {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                            }
+                        }
+
+                        iUTF8 += 4;
+                    } else {
+                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                            result = CSTR_ECODEPOINT;
+                            break;
+                        } else {
+                            /* Replacement. */
+                            iUTF8 += 1;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = iUTF8;
+        }
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    return result;
+}
+
+
+CSTR_API errno_t utf8_to_utf32ne(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf32CapOriginal = utf32Cap;
+
+    if (pUTF32 == NULL) {
+        return utf8_to_utf32_len(pUTF32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF8LenProcessed != NULL) {
+        *pUTF8LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (utf8_has_bom((const cstr_uint8*)pUTF8, utf8Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF8 += 3; /* Skip past the BOM. */
+        if (utf8Len != (size_t)-1) {
+            utf8Len -= 3;
+        }
+    }
+
+    if ((flags & CSTR_INPUT_IS_ASCII) != 0) {
+        /* The caller has guaranteed the input is ASCII so there is nothing to decode or validate. This loop is simple enough to be vectorized. */
+        size_t count;
+        size_t i;
+
+        if (utf8Len == (size_t)-1) {
+            utf8Len = utf8_strlen(pUTF8);
+        }
+
+        /* Like the decoding loops below, this fills the whole buffer if it needs to. ENOMEM is returned below if there's no room for the null terminator. */
+        count = utf8Len;
+        if (count > utf32Cap) {
+            count = utf32Cap;
+        }
+
+        for (i = 0; i < count; i += 1) {
+            pUTF32[i] = (cstr_utf32)pUTF8[i];
+        }
+
+        pUTF32   += count;
+        utf32Cap -= count;
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = count;
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, count * sizeof(*pUTF8));
+    } else if (utf8Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf8* pUTF8Original = pUTF8;
+        while (pUTF8[0] != 0) {
+            if (utf32Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if ((cstr_uint8)pUTF8[0] < 128) {   /* ASCII character. */
+                pUTF32[0] = pUTF8[0];
+                pUTF8 += 1;
+            } else {
+                if (cstr_is_invalid_utf8_octet(pUTF8[0])) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                        pUTF8 += 1;
+                    }
+                } else {
+                    if ((pUTF8[0] & 0xE0) == 0xC0) {
+                        if (pUTF8[1] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
+
+                        pUTF32[0] = ((cstr_utf16)(pUTF8[0] & 0x1F) <<  6) | (pUTF8[1] & 0x3F);
+                        pUTF8 += 2;
+                    } else if ((pUTF8[0] & 0xF0) == 0xE0) {
+                        if (pUTF8[1] == 0 || pUTF8[2] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
+
+                        pUTF32[0] = ((cstr_utf16)(pUTF8[0] & 0x0F) << 12) | ((cstr_utf16)(pUTF8[1] & 0x3F) << 6) | (pUTF8[2] & 0x3F);
+                        pUTF8 += 3;
+                    } else if ((pUTF8[0] & 0xF8) == 0xF0) {
+                        if (pUTF8[1] == 0 || pUTF8[2] == 0 || pUTF8[3] == 0) {
+                            result = EINVAL; /* Input string is too short. */
+                            break;
+                        }
+
+                        pUTF32[0] = ((cstr_utf32)(pUTF8[0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[2] & 0x3F) << 6) | (pUTF8[3] & 0x3F);
+                        pUTF8 += 4;
+
+                        if (!cstr_is_valid_code_point(pUTF32[0])) {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;   /* No characters should be in the UTF-16 surrogate pair range. */
+                                break;
+                            } else {
+                                /* Replacement. */
+                                pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+                    } else {
+                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                            result = CSTR_ECODEPOINT;
+                            break;
+                        } else {
+                            /* Replacement. */
+                            pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            pUTF8 += 1;
+                        }
+                    }
+                }
+            }
+
+            pUTF32   += 1;
+            utf32Cap -= 1;
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = (pUTF8 - pUTF8Original);
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, (pUTF8 - pUTF8Original) * sizeof(*pUTF8));
+    } else {
+        /* Fixed length string. */
+        size_t iUTF8;
+        for (iUTF8 = 0; iUTF8 < utf8Len; /* Do nothing */) {
+            if (utf32Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if ((cstr_uint8)pUTF8[iUTF8+0] < 128) {   /* ASCII character. */
+                pUTF32[0] = pUTF8[iUTF8+0];
+                iUTF8 += 1;
+            } else {
+                if (cstr_is_invalid_utf8_octet(pUTF8[iUTF8+0])) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                        iUTF8 += 1;
+                    }
+                } else {
+                    if ((pUTF8[iUTF8+0] & 0xE0) == 0xC0) {
+                        if (iUTF8+1 >= utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
+
+                        pUTF32[0] = ((cstr_utf16)(pUTF8[iUTF8+0] & 0x1F) <<  6) | (pUTF8[iUTF8+1] & 0x3F);
+                        iUTF8 += 2;
+                    } else if ((pUTF8[iUTF8+0] & 0xF0) == 0xE0) {
+                        if (iUTF8+2 >= utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
+
+                        pUTF32[0] = ((cstr_utf16)(pUTF8[iUTF8+0] & 0x0F) << 12) | ((cstr_utf16)(pUTF8[iUTF8+1] & 0x3F) << 6) | (pUTF8[iUTF8+2] & 0x3F);
+                        iUTF8 += 3;
+                    } else if ((pUTF8[iUTF8+0] & 0xF8) == 0xF0) {
+                        if (iUTF8+3 >= utf8Len) {
+                            result = EINVAL;
+                            break;
+                        }
+
+                        pUTF32[0] = ((cstr_utf32)(pUTF8[iUTF8+0] & 0x07) << 18) | ((cstr_utf32)(pUTF8[iUTF8+1] & 0x3F) << 12) | ((cstr_utf32)(pUTF8[iUTF8+2] & 0x3F) << 6) | (pUTF8[iUTF8+3] & 0x3F);
+                        iUTF8 += 4;
+
+                        if (!cstr_is_valid_code_point(pUTF32[0])) {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+                    } else {
+                        if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                            result = CSTR_ECODEPOINT;
+                            break;
+                        } else {
+                            /* Replacement. */
+                            pUTF32[0] = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            iUTF8 += 1;
+                        }
+                    }
+                }
+            }
+
+            pUTF32   += 1;
+            utf32Cap -= 1;
+        }
+
+        if (pUTF8LenProcessed != NULL) {
+            *pUTF8LenProcessed = iUTF8;
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, iUTF8 * sizeof(*pUTF8));
+    }
+
+    /* Null terminate. */
+    if (utf32Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF32[0] = 0;
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = (utf32CapOriginal - utf32Cap);
+    }
+
+    CSTR_STATS_ADD(conversionBytesOut, (utf32CapOriginal - utf32Cap) * sizeof(*pUTF32));
+
+    return result;
+}
+
+CSTR_API errno_t utf8_to_utf32le(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+    errno_t result;
+    size_t utf32Len;
+
+    /* Always do a native endian conversion first, then byte swap if necessary. */
+    result = utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    if (result != CSTR_SUCCESS) {
+        return result;
+    }
+
+    if (pUTF32 != NULL && !cstr_is_little_endian()) {
+        utf32_swap_endian(pUTF32, utf32Len);
+    }
+
+    return CSTR_SUCCESS;
+}
+
+CSTR_API errno_t utf8_to_utf32be(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+    errno_t result;
+    size_t utf32Len;
+
+    /* Always do a native endian conversion first, then byte swap if necessary. */
+    result = utf8_to_utf32ne(pUTF32, utf32Cap, &utf32Len, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    if (result != CSTR_SUCCESS) {
+        return result;
+    }
+
+    if (pUTF32 != NULL && !cstr_is_big_endian()) {
+        utf32_swap_endian(pUTF32, utf32Len);
+    }
+
+    return CSTR_SUCCESS;
+}
+
+CSTR_API errno_t utf8_to_wchar_len(size_t* pWCHARLen, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+#if CSTR_SIZEOF_WCHAR_T == 2
+    return utf8_to_utf16_len(pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#else
+    return utf8_to_utf32_len(pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#endif
+}
+
+CSTR_API errno_t utf8_to_wchar(wchar_t* pWCHAR, size_t wcharCap, size_t* pWCHARLen, const cstr_utf8* pUTF8, size_t utf8Len, size_t* pUTF8LenProcessed, cstr_uint32 flags)
+{
+#if CSTR_SIZEOF_WCHAR_T == 2
+    return utf8_to_utf16((cstr_utf16*)pWCHAR, wcharCap, pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#else
+    return utf8_to_utf32((cstr_utf32*)pWCHAR, wcharCap, pWCHARLen, pUTF8, utf8Len, pUTF8LenProcessed, flags);
+#endif
+}
+
+
+
+CSTR_API errno_t utf16_to_utf8_len_internal(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf8Len = 0;
+    cstr_utf16 w1;
+    cstr_utf16 w2;
+    cstr_utf32 utf32;
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF16 == NULL) {
+        return EINVAL; /* Invalid input. */
+    }
+
+    if (utf16Len == 0 || pUTF16[0] == 0) {
+        return CSTR_SUCCESS;  /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16 += 1; /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+    }
+
+    if (utf16Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf16* pUTF16Original = pUTF16;
+        while (pUTF16[0] != 0) {
+            if (isLE) {
+                w1 = cstr_le2host_16(pUTF16[0]);
+            } else {
+                w1 = cstr_be2host_16(pUTF16[0]);
+            }
+            
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                pUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (pUTF16[1] == 0) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = cstr_le2host_16(pUTF16[1]);
+                        } else {
+                            w2 = cstr_be2host_16(pUTF16[1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = utf16_pair_to_utf32_cp(pUTF16);
+                        } else {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        pUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    pUTF16 += 1;
+                }
+            }
+
+            utf8Len += utf32_cp_to_utf8_len(utf32);
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF16;
+        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+            if (isLE) {
+                w1 = cstr_le2host_16(pUTF16[iUTF16+0]);
+            } else {
+                w1 = cstr_be2host_16(pUTF16[iUTF16+0]);
+            }
+
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                iUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (iUTF16+1 > utf16Len) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = cstr_le2host_16(pUTF16[iUTF16+1]);
+                        } else {
+                            w2 = cstr_be2host_16(pUTF16[iUTF16+1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
+                        } else {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        iUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    iUTF16 += 1;
+                }
+            }
+
+            utf8Len += utf32_cp_to_utf8_len(utf32);
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = iUTF16;
+        }
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = utf8Len;
+    }
+
+    return result;
+}
+
+CSTR_API errno_t utf16ne_to_utf8_len(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    if (cstr_is_little_endian()) {
+        return utf16le_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    } else {
+        return utf16be_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+}
+
+CSTR_API errno_t utf16le_to_utf8_len(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    return utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_TRUE);
+}
+
+CSTR_API errno_t utf16be_to_utf8_len(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    return utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_FALSE);
+}
+
+CSTR_API errno_t utf16_to_utf8_len(size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
+        errno_t result;
+        size_t utf16LenProcessed;
+
+        cstr_bool32 isLE;
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = utf16_is_bom_le((const cstr_uint8*)pUTF16);
+        
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+
+        if (isLE) {
+            result = utf16le_to_utf8_len(pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = utf16be_to_utf8_len(pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return utf16ne_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+}
+
+
+CSTR_API errno_t utf16_to_utf8_internal(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf8CapOriginal = utf8Cap;
+    cstr_utf16 w1;
+    cstr_utf16 w2;
+    cstr_utf32 utf32;
+    size_t utf8cpLen;   /* Code point length in UTF-8 code units. */
+
+    if (pUTF8 == NULL) {
+        return utf16_to_utf8_len_internal(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, isLE);
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+    }
+
+    if (utf16Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf16* pUTF16Original = pUTF16;
+        while (pUTF16[0] != 0) {
+            if (utf8Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                w1 = cstr_le2host_16(pUTF16[0]);
+            } else {
+                w1 = cstr_be2host_16(pUTF16[0]);
+            }
+            
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                pUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (pUTF16[1] == 0) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = cstr_le2host_16(pUTF16[1]);
+                        } else {
+                            w2 = cstr_be2host_16(pUTF16[1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = utf16_pair_to_utf32_cp(pUTF16);
+                        } else {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        pUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    pUTF16 += 1;
+                }
+            }
+
+            utf8cpLen = utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
+            if (utf8cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF8   += utf8cpLen;
+            utf8Cap -= utf8cpLen;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, (pUTF16 - pUTF16Original) * sizeof(*pUTF16));
+    } else {
+        /* Fixed length string. */
+        size_t iUTF16;
+        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+            if (utf8Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                w1 = cstr_le2host_16(pUTF16[iUTF16+0]);
+            } else {
+                w1 = cstr_be2host_16(pUTF16[iUTF16+0]);
+            }
+
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                iUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (iUTF16+1 > utf16Len) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = cstr_le2host_16(pUTF16[iUTF16+1]);
+                        } else {
+                            w2 = cstr_be2host_16(pUTF16[iUTF16+1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
+                        } else {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        iUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    iUTF16 += 1;
+                }
+            }
+
+            utf8cpLen = utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
+            if (utf8cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF8   += utf8cpLen;
+            utf8Cap -= utf8cpLen;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = iUTF16;
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, iUTF16 * sizeof(*pUTF16));
+    }
+    
+    /* Null terminate. */
+    if (utf8Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF8[0] = 0;
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = (utf8CapOriginal - utf8Cap);
+    }
+
+    CSTR_STATS_ADD(conversionBytesOut, (utf8CapOriginal - utf8Cap) * sizeof(*pUTF8));
+
+    return result;
+}
+
+CSTR_API errno_t utf16ne_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    if (cstr_is_little_endian()) {
+        return utf16le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    } else {
+        return utf16be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+}
+
+CSTR_API errno_t utf16le_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    return utf16_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_TRUE);
+}
+
+CSTR_API errno_t utf16be_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    return utf16_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_FALSE);
+}
+
+CSTR_API errno_t utf16_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    if (pUTF8 == NULL) {
+        return utf16_to_utf8_len(pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
+        errno_t result;
+        size_t utf16LenProcessed;
+
+        cstr_bool32 isLE;
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = utf16_is_bom_le((const cstr_uint8*)pUTF16);
+        
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+
+        if (isLE) {
+            result = utf16le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = utf16be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return utf16ne_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+}
+
+
+CSTR_API errno_t utf16_to_utf32_len_internal(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf32Len = 0;
+    cstr_utf16 w1;
+    cstr_utf16 w2;
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF16 == NULL) {
+        return EINVAL; /* Invalid input. */
+    }
+
+    if (utf16Len == 0 || pUTF16[0] == 0) {
+        return CSTR_SUCCESS;  /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16 += 1; /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+    }
+
+    if (utf16Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf16* pUTF16Original = pUTF16;
+        while (pUTF16[0] != 0) {
+            if (isLE) {
+                w1 = cstr_le2host_16(pUTF16[0]);
+            } else {
+                w1 = cstr_be2host_16(pUTF16[0]);
+            }
+            
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                pUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (pUTF16[1] == 0) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = cstr_le2host_16(pUTF16[1]);
+                        } else {
+                            w2 = cstr_be2host_16(pUTF16[1]);
+                        }
+                    
+                        /* Check for invalid code point. */
+                        if (!(w2 >= 0xDC00 && w2 <= 0xDFFF)) {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            }
+                        }
+
+                        pUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    }
+
+                    pUTF16 += 1;
+                }
+            }
+
+            utf32Len += 1;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF16;
+        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+            if (isLE) {
+                w1 = cstr_le2host_16(pUTF16[iUTF16+0]);
+            } else {
+                w1 = cstr_be2host_16(pUTF16[iUTF16+0]);
+            }
+
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                iUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (iUTF16+1 > utf16Len) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = cstr_le2host_16(pUTF16[iUTF16+1]);
+                        } else {
+                            w2 = cstr_be2host_16(pUTF16[iUTF16+1]);
+                        }
+                    
+                        /* Check for invalid code point. */
+                        if (!(w2 >= 0xDC00 && w2 <= 0xDFFF)) {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            }
+                        }
+
+                        iUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    }
+
+                    iUTF16 += 1;
+                }
+            }
+
+            utf32Len += 1;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = iUTF16;
+        }
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = utf32Len;
+    }
+
+    return result;
+}
+
+CSTR_API errno_t utf16ne_to_utf32_len(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    if (cstr_is_little_endian()) {
+        return utf16le_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    } else {
+        return utf16be_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+}
+
+CSTR_API errno_t utf16le_to_utf32_len(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    return utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_TRUE);
+}
+
+CSTR_API errno_t utf16be_to_utf32_len(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    return utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_FALSE);
+}
+
+CSTR_API errno_t utf16_to_utf32_len(size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
+        errno_t result;
+        size_t utf16LenProcessed;
+
+        cstr_bool32 isLE;
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = utf16_is_bom_le((const cstr_uint8*)pUTF16);
+        
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+
+        if (isLE) {
+            result = utf16le_to_utf32_len(pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = utf16be_to_utf32_len(pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = utf16LenProcessed + 1;
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return utf16ne_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+}
+
+
+CSTR_API errno_t utf16_to_utf32_internal(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf32CapOriginal = utf32Cap;
+    cstr_utf16 w1;
+    cstr_utf16 w2;
+    cstr_utf32 utf32;
+
+    if (pUTF32 == NULL) {
+        return utf16_to_utf32_len_internal(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, isLE);
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF16LenProcessed != NULL) {
+        *pUTF16LenProcessed = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+    }
+
+    if (utf16Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf16* pUTF16Original = pUTF16;
+        while (pUTF16[0] != 0) {
+            if (utf32Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                w1 = cstr_le2host_16(pUTF16[0]);
+            } else {
+                w1 = cstr_be2host_16(pUTF16[0]);
+            }
+            
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                pUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (pUTF16[1] == 0) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = cstr_le2host_16(pUTF16[1]);
+                        } else {
+                            w2 = cstr_be2host_16(pUTF16[1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = utf16_pair_to_utf32_cp(pUTF16);
+                        } else {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        pUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    pUTF16 += 1;
+                }
+            }
+
+            if (isLE) {
+                pUTF32[0] = cstr_host2le_32(utf32);
+            } else {
+                pUTF32[0] = cstr_host2be_32(utf32);
+            }
+            
+            pUTF32   += 1;
+            utf32Cap -= 1;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = (pUTF16 - pUTF16Original);
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, (pUTF16 - pUTF16Original) * sizeof(*pUTF16));
+    } else {
+        /* Fixed length string. */
+        size_t iUTF16;
+        for (iUTF16 = 0; iUTF16 < utf16Len; /* Do nothing */) {
+            if (utf32Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                w1 = cstr_le2host_16(pUTF16[iUTF16+0]);
+            } else {
+                w1 = cstr_be2host_16(pUTF16[iUTF16+0]);
+            }
+
+            if (w1 < 0xD800 || w1 > 0xDFFF) {
+                /* 1 UTF-16 code unit. */
+                utf32 = w1;
+                iUTF16 += 1;
+            } else {
+                /* 2 UTF-16 code units, or an error. */
+                if (w1 >= 0xD800 && w1 <= 0xDBFF) {
+                    if (iUTF16+1 > utf16Len) {
+                        result = EINVAL; /* Ran out of input data. */
+                        break;
+                    } else {
+                        if (isLE) {
+                            w2 = cstr_le2host_16(pUTF16[iUTF16+1]);
+                        } else {
+                            w2 = cstr_be2host_16(pUTF16[iUTF16+1]);
+                        }
+                    
+                        if (w2 >= 0xDC00 && w2 <= 0xDFFF) {
+                            utf32 = utf16_pair_to_utf32_cp(pUTF16 + iUTF16);
+                        } else {
+                            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                                result = CSTR_ECODEPOINT;
+                                break;
+                            } else {
+                                /* Replacement. */
+                                utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                            }
+                        }
+
+                        iUTF16 += 2;
+                    }
+                } else {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        result = CSTR_ECODEPOINT;
+                        break;
+                    } else {
+                        /* Replacement. */
+                        utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                    }
+
+                    iUTF16 += 1;
+                }
+            }
+
+            if (isLE) {
+                pUTF32[0] = cstr_host2le_32(utf32);
+            } else {
+                pUTF32[0] = cstr_host2be_32(utf32);
+            }
+
+            pUTF32   += 1;
+            utf32Cap -= 1;
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = iUTF16;
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, iUTF16 * sizeof(*pUTF16));
+    }
+    
+    /* Null terminate. */
+    if (utf32Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF32[0] = 0;
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = (utf32CapOriginal - utf32Cap);
+    }
+
+    CSTR_STATS_ADD(conversionBytesOut, (utf32CapOriginal - utf32Cap) * sizeof(*pUTF32));
+
+    return result;
+}
+
+CSTR_API errno_t utf16ne_to_utf32ne(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    if (cstr_is_little_endian()) {
+        return utf16le_to_utf32le(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    } else {
+        return utf16be_to_utf32be(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+}
+
+CSTR_API errno_t utf16le_to_utf32le(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    return utf16_to_utf32_internal(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_TRUE);
+}
+
+CSTR_API errno_t utf16be_to_utf32be(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    return utf16_to_utf32_internal(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags, CSTR_FALSE);
+}
+
+CSTR_API errno_t utf16_to_utf32(cstr_utf32* pUTF32, size_t utf32Cap, size_t* pUTF32Len, const cstr_utf16* pUTF16, size_t utf16Len, size_t* pUTF16LenProcessed, cstr_uint32 flags)
+{
+    if (pUTF32 == NULL) {
+        return utf16_to_utf32_len(pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+    }
+
+    if (pUTF32Len != NULL) {
+        *pUTF32Len = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (utf16_has_bom((const cstr_uint8*)pUTF16, utf16Len)) {
+        errno_t result;
+        size_t utf16LenProcessed;
+
+        cstr_bool32 isLE;
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = utf16_is_bom_le((const cstr_uint8*)pUTF16);
+        
+        pUTF16 += 1;    /* Skip past the BOM. */
+        if (utf16Len != (size_t)-1) {
+            utf16Len -= 1;
+        }
+
+        if (isLE) {
+            result = utf16le_to_utf32le(pUTF32, utf32Cap, pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = utf16be_to_utf32be(pUTF32, utf32Cap, pUTF32Len, pUTF16+1, utf16Len-1, &utf16LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF16LenProcessed != NULL) {
+            *pUTF16LenProcessed = utf16LenProcessed + 1;    /* +1 for BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return utf16ne_to_utf32ne(pUTF32, utf32Cap, pUTF32Len, pUTF16, utf16Len, pUTF16LenProcessed, flags);
+}
+
+
+CSTR_API errno_t utf32_to_utf8_len_internal(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf8Len = 0;
+    cstr_utf32 utf32;
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL; /* Invalid input. */
+    }
+
+    if (utf32Len == 0 || pUTF32[0] == 0) {
+        return CSTR_SUCCESS;  /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+    }
+
+    if (utf32Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf32* pUTF32Original = pUTF32;
+        while (pUTF32[0] != 0) {
+            if (isLE) {
+                utf32 = cstr_le2host_32(pUTF32[0]);
+            } else {
+                utf32 = cstr_be2host_32(pUTF32[0]);
+            }
+
+            if (!cstr_is_valid_code_point(utf32)) {
+                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = CSTR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf8Len += utf32_cp_to_utf8_len(utf32);
+            pUTF32  += 1;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF32;
+        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+            if (isLE) {
+                utf32 = cstr_le2host_32(pUTF32[iUTF32]);
+            } else {
+                utf32 = cstr_be2host_32(pUTF32[iUTF32]);
+            }
+
+            if (!cstr_is_valid_code_point(utf32)) {
+                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = CSTR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf8Len += utf32_cp_to_utf8_len(utf32);
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = iUTF32;
+        }
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = utf8Len;
+    }
+
+    return result;
+}
+
+CSTR_API errno_t utf32ne_to_utf8_len(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    if (cstr_is_little_endian()) {
+        return utf32le_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    } else {
+        return utf32be_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    }
+}
+
+CSTR_API errno_t utf32le_to_utf8_len(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    return utf32_to_utf8_len_internal(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_TRUE);
+}
+
+CSTR_API errno_t utf32be_to_utf8_len(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    return utf32_to_utf8_len_internal(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_FALSE);
+}
+
+CSTR_API errno_t utf32_to_utf8_len(size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
+        errno_t result;
+        size_t utf32LenProcessed;
+
+        cstr_bool32 isLE;
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = utf32_is_bom_le((const cstr_uint8*)pUTF32);
+        
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+
+        if (isLE) {
+            result = utf32le_to_utf8_len(pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = utf32be_to_utf8_len(pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF32LenProcessed) {
+            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return utf32ne_to_utf8_len(pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+}
+
+
+CSTR_API errno_t utf32_to_utf8_internal(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf8CapOriginal = utf8Cap;
+    size_t utf8cpLen;   /* Code point length in UTF-8 code units. */
+    cstr_utf32 utf32;
+
+    if (pUTF8 == NULL) {
+        return utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, isLE);
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+    }
+
+    if (utf32Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf32* pUTF32Original = pUTF32;
+        while (pUTF32[0] != 0) {
+            if (utf8Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                utf32 = cstr_le2host_32(pUTF32[0]);
+            } else {
+                utf32 = cstr_be2host_32(pUTF32[0]);
+            }
+
+            if (!cstr_is_valid_code_point(utf32)) {
+                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = CSTR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf8cpLen = utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
+            if (utf8cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF8   += utf8cpLen;
+            utf8Cap -= utf8cpLen;
+            pUTF32  += 1;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, (pUTF32 - pUTF32Original) * sizeof(*pUTF32));
+    } else {
+        /* Fixed length string. */
+        size_t iUTF32;
+        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+            if (utf8Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                utf32 = cstr_le2host_32(pUTF32[iUTF32]);
+            } else {
+                utf32 = cstr_be2host_32(pUTF32[iUTF32]);
+            }
+
+            if (!cstr_is_valid_code_point(utf32)) {
+                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = CSTR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf8cpLen = utf32_cp_to_utf8(utf32, pUTF8, utf8Cap);
+            if (utf8cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            pUTF8   += utf8cpLen;
+            utf8Cap -= utf8cpLen;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = iUTF32;
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, iUTF32 * sizeof(*pUTF32));
+    }
+
+    /* Null terminate. */
+    if (utf8Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF8[0] = 0;
+    }
+
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = (utf8CapOriginal - utf8Cap);
+    }
+
+    CSTR_STATS_ADD(conversionBytesOut, (utf8CapOriginal - utf8Cap) * sizeof(*pUTF8));
+
+    return result;
+}
+
+CSTR_API errno_t utf32ne_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    if (cstr_is_little_endian()) {
+        return utf32le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    } else {
+        return utf32be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    }
+}
+
+CSTR_API errno_t utf32le_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    return utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_TRUE);
+}
+
+CSTR_API errno_t utf32be_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    return utf32_to_utf8_internal(pUTF8, utf8Cap, pUTF8Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_FALSE);
+}
+
+CSTR_API errno_t utf32_to_utf8(cstr_utf8* pUTF8, size_t utf8Cap, size_t* pUTF8Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    if (pUTF8Len != NULL) {
+        *pUTF8Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
+        errno_t result;
+        size_t utf32LenProcessed;
+
+        cstr_bool32 isLE;
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = utf32_is_bom_le((const cstr_uint8*)pUTF32);
+        
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+
+        if (isLE) {
+            result = utf32le_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = utf32be_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF32LenProcessed) {
+            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return utf32ne_to_utf8(pUTF8, utf8Cap, pUTF8Len, pUTF32+1, utf32Len-1, pUTF32LenProcessed, flags);
+}
+
+
+
+CSTR_API errno_t utf32_to_utf16_len_internal(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf16Len = 0;
+    cstr_utf32 utf32;
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF32 == NULL) {
+        return EINVAL; /* Invalid input. */
+    }
+
+    if (utf32Len == 0 || pUTF32[0] == 0) {
+        return CSTR_SUCCESS;  /* Empty input string. Length is always 0. */
+    }
+
+    /* Check for BOM. */
+    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+    }
+
+    if (utf32Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf32* pUTF32Original = pUTF32;
+        while (pUTF32[0] != 0) {
+            if (isLE) {
+                utf32 = cstr_le2host_32(pUTF32[0]);
+            } else {
+                utf32 = cstr_be2host_32(pUTF32[0]);
+            }
+
+            if (!cstr_is_valid_code_point(utf32)) {
+                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = CSTR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf16Len += utf32_cp_to_utf16_len(utf32);
+            pUTF32   += 1;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        }
+    } else {
+        /* Fixed length string. */
+        size_t iUTF32;
+        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+            if (isLE) {
+                utf32 = cstr_le2host_32(pUTF32[iUTF32]);
+            } else {
+                utf32 = cstr_be2host_32(pUTF32[iUTF32]);
+            }
+
+            if (!cstr_is_valid_code_point(utf32)) {
+                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = CSTR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf16Len += utf32_cp_to_utf16_len(utf32);
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = iUTF32;
+        }
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = utf16Len;
+    }
+
+    return result;
+}
+
+errno_t utf32ne_to_utf16_len(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    if (cstr_is_little_endian()) {
+        return utf32le_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    } else {
+        return utf32be_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    }
+}
+
+CSTR_API errno_t utf32le_to_utf16_len(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    return utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_TRUE);
+}
+
+CSTR_API errno_t utf32be_to_utf16_len(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    return utf32_to_utf16_len_internal(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_FALSE);
+}
+
+CSTR_API errno_t utf32_to_utf16_len(size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
+        errno_t result;
+        size_t utf32LenProcessed;
+
+        cstr_bool32 isLE;
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = utf32_is_bom_le((const cstr_uint8*)pUTF32);
+        
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+
+        if (isLE) {
+            result = utf32le_to_utf16_len(pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = utf32be_to_utf16_len(pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF32LenProcessed) {
+            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return utf32ne_to_utf16_len(pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+}
+
+
+CSTR_API errno_t utf32_to_utf16_internal(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags, cstr_bool32 isLE)
+{
+    errno_t result = CSTR_SUCCESS;
+    size_t utf16CapOriginal = utf16Cap;
+    size_t utf16cpLen;  /* Code point length in UTF-8 code units. */
+    cstr_utf32 utf32;
+
+    if (pUTF16 == NULL) {
+        return utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, isLE);
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    if (pUTF32LenProcessed != NULL) {
+        *pUTF32LenProcessed = 0;
+    }
+
+    if (pUTF16 == NULL) {
+        return EINVAL;
+    }
+
+    /* Check for BOM. */
+    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+    }
+
+    if (utf32Len == (size_t)-1) {
+        /* Null terminated string. */
+        const cstr_utf32* pUTF32Original = pUTF32;
+        while (pUTF32[0] != 0) {
+            if (utf16Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                utf32 = cstr_le2host_32(pUTF32[0]);
+            } else {
+                utf32 = cstr_be2host_32(pUTF32[0]);
+            }
+
+            if (!cstr_is_valid_code_point(utf32)) {
+                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = CSTR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf16cpLen = utf32_cp_to_utf16(utf32, pUTF16, utf16Cap);
+            if (utf16cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            if (isLE) {
+                if (utf16cpLen == 1) {
+                    pUTF16[0] = cstr_host2le_16(pUTF16[0]);
+                } else {
+                    pUTF16[0] = cstr_host2le_16(pUTF16[0]);
+                    pUTF16[1] = cstr_host2le_16(pUTF16[1]);
+                }
+            } else {
+                if (utf16cpLen == 1) {
+                    pUTF16[0] = cstr_host2be_16(pUTF16[0]);
+                } else {
+                    pUTF16[0] = cstr_host2be_16(pUTF16[0]);
+                    pUTF16[1] = cstr_host2be_16(pUTF16[1]);
+                }
+            }
+
+            pUTF16   += utf16cpLen;
+            utf16Cap -= utf16cpLen;
+            pUTF32   += 1;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = (pUTF32 - pUTF32Original);
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, (pUTF32 - pUTF32Original) * sizeof(*pUTF32));
+    } else {
+        /* Fixed length string. */
+        size_t iUTF32;
+        for (iUTF32 = 0; iUTF32 < utf32Len; iUTF32 += 1) {
+            if (utf16Cap == 0) {
+                result = ENOMEM;
+                break;
+            }
+
+            if (isLE) {
+                utf32 = cstr_le2host_32(pUTF32[iUTF32]);
+            } else {
+                utf32 = cstr_be2host_32(pUTF32[iUTF32]);
+            }
+
+            if (!cstr_is_valid_code_point(utf32)) {
+                if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                    result = CSTR_ECODEPOINT;
+                    break;
+                } else {
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+            }
+
+            utf16cpLen = utf32_cp_to_utf16(utf32, pUTF16, utf16Cap);
+            if (utf16cpLen == 0) {
+                result = ENOMEM;    /* A return value of 0 at this point means there was not enough room in the output buffer. */
+                break;
+            }
+
+            if (isLE) {
+                if (utf16cpLen == 1) {
+                    pUTF16[0] = cstr_host2le_16(pUTF16[0]);
+                } else {
+                    pUTF16[0] = cstr_host2le_16(pUTF16[0]);
+                    pUTF16[1] = cstr_host2le_16(pUTF16[1]);
+                }
+            } else {
+                if (utf16cpLen == 1) {
+                    pUTF16[0] = cstr_host2be_16(pUTF16[0]);
+                } else {
+                    pUTF16[0] = cstr_host2be_16(pUTF16[0]);
+                    pUTF16[1] = cstr_host2be_16(pUTF16[1]);
+                }
+            }
+
+            pUTF16   += utf16cpLen;
+            utf16Cap -= utf16cpLen;
+        }
+
+        if (pUTF32LenProcessed != NULL) {
+            *pUTF32LenProcessed = iUTF32;
+        }
+
+        CSTR_STATS_ADD(conversionBytesIn, iUTF32 * sizeof(*pUTF32));
+    }
+
+    /* Null terminate. */
+    if (utf16Cap == 0) {
+        result = ENOMEM;    /* Not enough room in the output buffer. */
+    } else {
+        pUTF16[0] = 0;
+    }
+
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = (utf16CapOriginal - utf16Cap);
+    }
+
+    CSTR_STATS_ADD(conversionBytesOut, (utf16CapOriginal - utf16Cap) * sizeof(*pUTF16));
+
+    return result;
+}
+
+CSTR_API errno_t utf32ne_to_utf16ne(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    if (cstr_is_little_endian()) {
+        return utf32le_to_utf16le(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    } else {
+        return utf32be_to_utf16be(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags);
+    }
+}
+
+CSTR_API errno_t utf32le_to_utf16le(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    return utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_TRUE);
+}
+
+CSTR_API errno_t utf32be_to_utf16be(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    return utf32_to_utf16_internal(pUTF16, utf16Cap, pUTF16Len, pUTF32, utf32Len, pUTF32LenProcessed, flags, CSTR_FALSE);
+}
+
+CSTR_API errno_t utf32_to_utf16(cstr_utf16* pUTF16, size_t utf16Cap, size_t* pUTF16Len, const cstr_utf32* pUTF32, size_t utf32Len, size_t* pUTF32LenProcessed, cstr_uint32 flags)
+{
+    if (pUTF16Len != NULL) {
+        *pUTF16Len = 0;
+    }
+
+    /* Check for BOM. */
+    if (utf32_has_bom((const cstr_uint8*)pUTF32, utf32Len)) {
+        errno_t result;
+        size_t utf32LenProcessed;
+
+        cstr_bool32 isLE;
+        if ((flags & CSTR_FORBID_BOM) != 0) {
+            return CSTR_EBOM;  /* Found a BOM, but it's forbidden. */
+        }
+
+        /* With this function, we need to use the endian defined by the BOM. */
+        isLE = utf32_is_bom_le((const cstr_uint8*)pUTF32);
+        
+        pUTF32 += 1;    /* Skip past the BOM. */
+        if (utf32Len != (size_t)-1) {
+            utf32Len -= 1;
+        }
+
+        if (isLE) {
+            result = utf32le_to_utf16le(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        } else {
+            result = utf32be_to_utf16be(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, &utf32LenProcessed, flags | CSTR_FORBID_BOM); /* <-- We already found a BOM, so we don't want to allow another occurance. */
+        }
+
+        if (pUTF32LenProcessed) {
+            *pUTF32LenProcessed = utf32LenProcessed + 1;    /* +1 for the BOM. */
+        }
+
+        return result;
+    }
+
+    /* Getting here means there was no BOM, so assume native endian. */
+    return utf32ne_to_utf16ne(pUTF16, utf16Cap, pUTF16Len, pUTF32+1, utf32Len-1, pUTF32LenProcessed, flags);
+}
+
+
+
+/**************************************************************************************************************************************************************
+
+Utilities
+
+**************************************************************************************************************************************************************/
+CSTR_API cstr_bool32 utf32_is_null_or_whitespace(const cstr_utf32* pUTF32, size_t utf32Len)
+{
+    if (pUTF32 == NULL) {
+        return CSTR_TRUE;
+    }
+
+    while (utf32Len > 0 && pUTF32[0] != 0) {
+        cstr_utf32 cp = pUTF32[0];
+
+        pUTF32   += 1;
+        utf32Len -= 1;
+        
+        if (cp >= 0x09 && cp <= 0x0D) {
+            continue;
+        }
+
+        if (cp >= 0x2000 && cp <= 0x200A) {
+            continue;
+        }
+
+        switch (cp) {
+            case 0x0020:
+            case 0x0085:
+            case 0x00A0:
+            case 0x1680:
+            case 0x2028:
+            case 0x2029:
+            case 0x202F:
+            case 0x205F:
+            case 0x3000:
+                continue;
+
+            default:
+                return CSTR_FALSE;
+        }
+    }
+
+    /* Getting here means we reached the end of the string without finding anything other than whitespace which means the string is entire whitespace. */
+    return CSTR_TRUE;
+}
+
+CSTR_API cstr_bool32 utf32_is_newline(cstr_utf32 utf32)
+{
+    if (utf32 >= 0x0A && utf32 <= 0x0D) {
+        return CSTR_TRUE;
+    }
+
+    if (utf32 == 0x85) {
+        return CSTR_TRUE;
+    }
+
+    if (utf32 >= 0x2028 && utf32 <= 0x2029) {
+        return CSTR_TRUE;
+    }
+
+    return CSTR_FALSE;
+}
+
+CSTR_API cstr_bool32 utf8_is_null_or_whitespace(const cstr_utf8* pUTF8, size_t utf8Len)
+{
+    if (pUTF8 == NULL) {
+        return CSTR_TRUE;
+    }
+
+    /* This could be faster, but it's practical. */
+    while (utf8Len > 0 && pUTF8[0] != '\0') {
+        cstr_utf32 utf32;
+        size_t utf8Processed;
+        int err;
+
+        /* We expect ENOMEM to be returned, but we should still have a valid utf32 character. */
+        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
+        if (err != 0 && err != ENOMEM) {
+            break;
+        }
+
+        if (utf8Processed == 0) {
+            break;
+        }
+
+        if (utf32_is_null_or_whitespace(&utf32, 1) == CSTR_FALSE) {
+            return CSTR_FALSE;
+        }
+
+        pUTF8   += utf8Processed;
+        utf8Len -= utf8Processed;
+    }
+
+    return CSTR_TRUE;
+}
+
+/* Returns the number of ASCII bytes at the start of the string. */
+static size_t cstr_utf8_ascii_run_len(const cstr_uint8* pUTF8, size_t utf8Len)
+{
+    size_t off = 0;
+
+#if defined(CSTR_SUPPORT_SSE2)
+    /* Four blocks are combined before testing so the branch is only taken once every 64 bytes. */
+    while (off + 64 <= utf8Len) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pUTF8 + off +  0));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pUTF8 + off + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(pUTF8 + off + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(pUTF8 + off + 48));
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0) {
+            break;
+        }
+
+        off += 64;
+    }
+
+    while (off + 16 <= utf8Len) {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(pUTF8 + off))) != 0) {
+            break;  /* The exact position is found with the scalar loop below. */
+        }
+
+        off += 16;
+    }
+#else
+    while (off + 8 <= utf8Len) {
+        cstr_uint64 bytes;
+
+        CSTR_COPY_MEMORY(&bytes, pUTF8 + off, 8);
+        if ((bytes & CSTR_UINT64(0x80808080, 0x80808080)) != 0) {
+            break;
+        }
+
+        off += 8;
+    }
+#endif
+
+    while (off < utf8Len && pUTF8[off] < 0x80) {
+        off += 1;
+    }
+
+    return off;
+}
+
+CSTR_API cstr_bool32 utf8_is_ascii(const cstr_utf8* pUTF8, size_t utf8Len)
+{
+    if (pUTF8 == NULL) {
+        return CSTR_FALSE;
+    }
+
+    if (utf8Len == (size_t)-1) {
+        utf8Len = utf8_strlen(pUTF8);
+    }
+
+    return cstr_utf8_ascii_run_len((const cstr_uint8*)pUTF8, utf8Len) == utf8Len;
+}
+
+CSTR_API cstr_bool32 utf8_is_valid(const cstr_utf8* pUTF8, size_t utf8Len)
+{
+    const cstr_uint8* pBytes = (const cstr_uint8*)pUTF8;
+    size_t off = 0;
+
+    if (pUTF8 == NULL) {
+        return CSTR_FALSE;
+    }
+
+    if (utf8Len == (size_t)-1) {
+        utf8Len = utf8_strlen(pUTF8);
+    }
+
+    while (off < utf8Len) {
+        cstr_uint8 lead = pBytes[off];
+        cstr_uint8 secondMin = 0x80;
+        cstr_uint8 secondMax = 0xBF;
+        size_t extra;
+        size_t i;
+
+        if (lead < 0x80) {
+            off += cstr_utf8_ascii_run_len(pBytes + off, utf8Len - off);
+            continue;
+        }
+
+        /* The allowed range of the second byte is narrowed for some lead bytes to exclude overlong forms, surrogates and code points above U+10FFFF. */
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            extra = 1;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            extra = 2;
+            if (lead == 0xE0) { secondMin = 0xA0; }
+            if (lead == 0xED) { secondMax = 0x9F; }
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            extra = 3;
+            if (lead == 0xF0) { secondMin = 0x90; }
+            if (lead == 0xF4) { secondMax = 0x8F; }
+        } else {
+            return CSTR_FALSE;
+        }
+
+        if (utf8Len - off <= extra) {
+            return CSTR_FALSE;  /* Truncated. */
+        }
+
+        if (pBytes[off + 1] < secondMin || pBytes[off + 1] > secondMax) {
+            return CSTR_FALSE;
+        }
+
+        for (i = 2; i <= extra; i += 1) {
+            if ((pBytes[off + i] & 0xC0) != 0x80) {
+                return CSTR_FALSE;
+            }
+        }
+
+        off += 1 + extra;
+    }
+
+    return CSTR_TRUE;
+}
+
+CSTR_API size_t utf8_next_whitespace(const cstr_utf8* pUTF8, size_t utf8Len)
+{
+    size_t utf8RunningOffset = 0;
+
+    if (pUTF8 == NULL) {
+        return cstr_npos;
+    }
+
+    while (utf8Len > 0 && pUTF8[0] != '\0') {
+        cstr_utf32 utf32;
+        size_t utf8Processed;
+        int err;
+
+        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
+        if (err != 0 && err != ENOMEM) {
+            break;
+        }
+
+        if (utf8Processed == 0) {
+            break;
+        }
+
+        if (utf32_is_null_or_whitespace(&utf32, 1) == CSTR_TRUE) {
+            return utf8RunningOffset;
+        }
+
+        utf8RunningOffset += utf8Processed;
+        pUTF8             += utf8Processed;
+        utf8Len           -= utf8Processed;
+    }
+
+    return cstr_npos;
+}
+
+
+CSTR_API size_t utf8_ltrim_offset(const cstr_utf8* pUTF8, size_t utf8Len)
+{
+    size_t utf8RunningOffset = 0;
+
+    if (pUTF8 == NULL) {
+        return cstr_npos;
+    }
+
+    while (utf8Len > 0 && pUTF8[0] != '\0') {
+        cstr_utf32 utf32;
+        size_t utf8Processed;
+        int err;
+
+        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
+        if (err != 0 && err != ENOMEM) {
+            break;
+        }
+
+        if (utf8Processed == 0) {
+            break;
+        }
+
+        if (utf32_is_null_or_whitespace(&utf32, 1) == CSTR_FALSE) {
+            break;
+        }
+
+        utf8RunningOffset += utf8Processed;
+        pUTF8             += utf8Processed;
+        utf8Len           -= utf8Processed;
+    }
+
+    return utf8RunningOffset;
+}
+
+CSTR_API size_t utf8_rtrim_offset(const cstr_utf8* pUTF8, size_t utf8Len)
+{
+    size_t utf8RunningOffset = 0;
+    size_t utf8LastNonWhitespaceOffset = utf8Len;
+
+    if (pUTF8 == NULL) {
+        return cstr_npos;
+    }
+
+    for (;;) {
+        cstr_utf32 utf32;
+        size_t utf8Processed;
+        int err;
+
+        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
+        if (err != 0 && err != ENOMEM) {
+            break;
+        }
+
+        if (utf8Processed == 0) {
+            break;
+        }
+
+        utf8RunningOffset += utf8Processed;
+
+        if (utf32_is_null_or_whitespace(&utf32, 1) == CSTR_FALSE) {
+            utf8LastNonWhitespaceOffset = utf8RunningOffset;
+        }
+
+        pUTF8   += utf8Processed;
+        utf8Len -= utf8Processed;
+    }
+
+    return utf8LastNonWhitespaceOffset;
+}
+
+CSTR_API size_t utf8_next_line(const cstr_utf8* pUTF8, size_t utf8Len, size_t* pThisLineLen)
+{
+    size_t thisLen = 0;
+    size_t nextBeg = 0;
+
+    if (pThisLineLen != NULL) {
+        *pThisLineLen = 0;
+    }
+
+    if (pUTF8 == NULL) {
+        return cstr_npos;
+    }
+
+    /* This could be faster, but it's practical. */
+    while (utf8Len > 0 && pUTF8[0] != '\0') {
+        cstr_utf32 utf32;
+        size_t utf8Processed;
+        int err;
+
+        /* We expect ENOMEM to be returned, but we should still have a valid utf32 character. */
+        err = utf8_to_utf32(&utf32, 1, NULL, pUTF8, utf8Len, &utf8Processed, 0);
+        if (err != 0 && err != ENOMEM) {
+            break;
+        }
+
+        if (utf8Processed == 0) {
+            break;
+        }
+
+        nextBeg += utf8Processed;
+
+        if (utf32_is_newline(utf32) == CSTR_TRUE) {
+            /* Special case for \r\n. This needs to be treated as one line. The \r by itself should also be treated as a new line, however. */
+            if (utf32 == '\r' && utf8Len > utf8Processed && pUTF8[utf8Processed] == '\n') {
+                nextBeg += 1;
+            }
+
+            break;
+        }
+
+        CSTR_ASSERT(utf8Len >= utf8Processed);  /* If there wasn't enough data in the UTF-8 string, utf8_to_utf32() should have failed. */
+
+        thisLen += utf8Processed;
+        pUTF8   += utf8Processed;
+        utf8Len -= utf8Processed;
+    }
+
+    if (pThisLineLen != NULL) {
+        *pThisLineLen = thisLen;
+    }
+
+    return nextBeg;
+}
+
+
+/**************************************************************************************************************************************************************
+
+Lexer
+
+**************************************************************************************************************************************************************/
+CSTR_API int cstr_lexer_init(const char* pText, size_t textLen, cstr_lexer* pLexer)
+{
+    if (pLexer == NULL) {
+        return EINVAL;  /* Invalid arguments. */
+    }
+
+    CSTR_ZERO_OBJECT(pLexer);
+
+    if (pText == NULL) {
+        return EINVAL;  
+    }
+
+    pLexer->pText      = pText;
+    pLexer->textLen    = textLen;
+    pLexer->textOff    = 0;
+    pLexer->lineNumber = 1;
+
+    /* We do not use the null terminator to know the end of the string so we need to calculate it now. */
+    if (pLexer->textLen == (size_t)-1) {
+        pLexer->textLen = utf8_strlen(pText);
+    }
+
+    return 0;
+}
+
+static int cstr_lexer_set_token(cstr_lexer* pLexer, cstr_utf32 token, size_t tokenLen)
+{
+    CSTR_ASSERT(pLexer != NULL);
+
+    pLexer->token     = token;
+    pLexer->pTokenStr = pLexer->pText + pLexer->textOff;
+    pLexer->tokenLen  = tokenLen;
+    pLexer->textOff  += tokenLen;
+
+    if (token == cstr_token_type_newline) {
+        pLexer->lineNumber += 1;
+    }
+
+    /* We need to parse comments and strings to find line numbers. */
+    if (token == cstr_token_type_comment || token == cstr_token_type_string_double || token == cstr_token_type_string_single) {
+        const char* pRunningStr = pLexer->pTokenStr;
+        for (;;) {
+            size_t thisLineLen;
+            size_t nextLineOff = utf8_next_line(pRunningStr, pLexer->tokenLen - (pRunningStr - pLexer->pTokenStr), &thisLineLen);
+            if (nextLineOff == thisLineLen) {
+                break;  /* Reached the end. */
+            }
+
+            pRunningStr += nextLineOff;
+            pLexer->lineNumber += 1;
+        }
+    }
+
+    return 0;
+}
+
+static int cstr_lexer_set_single_char(cstr_lexer* pLexer, cstr_utf32 c)
+{
+    return cstr_lexer_set_token(pLexer, c, 1);
+}
+
+static int cstr_lexer_set_error(cstr_lexer* pLexer, size_t tokenLen)
+{
+    cstr_lexer_set_token(pLexer, cstr_token_type_error, tokenLen);
+    return EINVAL;
+}
+
+static size_t cstr_lexer_parse_integer_suffix(cstr_lexer* pLexer, size_t off) /* Returns the new offset. */
+{
+    const char* txt;
+    size_t len;
+
+    CSTR_ASSERT(pLexer != NULL);
+
+    txt = pLexer->pText;
+    len = pLexer->textLen;
+
+    if (off < len) {
+        if (txt[off] == 'u' || txt[off] == 'U') {
+            off += 1;
+            if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
+                off += 1;
+                if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
+                    off += 1;   /* Suffix is ull/ULL. */
+                } else {
+                    /* Suffix is ul/UL. */
+                }
+            } else {
+                /* Suffix is u/U. */
+            }
+        } else if (txt[off] == 'l' || txt[off] == 'L') {
+            off += 1;
+            if (off < len && (txt[off] == 'l' || txt[off] == 'L')) {
+                off += 1;
+                if (off < len && (txt[off] == 'u' || txt[off] == 'U')) {
+                    off += 1;   /* Suffix is llu/LLU. */
+                } else {
+                    /* Suffix is ll/LL. */
+                }
+            } else if (off < len && (txt[off] == 'u' || txt[off] == 'U')) {
+                off += 1;   /* Suffix is lu/LU. */
+            } else {
+                /* Suffix is l/L. */
+            }
+        } else {
+            /* No suffix. */
+        }
+    } else {
+        /* No suffix (EOF). */
+    }
+
+    return off;
+}
+
+static size_t cstr_lexer_parse_float_suffix(cstr_lexer* pLexer, size_t off) /* Returns the new offset. */
+{
+    const char* txt;
+    size_t len;
+
+    CSTR_ASSERT(pLexer != NULL);
+
+    txt = pLexer->pText;
+    len = pLexer->textLen;
+
+    /* Supported suffixes: 'f'/'F' (float), 'd'/'D' (double) and 'l'/'L' (long double). */
+    if (off < len) {
+        if (txt[off] == 'f' || txt[off] == 'F' || txt[off] == 'd' || txt[off] == 'D' || txt[off] == 'l' || txt[off] == 'L') {
+            off += 1;
+        }
+    } else {
+        /* No suffix (EOF). */
+    }
+
+    return off;
+}
+
+static int cstr_lexer_parse_suffix_and_set_token(cstr_lexer* pLexer, cstr_utf32 token, size_t off)
+{
+    /* Get past the suffix first. */
+    if (token == cstr_token_type_float_literal_dec || token == cstr_token_type_float_literal_hex) {
+        /* Floating point suffix. */
+        off = cstr_lexer_parse_float_suffix(pLexer, off);
+    } else {
+        /* Assume an integer suffix. */
+        off = cstr_lexer_parse_integer_suffix(pLexer, off);
+    }
+
+    return cstr_lexer_set_token(pLexer, token, (off - pLexer->textOff));
+}
+
+CSTR_API int cstr_lexer_next(cstr_lexer* pLexer)
+{
+    int result;
+    const char* txt;
+    size_t off;
+    size_t len;
+
+    if (pLexer == NULL) {
+        return EINVAL;  /* Invalid arguments. */
+    }
+
+    /* We need to run this in a loop because we may be wanting to skip certain tokens such as whitespace, newlines and comments. */
+    for (;;) {
+        /*
+        When off == len, the end has been reached. The remaining number of bytes is (len - off). txt[off] is the current character. off is variable and can move forward
+        whereas len is constant and remains the same (it represents the length of the string and is required for calculating the number of bytes remaining).
+        */
+        txt = pLexer->pText;
+        off = pLexer->textOff;  /* Moves forward. */
+        len = pLexer->textLen;  /* Constant. */
+
+        if (off == len) {
+            cstr_lexer_set_token(pLexer, cstr_token_type_eof, 0);
+            return ENOMEM;  /* Out of input data. */
+        }
+
+        /* First check if we're on whitespace. */
+        {
+            size_t whitespaceLen = utf8_ltrim_offset(txt + off, (len - off));
+            if (whitespaceLen > 0) {
+                /* It's whitespace. Our lexer makes a distrinction between whitespace and new line characters so we need to check that too. */
+                size_t thisLineLen;
+                size_t nextLineOff = utf8_next_line(txt + off, (len - off), &thisLineLen);
+                if (thisLineLen >= whitespaceLen) {
+                    /* There's no new line character within the whitespace area. */
+                    result = cstr_lexer_set_token(pLexer, cstr_token_type_whitespace, whitespaceLen);
+                    if (pLexer->options.skipWhitespace) {
+                        continue;
+                    } else {
+                        return result;
+                    }
+                } else {
+                    if (thisLineLen > 0) {
+                        /* There's a new line character within the whitespace area. Only take the whitespace leading up to it. */
+                        result = cstr_lexer_set_token(pLexer, cstr_token_type_whitespace, thisLineLen);
+                        if (pLexer->options.skipWhitespace) {
+                            continue;
+                        } else {
+                            return result;
+                        }
+                    } else {
+                        CSTR_ASSERT(thisLineLen == 0);
+                        result = cstr_lexer_set_token(pLexer, cstr_token_type_newline, (nextLineOff - thisLineLen));
+                        if (pLexer->options.skipNewlines) {
+                            continue;
+                        } else {
+                            return result;
+                        }
+                    }
+                }
+            }
+        }
+
+        /* It's not whitespace or a new line. */
+        if (txt[off] == '/') {
+            /* Might be an opening comment. */
+            if (((off+1) < len) && txt[off+1] == '*') {
+                /* It's a block comment. We need to include  */
+                size_t tokenLen;
+            
+                off += 2;
+                tokenLen = cstr8_findn(txt + off, (len - off), "*/", 2);
+                if (tokenLen == cstr_npos) {
+                    /* The closing token could not be found. Treat the entire rest of the file as a comment. */
+                    result = cstr_lexer_set_token(pLexer, cstr_token_type_comment, (len - off) + 2);  /* +2 for the opening. */
+                } else {
+                    /* We found the closing token. */
+                    result = cstr_lexer_set_token(pLexer, cstr_token_type_comment, tokenLen + 4);     /* +2 for the opening, +2 for the closing. */
+                }
+
+                if (pLexer->options.skipComments) {
+                    continue;
+                } else {
+                    return result;
+                }
+            } else if ((off+1 < len) && txt[off+1] == '/') {
+                /* It's a line comment. Note that we do *not* include the new line in the returned token. */
+                size_t thisLineLen;
+            
+                off += 2;
+                utf8_next_line(txt + off, (len - off), &thisLineLen);
+                result = cstr_lexer_set_token(pLexer, cstr_token_type_comment, thisLineLen + 2);      /* +2 for the opening. */
+                if (pLexer->options.skipComments) {
+                    continue;
+                } else {
+                    return result;
+                }
+            } else {
+                /* It's just a general token. */
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            }
+        }
+
+        /* It's not whitespace, new line nor a comment. Check if it's a string. We support both double and single quoted strings. */
+        if (txt[off] == '\"') {
+            off += 1;
+            for (; off < len; off += 1) {
+                if (txt[off] == '\"') {
+                    /* Could be the end of the string. Need to check that this double-quote is escaped. If so we continue, otherwise we have reached the end. */
+                    CSTR_ASSERT(off > 0);
+                    if (txt[off-1] != '\\') {
+                        /* It's not an escaped double quote which means we've reached the end. */
+                        off += 1;
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_string_double, (off - pLexer->textOff));
+                    }
+                }
+            }
+
+            /* The closing quote could not be found. Don't read past the end of the text. */
+            return cstr_lexer_set_error(pLexer, (off - pLexer->textOff));
+        }
+
+        if (txt[off] == '\'') {
+            off += 1;
+            for (; off < len; off += 1) {
+                if (txt[off] == '\'') {
+                    /* Could be the end of the string. Need to check that this double-quote is escaped. If so we continue, otherwise we have reached the end. */
+                    CSTR_ASSERT(off > 0);
+                    if (txt[off-1] != '\\') {
+                        /* It's not an escaped double quote which means we've reached the end. */
+                        off += 1;
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_string_double, (off - pLexer->textOff));
+                    }
+                }
+            }
+
+            /* The closing quote could not be found. Don't read past the end of the text. */
+            return cstr_lexer_set_error(pLexer, (off - pLexer->textOff));
+        }
+
+        /* It's not whitespace, new line, comment, nor a string. Check if it's a number. Using a switch here so we can do a convenient fall-through for handling the 0 special case. */
+        switch (txt[off]) {
+            case '0':
+            {
+                size_t tokenBeg = off;  /* <-- Will be used to calculate the length of the token. */
+
+                if ((off+1) < len) {
+                    if (txt[off+1] == 'x' || txt[off+1] == 'X') {
+                        /* Hex integer or float literal. If we find a '.', 'p' or 'P' it means we're looking at a floating-point literal. */
+                        off += 2;   /* +1 for the '0' and +1 for the 'x/X'. */
+                        while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
+                            off += 1;
+                        }
+
+                        if (off < len && txt[off] == '.') {
+                            off += 1;
+                            while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
+                                off += 1;
+                            }
+                        }
+
+                        /* If our next character is an 'p' or 'P' it means we're using scientific notation. */
+                        if (off < len && (txt[off] == 'p' || txt[off] == 'P')) {
+                            /* Scientific notation. */
+                            off += 1;
+                            if (off < len && (txt[off] == '-' || txt[off] == '+')) {
+                                off += 1;
+                            }
+
+                            /* We must have at least one digit. */
+                            if (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
+                                off += 1;
+                            } else {
+                                /* Invalid float literal. */
+                                return cstr_lexer_set_error(pLexer, (off - tokenBeg));
+                            }
+
+                            /* Now we just need to go until we hit the last digit. */
+                            while (off < len && ((txt[off] >= '0' && txt[off] <= '9') || (txt[off] >= 'a' && txt[off] <= 'f') || (txt[off] >= 'A' && txt[off] <= 'F'))) {
+                                off += 1;
+                            }
+                        }
+
+                        /* We've reached the end of the literal. Check for a suffix and set the token. */
+                        return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_float_literal_hex, off);
+                    } else if (txt[off+1] == 'b' || txt[off+1] == 'B') {
+                        /* Binary literal. */
+                        off += 2;   /* +1 for '0' and +1 for 'b/B'. */
+                        while (off < len && (txt[off] >= '0' && txt[off] <= '1')) {
+                            off += 1;
+                        }
+
+                        /* We've reached the end of the literal. */
+                        return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_integer_literal_bin, off);
+                    } else {
                         /* Maybe an octal literal, but could also just be a float starting with 0. If it's float we fall through to the next case statement which will treat it as decimal. */
                         size_t newOff = off+1;
 
-                        /* First get past all leading zeros. */
-                        while (newOff < len && txt[newOff] == '0') {
-                            newOff += 1;
-                        }
+                        /* First get past all leading zeros. */
+                        while (newOff < len && txt[newOff] == '0') {
+                            newOff += 1;
+                        }
+
+                        /* If the next character is between 1 and 7 it means we have an octal constant. Otherwise we need to fall through and treat it as a decimal literal. */
+                        if (newOff < len && txt[newOff] >= '1' && txt[newOff] <= '7') {
+                            /* It's an octal integer literal. */
+                            off = newOff;
+                            while (off < len && (txt[off] >= '0' && txt[off] <= '7')) {
+                                off += 1;
+                            }
+
+                            /* We've reached the end of the literal. */
+                            return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_integer_literal_oct, off);
+                        } else {
+                            /* It's not an octal literal. Just fall through and treat it as a decimal literal. Note that we have not incremented 'off' at this point. */
+                        }
+                    }
+                }
+            } /* fallthrough */;
+
+            case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+            {
+                /* Decimal integer or float literal. We keep looping until we find something that's not a number. If it is a '.', 'e' or 'E' it means we're looking at a floating-point literal. */
+                size_t tokenBeg = off;  /* <-- Will be used to calculate the length of the token. */
+                off += 1;
+                while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
+                    off += 1;
+                }
+
+                /* Not a digit. If it's a dot it means we're processing a floating point literal. */
+                if (off < len && (txt[off] == '.' || txt[off] == 'e' || txt[off] == 'E')) {
+                    /* It's a floating point literal. We need to do another digit iteration. */
+                    if (off < len && txt[off] == '.') {
+                        off += 1;
+                        while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
+                            off += 1;
+                        }
+                    }
+
+                    /* If our next character is an 'e' or 'E' it means we're using scientific notation. */
+                    if (off < len && (txt[off] == 'e' || txt[off] == 'E')) {
+                        /* Scientific notation. */
+                        off += 1;
+                        if (off < len && (txt[off] == '-' || txt[off] == '+')) {
+                            off += 1;
+                        }
+
+                        /* We must have at least one digit. */
+                        if (off < len && txt[off] >= '0' && txt[off] <= '9') {
+                            off += 1;
+                        } else {
+                            /* Invalid float literal. */
+                            return cstr_lexer_set_error(pLexer, (off - tokenBeg));
+                        }
+
+                        /* Now we just need to go until we hit the last digit. */
+                        while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
+                            off += 1;
+                        }
+                    }
+
+                    /* We've reached the end of the literal. Check for a suffix and set the token. */
+                    return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_float_literal_dec, off);
+                } else {
+                    /* It's a decimal integer literal. Check fo a suffix and set the token. */
+                    return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_integer_literal_dec, off);
+                }
+            } break;
+
+            case '=':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_eqeq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '!':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_noteq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '<':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_lteq, 2);
+                    }
+                    if (txt[off+1] == '<') {
+                        if (off+2 < len) {
+                            if (txt[off+2] == '=') {
+                                return cstr_lexer_set_token(pLexer, cstr_token_type_shleq, 3);
+                            }
+                        }
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_shl, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '>':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_gteq, 2);
+                    }
+                    if (txt[off+1] == '>') {
+                        if (off+2 < len) {
+                            if (txt[off+2] == '=') {
+                                return cstr_lexer_set_token(pLexer, cstr_token_type_shreq, 3);
+                            }
+                        }
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_shr, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '&':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '&') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_andand, 2);
+                    }
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_andeq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '|':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '|') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_oror, 2);
+                    }
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_oreq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '+':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '+') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_plusplus, 2);
+                    }
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_pluseq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '-':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '-') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_minusminus, 2);
+                    }
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_minuseq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '*':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_muleq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '/':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_diveq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);   /* Should never hit this because the '/' character is handled when handling comments. */
+            };
+
+            case '%':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_modeq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '^':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == '=') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_xoreq, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case ':':
+            {
+                if (off+1 < len) {
+                    if (txt[off+1] == ':') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_coloncolon, 2);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            case '.':
+            {
+                if (off+2 < len) {
+                    if(txt[off+1] == '.' && txt[off+2] == '.') {
+                        return cstr_lexer_set_token(pLexer, cstr_token_type_ellipsis, 3);
+                    }
+                }
+                return cstr_lexer_set_single_char(pLexer, txt[off]);
+            };
+
+            /*
+            By default we must have an identifier. In our lexer, all special operators are represented using ASCII characters. This means we can use *most* Unicode code points
+            in our identifiers. What we cannot use, however, is any of the Unicode defined whitespace characters (these encompass new line characters). We know that it won't
+            start with a whitespace character because we checked that at the top. However, we need to make sure we don't include any Unicode whitespace characters.
+            */
+            default:
+            {
+                /* We just need to loop until we hit the first disallowed character. We support "_", "a-z", "A-Z", "0-9" and all Unicode characters outside of ASCII except whitespace. */
+                if ((txt[off] >= 'a' && txt[off] <= 'z') ||
+                    (txt[off] >= 'A' && txt[off] <= 'Z') ||
+                    (txt[off] == '_')                    ||
+                    ((unsigned char)txt[off] >= 0x80)) {
+                    size_t tokenMaxLen = utf8_next_whitespace(txt + off, (len - off));   /* <-- We'll be using this to ensure we don't include any Unicode whitespace characters. */
+                    size_t tokenLen = 0;
+
+                    while (tokenLen < (len - off)) {
+                        tokenLen += 1;
+                        if (tokenLen == tokenMaxLen) {
+                            break;
+                        }
+
+                        if (off + tokenLen == len) {
+                            break;  /* Reached the end of the text. It may not be null terminated so we can't look at the next byte. */
+                        }
+
+                        if ((txt[off+tokenLen] >= 'a' && txt[off+tokenLen] <= 'z')                 ||
+                            (txt[off+tokenLen] >= 'A' && txt[off+tokenLen] <= 'Z')                 ||
+                            (txt[off+tokenLen] >= '0' && txt[off+tokenLen] <= '9')                 ||
+                            (txt[off+tokenLen] == '_')                                             ||
+                            (txt[off+tokenLen] == '-' && pLexer->options.allowDashesInIdentifiers) ||   /* Enables support for kabab-case. */
+                            ((unsigned char)txt[off+tokenLen] >= 0x80)) {
+                            continue;   /* Still valid. */
+                        } else {
+                            break;      /* Not a valid character for an identifier. We're done. */
+                        }
+                    }
+
+                    return cstr_lexer_set_token(pLexer, cstr_token_type_identifier, tokenLen);
+                } else {
+                    return cstr_lexer_set_single_char(pLexer, txt[off]);
+                }
+            };
+        }
+    }
+
+    /* Shouldn't get here. */
+    /*return 0;*/
+}
+
+CSTR_API int cstr_lexer_transform_string(const char* pToken, size_t tokenLen, cstr* pStr)
+{
+    cstr str = NULL;
+
+    if (pStr == NULL) {
+        return EINVAL;
+    }
+
+    *pStr = NULL;
+
+    if (pToken == NULL || pStr == NULL) {
+        return EINVAL;
+    }
+
+    /* We need to remove the surrounding quotes. */
+    if (pToken[0] == '\"' || pToken[0] == '\'' && tokenLen >= 2) {
+        str = cstr_newn(pToken + 1, tokenLen - 2);
+    } else {
+        str = cstr_newn(pToken, tokenLen);
+    }
+
+    if (str == NULL) {
+        return ENOMEM;
+    }
+
+
+    /*
+    From here on we won't ever be making the string smaller. We can therefore do an efficient iteration with the assumption that we won't ever need to expand. We need
+    to transform the following:
+
+        \\r -> \r
+        \\n -> \n
+        \\t -> \t
+        \\f -> \f
+        \\" -> \"
+        \\' -> \'
+        \\\ -> \\
+        \\0 -> \0
+    */
+    {
+        size_t i = 0;
+        while (i < cstr_len(str)) {
+            if (str[i] == '\\' && i+1 < cstr_len(str)) {
+                if (str[i+1] == '\r' ||
+                    str[i+1] == '\n' ||
+                    str[i+1] == '\t' ||
+                    str[i+1] == '\f' ||
+                    str[i+1] == '\"' ||
+                    str[i+1] == '\'' ||
+                    str[i+1] == '\\' ||
+                    str[i+1] == '\0') {
+                    cstr8_remove_at(str, i);
+                    continue;   /* Continue without incrementing the counter. */
+                }
+            }
+
+            i += 1;
+        }
+    }
+
+    /* TODO: Handle unicode constants with '\u'. */
+    /* TODO: Handle hex constants with '\x'. */
+    /* TODO: Handle octal constants with '\0[0..7]'. */
+
+    /* We're done. */
+    *pStr = str;
+    return 0;
+}
+
+CSTR_API int cstr_lexer_transform_comment(const char* pToken, size_t tokenLen, cstr* pStr)
+{
+    cstr str = NULL;
+
+    if (pStr == NULL) {
+        return EINVAL;
+    }
+
+    *pStr = NULL;
+
+    if (pToken == NULL || pStr == NULL) {
+        return EINVAL;
+    }
+
+    /* We need to remove the surrounding comment tokens. */
+    if (pToken[0] == '/') {
+        if (pToken[1] == '/') {
+            /* Line comment. */
+            str = cstr_newn(pToken + 2, tokenLen - 2);
+        } else if (pToken[1] == '*' && tokenLen >= 4) {
+            /* Block comment. */
+            str = cstr_newn(pToken + 2, tokenLen - 4);
+        }
+    } else {
+        str = cstr_newn(pToken, tokenLen);
+    }
+
+    if (str == NULL) {
+        return ENOMEM;
+    }
+
+    /* We're done. */
+    *pStr = str;
+    return 0;
+}
+
+
+/**************************************************************************************************************************************************************
+
+Key/Value Parser
+
+**************************************************************************************************************************************************************/
+CSTR_API int cstr_keyvalue_parser_init(const char* pText, size_t textLen, cstr_keyvalue_parser* pParser)
+{
+    int result;
+
+    if (pParser == NULL) {
+        return EINVAL;  /* Invalid arguments. */
+    }
+
+    CSTR_ZERO_OBJECT(pParser);
+
+    result = cstr_lexer_init(pText, textLen, &pParser->lexer);
+    if (result != 0) {
+        return result;  /* Failed to initialize the lexer. */
+    }
+
+    pParser->lexer.options.allowDashesInIdentifiers = CSTR_TRUE;    /* Enables kabab-case. */
+
+    return 0;
+}
+
+static int cstr_keyvalue_parser_parse_section(cstr_keyvalue_parser* pParser)
+{
+    int result;
+    const char* pSectionBeg = NULL;
+    const char* pSectionEnd = NULL;
+
+    CSTR_ASSERT(pParser != NULL);
+    CSTR_ASSERT(pParser->lexer.token == '[');
+
+    /* The section name is everything up to the closing bracket, excluding surrounding whitespace. It must all be on the same line. */
+    for (;;) {
+        result = cstr_lexer_next(&pParser->lexer);
+        if (result != 0) {
+            return EINVAL;  /* Unterminated section header. */
+        }
+
+        if (pParser->lexer.token == ']') {
+            break;
+        }
+
+        if (pParser->lexer.token == cstr_token_type_newline || pParser->lexer.token == cstr_token_type_error) {
+            return EINVAL;
+        }
+
+        if (pParser->lexer.token == cstr_token_type_whitespace || pParser->lexer.token == cstr_token_type_comment) {
+            continue;
+        }
+
+        if (pSectionBeg == NULL) {
+            pSectionBeg = pParser->lexer.pTokenStr;
+        }
+
+        pSectionEnd = pParser->lexer.pTokenStr + pParser->lexer.tokenLen;
+    }
+
+    if (pSectionBeg == NULL) {
+        pParser->pSection   = pParser->lexer.pTokenStr; /* Empty section. Switches back to the top level. */
+        pParser->sectionLen = 0;
+    } else {
+        pParser->pSection   = pSectionBeg;
+        pParser->sectionLen = (size_t)(pSectionEnd - pSectionBeg);
+    }
+
+    return 0;
+}
+
+CSTR_API int cstr_keyvalue_parser_next(cstr_keyvalue_parser* pParser)
+{
+    int result;
+    const char* pKey = NULL;
+    size_t keyLen = 0;
+    const char* pVal = NULL;
+    size_t valLen = 0;
+    size_t lineNumber = 0;
+
+    if (pParser == NULL) {
+        return EINVAL;
+    }
+
+    /* Extract the key. */
+    for (;;) {
+        lineNumber = pParser->lexer.lineNumber;   /* The lexer's line number is updated when the token is set so it needs to be retrieved beforehand. */
+
+        result = cstr_lexer_next(&pParser->lexer);
+        if (result != 0) {
+            return result;  /* Probably reached the end. */
+        }
+
+        /* The key needs to be an identifier or a string. If it's not we just skip it and try again. */
+        switch (pParser->lexer.token) {
+            case cstr_token_type_identifier:
+            case cstr_token_type_string_double:
+            case cstr_token_type_string_single:
+            {
+                pKey   = pParser->lexer.pTokenStr;
+                keyLen = pParser->lexer.tokenLen;
+            } break;
+
+            /* Whitespace, newline and comment tokens are allowed. These are just skipped. */
+            case cstr_token_type_whitespace:
+            case cstr_token_type_newline:
+            case cstr_token_type_comment:
+            {
+                /* Do nothing and continue. */
+            } continue;
+
+            default:
+            {
+                /* The ';' token is allowed. This is just a statement terminator. */
+                if (pParser->lexer.token == ';') {
+                    continue;
+                }
+
+                /* A '[' token starts a section header. */
+                if (pParser->lexer.token == '[') {
+                    result = cstr_keyvalue_parser_parse_section(pParser);
+                    if (result != 0) {
+                        return result;
+                    }
+
+                    continue;
+                }
+
+                /* Getting here means we have a syntax error. */
+                /* TODO: Post an error. */
+                return EINVAL;
+            };
+        }
+
+        if (pKey != NULL) {
+            /* Identifiers can be joined with dots to form a hierarchical key such as `a.b.c`. */
+            if (pParser->lexer.token == cstr_token_type_identifier) {
+                for (;;) {
+                    /* Peek at the next character directly rather than lexing the next token so that the common case of an undotted key stays cheap. */
+                    if (pParser->lexer.textOff >= pParser->lexer.textLen || pParser->lexer.pText[pParser->lexer.textOff] != '.') {
+                        break;
+                    }
+
+                    result = cstr_lexer_next(&pParser->lexer);
+                    if (result != 0 || pParser->lexer.token != '.') {
+                        return EINVAL;
+                    }
+
+                    result = cstr_lexer_next(&pParser->lexer);
+                    if (result != 0 || pParser->lexer.token != cstr_token_type_identifier) {
+                        return EINVAL;  /* A dot must be followed by an identifier. */
+                    }
+
+                    keyLen = (size_t)((pParser->lexer.pTokenStr + pParser->lexer.tokenLen) - pKey);
+                }
+            }
+
+            break;
+        }
+    }
+
+    /* Getting here means we should have a key. Now we need to extract the value. */
+    for (;;) {
+        result = cstr_lexer_next(&pParser->lexer);
+        if (result != 0) {
+            return result;  /* Probably reached the end. */
+        }
+
+        switch (pParser->lexer.token) {
+            case cstr_token_type_identifier:
+            case cstr_token_type_string_double:
+            case cstr_token_type_string_single:
+            {
+                pVal   = pParser->lexer.pTokenStr;
+                valLen = pParser->lexer.tokenLen;
+            } break;
+
+            /* Whitespace, newline and comments can be ignored. */
+            case cstr_token_type_whitespace:
+            case cstr_token_type_newline:
+            case cstr_token_type_comment:
+            {
+                /* Do nothing and continue. */
+            } continue;
+
+            default:
+            {
+                /* We can allow an "=" sign for those who prefer an explicit assignment operator. This is optional in our key/value parser as whitespace gives enough context. */
+                if (pParser->lexer.token == '=') {
+                    continue;
+                }
+
+                /* Getting here means we have a syntax error. */
+                /* TODO: Post an error. */
+                return EINVAL;
+            };
+        }
+
+        if (pVal != NULL) {
+            break;
+        }
+    }
+
+    /* If we get here we should have both a key and a value. We can now set the members of pParser and return. */
+    pParser->pKey     = pKey;
+    pParser->keyLen   = keyLen;
+    pParser->pValue     = pVal;
+    pParser->valueLen   = valLen;
+    pParser->lineNumber = lineNumber;
+
+    return 0;
+}
+
+
+/*
+The functions below implement cstr_keyvalue_parse(). They work on the same parser object as cstr_keyvalue_parser_next() and use the lexer's cursor, line
+number and token as their state, but only fall back to the lexer itself for tokens that aren't relevant to the common case.
+*/
+static CSTR_INLINE cstr_bool32 cstr_keyvalue_is_identifier_start(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static CSTR_INLINE cstr_bool32 cstr_keyvalue_is_identifier_char(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+}
+
+static CSTR_INLINE cstr_bool32 cstr_keyvalue_is_special(unsigned char c, unsigned char target)
+{
+    return c == target || c < 0x0E || c >= 0x80;
+}
+
+/*
+Returns the offset of the first byte that is either equal to `target`, a control character below 0x0E (which includes all of the ASCII new line characters) or
+a non-ASCII byte. Returns textLen if there are none. This is used to skip over the bodies of strings and comments, and is the only part of the key/value
+scanner where long runs of bytes are expected.
+*/
+static size_t cstr_keyvalue_find_special(const char* pText, size_t textLen, char target)
+{
+    size_t off = 0;
+
+#if defined(CSTR_SUPPORT_SSE2)
+    {
+        __m128i target16 = _mm_set1_epi8(target);
+        __m128i limit16  = _mm_set1_epi8(0x0E);   /* Signed comparison. Non-ASCII bytes are negative and will be less than this. */
+
+        while (off + 16 <= textLen) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(pText + off));
+            __m128i hits  = _mm_or_si128(_mm_cmpeq_epi8(bytes, target16), _mm_cmplt_epi8(bytes, limit16));
+            if (_mm_movemask_epi8(hits) != 0) {
+                break;  /* The exact position is found with the scalar loop below. */
+            }
+
+            off += 16;
+        }
+    }
+#else
+    {
+        /* SWAR fallback. This only tells us whether or not there's a match in a block of 8 bytes, which is all we need since the scalar loop finds it. */
+        const cstr_uint64 ones = CSTR_UINT64(0x01010101, 0x01010101);
+        const cstr_uint64 high = CSTR_UINT64(0x80808080, 0x80808080);
+        const cstr_uint64 target8 = ones * (cstr_uint8)target;
+
+        while (off + 8 <= textLen) {
+            cstr_uint64 bytes;
+            cstr_uint64 zeroed;
+
+            CSTR_COPY_MEMORY(&bytes, pText + off, 8);
+            zeroed = bytes ^ target8;
+
+            /* Bytes equal to the target, bytes less than 0x0E and bytes with the high bit set, respectively. */
+            if (((((zeroed - ones) & ~zeroed) | ((bytes - (ones * 0x0E)) & ~bytes) | bytes) & high) != 0) {
+                break;
+            }
+
+            off += 8;
+        }
+    }
+#endif
+
+    while (off < textLen && !cstr_keyvalue_is_special((unsigned char)pText[off], (unsigned char)target)) {
+        off += 1;
+    }
+
+    return off;
+}
+
+static size_t cstr_keyvalue_count_line_breaks(const char* pText, size_t textLen)
+{
+    /* This needs to be done in exactly the same way as the lexer, which is by using utf8_next_line(). */
+    size_t lineBreakCount = 0;
+
+    for (;;) {
+        size_t thisLineLen;
+        size_t nextLineOff = utf8_next_line(pText, textLen, &thisLineLen);
+        if (nextLineOff == thisLineLen) {
+            break;
+        }
+
+        pText   += nextLineOff;
+        textLen -= nextLineOff;
+        lineBreakCount += 1;
+    }
+
+    return lineBreakCount;
+}
+
+static CSTR_INLINE void cstr_keyvalue_parser_set_token(cstr_lexer* pLexer, cstr_utf32 token, size_t tokenOff, size_t tokenLen, size_t lineNumber)
+{
+    pLexer->token      = token;
+    pLexer->pTokenStr  = pLexer->pText + tokenOff;
+    pLexer->tokenLen   = tokenLen;
+    pLexer->textOff    = tokenOff + tokenLen;
+    pLexer->lineNumber = lineNumber;
+}
+
+/*
+Reads the next token, optionally skipping over whitespace, new lines and comments first. Identifiers, strings, "=" and ";" are scanned directly. Everything else
+is handed to the lexer so that both paths agree on the grammar. The line number of the start of the token is returned in pLineNumber.
+*/
+static int cstr_keyvalue_parser_read_token(cstr_keyvalue_parser* pParser, cstr_bool32 skipTrivia, size_t* pLineNumber)
+{
+    int result;
+    cstr_lexer* pLexer = &pParser->lexer;
+    const char* txt = pLexer->pText;
+    size_t len = pLexer->textLen;
+    size_t off = pLexer->textOff;
+    size_t lineNumber = pLexer->lineNumber;
+    unsigned char c;
+
+    for (;;) {
+        *pLineNumber = lineNumber;
+
+        if (off == len) {
+            cstr_keyvalue_parser_set_token(pLexer, cstr_token_type_eof, off, 0, lineNumber);
+            return ENOMEM;  /* Out of input data. Same as the lexer. */
+        }
+
+        c = (unsigned char)txt[off];
+
+        if (skipTrivia) {
+            if (c == ' ' || c == '\t') {
+                off += 1;
+                continue;
+            }
+
+            if (c >= '\n' && c <= '\r') {
+                off += 1;
+                if (c == '\r' && off < len && txt[off] == '\n') {
+                    off += 1;
+                }
+
+                lineNumber += 1;
+                continue;
+            }
+
+            if (c == '/' && off + 1 < len && txt[off+1] == '/') {
+                /* Line comment. The new line is not part of the comment. A non-ASCII byte might be a Unicode line break so let utf8_next_line() deal with those. */
+                off += 2;
+                for (;;) {
+                    off += cstr_keyvalue_find_special(txt + off, len - off, '\n');
+                    if (off == len || txt[off] == '\0' || (txt[off] >= '\n' && txt[off] <= '\r')) {
+                        break;
+                    }
+
+                    if ((unsigned char)txt[off] >= 0x80) {
+                        size_t thisLineLen;
+                        utf8_next_line(txt + off, len - off, &thisLineLen);
+                        off += thisLineLen;
+                        break;
+                    }
+
+                    off += 1;
+                }
+
+                continue;
+            }
+
+            if (c == '/' && off + 1 < len && txt[off+1] == '*') {
+                /* Block comment. An unterminated comment runs to the end of the text. */
+                size_t commentBeg = off;
+                cstr_bool32 hasSpecial = CSTR_FALSE;
+
+                off += 2;
+                for (;;) {
+                    off += cstr_keyvalue_find_special(txt + off, len - off, '*');
+                    if (off == len) {
+                        break;
+                    }
+
+                    if (txt[off] == '*') {
+                        if (off + 1 < len && txt[off+1] == '/') {
+                            off += 2;
+                            break;
+                        }
+                    } else {
+                        hasSpecial = CSTR_TRUE;
+                    }
+
+                    off += 1;
+                }
+
+                if (hasSpecial) {
+                    lineNumber += cstr_keyvalue_count_line_breaks(txt + commentBeg, off - commentBeg);
+                }
+
+                continue;
+            }
+        }
+
+        if (cstr_keyvalue_is_identifier_start(c)) {
+            size_t tokenEnd = off + 1;
+            while (tokenEnd < len && cstr_keyvalue_is_identifier_char((unsigned char)txt[tokenEnd])) {
+                tokenEnd += 1;
+            }
+
+            /* If the identifier continues with a non-ASCII character the lexer needs to check it for Unicode whitespace. */
+            if (tokenEnd == len || (unsigned char)txt[tokenEnd] < 0x80) {
+                cstr_keyvalue_parser_set_token(pLexer, cstr_token_type_identifier, off, tokenEnd - off, lineNumber);
+                return 0;
+            }
+        } else if (c == '\"' || c == '\'') {
+            size_t tokenEnd = off + 1;
+            cstr_bool32 hasSpecial = CSTR_FALSE;
+
+            for (;;) {
+                tokenEnd += cstr_keyvalue_find_special(txt + tokenEnd, len - tokenEnd, (char)c);
+                if (tokenEnd == len) {
+                    /* The closing quote could not be found. */
+                    cstr_keyvalue_parser_set_token(pLexer, cstr_token_type_error, off, tokenEnd - off, lineNumber);
+                    return EINVAL;
+                }
+
+                if ((unsigned char)txt[tokenEnd] == c) {
+                    if (txt[tokenEnd-1] != '\\') {
+                        tokenEnd += 1;
+                        break;
+                    }
+                } else {
+                    hasSpecial = CSTR_TRUE;
+                }
+
+                tokenEnd += 1;
+            }
+
+            /* The lexer reports both kinds of strings as cstr_token_type_string_double. */
+            cstr_keyvalue_parser_set_token(pLexer, cstr_token_type_string_double, off, tokenEnd - off, lineNumber);
+
+            if (hasSpecial) {
+                pLexer->lineNumber += cstr_keyvalue_count_line_breaks(txt + off, tokenEnd - off);
+            }
+
+            return 0;
+        } else if (c == ';' || (c == '=' && (off + 1 == len || txt[off+1] != '='))) {
+            cstr_keyvalue_parser_set_token(pLexer, c, off, 1, lineNumber);
+            return 0;
+        }
+
+        /* Getting here means it's something we don't handle directly. */
+        pLexer->textOff    = off;
+        pLexer->lineNumber = lineNumber;
+
+        result = cstr_lexer_next(pLexer);
+        if (result != 0) {
+            return result;
+        }
+
+        if (skipTrivia && (pLexer->token == cstr_token_type_whitespace || pLexer->token == cstr_token_type_newline || pLexer->token == cstr_token_type_comment)) {
+            off        = pLexer->textOff;
+            lineNumber = pLexer->lineNumber;
+            continue;
+        }
+
+        return 0;
+    }
+}
+
+static int cstr_keyvalue_parser_scan(cstr_keyvalue_parser* pParser)
+{
+    int result;
+    const char* pKey;
+    size_t keyLen;
+    size_t lineNumber;
+    size_t tokenLineNumber;
+
+    CSTR_ASSERT(pParser != NULL);
+
+    /* Extract the key. */
+    for (;;) {
+        result = cstr_keyvalue_parser_read_token(pParser, CSTR_TRUE, &lineNumber);
+        if (result != 0) {
+            return result;
+        }
+
+        if (pParser->lexer.token == cstr_token_type_identifier || pParser->lexer.token == cstr_token_type_string_double || pParser->lexer.token == cstr_token_type_string_single) {
+            break;
+        }
+
+        if (pParser->lexer.token == ';') {
+            continue;
+        }
+
+        if (pParser->lexer.token == '[') {
+            result = cstr_keyvalue_parser_parse_section(pParser);
+            if (result != 0) {
+                return result;
+            }
+
+            continue;
+        }
+
+        return EINVAL;  /* Syntax error. */
+    }
+
+    pKey   = pParser->lexer.pTokenStr;
+    keyLen = pParser->lexer.tokenLen;
+
+    if (pParser->lexer.token == cstr_token_type_identifier) {
+        while (pParser->lexer.textOff < pParser->lexer.textLen && pParser->lexer.pText[pParser->lexer.textOff] == '.') {
+            pParser->lexer.textOff += 1;
+
+            result = cstr_keyvalue_parser_read_token(pParser, CSTR_FALSE, &tokenLineNumber);
+            if (result != 0 || pParser->lexer.token != cstr_token_type_identifier) {
+                return EINVAL;  /* A dot must be followed by an identifier. */
+            }
+
+            keyLen = (size_t)((pParser->lexer.pTokenStr + pParser->lexer.tokenLen) - pKey);
+        }
+    }
+
+    /* Extract the value. */
+    for (;;) {
+        result = cstr_keyvalue_parser_read_token(pParser, CSTR_TRUE, &tokenLineNumber);
+        if (result != 0) {
+            return result;
+        }
+
+        if (pParser->lexer.token == cstr_token_type_identifier || pParser->lexer.token == cstr_token_type_string_double || pParser->lexer.token == cstr_token_type_string_single) {
+            break;
+        }
+
+        if (pParser->lexer.token == '=') {
+            continue;
+        }
+
+        return EINVAL;  /* Syntax error. */
+    }
+
+    pParser->pKey       = pKey;
+    pParser->keyLen     = keyLen;
+    pParser->pValue     = pParser->lexer.pTokenStr;
+    pParser->valueLen   = pParser->lexer.tokenLen;
+    pParser->lineNumber = lineNumber;
+
+    return 0;
+}
+
+CSTR_API int cstr_keyvalue_parse(const char* pText, size_t textLen, cstr_keyvalue_pair_proc onPair, void* pUserData)
+{
+    int result;
+    cstr_keyvalue_parser parser;
+
+    if (onPair == NULL) {
+        return EINVAL;
+    }
+
+    result = cstr_keyvalue_parser_init(pText, textLen, &parser);
+    if (result != 0) {
+        return result;
+    }
+
+    for (;;) {
+        result = cstr_keyvalue_parser_scan(&parser);
+        if (result != 0) {
+            break;
+        }
+
+        result = onPair(pUserData, parser.pSection, parser.sectionLen, parser.pKey, parser.keyLen, parser.pValue, parser.valueLen, parser.lineNumber);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    /* Running out of input is how we know we've successfully reached the end. */
+    if (result != ENOMEM) {
+        return result;
+    }
+
+    return 0;
+}
+
+
+
+/**************************************************************************************************************************************************************
+
+CSV Parser
+
+**************************************************************************************************************************************************************/
+/* Builds the masks of quotes, delimiters and newlines for a block of up to 64 bytes. */
+static void cstr_csv_scan_block(const cstr_uint8* pBlock, size_t len, char delimiter, cstr_uint64* pQuotes, cstr_uint64* pDelimiters, cstr_uint64* pNewlines)
+{
+    cstr_uint64 quotes     = 0;
+    cstr_uint64 delimiters = 0;
+    cstr_uint64 newlines   = 0;
+    size_t i;
+
+#if defined(CSTR_SUPPORT_SSE2)
+    if (len == 64) {
+        cstr_uint32 iBlock;
+
+        for (iBlock = 0; iBlock < 4; iBlock += 1) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(pBlock + iBlock*16));
+
+            quotes     |= (cstr_uint64)(cstr_uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')))       << (iBlock * 16);
+            delimiters |= (cstr_uint64)(cstr_uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(delimiter)))  << (iBlock * 16);
+            newlines   |= (cstr_uint64)(cstr_uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')))      << (iBlock * 16);
+        }
+
+        *pQuotes     = quotes;
+        *pDelimiters = delimiters;
+        *pNewlines   = newlines;
+        return;
+    }
+#endif
+
+    for (i = 0; i < len; i += 1) {
+        cstr_uint64 bit = (cstr_uint64)1 << i;
+
+        if (pBlock[i] == '"') {
+            quotes |= bit;
+        }
+        if (pBlock[i] == (cstr_uint8)delimiter) {
+            delimiters |= bit;
+        }
+        if (pBlock[i] == '\n') {
+            newlines |= bit;
+        }
+    }
+
+    *pQuotes     = quotes;
+    *pDelimiters = delimiters;
+    *pNewlines   = newlines;
+}
+
+/*
+Each bit of the output is the XOR of that bit and every bit below it in the input. For a mask of quotes, this sets every bit from an opening quote up to, but
+not including, its closing quote.
+*/
+static CSTR_INLINE cstr_uint64 cstr_csv_prefix_xor(cstr_uint64 n)
+{
+    n ^= n << 1;
+    n ^= n << 2;
+    n ^= n << 4;
+    n ^= n << 8;
+    n ^= n << 16;
+    n ^= n << 32;
+
+    return n;
+}
+
+/* Scans the block at the given offset. `pQuoteCarry` is all bits set if the start of the block is inside quotes and is updated for the end of the block. */
+static cstr_uint64 cstr_csv_scan_structural(const char* pText, size_t textLen, size_t offset, char delimiter, cstr_uint64* pQuoteCarry, cstr_uint64* pNewlines)
+{
+    cstr_uint64 quotes;
+    cstr_uint64 delimiters;
+    cstr_uint64 inside;
+
+    cstr_csv_scan_block((const cstr_uint8*)pText + offset, (textLen - offset < 64) ? textLen - offset : 64, delimiter, &quotes, &delimiters, pNewlines);
+
+    inside = cstr_csv_prefix_xor(quotes) ^ *pQuoteCarry;
+    *pQuoteCarry = (cstr_uint64)0 - (inside >> 63);
+
+    return (delimiters | *pNewlines) & ~inside;
+}
+
+/* Returns the offset of the next delimiter or newline outside of quotes, or `textLen` if there are none. */
+static size_t cstr_csv_parser_next_structural(cstr_csv_parser* pParser)
+{
+    size_t offset;
+
+    while (pParser->structural == 0) {
+        if (pParser->nextBlock >= pParser->textLen) {
+            return pParser->textLen;
+        }
+
+        pParser->newlineCount += cstr_popcount64(pParser->newlines);
+        pParser->blockBase     = pParser->nextBlock;
+        pParser->structural    = cstr_csv_scan_structural(pParser->pText, pParser->textLen, pParser->blockBase, pParser->delimiter, &pParser->quoteCarry, &pParser->newlines);
+        pParser->nextBlock    += 64;
+    }
+
+    offset = pParser->blockBase + cstr_ctz64(pParser->structural);
+    pParser->structural &= pParser->structural - 1;
+
+    return offset;
+}
+
+/* The cursor must be within the current block, or at the start of the next one. */
+static size_t cstr_csv_parser_get_cursor_line_number(const cstr_csv_parser* pParser)
+{
+    size_t bit = pParser->cursor - pParser->blockBase;
+    size_t lineNumber = 1 + pParser->newlineCount;
+
+    if (bit >= 64) {
+        lineNumber += cstr_popcount64(pParser->newlines);
+    } else {
+        lineNumber += cstr_popcount64(pParser->newlines & (((cstr_uint64)1 << bit) - 1));
+    }
+
+    return lineNumber;
+}
+
+CSTR_API int cstr_csv_parser_init(const char* pText, size_t textLen, char delimiter, cstr_csv_parser* pParser)
+{
+    if (pParser == NULL) {
+        return EINVAL;
+    }
+
+    CSTR_ZERO_OBJECT(pParser);
+
+    if (pText == NULL && textLen > 0) {
+        return EINVAL;
+    }
+
+    if (delimiter == '"' || delimiter == '\n' || delimiter == '\r') {
+        return EINVAL;
+    }
+
+    pParser->pText     = pText;
+    pParser->textLen   = textLen;
+    pParser->delimiter = delimiter;
+
+    return 0;
+}
+
+CSTR_API int cstr_csv_parser_next(cstr_csv_parser* pParser, cstr_csv_field* pFields, size_t fieldCap, size_t* pFieldCount)
+{
+    const char* pText;
+    size_t textLen;
+    size_t lineNumber;
+    size_t fieldCount = 0;
+
+    if (pFieldCount != NULL) {
+        *pFieldCount = 0;
+    }
+
+    if (pParser == NULL || (pFields == NULL && fieldCap > 0)) {
+        return EINVAL;
+    }
+
+    pText   = pParser->pText;
+    textLen = pParser->textLen;
+
+    /* Find the start of the next row, skipping over empty lines. A newline at the cursor is always the next structural character. */
+    for (;;) {
+        if (pParser->cursor >= textLen) {
+            return ENOMEM;  /* Out of input data. */
+        }
+
+        lineNumber = cstr_csv_parser_get_cursor_line_number(pParser);
+
+        if (pText[pParser->cursor] == '\n' || (pText[pParser->cursor] == '\r' && pParser->cursor + 1 < textLen && pText[pParser->cursor + 1] == '\n')) {
+            pParser->cursor = cstr_csv_parser_next_structural(pParser) + 1;
+        } else {
+            break;
+        }
+    }
+
+    for (;;) {
+        size_t fieldStart = pParser->cursor;
+        size_t fieldEnd;
+        size_t offset;
+        cstr_bool32 isEndOfRow;
+        cstr_uint32 flags = 0;
+
+        offset     = cstr_csv_parser_next_structural(pParser);
+        fieldEnd   = offset;
+        isEndOfRow = offset == textLen || pText[offset] == '\n';
+
+        if (offset < textLen && pText[offset] == '\n' && fieldEnd > fieldStart && pText[fieldEnd - 1] == '\r') {
+            fieldEnd -= 1;
+        }
+
+        if (fieldStart < fieldEnd && pText[fieldStart] == '"') {
+            const char* pQuote;
+
+            /* The closing quote must be immediately before the delimiter or newline. */
+            if (fieldEnd - fieldStart < 2 || pText[fieldEnd - 1] != '"' || (offset == textLen && pParser->quoteCarry != 0)) {
+                return EINVAL;
+            }
+
+            fieldStart += 1;
+            fieldEnd   -= 1;
+            flags      |= CSTR_CSV_FIELD_QUOTED;
+
+            /* Any quotes inside the field must be doubled. */
+            pQuote = (const char*)memchr(pText + fieldStart, '"', fieldEnd - fieldStart);
+            while (pQuote != NULL) {
+                size_t quoteOffset = (size_t)(pQuote - pText);
+                if (quoteOffset + 1 >= fieldEnd || pText[quoteOffset + 1] != '"') {
+                    return EINVAL;
+                }
+
+                flags |= CSTR_CSV_FIELD_ESCAPED;
+                pQuote = (const char*)memchr(pText + quoteOffset + 2, '"', fieldEnd - (quoteOffset + 2));
+            }
+        }
+
+        if (fieldCount < fieldCap) {
+            pFields[fieldCount].p     = pText + fieldStart;
+            pFields[fieldCount].len   = fieldEnd - fieldStart;
+            pFields[fieldCount].flags = flags;
+        }
+
+        fieldCount += 1;
+
+        pParser->cursor = (offset < textLen) ? offset + 1 : textLen;
+
+        if (isEndOfRow) {
+            break;
+        }
+    }
+
+    pParser->lineNumber = lineNumber;
+
+    if (pFieldCount != NULL) {
+        *pFieldCount = fieldCount;
+    }
+
+    return 0;
+}
+
+CSTR_API int cstr_csv_field_unescape(const cstr_csv_field* pField, char* pDst, size_t dstCap, size_t* pDstLen)
+{
+    const char* pSrc;
+    const char* pSrcEnd;
+    size_t dstLen = 0;
+
+    if (pDstLen != NULL) {
+        *pDstLen = 0;
+    }
+
+    if (pField == NULL || (pField->p == NULL && pField->len > 0)) {
+        return EINVAL;
+    }
+
+    pSrc    = pField->p;
+    pSrcEnd = pField->p + pField->len;
+
+    /* Clean runs are copied in bulk up to and including the first quote of each pair. The second quote is then skipped. */
+    while (pSrc < pSrcEnd) {
+        const char* pQuote = NULL;
+        size_t runLen;
+
+        if ((pField->flags & CSTR_CSV_FIELD_ESCAPED) != 0) {
+            pQuote = (const char*)memchr(pSrc, '"', (size_t)(pSrcEnd - pSrc));
+        }
+
+        if (pQuote == NULL) {
+            runLen = (size_t)(pSrcEnd - pSrc);
+        } else {
+            runLen = (size_t)(pQuote - pSrc) + 1;
+        }
+
+        if (pDst != NULL) {
+            if (dstCap - dstLen < runLen) {
+                return ENOMEM;
+            }
+
+            CSTR_MOVE_MEMORY(pDst + dstLen, pSrc, runLen);
+        }
+
+        dstLen += runLen;
+        pSrc   += runLen;
+
+        if (pQuote != NULL && pSrc < pSrcEnd && *pSrc == '"') {
+            pSrc += 1;
+        }
+    }
+
+    /* Null terminate if there's room for it. */
+    if (pDst != NULL && dstLen < dstCap) {
+        pDst[dstLen] = '\0';
+    }
+
+    if (pDstLen != NULL) {
+        *pDstLen = dstLen;
+    }
+
+    return 0;
+}
+
+CSTR_API void cstr_csv_find_chunks(const char* pText, size_t textLen, size_t chunkCount, size_t* pOffsets)
+{
+    cstr_uint64 quoteCarry = 0;
+    size_t chunkSize;
+    size_t iChunk;
+    size_t blockBase;
+
+    if (pOffsets == NULL) {
+        return;
+    }
+
+    pOffsets[0] = 0;
+
+    if (chunkCount == 0) {
+        return;
+    }
+
+    if (pText == NULL) {
+        textLen = 0;
+    }
+
+    chunkSize = textLen / chunkCount;
+    iChunk    = 1;
+
+    /* Each chunk after the first starts just after the first newline outside of quotes that is at or after its target offset. */
+    for (blockBase = 0; blockBase < textLen && iChunk < chunkCount; blockBase += 64) {
+        cstr_uint64 newlines;
+        cstr_uint64 rowEnds;
+
+        if (blockBase + 64 <= chunkSize * iChunk) {
+            /* The block is before the next target, but still needs to be scanned for the state of the quotes. */
+            cstr_csv_scan_structural(pText, textLen, blockBase, '\n', &quoteCarry, &newlines);
+            continue;
+        }
+
+        rowEnds = cstr_csv_scan_structural(pText, textLen, blockBase, '\n', &quoteCarry, &newlines) & newlines;
+
+        while (iChunk < chunkCount) {
+            size_t searchStart = chunkSize * iChunk;
+            size_t offset;
+
+            if (searchStart < pOffsets[iChunk - 1]) {
+                searchStart = pOffsets[iChunk - 1];
+            }
+
+            if (searchStart > blockBase) {
+                if (searchStart - blockBase >= 64) {
+                    break;
+                }
+
+                rowEnds &= ~(cstr_uint64)0 << (searchStart - blockBase);
+            }
+
+            if (rowEnds == 0) {
+                break;
+            }
+
+            offset = blockBase + cstr_ctz64(rowEnds) + 1;
+            rowEnds &= rowEnds - 1;
+
+            pOffsets[iChunk] = offset;
+            iChunk += 1;
+        }
+    }
+
+    for (; iChunk <= chunkCount; iChunk += 1) {
+        pOffsets[iChunk] = textLen;
+    }
+}
+
+
+
+/**************************************************************************************************************************************************************
+
+Key/Value Documents
+
+**************************************************************************************************************************************************************/
+#define CSTR_FNV1A_32_OFFSET_BASIS    2166136261U
+
+static cstr_uint32 cstr_hash32_fnv1a_continue(cstr_uint32 hash, const char* pData, size_t dataLen)
+{
+    size_t i;
+
+    for (i = 0; i < dataLen; i += 1) {
+        hash ^= (cstr_uint8)pData[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static cstr_uint32 cstr_hash32_fnv1a(const char* pData, size_t dataLen)
+{
+    return cstr_hash32_fnv1a_continue(CSTR_FNV1A_32_OFFSET_BASIS, pData, dataLen);
+}
+
+static cstr_bool32 cstr_kvdoc_is_quoted(const char* pToken, size_t tokenLen)
+{
+    return tokenLen >= 2 && (pToken[0] == '\"' || pToken[0] == '\'');
+}
+
+/*
+The full path of a key is its section and key joined with a dot, but it's never actually stored that way since the section and key are in different parts of
+the text. These functions treat the section and key as a single virtual string. A key with no section is passed in with a section length of 0.
+*/
+static size_t cstr_kvdoc_path_pieces(const char* pSection, size_t sectionLen, const char* pKey, size_t keyLen, const char** ppPieces, size_t* pPieceLens)
+{
+    size_t pieceCount = 0;
+
+    if (sectionLen > 0) {
+        ppPieces[pieceCount] = pSection;
+        pPieceLens[pieceCount] = sectionLen;
+        pieceCount += 1;
+
+        ppPieces[pieceCount] = ".";
+        pPieceLens[pieceCount] = 1;
+        pieceCount += 1;
+    }
+
+    ppPieces[pieceCount] = pKey;
+    pPieceLens[pieceCount] = keyLen;
+    pieceCount += 1;
+
+    return pieceCount;
+}
+
+static size_t cstr_kvdoc_path_len(size_t sectionLen, size_t keyLen)
+{
+    return (sectionLen > 0) ? (sectionLen + 1 + keyLen) : keyLen;
+}
+
+static cstr_uint32 cstr_kvdoc_path_hash(const char* pSection, size_t sectionLen, const char* pKey, size_t keyLen)
+{
+    cstr_uint32 hash = CSTR_FNV1A_32_OFFSET_BASIS;
+
+    if (sectionLen > 0) {
+        hash = cstr_hash32_fnv1a_continue(hash, pSection, sectionLen);
+        hash = cstr_hash32_fnv1a_continue(hash, ".", 1);
+    }
+
+    return cstr_hash32_fnv1a_continue(hash, pKey, keyLen);
+}
+
+static cstr_bool32 cstr_kvdoc_path_equal(const char* pSectionA, size_t sectionLenA, const char* pKeyA, size_t keyLenA, const char* pSectionB, size_t sectionLenB, const char* pKeyB, size_t keyLenB)
+{
+    const char* pPiecesA[3];
+    const char* pPiecesB[3];
+    size_t pieceLensA[3];
+    size_t pieceLensB[3];
+    size_t pieceCountA;
+    size_t pieceCountB;
+    size_t iPieceA = 0;
+    size_t iPieceB = 0;
+    size_t offA = 0;
+    size_t offB = 0;
+
+    if (cstr_kvdoc_path_len(sectionLenA, keyLenA) != cstr_kvdoc_path_len(sectionLenB, keyLenB)) {
+        return CSTR_FALSE;
+    }
+
+    pieceCountA = cstr_kvdoc_path_pieces(pSectionA, sectionLenA, pKeyA, keyLenA, pPiecesA, pieceLensA);
+    pieceCountB = cstr_kvdoc_path_pieces(pSectionB, sectionLenB, pKeyB, keyLenB, pPiecesB, pieceLensB);
+
+    /* The total lengths are the same so we can just compare the overlapping parts of each piece until one side runs out. */
+    while (iPieceA < pieceCountA && iPieceB < pieceCountB) {
+        size_t lenA = pieceLensA[iPieceA] - offA;
+        size_t lenB = pieceLensB[iPieceB] - offB;
+        size_t len  = (lenA < lenB) ? lenA : lenB;
+
+        if (CSTR_COMPARE_MEMORY(pPiecesA[iPieceA] + offA, pPiecesB[iPieceB] + offB, len) != 0) {
+            return CSTR_FALSE;
+        }
+
+        offA += len;
+        offB += len;
+
+        if (offA == pieceLensA[iPieceA]) {
+            iPieceA += 1;
+            offA = 0;
+        }
+        if (offB == pieceLensB[iPieceB]) {
+            iPieceB += 1;
+            offB = 0;
+        }
+    }
+
+    return CSTR_TRUE;
+}
+
+static cstr_bool32 cstr_kvdoc_entry_path_equal(const cstr_kvdoc_entry* pEntryA, const cstr_kvdoc_entry* pEntryB)
+{
+    return pEntryA->keyHash == pEntryB->keyHash && cstr_kvdoc_path_equal(pEntryA->pSection, pEntryA->sectionLen, pEntryA->pKey, pEntryA->keyLen, pEntryB->pSection, pEntryB->sectionLen, pEntryB->pKey, pEntryB->keyLen);
+}
+
+static int cstr_kvdoc_reserve_index(cstr_kvdoc* pDoc, size_t entryCount)
+{
+    size_t indexCap;
+
+    CSTR_ASSERT(pDoc != NULL);
+
+    /* Keep the load factor at or below 50%. */
+    indexCap = 16;
+    while (indexCap < entryCount * 2) {
+        indexCap *= 2;
+    }
+
+    if (indexCap > pDoc->indexCap) {
+        cstr_uint32* pNewIndex = (cstr_uint32*)CSTR_REALLOC(pDoc->pIndex, indexCap * sizeof(*pNewIndex));
+        if (pNewIndex == NULL) {
+            return ENOMEM;
+        }
+
+        pDoc->pIndex   = pNewIndex;
+        pDoc->indexCap = indexCap;
+    }
+
+    return 0;
+}
+
+static void cstr_kvdoc_rebuild_index(cstr_kvdoc* pDoc)
+{
+    size_t iEntry;
+
+    CSTR_ASSERT(pDoc != NULL);
+    CSTR_ASSERT(pDoc->indexCap >= pDoc->entryCount * 2);
+
+    CSTR_ZERO_MEMORY(pDoc->pIndex, pDoc->indexCap * sizeof(*pDoc->pIndex));
+
+    /* Entries are inserted in order, with later duplicates replacing earlier ones. */
+    for (iEntry = 0; iEntry < pDoc->entryCount; iEntry += 1) {
+        const cstr_kvdoc_entry* pEntry = &pDoc->pEntries[iEntry];
+        size_t mask = pDoc->indexCap - 1;
+        size_t iSlot = pEntry->keyHash & mask;
+
+        for (;;) {
+            cstr_uint32 slot = pDoc->pIndex[iSlot];
+            if (slot == 0) {
+                break;  /* Empty slot. */
+            }
+
+            if (cstr_kvdoc_entry_path_equal(&pDoc->pEntries[slot-1], pEntry)) {
+                break;  /* Duplicate key. */
+            }
+
+            iSlot = (iSlot + 1) & mask;
+        }
+
+        pDoc->pIndex[iSlot] = (cstr_uint32)(iEntry + 1);
+    }
+}
+
+static int cstr_kvdoc_reserve_entries(cstr_kvdoc_entry** ppEntries, size_t* pEntryCap, size_t entryCount)
+{
+    size_t newCap;
+    cstr_kvdoc_entry* pNewEntries;
+
+    CSTR_ASSERT(ppEntries != NULL);
+    CSTR_ASSERT(pEntryCap != NULL);
+
+    if (entryCount <= *pEntryCap) {
+        return 0;
+    }
+
+    newCap = (*pEntryCap == 0) ? 32 : *pEntryCap;
+    while (newCap < entryCount) {
+        newCap *= 2;
+    }
+
+    pNewEntries = (cstr_kvdoc_entry*)CSTR_REALLOC(*ppEntries, newCap * sizeof(*pNewEntries));
+    if (pNewEntries == NULL) {
+        return ENOMEM;
+    }
+
+    *ppEntries = pNewEntries;
+    *pEntryCap = newCap;
+
+    return 0;
+}
+
+static int cstr_kvdoc_push_entry(cstr_kvdoc_entry** ppEntries, size_t* pEntryCount, size_t* pEntryCap, const cstr_keyvalue_parser* pParser)
+{
+    int result;
+    cstr_kvdoc_entry* pEntry;
+
+    result = cstr_kvdoc_reserve_entries(ppEntries, pEntryCap, *pEntryCount + 1);
+    if (result != 0) {
+        return result;
+    }
+
+    pEntry = &(*ppEntries)[*pEntryCount];
+    pEntry->pSection   = pParser->pSection;
+    pEntry->sectionLen = pParser->sectionLen;
+    pEntry->pKey       = pParser->pKey;
+    pEntry->keyLen     = pParser->keyLen;
+    pEntry->pValue     = pParser->pValue;
+    pEntry->valueLen   = pParser->valueLen;
+    pEntry->pDecodedValue   = NULL;
+    pEntry->decodedValueLen = 0;
+    pEntry->lineNumber = pParser->lineNumber;
+
+    if (cstr_kvdoc_is_quoted(pEntry->pKey, pEntry->keyLen)) {
+        pEntry->pKey   += 1;
+        pEntry->keyLen -= 2;
+    }
+
+    pEntry->keyHash = cstr_kvdoc_path_hash(pEntry->pSection, pEntry->sectionLen, pEntry->pKey, pEntry->keyLen);
+
+    *pEntryCount += 1;
+    return 0;
+}
+
+static cstr_uint32 cstr_kvdoc_node_hash(cstr_uint32 parent, cstr_uint32 nameHash)
+{
+    return nameHash ^ (parent * 2654435761U);
+}
+
+static size_t cstr_kvdoc_count_segments(const char* pStr, size_t strLen)
+{
+    size_t segmentCount = 1;
+    size_t i;
+
+    for (i = 0; i < strLen; i += 1) {
+        if (pStr[i] == '.') {
+            segmentCount += 1;
+        }
+    }
+
+    return segmentCount;
+}
+
+static int cstr_kvdoc_reserve_tree(cstr_kvdoc* pDoc, const cstr_kvdoc_entry* pEntries, size_t entryCount)
+{
+    size_t maxNodeCount;
+    size_t nodeIndexCap;
+    size_t iEntry;
+
+    CSTR_ASSERT(pDoc != NULL);
+
+    /* Every segment of every path could be a new node. This is an upper bound which lets the tree be built without any allocations. */
+    maxNodeCount = 1;   /* Root. */
+    for (iEntry = 0; iEntry < entryCount; iEntry += 1) {
+        if (pEntries[iEntry].sectionLen > 0) {
+            maxNodeCount += cstr_kvdoc_count_segments(pEntries[iEntry].pSection, pEntries[iEntry].sectionLen);
+        }
+
+        maxNodeCount += cstr_kvdoc_count_segments(pEntries[iEntry].pKey, pEntries[iEntry].keyLen);
+    }
+
+    if (maxNodeCount >= (cstr_uint32)0xFFFFFFFF) {
+        return ENOMEM;  /* Node indices are 32-bit. */
+    }
+
+    if (maxNodeCount > pDoc->nodeCap) {
+        cstr_kvdoc_node* pNewNodes = (cstr_kvdoc_node*)CSTR_REALLOC(pDoc->pNodes, maxNodeCount * sizeof(*pNewNodes));
+        if (pNewNodes == NULL) {
+            return ENOMEM;
+        }
+
+        pDoc->pNodes  = pNewNodes;
+        pDoc->nodeCap = maxNodeCount;
+    }
+
+    /* Keep the load factor at or below 50%. */
+    nodeIndexCap = 16;
+    while (nodeIndexCap < maxNodeCount * 2) {
+        nodeIndexCap *= 2;
+    }
+
+    if (nodeIndexCap > pDoc->nodeIndexCap) {
+        cstr_uint32* pNewNodeIndex = (cstr_uint32*)CSTR_REALLOC(pDoc->pNodeIndex, nodeIndexCap * sizeof(*pNewNodeIndex));
+        if (pNewNodeIndex == NULL) {
+            return ENOMEM;
+        }
+
+        pDoc->pNodeIndex   = pNewNodeIndex;
+        pDoc->nodeIndexCap = nodeIndexCap;
+    }
+
+    return 0;
+}
+
+static cstr_uint32 cstr_kvdoc_find_child(const cstr_kvdoc* pDoc, cstr_uint32 parent, const char* pName, size_t nameLen, cstr_uint32 nameHash, size_t* pSlot)
+{
+    size_t mask = pDoc->nodeIndexCap - 1;
+    size_t iSlot = cstr_kvdoc_node_hash(parent, nameHash) & mask;
+    size_t iProbe;
+    cstr_uint32 result = 0;
+
+    /* The table is never more than half full so there's always an empty slot, but the probe is bounded anyway so a bad table can't loop forever. */
+    for (iProbe = 0; iProbe < pDoc->nodeIndexCap; iProbe += 1) {
+        const cstr_kvdoc_node* pNode;
+        cstr_uint32 slot = pDoc->pNodeIndex[iSlot];
+        if (slot == 0) {
+            break;  /* Not found. */
+        }
+
+        pNode = &pDoc->pNodes[slot-1];
+        if (pNode->parent == parent && pNode->nameHash == nameHash && pNode->nameLen == nameLen && CSTR_COMPARE_MEMORY(pNode->pName, pName, nameLen) == 0) {
+            result = slot;
+            break;
+        }
+
+        iSlot = (iSlot + 1) & mask;
+    }
+
+    if (pSlot != NULL) {
+        *pSlot = iSlot;
+    }
+
+    return result;  /* Node index plus one, or 0 if it wasn't found. */
+}
+
+static cstr_uint32 cstr_kvdoc_insert_segments(cstr_kvdoc* pDoc, cstr_uint32 parent, const char* pPath, size_t pathLen)
+{
+    size_t segmentBeg = 0;
+
+    for (;;) {
+        size_t segmentEnd = segmentBeg;
+        cstr_uint32 nameHash = CSTR_FNV1A_32_OFFSET_BASIS;
+        cstr_uint32 slot;
+        size_t iSlot;
+
+        /* The hash is calculated while searching for the end of the segment so the path is only read once. */
+        while (segmentEnd < pathLen && pPath[segmentEnd] != '.') {
+            nameHash ^= (cstr_uint8)pPath[segmentEnd];
+            nameHash *= 16777619U;
+            segmentEnd += 1;
+        }
+
+        slot = cstr_kvdoc_find_child(pDoc, parent, pPath + segmentBeg, segmentEnd - segmentBeg, nameHash, &iSlot);
+        if (slot == 0) {
+            cstr_uint32 iNode = (cstr_uint32)pDoc->nodeCount;
+            cstr_kvdoc_node* pNode = &pDoc->pNodes[iNode];
+
+            CSTR_ASSERT(pDoc->nodeCount < pDoc->nodeCap);
+
+            pNode->pName       = pPath + segmentBeg;
+            pNode->nameLen     = segmentEnd - segmentBeg;
+            pNode->nameHash    = nameHash;
+            pNode->parent      = parent;
+            pNode->firstChild  = 0;
+            pNode->lastChild   = 0;
+            pNode->nextSibling = 0;
+            pNode->entry       = 0;
+
+            if (pDoc->pNodes[parent].lastChild == 0) {
+                pDoc->pNodes[parent].firstChild = iNode;
+            } else {
+                pDoc->pNodes[pDoc->pNodes[parent].lastChild].nextSibling = iNode;
+            }
+            pDoc->pNodes[parent].lastChild = iNode;
+
+            pDoc->nodeCount += 1;
+            pDoc->pNodeIndex[iSlot] = iNode + 1;
+
+            parent = iNode;
+        } else {
+            parent = slot - 1;
+        }
+
+        if (segmentEnd == pathLen) {
+            break;
+        }
+
+        segmentBeg = segmentEnd + 1;   /* Skip the dot. */
+    }
+
+    return parent;
+}
+
+static void cstr_kvdoc_rebuild_tree(cstr_kvdoc* pDoc)
+{
+    size_t iEntry;
+
+    CSTR_ASSERT(pDoc != NULL);
+    CSTR_ASSERT(pDoc->nodeCap > 0);
+
+    CSTR_ZERO_MEMORY(pDoc->pNodeIndex, pDoc->nodeIndexCap * sizeof(*pDoc->pNodeIndex));
+
+    /* The root is never in the index. It's always at index 0 which is why 0 can be used to mean "none" for children and siblings. */
+    CSTR_ZERO_OBJECT(&pDoc->pNodes[0]);
+    pDoc->pNodes[0].pName = pDoc->pText;
+    pDoc->nodeCount = 1;
+
+    for (iEntry = 0; iEntry < pDoc->entryCount; iEntry += 1) {
+        const cstr_kvdoc_entry* pEntry = &pDoc->pEntries[iEntry];
+        cstr_uint32 iNode = 0;
+
+        if (pEntry->sectionLen > 0) {
+            iNode = cstr_kvdoc_insert_segments(pDoc, iNode, pEntry->pSection, pEntry->sectionLen);
+        }
+
+        iNode = cstr_kvdoc_insert_segments(pDoc, iNode, pEntry->pKey, pEntry->keyLen);
+
+        /* Later duplicates replace earlier ones, the same as the flat index. */
+        pDoc->pNodes[iNode].entry = (cstr_uint32)(iEntry + 1);
+    }
+}
+
+static int cstr_kvdoc_parse(cstr_kvdoc* pDoc)
+{
+    int result;
+    cstr_keyvalue_parser parser;
+
+    CSTR_ASSERT(pDoc != NULL);
+
+    pDoc->entryCount = 0;
+
+    result = cstr_keyvalue_parser_init(pDoc->pText, pDoc->textLen, &parser);
+    if (result != 0) {
+        return result;
+    }
+
+    for (;;) {
+        result = cstr_keyvalue_parser_scan(&parser);
+        if (result != 0) {
+            break;
+        }
+
+        result = cstr_kvdoc_push_entry(&pDoc->pEntries, &pDoc->entryCount, &pDoc->entryCap, &parser);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    /* The lexer returns ENOMEM when it runs out of input which is how we know we've successfully reached the end. */
+    if (result != ENOMEM) {
+        return result;
+    }
+
+    result = cstr_kvdoc_reserve_index(pDoc, pDoc->entryCount);
+    if (result != 0) {
+        return result;
+    }
+
+    result = cstr_kvdoc_reserve_tree(pDoc, pDoc->pEntries, pDoc->entryCount);
+    if (result != 0) {
+        return result;
+    }
+
+    cstr_kvdoc_rebuild_index(pDoc);
+    cstr_kvdoc_rebuild_tree(pDoc);
+    return 0;
+}
+
+CSTR_API int cstr_kvdoc_init(const char* pText, size_t textLen, cstr_kvdoc* pDoc)
+{
+    int result;
+
+    if (pDoc == NULL) {
+        return EINVAL;
+    }
+
+    CSTR_ZERO_OBJECT(pDoc);
+
+    if (pText == NULL) {
+        return EINVAL;
+    }
+
+    if (textLen == (size_t)-1) {
+        textLen = utf8_strlen(pText);
+    }
+
+    pDoc->pText   = pText;
+    pDoc->textLen = textLen;
+
+    result = cstr_kvdoc_parse(pDoc);
+    if (result != 0) {
+        cstr_kvdoc_uninit(pDoc);
+        return result;
+    }
+
+    return 0;
+}
+
+#if defined(CSTR_WIN32)
+static int cstr_utf8_to_wchar_path(const char* pFilePath, wchar_t** ppPathW)
+{
+    int result;
+    size_t pathLen;
+    wchar_t* pPathW;
+
+    *ppPathW = NULL;
+
+    /* The path is UTF-8 so we need to use the wide-character API. */
+    result = utf8_to_wchar_len(&pathLen, pFilePath, (size_t)-1, NULL, 0);
+    if (result != 0) {
+        return result;
+    }
+
+    pPathW = (wchar_t*)CSTR_MALLOC((pathLen + 1) * sizeof(*pPathW));
+    if (pPathW == NULL) {
+        return ENOMEM;
+    }
+
+    utf8_to_wchar(pPathW, pathLen + 1, NULL, pFilePath, (size_t)-1, NULL, 0);
+    pPathW[pathLen] = 0;
+
+    *ppPathW = pPathW;
+    return 0;
+}
+#endif
+
+static int cstr_get_file_info(const char* pFilePath, cstr_uint64* pSizeInBytes, cstr_uint64* pModifiedTime)
+{
+#if defined(CSTR_WIN32)
+    int result;
+    wchar_t* pPathW;
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    BOOL success;
+
+    result = cstr_utf8_to_wchar_path(pFilePath, &pPathW);
+    if (result != 0) {
+        return result;
+    }
+
+    success = GetFileAttributesExW(pPathW, GetFileExInfoStandard, &info);
+    CSTR_FREE(pPathW);
+
+    if (!success) {
+        return ENOENT;
+    }
+
+    *pSizeInBytes  = ((cstr_uint64)info.nFileSizeHigh << 32) | (cstr_uint64)info.nFileSizeLow;
+    *pModifiedTime = ((cstr_uint64)info.ftLastWriteTime.dwHighDateTime << 32) | (cstr_uint64)info.ftLastWriteTime.dwLowDateTime;
+
+    return 0;
+#elif defined(CSTR_POSIX)
+    struct stat info;
+
+    if (stat(pFilePath, &info) != 0) {
+        return ENOENT;
+    }
+
+    *pSizeInBytes  = (cstr_uint64)info.st_size;
+    *pModifiedTime = (cstr_uint64)info.st_mtime;
+
+    return 0;
+#else
+    /* Standard C has no way to retrieve the modification time so we can only use the size. */
+    FILE* pFile;
+    long fileSize;
+
+    pFile = fopen(pFilePath, "rb");
+    if (pFile == NULL) {
+        return ENOENT;
+    }
+
+    if (fseek(pFile, 0, SEEK_END) != 0 || (fileSize = ftell(pFile)) < 0) {
+        fclose(pFile);
+        return EINVAL;
+    }
+
+    fclose(pFile);
+
+    *pSizeInBytes  = (cstr_uint64)fileSize;
+    *pModifiedTime = 0;
+
+    return 0;
+#endif
+}
+
+static int cstr_write_file_replace(const char* pFilePath, const void* pData, size_t dataSize)
+{
+    /* The data is written to a temporary file which then replaces the destination so that readers never see a partially written file. */
+    size_t pathLen = utf8_strlen(pFilePath);
+    char* pTempPath;
+    int result = 0;
+
+    pTempPath = (char*)CSTR_MALLOC(pathLen + 5);
+    if (pTempPath == NULL) {
+        return ENOMEM;
+    }
+
+    CSTR_COPY_MEMORY(pTempPath, pFilePath, pathLen);
+    CSTR_COPY_MEMORY(pTempPath + pathLen, ".tmp", 5);
+
+#if defined(CSTR_WIN32)
+    {
+        wchar_t* pPathW;
+        wchar_t* pTempPathW;
+        HANDLE hFile;
+        const char* pRunningData = (const char*)pData;
+
+        result = cstr_utf8_to_wchar_path(pFilePath, &pPathW);
+        if (result != 0) {
+            CSTR_FREE(pTempPath);
+            return result;
+        }
+
+        result = cstr_utf8_to_wchar_path(pTempPath, &pTempPathW);
+        CSTR_FREE(pTempPath);
+
+        if (result != 0) {
+            CSTR_FREE(pPathW);
+            return result;
+        }
+
+        hFile = CreateFileW(pTempPathW, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            CSTR_FREE(pTempPathW);
+            CSTR_FREE(pPathW);
+            return EIO;
+        }
+
+        while (dataSize > 0) {
+            DWORD bytesToWrite = (dataSize > 0x40000000) ? 0x40000000 : (DWORD)dataSize;
+            DWORD bytesWritten;
+
+            if (!WriteFile(hFile, pRunningData, bytesToWrite, &bytesWritten, NULL) || bytesWritten != bytesToWrite) {
+                result = EIO;
+                break;
+            }
+
+            pRunningData += bytesWritten;
+            dataSize     -= bytesWritten;
+        }
+
+        CloseHandle(hFile);
+
+        if (result == 0 && !MoveFileExW(pTempPathW, pPathW, MOVEFILE_REPLACE_EXISTING)) {
+            result = EIO;
+        }
+
+        if (result != 0) {
+            DeleteFileW(pTempPathW);
+        }
+
+        CSTR_FREE(pTempPathW);
+        CSTR_FREE(pPathW);
+    }
+#else
+    {
+        FILE* pFile = fopen(pTempPath, "wb");
+        if (pFile == NULL) {
+            CSTR_FREE(pTempPath);
+            return EIO;
+        }
+
+        if (fwrite(pData, 1, dataSize, pFile) != dataSize) {
+            result = EIO;
+        }
+
+        if (fclose(pFile) != 0) {
+            result = EIO;
+        }
+
+        if (result == 0 && rename(pTempPath, pFilePath) != 0) {
+            result = EIO;
+        }
+
+        if (result != 0) {
+            remove(pTempPath);
+        }
+
+        CSTR_FREE(pTempPath);
+    }
+#endif
+
+    return result;
+}
+
+static int cstr_kvdoc_map_file(const char* pFilePath, cstr_kvdoc* pDoc)
+{
+#if defined(CSTR_HAS_MMAP) && defined(CSTR_WIN32)
+    int result;
+    wchar_t* pPathW;
+    HANDLE hFile;
+    HANDLE hMapping;
+    LARGE_INTEGER fileSize;
+    void* pData = NULL;
+
+    result = cstr_utf8_to_wchar_path(pFilePath, &pPathW);
+    if (result != 0) {
+        return result;
+    }
+
+    hFile = CreateFileW(pPathW, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    CSTR_FREE(pPathW);
+
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return ENOENT;
+    }
+
+    if (!GetFileSizeEx(hFile, &fileSize) || (cstr_uint64)fileSize.QuadPart > (size_t)-1) {
+        CloseHandle(hFile);
+        return EINVAL;
+    }
+
+    /* A zero length file cannot be mapped. */
+    if (fileSize.QuadPart == 0) {
+        CloseHandle(hFile);
+        return 0;
+    }
+
+    hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile); /* The mapping keeps the file open. */
+
+    if (hMapping == NULL) {
+        return EINVAL;
+    }
+
+    pData = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (pData == NULL) {
+        CloseHandle(hMapping);
+        return ENOMEM;
+    }
+
+    pDoc->file.pData       = pData;
+    pDoc->file.sizeInBytes = (size_t)fileSize.QuadPart;
+    pDoc->file.hMapping    = (void*)hMapping;
+
+    return 0;
+#elif defined(CSTR_HAS_MMAP)
+    int fd;
+    struct stat info;
+    void* pData;
+
+    fd = open(pFilePath, O_RDONLY);
+    if (fd < 0) {
+        return ENOENT;
+    }
+
+    if (fstat(fd, &info) != 0 || info.st_size < 0) {
+        close(fd);
+        return EINVAL;
+    }
+
+    /* A zero length file cannot be mapped. */
+    if (info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    pData = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  /* The mapping keeps the file open. */
+
+    if (pData == MAP_FAILED) {
+        return ENOMEM;
+    }
+
+    /* The parser is a single forward pass over the file. Let the kernel know so it can read ahead aggressively. */
+    #if defined(MADV_SEQUENTIAL)
+    madvise(pData, (size_t)info.st_size, MADV_SEQUENTIAL);
+    #endif
+
+    pDoc->file.pData       = pData;
+    pDoc->file.sizeInBytes = (size_t)info.st_size;
+
+    return 0;
+#else
+    FILE* pFile;
+    long fileSize;
+    char* pData;
+
+    pFile = fopen(pFilePath, "rb");
+    if (pFile == NULL) {
+        return ENOENT;
+    }
+
+    if (fseek(pFile, 0, SEEK_END) != 0 || (fileSize = ftell(pFile)) < 0 || fseek(pFile, 0, SEEK_SET) != 0) {
+        fclose(pFile);
+        return EINVAL;
+    }
+
+    pData = (char*)CSTR_MALLOC((size_t)fileSize + 1);
+    if (pData == NULL) {
+        fclose(pFile);
+        return ENOMEM;
+    }
+
+    if (fread(pData, 1, (size_t)fileSize, pFile) != (size_t)fileSize) {
+        CSTR_FREE(pData);
+        fclose(pFile);
+        return EIO;
+    }
+
+    fclose(pFile);
+    pData[fileSize] = '\0';
+
+    pDoc->file.pData       = pData;
+    pDoc->file.sizeInBytes = (size_t)fileSize;
+    pDoc->file.isHeap      = CSTR_TRUE;
+
+    return 0;
+#endif
+}
+
+static void cstr_kvdoc_unmap_file(cstr_kvdoc* pDoc)
+{
+    CSTR_ASSERT(pDoc != NULL);
+
+    if (pDoc->file.pData == NULL) {
+        return;
+    }
+
+    if (pDoc->file.isHeap) {
+        CSTR_FREE(pDoc->file.pData);
+    } else {
+    #if defined(CSTR_HAS_MMAP) && defined(CSTR_WIN32)
+        UnmapViewOfFile(pDoc->file.pData);
+        CloseHandle((HANDLE)pDoc->file.hMapping);
+    #elif defined(CSTR_HAS_MMAP)
+        munmap(pDoc->file.pData, pDoc->file.sizeInBytes);
+    #endif
+    }
+
+    CSTR_ZERO_OBJECT(&pDoc->file);
+}
+
+CSTR_API int cstr_kvdoc_open_file(const char* pFilePath, cstr_kvdoc* pDoc)
+{
+    int result;
+
+    if (pDoc == NULL) {
+        return EINVAL;
+    }
+
+    CSTR_ZERO_OBJECT(pDoc);
+
+    if (pFilePath == NULL) {
+        return EINVAL;
+    }
+
+    result = cstr_kvdoc_map_file(pFilePath, pDoc);
+    if (result != 0) {
+        return result;
+    }
+
+    pDoc->pText   = (pDoc->file.pData != NULL) ? (const char*)pDoc->file.pData : "";
+    pDoc->textLen = pDoc->file.sizeInBytes;
+
+    result = cstr_kvdoc_parse(pDoc);
+    if (result != 0) {
+        cstr_kvdoc_uninit(pDoc);
+        return result;
+    }
+
+    return 0;
+}
+
+CSTR_API void cstr_kvdoc_uninit(cstr_kvdoc* pDoc)
+{
+    if (pDoc == NULL) {
+        return;
+    }
+
+    CSTR_FREE(pDoc->pEntries);
+    CSTR_FREE(pDoc->pIndex);
+    CSTR_FREE(pDoc->pNodes);
+    CSTR_FREE(pDoc->pNodeIndex);
+    cstr_kvdoc_unmap_file(pDoc);
+
+    CSTR_ZERO_OBJECT(pDoc);
+}
+
+static const cstr_kvdoc_entry* cstr_kvdoc_find_hashed(const cstr_kvdoc* pDoc, const char* pSection, size_t sectionLen, const char* pKey, size_t keyLen, cstr_uint32 keyHash)
+{
+    size_t mask;
+    size_t iSlot;
+    size_t iProbe;
+
+    CSTR_ASSERT(pDoc != NULL);
+
+    if (pDoc->indexCap == 0) {
+        return NULL;
+    }
+
+    mask  = pDoc->indexCap - 1;
+    iSlot = keyHash & mask;
+
+    /* Bounded for the same reason as cstr_kvdoc_find_child(). */
+    for (iProbe = 0; iProbe < pDoc->indexCap; iProbe += 1) {
+        const cstr_kvdoc_entry* pEntry;
+        cstr_uint32 slot = pDoc->pIndex[iSlot];
+        if (slot == 0) {
+            return NULL;    /* Not found. */
+        }
+
+        pEntry = &pDoc->pEntries[slot-1];
+        if (pEntry->keyHash == keyHash && cstr_kvdoc_path_equal(pEntry->pSection, pEntry->sectionLen, pEntry->pKey, pEntry->keyLen, pSection, sectionLen, pKey, keyLen)) {
+            return pEntry;
+        }
+
+        iSlot = (iSlot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+CSTR_API const cstr_kvdoc_entry* cstr_kvdoc_find(const cstr_kvdoc* pDoc, const char* pKey, size_t keyLen)
+{
+    if (pDoc == NULL || pKey == NULL) {
+        return NULL;
+    }
+
+    if (keyLen == (size_t)-1) {
+        keyLen = utf8_strlen(pKey);
+    }
+
+    return cstr_kvdoc_find_hashed(pDoc, NULL, 0, pKey, keyLen, cstr_hash32_fnv1a(pKey, keyLen));
+}
+
+CSTR_API int cstr_kvdoc_entry_get_value(const cstr_kvdoc_entry* pEntry, cstr* pValue)
+{
+    if (pValue == NULL) {
+        return EINVAL;
+    }
+
+    *pValue = NULL;
+
+    if (pEntry == NULL) {
+        return EINVAL;
+    }
+
+    /* Documents loaded from a binary cache have already been decoded. */
+    if (pEntry->pDecodedValue != NULL) {
+        *pValue = cstr_newn(pEntry->pDecodedValue, pEntry->decodedValueLen);
+        if (*pValue == NULL) {
+            return ENOMEM;
+        }
+
+        return 0;
+    }
+
+    /* This is where the deferred unescaping happens. Unquoted values do not need any transformation. */
+    if (cstr_kvdoc_is_quoted(pEntry->pValue, pEntry->valueLen)) {
+        return cstr_lexer_transform_string(pEntry->pValue, pEntry->valueLen, pValue);
+    } else {
+        *pValue = cstr_newn(pEntry->pValue, pEntry->valueLen);
+        if (*pValue == NULL) {
+            return ENOMEM;
+        }
+
+        return 0;
+    }
+}
+
+CSTR_API int cstr_kvdoc_get_value(const cstr_kvdoc* pDoc, const char* pKey, size_t keyLen, cstr* pValue)
+{
+    const cstr_kvdoc_entry* pEntry;
+
+    if (pValue == NULL) {
+        return EINVAL;
+    }
+
+    *pValue = NULL;
+
+    pEntry = cstr_kvdoc_find(pDoc, pKey, keyLen);
+    if (pEntry == NULL) {
+        return ENOENT;
+    }
+
+    return cstr_kvdoc_entry_get_value(pEntry, pValue);
+}
+
+CSTR_API const cstr_kvdoc_node* cstr_kvdoc_find_node(const cstr_kvdoc* pDoc, const char* pPath, size_t pathLen)
+{
+    cstr_uint32 iNode = 0;
+    size_t segmentBeg = 0;
+
+    if (pDoc == NULL || pPath == NULL || pDoc->nodeCount == 0) {
+        return NULL;
+    }
+
+    if (pathLen == (size_t)-1) {
+        pathLen = utf8_strlen(pPath);
+    }
+
+    if (pathLen == 0) {
+        return &pDoc->pNodes[0];
+    }
+
+    for (;;) {
+        size_t segmentEnd = segmentBeg;
+        cstr_uint32 slot;
+
+        while (segmentEnd < pathLen && pPath[segmentEnd] != '.') {
+            segmentEnd += 1;
+        }
+
+        slot = cstr_kvdoc_find_child(pDoc, iNode, pPath + segmentBeg, segmentEnd - segmentBeg, cstr_hash32_fnv1a(pPath + segmentBeg, segmentEnd - segmentBeg), NULL);
+        if (slot == 0) {
+            return NULL;
+        }
+
+        iNode = slot - 1;
+
+        if (segmentEnd == pathLen) {
+            break;
+        }
+
+        segmentBeg = segmentEnd + 1;
+    }
+
+    return &pDoc->pNodes[iNode];
+}
+
+CSTR_API const cstr_kvdoc_node* cstr_kvdoc_node_first_child(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode)
+{
+    if (pDoc == NULL || pNode == NULL || pNode->firstChild == 0) {
+        return NULL;
+    }
+
+    return &pDoc->pNodes[pNode->firstChild];
+}
+
+CSTR_API const cstr_kvdoc_node* cstr_kvdoc_node_next_sibling(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode)
+{
+    if (pDoc == NULL || pNode == NULL || pNode->nextSibling == 0) {
+        return NULL;
+    }
+
+    return &pDoc->pNodes[pNode->nextSibling];
+}
+
+CSTR_API const cstr_kvdoc_node* cstr_kvdoc_node_next(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode, const cstr_kvdoc_node* pRoot)
+{
+    if (pDoc == NULL || pNode == NULL || pRoot == NULL) {
+        return NULL;
+    }
+
+    if (pNode->firstChild != 0) {
+        return &pDoc->pNodes[pNode->firstChild];
+    }
+
+    /* No children so move to the next sibling, walking back up the tree until we find one. Never go above the root of the subtree. */
+    while (pNode != pRoot) {
+        if (pNode->nextSibling != 0) {
+            return &pDoc->pNodes[pNode->nextSibling];
+        }
+
+        pNode = &pDoc->pNodes[pNode->parent];
+    }
+
+    return NULL;
+}
+
+CSTR_API const cstr_kvdoc_entry* cstr_kvdoc_node_get_entry(const cstr_kvdoc* pDoc, const cstr_kvdoc_node* pNode)
+{
+    if (pDoc == NULL || pNode == NULL || pNode->entry == 0) {
+        return NULL;
+    }
+
+    return &pDoc->pEntries[pNode->entry - 1];
+}
+
+/*
+The binary cache is a single image that's memory mapped when loaded. All multi-byte fields are in native byte order and every array starts on an 8 byte
+boundary, so the image can be read in place. Offsets are relative to the start of the image and are 32-bit regardless of the size of a pointer, which limits
+the image to 4GB. The text is stored in full so that the loaded document can be reloaded incrementally just like a parsed one.
+
+    [header][entries][nodes][index][node index][text][decoded values]
+*/
+#define CSTR_KVDOC_BINARY_MAGIC         "cstrkvdb"
+#define CSTR_KVDOC_BINARY_VERSION       2
+#define CSTR_KVDOC_BINARY_BYTE_ORDER    0x01020304
+#define CSTR_KVDOC_BINARY_HAS_SOURCE    0x00000001  /* Header flag. The source file's size and modification time were recorded. */
+#define CSTR_KVDOC_BINARY_HAS_SECTION   0x00000001  /* Entry flag. pSection is not NULL. */
+
+typedef struct
+{
+    char magic[8];
+    cstr_uint32 version;
+    cstr_uint32 byteOrder;
+    cstr_uint64 checksum;           /* Checksum of the entire image, with this field set to zero. */
+    cstr_uint64 sourceSize;
+    cstr_uint64 sourceModifiedTime;
+    cstr_uint32 flags;
+    cstr_uint32 fileSize;           /* The size of the entire image, including this header. */
+    cstr_uint32 entriesOffset;
+    cstr_uint32 entryCount;
+    cstr_uint32 nodesOffset;
+    cstr_uint32 nodeCount;
+    cstr_uint32 indexOffset;
+    cstr_uint32 indexCap;
+    cstr_uint32 nodeIndexOffset;
+    cstr_uint32 nodeIndexCap;
+    cstr_uint32 textOffset;
+    cstr_uint32 textLen;
+} cstr_kvdoc_binary_header;
+
+typedef struct
+{
+    cstr_uint32 sectionOffset;
+    cstr_uint32 sectionLen;
+    cstr_uint32 keyOffset;
+    cstr_uint32 keyLen;
+    cstr_uint32 valueOffset;
+    cstr_uint32 valueLen;
+    cstr_uint32 decodedValueOffset;
+    cstr_uint32 decodedValueLen;
+    cstr_uint32 lineNumber;
+    cstr_uint32 keyHash;
+    cstr_uint32 flags;
+    cstr_uint32 reserved;
+} cstr_kvdoc_binary_entry;
+
+typedef struct
+{
+    cstr_uint32 nameOffset;
+    cstr_uint32 nameLen;
+    cstr_uint32 nameHash;
+    cstr_uint32 parent;
+    cstr_uint32 firstChild;
+    cstr_uint32 lastChild;
+    cstr_uint32 nextSibling;
+    cstr_uint32 entry;
+} cstr_kvdoc_binary_node;
+
+static size_t cstr_kvdoc_binary_align(size_t offset)
+{
+    return (offset + 7) & ~(size_t)7;
+}
+
+static cstr_uint64 cstr_kvdoc_binary_checksum(const char* pImage, size_t imageSize)
+{
+    cstr_kvdoc_binary_header header;
+
+    CSTR_ASSERT(imageSize >= sizeof(header));
+
+    /* The header is included so that every byte of the file is covered, but the checksum can't include itself. */
+    CSTR_COPY_MEMORY(&header, pImage, sizeof(header));
+    header.checksum = 0;
+
+    return cstr_hash64(pImage + sizeof(header), imageSize - sizeof(header), cstr_hash64(&header, sizeof(header), 0));
+}
+
+CSTR_API int cstr_kvdoc_save_binary(const cstr_kvdoc* pDoc, const char* pFilePath, const char* pSourceFilePath)
+{
+    int result;
+    cstr_kvdoc_binary_header header;
+    size_t entriesOffset;
+    size_t nodesOffset;
+    size_t indexOffset;
+    size_t nodeIndexOffset;
+    size_t textOffset;
+    size_t decodedValuesOffset;
+    size_t decodedValuesCap = 0;
+    size_t decodedValuesLen = 0;
+    size_t imageCap;
+    char* pImage;
+    cstr_kvdoc_binary_entry* pBinaryEntries;
+    cstr_kvdoc_binary_node* pBinaryNodes;
+    size_t iEntry;
+    size_t iNode;
+
+    if (pDoc == NULL || pFilePath == NULL || pDoc->pText == NULL || pDoc->nodeCount == 0) {
+        return EINVAL;
+    }
+
+    CSTR_ZERO_OBJECT(&header);
+    CSTR_COPY_MEMORY(header.magic, CSTR_KVDOC_BINARY_MAGIC, sizeof(header.magic));
+    header.version   = CSTR_KVDOC_BINARY_VERSION;
+    header.byteOrder = CSTR_KVDOC_BINARY_BYTE_ORDER;
+
+    if (pSourceFilePath != NULL) {
+        result = cstr_get_file_info(pSourceFilePath, &header.sourceSize, &header.sourceModifiedTime);
+        if (result != 0) {
+            return result;
+        }
+
+        header.flags |= CSTR_KVDOC_BINARY_HAS_SOURCE;
+    }
+
+    /* Decoding a string never makes it longer so the length of the quoted values is enough room for the decoded values. */
+    for (iEntry = 0; iEntry < pDoc->entryCount; iEntry += 1) {
+        if (cstr_kvdoc_is_quoted(pDoc->pEntries[iEntry].pValue, pDoc->pEntries[iEntry].valueLen)) {
+            decodedValuesCap += pDoc->pEntries[iEntry].valueLen;
+        }
+    }
+
+    entriesOffset       = cstr_kvdoc_binary_align(sizeof(header));
+    nodesOffset         = cstr_kvdoc_binary_align(entriesOffset   + pDoc->entryCount   * sizeof(cstr_kvdoc_binary_entry));
+    indexOffset         = cstr_kvdoc_binary_align(nodesOffset     + pDoc->nodeCount    * sizeof(cstr_kvdoc_binary_node));
+    nodeIndexOffset     = cstr_kvdoc_binary_align(indexOffset     + pDoc->indexCap     * sizeof(*pDoc->pIndex));
+    textOffset          = cstr_kvdoc_binary_align(nodeIndexOffset + pDoc->nodeIndexCap * sizeof(*pDoc->pNodeIndex));
+    decodedValuesOffset = cstr_kvdoc_binary_align(textOffset      + pDoc->textLen);
+    imageCap            = decodedValuesOffset + decodedValuesCap;
+
+    /* Offsets are 32-bit. Compare against the text length as well in case the calculation above wrapped. */
+    if ((cstr_uint64)imageCap > 0xFFFFFFFF || imageCap < pDoc->textLen) {
+        return ERANGE;
+    }
+
+    header.entriesOffset   = (cstr_uint32)entriesOffset;
+    header.entryCount      = (cstr_uint32)pDoc->entryCount;
+    header.nodesOffset     = (cstr_uint32)nodesOffset;
+    header.nodeCount       = (cstr_uint32)pDoc->nodeCount;
+    header.indexOffset     = (cstr_uint32)indexOffset;
+    header.indexCap        = (cstr_uint32)pDoc->indexCap;
+    header.nodeIndexOffset = (cstr_uint32)nodeIndexOffset;
+    header.nodeIndexCap    = (cstr_uint32)pDoc->nodeIndexCap;
+    header.textOffset      = (cstr_uint32)textOffset;
+    header.textLen         = (cstr_uint32)pDoc->textLen;
+
+    /* Zero initialized so that padding is deterministic. */
+    pImage = (char*)CSTR_CALLOC(imageCap);
+    if (pImage == NULL) {
+        return ENOMEM;
+    }
+
+    pBinaryEntries = (cstr_kvdoc_binary_entry*)(pImage + header.entriesOffset);
+    for (iEntry = 0; iEntry < pDoc->entryCount; iEntry += 1) {
+        const cstr_kvdoc_entry* pEntry = &pDoc->pEntries[iEntry];
+        cstr_kvdoc_binary_entry* pBinaryEntry = &pBinaryEntries[iEntry];
+
+        if (pEntry->pSection != NULL) {
+            pBinaryEntry->sectionOffset = (cstr_uint32)(textOffset + (size_t)(pEntry->pSection - pDoc->pText));
+            pBinaryEntry->sectionLen    = (cstr_uint32)pEntry->sectionLen;
+            pBinaryEntry->flags        |= CSTR_KVDOC_BINARY_HAS_SECTION;
+        }
+
+        pBinaryEntry->keyOffset   = (cstr_uint32)(textOffset + (size_t)(pEntry->pKey   - pDoc->pText));
+        pBinaryEntry->keyLen      = (cstr_uint32)pEntry->keyLen;
+        pBinaryEntry->valueOffset = (cstr_uint32)(textOffset + (size_t)(pEntry->pValue - pDoc->pText));
+        pBinaryEntry->valueLen    = (cstr_uint32)pEntry->valueLen;
+        pBinaryEntry->lineNumber  = (cstr_uint32)pEntry->lineNumber;
+        pBinaryEntry->keyHash     = pEntry->keyHash;
+
+        if (cstr_kvdoc_is_quoted(pEntry->pValue, pEntry->valueLen)) {
+            cstr decodedValue;
+
+            result = cstr_kvdoc_entry_get_value(pEntry, &decodedValue);
+            if (result != 0) {
+                CSTR_FREE(pImage);
+                return result;
+            }
+
+            CSTR_ASSERT(cstr_len(decodedValue) <= pEntry->valueLen);
+
+            CSTR_COPY_MEMORY(pImage + decodedValuesOffset + decodedValuesLen, decodedValue, cstr_len(decodedValue));
+            pBinaryEntry->decodedValueOffset = (cstr_uint32)(decodedValuesOffset + decodedValuesLen);
+            pBinaryEntry->decodedValueLen    = (cstr_uint32)cstr_len(decodedValue);
+            decodedValuesLen += cstr_len(decodedValue);
+
+            cstr_free(decodedValue);
+        } else {
+            /* Unquoted values are used as-is. */
+            pBinaryEntry->decodedValueOffset = pBinaryEntry->valueOffset;
+            pBinaryEntry->decodedValueLen    = pBinaryEntry->valueLen;
+        }
+    }
+
+    pBinaryNodes = (cstr_kvdoc_binary_node*)(pImage + header.nodesOffset);
+    for (iNode = 0; iNode < pDoc->nodeCount; iNode += 1) {
+        const cstr_kvdoc_node* pNode = &pDoc->pNodes[iNode];
+        cstr_kvdoc_binary_node* pBinaryNode = &pBinaryNodes[iNode];
+
+        pBinaryNode->nameOffset  = (cstr_uint32)(textOffset + (size_t)(pNode->pName - pDoc->pText));
+        pBinaryNode->nameLen     = (cstr_uint32)pNode->nameLen;
+        pBinaryNode->nameHash    = pNode->nameHash;
+        pBinaryNode->parent      = pNode->parent;
+        pBinaryNode->firstChild  = pNode->firstChild;
+        pBinaryNode->lastChild   = pNode->lastChild;
+        pBinaryNode->nextSibling = pNode->nextSibling;
+        pBinaryNode->entry       = pNode->entry;
+    }
+
+    CSTR_COPY_MEMORY(pImage + indexOffset,     pDoc->pIndex,     pDoc->indexCap     * sizeof(*pDoc->pIndex));
+    CSTR_COPY_MEMORY(pImage + nodeIndexOffset, pDoc->pNodeIndex, pDoc->nodeIndexCap * sizeof(*pDoc->pNodeIndex));
+    CSTR_COPY_MEMORY(pImage + textOffset,      pDoc->pText,      pDoc->textLen);
+
+    header.fileSize = (cstr_uint32)(decodedValuesOffset + decodedValuesLen);
+    CSTR_COPY_MEMORY(pImage, &header, sizeof(header));
+
+    header.checksum = cstr_kvdoc_binary_checksum(pImage, header.fileSize);
+    CSTR_COPY_MEMORY(pImage, &header, sizeof(header));
+
+    result = cstr_write_file_replace(pFilePath, pImage, (size_t)header.fileSize);
+    CSTR_FREE(pImage);
+
+    return result;
+}
+
+static cstr_bool32 cstr_kvdoc_binary_range_is_valid(cstr_uint64 offset, cstr_uint64 len, cstr_uint64 rangeBeg, cstr_uint64 rangeEnd)
+{
+    return offset >= rangeBeg && offset <= rangeEnd && len <= rangeEnd - offset;
+}
+
+static cstr_bool32 cstr_kvdoc_binary_array_is_valid(cstr_uint64 offset, cstr_uint64 count, size_t elementSize, cstr_uint64 fileSize)
+{
+    if ((offset & 7) != 0) {
+        return CSTR_FALSE;
+    }
+
+    return cstr_kvdoc_binary_range_is_valid(offset, count * elementSize, 0, fileSize);  /* The count is 32-bit so this can't overflow. */
+}
+
+static int cstr_kvdoc_load_binary_image(const char* pImage, size_t imageSize, const char* pSourceFilePath, cstr_kvdoc* pDoc)
+{
+    int result;
+    cstr_kvdoc_binary_header header;
+    const cstr_kvdoc_binary_entry* pBinaryEntries;
+    const cstr_kvdoc_binary_node* pBinaryNodes;
+    const cstr_uint32* pBinaryIndex;
+    const cstr_uint32* pBinaryNodeIndex;
+    cstr_uint32 textBeg;
+    cstr_uint32 textEnd;
+    size_t iEntry;
+    size_t iNode;
+    size_t iSlot;
+    size_t usedSlotCount;
+
+    if (imageSize < sizeof(header)) {
+        return CSTR_ECORRUPT;
+    }
+
+    CSTR_COPY_MEMORY(&header, pImage, sizeof(header));
+
+    if (CSTR_COMPARE_MEMORY(header.magic, CSTR_KVDOC_BINARY_MAGIC, sizeof(header.magic)) != 0) {
+        return CSTR_ECORRUPT;
+    }
+
+    /* A cache from a different version of the format or a machine with a different byte order isn't wrong. It just needs to be generated again. */
+    if (header.version != CSTR_KVDOC_BINARY_VERSION || header.byteOrder != CSTR_KVDOC_BINARY_BYTE_ORDER) {
+        return CSTR_ESTALE;
+    }
+
+    if (header.fileSize != imageSize) {
+        return CSTR_ECORRUPT;
+    }
+
+    if (pSourceFilePath != NULL) {
+        cstr_uint64 sourceSize;
+        cstr_uint64 sourceModifiedTime;
+
+        if ((header.flags & CSTR_KVDOC_BINARY_HAS_SOURCE) == 0) {
+            return CSTR_ESTALE;
+        }
+
+        result = cstr_get_file_info(pSourceFilePath, &sourceSize, &sourceModifiedTime);
+        if (result != 0) {
+            return result;
+        }
+
+        if (sourceSize != header.sourceSize || sourceModifiedTime != header.sourceModifiedTime) {
+            return CSTR_ESTALE;
+        }
+    }
+
+    if (cstr_kvdoc_binary_checksum(pImage, imageSize) != header.checksum) {
+        return CSTR_ECORRUPT;
+    }
+
+    /*
+    The checksum guarantees the file is what we wrote, but the file could still have been crafted. Everything is checked before it's used so that a bad cache
+    can never cause an out of bounds access or a lookup that never terminates. These are the same invariants the parser maintains.
+    */
+    if (!cstr_kvdoc_binary_array_is_valid(header.entriesOffset,   header.entryCount,   sizeof(cstr_kvdoc_binary_entry), header.fileSize) ||
+        !cstr_kvdoc_binary_array_is_valid(header.nodesOffset,     header.nodeCount,    sizeof(cstr_kvdoc_binary_node),  header.fileSize) ||
+        !cstr_kvdoc_binary_array_is_valid(header.indexOffset,     header.indexCap,     sizeof(cstr_uint32),             header.fileSize) ||
+        !cstr_kvdoc_binary_array_is_valid(header.nodeIndexOffset, header.nodeIndexCap, sizeof(cstr_uint32),             header.fileSize) ||
+        !cstr_kvdoc_binary_range_is_valid(header.textOffset, header.textLen, 0, header.fileSize)) {
+        return CSTR_ECORRUPT;
+    }
+
+    if (header.nodeCount == 0 || header.indexCap == 0 ||
+        header.indexCap     < (cstr_uint64)header.entryCount * 2 || (header.indexCap     & (header.indexCap     - 1)) != 0 ||
+        header.nodeIndexCap < (cstr_uint64)header.nodeCount  * 2 || (header.nodeIndexCap & (header.nodeIndexCap - 1)) != 0) {
+        return CSTR_ECORRUPT;
+    }
+
+    textBeg = header.textOffset;
+    textEnd = header.textOffset + header.textLen;
+
+    pBinaryEntries   = (const cstr_kvdoc_binary_entry*)(pImage + header.entriesOffset);
+    pBinaryNodes     = (const cstr_kvdoc_binary_node*) (pImage + header.nodesOffset);
+    pBinaryIndex     = (const cstr_uint32*)            (pImage + header.indexOffset);
+    pBinaryNodeIndex = (const cstr_uint32*)            (pImage + header.nodeIndexOffset);
+
+    pDoc->pText   = pImage + header.textOffset;
+    pDoc->textLen = (size_t)header.textLen;
+
+    pDoc->pEntries   = (cstr_kvdoc_entry*)CSTR_MALLOC(((header.entryCount > 0) ? (size_t)header.entryCount : 1) * sizeof(*pDoc->pEntries));
+    pDoc->entryCap   = (size_t)header.entryCount;
+    pDoc->pNodes     = (cstr_kvdoc_node*)CSTR_MALLOC((size_t)header.nodeCount * sizeof(*pDoc->pNodes));
+    pDoc->nodeCap    = (size_t)header.nodeCount;
+    pDoc->pIndex     = (cstr_uint32*)CSTR_MALLOC((size_t)header.indexCap * sizeof(*pDoc->pIndex));
+    pDoc->indexCap   = (size_t)header.indexCap;
+    pDoc->pNodeIndex = (cstr_uint32*)CSTR_MALLOC((size_t)header.nodeIndexCap * sizeof(*pDoc->pNodeIndex));
+    pDoc->nodeIndexCap = (size_t)header.nodeIndexCap;
+    if (pDoc->pEntries == NULL || pDoc->pNodes == NULL || pDoc->pIndex == NULL || pDoc->pNodeIndex == NULL) {
+        return ENOMEM;
+    }
+
+    for (iEntry = 0; iEntry < (size_t)header.entryCount; iEntry += 1) {
+        const cstr_kvdoc_binary_entry* pBinaryEntry = &pBinaryEntries[iEntry];
+        cstr_kvdoc_entry* pEntry = &pDoc->pEntries[iEntry];
+
+        if (!cstr_kvdoc_binary_range_is_valid(pBinaryEntry->keyOffset,   pBinaryEntry->keyLen,   textBeg, textEnd) ||
+            !cstr_kvdoc_binary_range_is_valid(pBinaryEntry->valueOffset, pBinaryEntry->valueLen, textBeg, textEnd) ||
+            !cstr_kvdoc_binary_range_is_valid(pBinaryEntry->decodedValueOffset, pBinaryEntry->decodedValueLen, textBeg, header.fileSize)) {
+            return CSTR_ECORRUPT;
+        }
+
+        if ((pBinaryEntry->flags & CSTR_KVDOC_BINARY_HAS_SECTION) != 0) {
+            if (!cstr_kvdoc_binary_range_is_valid(pBinaryEntry->sectionOffset, pBinaryEntry->sectionLen, textBeg, textEnd)) {
+                return CSTR_ECORRUPT;
+            }
+
+            pEntry->pSection   = pImage + pBinaryEntry->sectionOffset;
+            pEntry->sectionLen = (size_t)pBinaryEntry->sectionLen;
+        } else {
+            pEntry->pSection   = NULL;
+            pEntry->sectionLen = 0;
+        }
+
+        pEntry->pKey            = pImage + pBinaryEntry->keyOffset;
+        pEntry->keyLen          = (size_t)pBinaryEntry->keyLen;
+        pEntry->pValue          = pImage + pBinaryEntry->valueOffset;
+        pEntry->valueLen        = (size_t)pBinaryEntry->valueLen;
+        pEntry->pDecodedValue   = pImage + pBinaryEntry->decodedValueOffset;
+        pEntry->decodedValueLen = (size_t)pBinaryEntry->decodedValueLen;
+        pEntry->lineNumber      = (size_t)pBinaryEntry->lineNumber;
+        pEntry->keyHash         = pBinaryEntry->keyHash;
+    }
+
+    pDoc->entryCount = (size_t)header.entryCount;
+
+    for (iNode = 0; iNode < (size_t)header.nodeCount; iNode += 1) {
+        const cstr_kvdoc_binary_node* pBinaryNode = &pBinaryNodes[iNode];
+        cstr_kvdoc_node* pNode = &pDoc->pNodes[iNode];
+
+        if (!cstr_kvdoc_binary_range_is_valid(pBinaryNode->nameOffset, pBinaryNode->nameLen, textBeg, textEnd) ||
+            pBinaryNode->parent >= header.nodeCount || pBinaryNode->firstChild >= header.nodeCount || pBinaryNode->lastChild >= header.nodeCount ||
+            pBinaryNode->nextSibling >= header.nodeCount || pBinaryNode->entry > header.entryCount) {
+            return CSTR_ECORRUPT;
+        }
+
+        /* Children always come after their parent, which guarantees there are no cycles for cstr_kvdoc_node_next() to get stuck in. */
+        if ((iNode > 0 && pBinaryNode->parent >= iNode) || (pBinaryNode->firstChild != 0 && pBinaryNode->firstChild <= iNode) || (pBinaryNode->nextSibling != 0 && pBinaryNode->nextSibling <= iNode)) {
+            return CSTR_ECORRUPT;
+        }
+
+        pNode->pName       = pImage + pBinaryNode->nameOffset;
+        pNode->nameLen     = (size_t)pBinaryNode->nameLen;
+        pNode->nameHash    = pBinaryNode->nameHash;
+        pNode->parent      = pBinaryNode->parent;
+        pNode->firstChild  = pBinaryNode->firstChild;
+        pNode->lastChild   = pBinaryNode->lastChild;
+        pNode->nextSibling = pBinaryNode->nextSibling;
+        pNode->entry       = pBinaryNode->entry;
+    }
+
+    pDoc->nodeCount = (size_t)header.nodeCount;
+
+    /*
+    The lookups probe until they find an empty slot, so a table with no empty slot would never terminate. Each table can't have more used slots than there
+    are items to index, which together with the capacity checks above guarantees an empty slot, but that's checked explicitly as well.
+    */
+    usedSlotCount = 0;
+    for (iSlot = 0; iSlot < pDoc->indexCap; iSlot += 1) {
+        if (pBinaryIndex[iSlot] > header.entryCount) {
+            return CSTR_ECORRUPT;
+        }
+
+        if (pBinaryIndex[iSlot] != 0) {
+            usedSlotCount += 1;
+        }
+
+        pDoc->pIndex[iSlot] = pBinaryIndex[iSlot];
+    }
+
+    if (usedSlotCount > header.entryCount || usedSlotCount == pDoc->indexCap) {
+        return CSTR_ECORRUPT;
+    }
+
+    usedSlotCount = 0;
+    for (iSlot = 0; iSlot < pDoc->nodeIndexCap; iSlot += 1) {
+        if (pBinaryNodeIndex[iSlot] > header.nodeCount) {
+            return CSTR_ECORRUPT;
+        }
+
+        if (pBinaryNodeIndex[iSlot] != 0) {
+            usedSlotCount += 1;
+        }
+
+        pDoc->pNodeIndex[iSlot] = pBinaryNodeIndex[iSlot];
+    }
+
+    if (usedSlotCount > header.nodeCount || usedSlotCount == pDoc->nodeIndexCap) {
+        return CSTR_ECORRUPT;
+    }
+
+    return 0;
+}
+
+CSTR_API int cstr_kvdoc_load_binary(const char* pFilePath, const char* pSourceFilePath, cstr_kvdoc* pDoc)
+{
+    int result;
+
+    if (pDoc == NULL) {
+        return EINVAL;
+    }
+
+    CSTR_ZERO_OBJECT(pDoc);
+
+    if (pFilePath == NULL) {
+        return EINVAL;
+    }
+
+    result = cstr_kvdoc_map_file(pFilePath, pDoc);
+    if (result != 0) {
+        return result;
+    }
+
+    result = cstr_kvdoc_load_binary_image((const char*)pDoc->file.pData, pDoc->file.sizeInBytes, pSourceFilePath, pDoc);
+    if (result != 0) {
+        cstr_kvdoc_uninit(pDoc);
+        return result;
+    }
+
+    return 0;
+}
+
+/* The lexer looks ahead by a character to find the end of an identifier so entries must end at least this far before the first difference to be reused. */
+#define CSTR_KVDOC_RELOAD_LOOKAHEAD    4
+
+typedef struct
+{
+    const char* pSection;
+    size_t sectionLen;
+    const char* pKey;
+    size_t keyLen;
+    cstr_uint32 keyHash;
+    const cstr_kvdoc_entry* pOldEntry;
+} cstr_kvdoc_reload_candidate;
+
+static size_t cstr_kvdoc_entry_end(const char* pText, const cstr_kvdoc_entry* pEntry)
+{
+    return (size_t)((pEntry->pValue + pEntry->valueLen) - pText);
+}
+
+static size_t cstr_kvdoc_entry_end_line(const cstr_kvdoc_entry* pEntry)
+{
+    /* This needs to count line breaks in the same way as the lexer, which is by using utf8_next_line(). */
+    const char* pRunningStr = pEntry->pKey;
+    size_t remainingLen = (size_t)((pEntry->pValue + pEntry->valueLen) - pEntry->pKey);
+    size_t lineNumber = pEntry->lineNumber;
+
+    for (;;) {
+        size_t thisLineLen;
+        size_t nextLineOff = utf8_next_line(pRunningStr, remainingLen, &thisLineLen);
+        if (nextLineOff == thisLineLen) {
+            break;
+        }
+
+        pRunningStr  += nextLineOff;
+        remainingLen -= nextLineOff;
+        lineNumber   += 1;
+    }
+
+    return lineNumber;
+}
+
+static cstr_kvdoc_entry cstr_kvdoc_entry_rebase(const cstr_kvdoc_entry* pEntry, const char* pOldText, size_t oldTextLen, const char* pNewText, size_t newTextLen, cstr_bool32 fromEnd)
+{
+    cstr_kvdoc_entry entry = *pEntry;
+
+    /* Decoded values from a binary cache live outside of the text and will be gone once the old file is unmapped. */
+    entry.pDecodedValue   = NULL;
+    entry.decodedValueLen = 0;
+
+    /* Entries from the common prefix keep their offset from the start. Entries from the common suffix keep their offset from the end. */
+    if (fromEnd) {
+        entry.pKey   = pNewText + newTextLen - (oldTextLen - (size_t)(pEntry->pKey   - pOldText));
+        entry.pValue = pNewText + newTextLen - (oldTextLen - (size_t)(pEntry->pValue - pOldText));
+    } else {
+        entry.pKey   = pNewText + (size_t)(pEntry->pKey   - pOldText);
+        entry.pValue = pNewText + (size_t)(pEntry->pValue - pOldText);
+    }
+
+    if (pEntry->pSection != NULL) {
+        if (fromEnd) {
+            entry.pSection = pNewText + newTextLen - (oldTextLen - (size_t)(pEntry->pSection - pOldText));
+        } else {
+            entry.pSection = pNewText + (size_t)(pEntry->pSection - pOldText);
+        }
+    }
+
+    return entry;
+}
+
+static cstr_uint32 cstr_kvdoc_rebase_segments(cstr_kvdoc* pDoc, cstr_uint32 parent, const char* pPath, size_t pathLen, const char* pOldText, size_t oldTextLen)
+{
+    size_t segmentBeg = 0;
+
+    for (;;) {
+        size_t segmentEnd = segmentBeg;
+        cstr_uint32 slot;
+        cstr_kvdoc_node* pNode;
+
+        while (segmentEnd < pathLen && pPath[segmentEnd] != '.') {
+            segmentEnd += 1;
+        }
+
+        slot = cstr_kvdoc_find_child(pDoc, parent, pPath + segmentBeg, segmentEnd - segmentBeg, cstr_hash32_fnv1a(pPath + segmentBeg, segmentEnd - segmentBeg), NULL);
+        CSTR_ASSERT(slot != 0);
+
+        pNode = &pDoc->pNodes[slot - 1];
+        if (pNode->pName >= pOldText && pNode->pName <= pOldText + oldTextLen) {
+            pNode->pName = pPath + segmentBeg;  /* Still pointing at the old text. */
+        }
+
+        parent = slot - 1;
+
+        if (segmentEnd == pathLen) {
+            break;
+        }
+
+        segmentBeg = segmentEnd + 1;
+    }
+
+    return parent;
+}
+
+static void cstr_kvdoc_rebase_tree(cstr_kvdoc* pDoc, const char* pOldText, size_t oldTextLen, size_t prefixLen, size_t suffixLen, size_t newMiddleBeg, size_t newMiddleEnd)
+{
+    size_t iNode;
+    size_t iEntry;
+
+    CSTR_ASSERT(pDoc != NULL);
+    CSTR_ASSERT(pDoc->nodeCount > 0);
+
+    /* Names in the unchanged regions can be moved in the same way as entries. */
+    pDoc->pNodes[0].pName = pDoc->pText;
+
+    for (iNode = 1; iNode < pDoc->nodeCount; iNode += 1) {
+        size_t nameOff = (size_t)(pDoc->pNodes[iNode].pName - pOldText);
+
+        if (nameOff + pDoc->pNodes[iNode].nameLen <= prefixLen) {
+            pDoc->pNodes[iNode].pName = pDoc->pText + nameOff;
+        } else if (nameOff >= oldTextLen - suffixLen) {
+            pDoc->pNodes[iNode].pName = pDoc->pText + pDoc->textLen - (oldTextLen - nameOff);
+        }
+    }
+
+    /*
+    Names that touch the changed region are taken from the new entries. Any such node must have been first used by one of the entries that were parsed again,
+    and the new entry at the same position has the same path.
+    */
+    for (iEntry = newMiddleBeg; iEntry < newMiddleEnd; iEntry += 1) {
+        const cstr_kvdoc_entry* pEntry = &pDoc->pEntries[iEntry];
+        cstr_uint32 iParent = 0;
+
+        if (pEntry->sectionLen > 0) {
+            iParent = cstr_kvdoc_rebase_segments(pDoc, iParent, pEntry->pSection, pEntry->sectionLen, pOldText, oldTextLen);
+        }
+
+        cstr_kvdoc_rebase_segments(pDoc, iParent, pEntry->pKey, pEntry->keyLen, pOldText, oldTextLen);
+    }
+}
+
+CSTR_API int cstr_kvdoc_reload(cstr_kvdoc* pDoc, const char* pNewText, size_t newTextLen, cstr_kvdoc_changes* pChanges)
+{
+    int result;
+    const char* pOldText;
+    size_t oldTextLen;
+    size_t prefixLen;
+    size_t suffixLen;
+    size_t maxCommonLen;
+    size_t iEntry;
+    size_t oldMiddleBeg;
+    size_t oldMiddleEnd;
+    size_t newMiddleBeg;
+    size_t newMiddleEnd;
+    size_t syncEntry = cstr_npos;
+    size_t syncOldLine = 0;
+    size_t syncNewLine = 0;
+    cstr_bool32 sameTreeShape;
+    cstr_kvdoc_entry* pNewEntries = NULL;
+    size_t newEntryCount = 0;
+    size_t newEntryCap = 0;
+    cstr_kvdoc_entry* pOldEntries;
+    cstr_kvdoc_reload_candidate* pCandidates = NULL;
+    size_t candidateCount = 0;
+    cstr_uint32* pCandidateSet = NULL;
+    size_t candidateSetCap;
+    size_t removedKeyDataCap = 0;
+    size_t removedKeyDataLen = 0;
+    cstr_kvdoc_changes changes;
+    cstr_keyvalue_parser parser;
+
+    if (pChanges != NULL) {
+        CSTR_ZERO_OBJECT(pChanges);
+    }
+
+    if (pDoc == NULL || pNewText == NULL) {
+        return EINVAL;
+    }
+
+    if (newTextLen == (size_t)-1) {
+        newTextLen = utf8_strlen(pNewText);
+    }
+
+    CSTR_ZERO_OBJECT(&changes);
+
+    pOldText   = pDoc->pText;
+    oldTextLen = pDoc->textLen;
+
+
+    /* Step 1: Find the regions at the start and end of the text that are unchanged. */
+    maxCommonLen = (oldTextLen < newTextLen) ? oldTextLen : newTextLen;
+
+    prefixLen = 0;
+    while (prefixLen < maxCommonLen && pOldText[prefixLen] == pNewText[prefixLen]) {
+        prefixLen += 1;
+    }
+
+    suffixLen = 0;
+    while (suffixLen < (maxCommonLen - prefixLen) && pOldText[oldTextLen - suffixLen - 1] == pNewText[newTextLen - suffixLen - 1]) {
+        suffixLen += 1;
+    }
+
+
+    /* Step 2: Reuse the entries from the unchanged prefix. */
+    if (prefixLen == oldTextLen && prefixLen == newTextLen) {
+        oldMiddleBeg = pDoc->entryCount;    /* The text is identical. */
+    } else {
+        oldMiddleBeg = 0;
+        while (oldMiddleBeg < pDoc->entryCount && cstr_kvdoc_entry_end(pOldText, &pDoc->pEntries[oldMiddleBeg]) + CSTR_KVDOC_RELOAD_LOOKAHEAD <= prefixLen) {
+            oldMiddleBeg += 1;
+        }
+    }
+
+    result = cstr_kvdoc_reserve_entries(&pNewEntries, &newEntryCap, pDoc->entryCount);
+    if (result != 0) {
+        goto done;
+    }
+
+    for (iEntry = 0; iEntry < oldMiddleBeg; iEntry += 1) {
+        pNewEntries[newEntryCount++] = cstr_kvdoc_entry_rebase(&pDoc->pEntries[iEntry], pOldText, oldTextLen, pNewText, newTextLen, CSTR_FALSE);
+    }
+
+
+    /* Step 3: Parse the changed region, stopping as soon as we get back in sync with an entry boundary inside the unchanged suffix. */
+    newMiddleBeg = newEntryCount;
+    oldMiddleEnd = pDoc->entryCount;
+
+    if (prefixLen != oldTextLen || prefixLen != newTextLen) {
+        size_t resumeOff  = 0;
+        size_t resumeLine = 1;
+
+        if (oldMiddleBeg > 0) {
+            resumeOff  = cstr_kvdoc_entry_end(pOldText, &pDoc->pEntries[oldMiddleBeg - 1]);
+            resumeLine = cstr_kvdoc_entry_end_line(&pDoc->pEntries[oldMiddleBeg - 1]);
+        }
+
+        result = cstr_keyvalue_parser_init(pNewText + resumeOff, newTextLen - resumeOff, &parser);
+        if (result != 0) {
+            goto done;
+        }
+
+        parser.lexer.lineNumber = resumeLine;
+
+        /* The section header that was in effect at the end of the last reused entry is still in effect. */
+        if (oldMiddleBeg > 0) {
+            parser.pSection   = pNewEntries[oldMiddleBeg - 1].pSection;
+            parser.sectionLen = pNewEntries[oldMiddleBeg - 1].sectionLen;
+        }
+
+        for (;;) {
+            size_t newEnd;
+
+            result = cstr_keyvalue_parser_scan(&parser);
+            if (result != 0) {
+                break;
+            }
+
+            result = cstr_kvdoc_push_entry(&pNewEntries, &newEntryCount, &newEntryCap, &parser);
+            if (result != 0) {
+                goto done;
+            }
+
+            newEnd = cstr_kvdoc_entry_end(pNewText, &pNewEntries[newEntryCount - 1]);
+            if (suffixLen > 0 && newEnd >= newTextLen - suffixLen) {
+                /*
+                We're inside the unchanged suffix. If an old entry ended at the same relative position, and it was in the same section, everything after it can
+                be reused.
+                */
+                size_t oldEnd = oldTextLen - (newTextLen - newEnd);
+                size_t lo = oldMiddleBeg;
+                size_t hi = pDoc->entryCount;
+
+                while (lo < hi) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (cstr_kvdoc_entry_end(pOldText, &pDoc->pEntries[mid]) < oldEnd) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                    }
+                }
+
+                if (lo < pDoc->entryCount && cstr_kvdoc_entry_end(pOldText, &pDoc->pEntries[lo]) == oldEnd && pDoc->pEntries[lo].sectionLen == parser.sectionLen && (parser.sectionLen == 0 || CSTR_COMPARE_MEMORY(pDoc->pEntries[lo].pSection, parser.pSection, parser.sectionLen) == 0)) {
+                    syncEntry    = lo;
+                    syncOldLine  = cstr_kvdoc_entry_end_line(&pDoc->pEntries[lo]);
+                    syncNewLine  = parser.lexer.lineNumber;
+                    oldMiddleEnd = lo + 1;
+                    break;
+                }
+            }
+        }
+
+        /* The lexer returns ENOMEM when it runs out of input. */
+        if (result != 0 && result != ENOMEM) {
+            goto done;
+        }
+    }
+
+    newMiddleEnd = newEntryCount;
+
+    if (syncEntry != cstr_npos) {
+        result = cstr_kvdoc_reserve_entries(&pNewEntries, &newEntryCap, newEntryCount + (pDoc->entryCount - oldMiddleEnd));
+        if (result != 0) {
+            goto done;
+        }
+
+        for (iEntry = oldMiddleEnd; iEntry < pDoc->entryCount; iEntry += 1) {
+            cstr_kvdoc_entry entry = cstr_kvdoc_entry_rebase(&pDoc->pEntries[iEntry], pOldText, oldTextLen, pNewText, newTextLen, CSTR_TRUE);
+            entry.lineNumber = entry.lineNumber - syncOldLine + syncNewLine;
+
+            /* Entries still under the same header as the sync entry can't be rebased from the end because the header itself may have been in the changed region. */
+            if (pDoc->pEntries[iEntry].pSection == pDoc->pEntries[syncEntry].pSection) {
+                entry.pSection = parser.pSection;
+            }
+
+            pNewEntries[newEntryCount++] = entry;
+        }
+    }
+
+
+    /*
+    Step 4: Collect the keys that appear in the changed region of either the old or new text. These are the only keys that can possibly have changed. Each key
+    is looked up against the old index now, while it still exists. Duplicates are removed with a temporary hash set.
+    */
+    if (oldMiddleEnd - oldMiddleBeg + newMiddleEnd - newMiddleBeg > 0) {
+        size_t maxCandidateCount = (oldMiddleEnd - oldMiddleBeg) + (newMiddleEnd - newMiddleBeg);
+
+        candidateSetCap = 16;
+        while (candidateSetCap < maxCandidateCount * 2) {
+            candidateSetCap *= 2;
+        }
+
+        pCandidates   = (cstr_kvdoc_reload_candidate*)CSTR_MALLOC(maxCandidateCount * sizeof(*pCandidates));
+        pCandidateSet = (cstr_uint32*)CSTR_CALLOC(candidateSetCap * sizeof(*pCandidateSet));
+        if (pCandidates == NULL || pCandidateSet == NULL) {
+            result = ENOMEM;
+            goto done;
+        }
+
+        for (iEntry = 0; iEntry < maxCandidateCount; iEntry += 1) {
+            const cstr_kvdoc_entry* pEntry;
+            size_t iSlot;
+
+            if (iEntry < (oldMiddleEnd - oldMiddleBeg)) {
+                pEntry = &pDoc->pEntries[oldMiddleBeg + iEntry];
+            } else {
+                pEntry = &pNewEntries[newMiddleBeg + (iEntry - (oldMiddleEnd - oldMiddleBeg))];
+            }
+
+            iSlot = pEntry->keyHash & (candidateSetCap - 1);
+            for (;;) {
+                cstr_uint32 slot = pCandidateSet[iSlot];
+                if (slot == 0) {
+                    break;
+                }
+
+                if (pCandidates[slot-1].keyHash == pEntry->keyHash && cstr_kvdoc_path_equal(pCandidates[slot-1].pSection, pCandidates[slot-1].sectionLen, pCandidates[slot-1].pKey, pCandidates[slot-1].keyLen, pEntry->pSection, pEntry->sectionLen, pEntry->pKey, pEntry->keyLen)) {
+                    break;
+                }
+
+                iSlot = (iSlot + 1) & (candidateSetCap - 1);
+            }
+
+            if (pCandidateSet[iSlot] != 0) {
+                continue;   /* Already a candidate. */
+            }
+
+            pCandidates[candidateCount].pSection   = pEntry->pSection;
+            pCandidates[candidateCount].sectionLen = pEntry->sectionLen;
+            pCandidates[candidateCount].pKey       = pEntry->pKey;
+            pCandidates[candidateCount].keyLen     = pEntry->keyLen;
+            pCandidates[candidateCount].keyHash    = pEntry->keyHash;
+            pCandidates[candidateCount].pOldEntry  = cstr_kvdoc_find_hashed(pDoc, pEntry->pSection, pEntry->sectionLen, pEntry->pKey, pEntry->keyLen, pEntry->keyHash);
+            candidateCount += 1;
+
+            pCandidateSet[iSlot] = (cstr_uint32)candidateCount;
+
+            if (pCandidates[candidateCount-1].pOldEntry != NULL) {
+                removedKeyDataCap += pEntry->sectionLen + pEntry->keyLen;
+            }
+        }
+    }
+
+    /* Everything that can fail needs to be allocated before the document is modified so that it's left untouched if an error occurs. */
+    if (pChanges != NULL && candidateCount > 0) {
+        changes.pChanges = (cstr_kvdoc_change*)CSTR_MALLOC(candidateCount * sizeof(*changes.pChanges));
+        if (changes.pChanges == NULL) {
+            result = ENOMEM;
+            goto done;
+        }
+
+        changes.cap = candidateCount;
+
+        if (removedKeyDataCap > 0) {
+            changes.pRemovedKeyData = (char*)CSTR_MALLOC(removedKeyDataCap);
+            if (changes.pRemovedKeyData == NULL) {
+                result = ENOMEM;
+                goto done;
+            }
+        }
+    }
+
+    result = cstr_kvdoc_reserve_index(pDoc, newEntryCount);
+    if (result != 0) {
+        goto done;
+    }
+
+    /*
+    The shape of the tree depends only on the sequence of paths. If the changed region has the same paths in the same order, which is the case when only values
+    have been edited, the existing tree can be kept and only the names need to be moved over to the new text.
+    */
+    sameTreeShape = (newEntryCount == pDoc->entryCount) && (oldMiddleEnd - oldMiddleBeg) == (newMiddleEnd - newMiddleBeg);
+    for (iEntry = 0; sameTreeShape && iEntry < (newMiddleEnd - newMiddleBeg); iEntry += 1) {
+        sameTreeShape = cstr_kvdoc_entry_path_equal(&pDoc->pEntries[oldMiddleBeg + iEntry], &pNewEntries[newMiddleBeg + iEntry]);
+    }
+
+    if (!sameTreeShape) {
+        result = cstr_kvdoc_reserve_tree(pDoc, pNewEntries, newEntryCount);
+        if (result != 0) {
+            goto done;
+        }
+    }
+
+
+    /* Step 5: Swap in the new entries. If nothing was parsed the keys are in the same order and the existing index can be used as-is. */
+    pOldEntries = pDoc->pEntries;
+
+    pDoc->pText      = pNewText;
+    pDoc->textLen    = newTextLen;
+    pDoc->pEntries   = pNewEntries;
+    pDoc->entryCount = newEntryCount;
+    pDoc->entryCap   = newEntryCap;
+    pNewEntries = pOldEntries;  /* <-- The old entries will be freed at the end. The candidates still reference them. */
+
+    if (candidateCount > 0 || newMiddleEnd > newMiddleBeg) {
+        cstr_kvdoc_rebuild_index(pDoc);
+    }
+
+    if (sameTreeShape) {
+        cstr_kvdoc_rebase_tree(pDoc, pOldText, oldTextLen, prefixLen, suffixLen, newMiddleBeg, newMiddleEnd);
+    } else {
+        cstr_kvdoc_rebuild_tree(pDoc);
+    }
+
+
+    /* Step 6: Compare each candidate against the new index. */
+    if (pChanges != NULL) {
+        size_t iCandidate;
+        for (iCandidate = 0; iCandidate < candidateCount; iCandidate += 1) {
+            const cstr_kvdoc_reload_candidate* pCandidate = &pCandidates[iCandidate];
+            const cstr_kvdoc_entry* pNewEntry = cstr_kvdoc_find_hashed(pDoc, pCandidate->pSection, pCandidate->sectionLen, pCandidate->pKey, pCandidate->keyLen, pCandidate->keyHash);
+            cstr_kvdoc_change* pChange = &changes.pChanges[changes.count];
+
+            if (pCandidate->pOldEntry == NULL) {
+                if (pNewEntry == NULL) {
+                    continue;   /* Shouldn't happen. */
+                }
+
+                pChange->type = cstr_kvdoc_change_type_added;
+            } else {
+                if (pNewEntry == NULL) {
+                    pChange->type = cstr_kvdoc_change_type_removed;
+                } else {
+                    if (pCandidate->pOldEntry->valueLen == pNewEntry->valueLen && CSTR_COMPARE_MEMORY(pCandidate->pOldEntry->pValue, pNewEntry->pValue, pNewEntry->valueLen) == 0) {
+                        continue;   /* Unchanged. */
+                    }
+
+                    pChange->type = cstr_kvdoc_change_type_modified;
+                }
+            }
+
+            if (pNewEntry != NULL) {
+                pChange->pSection   = pNewEntry->pSection;
+                pChange->sectionLen = pNewEntry->sectionLen;
+                pChange->pKey       = pNewEntry->pKey;
+                pChange->keyLen     = pNewEntry->keyLen;
+                pChange->pEntry     = pNewEntry;
+            } else {
+                /* The old text may not be valid after we return so removed keys need to be copied. */
+                if (pCandidate->sectionLen > 0) {
+                    CSTR_COPY_MEMORY(changes.pRemovedKeyData + removedKeyDataLen, pCandidate->pSection, pCandidate->sectionLen);
+                }
+                pChange->pSection   = changes.pRemovedKeyData + removedKeyDataLen;
+                pChange->sectionLen = pCandidate->sectionLen;
+                removedKeyDataLen += pCandidate->sectionLen;
+
+                CSTR_COPY_MEMORY(changes.pRemovedKeyData + removedKeyDataLen, pCandidate->pKey, pCandidate->keyLen);
+                pChange->pKey       = changes.pRemovedKeyData + removedKeyDataLen;
+                pChange->keyLen     = pCandidate->keyLen;
+                pChange->pEntry     = NULL;
+                removedKeyDataLen += pCandidate->keyLen;
+            }
+
+            changes.count += 1;
+        }
+
+        *pChanges = changes;
+        CSTR_ZERO_OBJECT(&changes);
+    }
+
+    /* The old text is no longer referenced. If it was a file we can unmap it now. */
+    cstr_kvdoc_unmap_file(pDoc);
+    result = 0;
+
+done:
+    CSTR_FREE(pNewEntries);
+    CSTR_FREE(pCandidates);
+    CSTR_FREE(pCandidateSet);
+    cstr_kvdoc_changes_uninit(&changes);
+
+    return result;
+}
+
+CSTR_API void cstr_kvdoc_changes_uninit(cstr_kvdoc_changes* pChanges)
+{
+    if (pChanges == NULL) {
+        return;
+    }
+
+    CSTR_FREE(pChanges->pChanges);
+    CSTR_FREE(pChanges->pRemovedKeyData);
+
+    CSTR_ZERO_OBJECT(pChanges);
+}
+
+
+/**************************************************************************************************************************************************************
+
+String Interning
+
+**************************************************************************************************************************************************************/
+#ifndef CSTR_NO_UTF8
+#define CSTR_INTERNER_BLOCK_SIZE            65536
+#define CSTR_INTERNER_INITIAL_TABLE_CAP     64
+#define CSTR_INTERNER_ID_BLOCK_BASE         1024    /* The number of IDs in the first ID block. Must be a power of two. */
+#define CSTR_INTERNER_ID_BLOCK_BASE_BITS    10
+#define CSTR_INTERNER_REFCOUNT              0x40000000  /* Interned strings start with a large reference count so they always look shared and are never freed. */
+#define CSTR_INTERNER_ALIGN(sz)             (((sz) + 7) & ~(size_t)7)
+#define CSTR_INTERNER_BATCH_SIZE            256
+
+typedef struct cstr_interner_block cstr_interner_block;
+struct cstr_interner_block
+{
+    cstr_interner_block* pNext;
+    size_t size;
+    size_t used;
+    /* String data follows. */
+};
+
+#define CSTR_INTERNER_BLOCK_HEADER_SIZE     CSTR_INTERNER_ALIGN(sizeof(cstr_interner_block))
+
+typedef struct cstr_interner_table cstr_interner_table;
+struct cstr_interner_table
+{
+    cstr_interner_table* pNext;     /* For the list of retired tables. */
+    size_t cap;                     /* Always a power of two. */
+    void* volatile pSlots[1];       /* Pointers to cstr_interner_entry objects. Variable length. */
+};
+
+/* The header of a string is last so that it sits immediately before the string data, just like a normal dynamic string. */
+typedef struct
+{
+    cstr_uint32 hash;               /* The low 32 bits of the hash. The high bits select the shard. */
+    cstr_uint32 id;
+    cstr8_header header;
+} cstr_interner_entry;
+
+static CSTR_INLINE cstr8 cstr_interner_entry_get_str(cstr_interner_entry* pEntry)
+{
+    return (char*)&pEntry->header + CSTR_HEADER_SIZE_IN_BYTES;
+}
+
+static CSTR_INLINE cstr_interner_entry* cstr_interner_entry_from_str(cstr8 str)
+{
+    return (cstr_interner_entry*)((char*)cstr8_get_header(str) - offsetof(cstr_interner_entry, header));
+}
+
+/* Interned strings follow CSTR_ALIGNMENT like any other dynamic string. They're never reallocated or freed individually so the offset isn't stored. */
+static CSTR_INLINE cstr_interner_entry* cstr_interner_entry_place(void* pMemory)
+{
+#if CSTR_ALIGNMENT > 0
+    size_t str = (size_t)pMemory + offsetof(cstr_interner_entry, header) + CSTR_HEADER_SIZE_IN_BYTES;
+    str = (str + (CSTR_ALIGNMENT - 1)) & ~(size_t)(CSTR_ALIGNMENT - 1);
+    return cstr_interner_entry_from_str((cstr8)str);
+#else
+    return (cstr_interner_entry*)pMemory;
+#endif
+}
+
+static CSTR_INLINE cstr_interner_shard* cstr_interner_get_shard(const cstr_interner* pInterner, cstr_uint64 hash)
+{
+    /* The shard is selected with the high bits of the hash because the low bits are used for selecting a slot in the shard's table. */
+    return (cstr_interner_shard*)&pInterner->shards[(size_t)(((hash >> 32) * CSTR_INTERNER_SHARD_COUNT) >> 32)];
+}
+
+/* IDs are mapped to blocks that double in size so that the mapping can grow without ever moving an existing block, which means readers don't need a lock. */
+static void cstr_interner_get_id_location(cstr_uint32 id, size_t* pBlockIndex, size_t* pOffset)
+{
+    cstr_uint64 index = (cstr_uint64)id + CSTR_INTERNER_ID_BLOCK_BASE;
+    size_t blockIndex = 0;
+
+    while ((index >> (blockIndex + CSTR_INTERNER_ID_BLOCK_BASE_BITS + 1)) != 0) {
+        blockIndex += 1;
+    }
+
+    *pBlockIndex = blockIndex;
+    *pOffset     = (size_t)(index - ((cstr_uint64)1 << (blockIndex + CSTR_INTERNER_ID_BLOCK_BASE_BITS)));
+}
+
+static cstr_interner_entry* cstr_interner_table_find(cstr_interner_table* pTable, const char* pStr, size_t len, cstr_uint64 hash)
+{
+    size_t mask;
+    size_t iSlot;
+
+    if (pTable == NULL) {
+        return NULL;
+    }
+
+    mask = pTable->cap - 1;
+
+    /* The table is never more than half full so there will always be an empty slot to terminate the search. */
+    for (iSlot = (cstr_uint32)hash & mask; ; iSlot = (iSlot + 1) & mask) {
+        cstr_interner_entry* pEntry = (cstr_interner_entry*)cstr_atomic_load_ptr(&pTable->pSlots[iSlot]);
+        if (pEntry == NULL) {
+            return NULL;
+        }
+
+        if (pEntry->hash == (cstr_uint32)hash && pEntry->header.len == len && CSTR_COMPARE_MEMORY(cstr_interner_entry_get_str(pEntry), pStr, len) == 0) {
+            return pEntry;
+        }
+    }
+}
+
+static cstr_interner_entry* cstr_interner_find_hashed(const cstr_interner* pInterner, const char* pStr, size_t len, cstr_uint64 hash)
+{
+    cstr_interner_shard* pShard = cstr_interner_get_shard(pInterner, hash);
+    return cstr_interner_table_find((cstr_interner_table*)cstr_atomic_load_ptr(&pShard->pTable), pStr, len, hash);
+}
+
+static void cstr_interner_table_insert(cstr_interner_table* pTable, cstr_interner_entry* pEntry)
+{
+    size_t mask = pTable->cap - 1;
+    size_t iSlot;
+
+    for (iSlot = pEntry->hash & mask; pTable->pSlots[iSlot] != NULL; iSlot = (iSlot + 1) & mask) {
+        /* Find an empty slot. */
+    }
+
+    cstr_atomic_store_ptr(&pTable->pSlots[iSlot], pEntry);
+}
+
+/* Must be called while holding the lock of the shard. */
+static int cstr_interner_shard_reserve(cstr_interner_shard* pShard)
+{
+    cstr_interner_table* pOldTable = (cstr_interner_table*)pShard->pTable;
+    cstr_interner_table* pNewTable;
+    size_t newCap;
+    size_t iSlot;
+
+    if (pOldTable != NULL && (pShard->count + 1) * 2 <= pOldTable->cap) {
+        return 0;   /* There's enough room. */
+    }
+
+    newCap = (pOldTable != NULL) ? pOldTable->cap * 2 : CSTR_INTERNER_INITIAL_TABLE_CAP;
+
+    pNewTable = (cstr_interner_table*)CSTR_CALLOC(offsetof(cstr_interner_table, pSlots) + newCap * sizeof(void*));
+    if (pNewTable == NULL) {
+        return ENOMEM;
+    }
+
+    pNewTable->cap = newCap;
+
+    if (pOldTable != NULL) {
+        for (iSlot = 0; iSlot < pOldTable->cap; iSlot += 1) {
+            if (pOldTable->pSlots[iSlot] != NULL) {
+                cstr_interner_table_insert(pNewTable, (cstr_interner_entry*)pOldTable->pSlots[iSlot]);
+            }
+        }
+
+        /* Readers may still be searching the old table so it needs to stay alive until the interner is uninitialized. */
+        pOldTable->pNext = (cstr_interner_table*)pShard->pRetiredTables;
+        pShard->pRetiredTables = pOldTable;
+    }
+
+    cstr_atomic_store_ptr(&pShard->pTable, pNewTable);
+
+    return 0;
+}
+
+/* Must be called while holding the lock of the shard. */
+static void* cstr_interner_shard_alloc(cstr_interner_shard* pShard, size_t size)
+{
+    cstr_interner_block* pBlock = (cstr_interner_block*)pShard->pBlocks;
+    void* p;
+
+    size = CSTR_INTERNER_ALIGN(size);
+
+    /* Large strings get their own block. It's placed behind the current block so the remaining space in the current block isn't wasted. */
+    if (size > CSTR_INTERNER_BLOCK_SIZE / 4) {
+        cstr_interner_block* pLargeBlock = (cstr_interner_block*)CSTR_MALLOC(CSTR_INTERNER_BLOCK_HEADER_SIZE + size);
+        if (pLargeBlock == NULL) {
+            return NULL;
+        }
+
+        pLargeBlock->size = CSTR_INTERNER_BLOCK_HEADER_SIZE + size;
+        pLargeBlock->used = pLargeBlock->size;
+
+        if (pBlock != NULL) {
+            pLargeBlock->pNext = pBlock->pNext;
+            pBlock->pNext = pLargeBlock;
+        } else {
+            pLargeBlock->pNext = NULL;
+            pShard->pBlocks = pLargeBlock;
+        }
+
+        return (char*)pLargeBlock + CSTR_INTERNER_BLOCK_HEADER_SIZE;
+    }
+
+    if (pBlock == NULL || pBlock->size - pBlock->used < size) {
+        pBlock = (cstr_interner_block*)CSTR_MALLOC(CSTR_INTERNER_BLOCK_SIZE);
+        if (pBlock == NULL) {
+            return NULL;
+        }
+
+        pBlock->pNext = (cstr_interner_block*)pShard->pBlocks;
+        pBlock->size  = CSTR_INTERNER_BLOCK_SIZE;
+        pBlock->used  = CSTR_INTERNER_BLOCK_HEADER_SIZE;
+        pShard->pBlocks = pBlock;
+    }
+
+    p = (char*)pBlock + pBlock->used;
+    pBlock->used += size;
+
+    return p;
+}
+
+static int cstr_interner_assign_id(cstr_interner* pInterner, cstr_interner_entry* pEntry)
+{
+    cstr_uint32 id;
+    size_t blockIndex;
+    size_t offset;
+    void** pIDBlock;
+
+    id = cstr_atomic_fetch_add_32(&pInterner->nextID, 1);
+    if (id >= CSTR_INTERNER_INVALID_ID) {
+        return ERANGE;
+    }
+
+    cstr_interner_get_id_location(id, &blockIndex, &offset);
+
+    pIDBlock = (void**)cstr_atomic_load_ptr(&pInterner->pIDBlocks[blockIndex]);
+    if (pIDBlock == NULL) {
+        cstr_spinlock_lock(&pInterner->idLock);
+        {
+            pIDBlock = (void**)pInterner->pIDBlocks[blockIndex];
+            if (pIDBlock == NULL) {
+                cstr_uint64 blockSize = ((cstr_uint64)CSTR_INTERNER_ID_BLOCK_BASE << blockIndex) * sizeof(void*);
+                if (blockSize <= (size_t)-1) {
+                    pIDBlock = (void**)CSTR_CALLOC((size_t)blockSize);
+                }
+
+                if (pIDBlock != NULL) {
+                    cstr_atomic_store_ptr(&pInterner->pIDBlocks[blockIndex], pIDBlock);
+                }
+            }
+        }
+        cstr_spinlock_unlock(&pInterner->idLock);
+
+        if (pIDBlock == NULL) {
+            return ENOMEM;  /* The ID is lost, but that's not a problem. It just means there will be a gap. */
+        }
+    }
+
+    pEntry->id = id;
+    cstr_atomic_store_ptr((void* volatile*)&pIDBlock[offset], pEntry);
+
+    return 0;
+}
+
+/* Must be called while holding the lock of the shard. */
+static int cstr_interner_shard_intern(cstr_interner* pInterner, cstr_interner_shard* pShard, const char* pStr, size_t len, cstr_uint64 hash, cstr_interner_entry** ppEntry)
+{
+    cstr_interner_entry* pEntry;
+    int result;
+
+    /* The string may have been inserted by another thread between the lock-free lookup and taking the lock. */
+    pEntry = cstr_interner_table_find((cstr_interner_table*)pShard->pTable, pStr, len, hash);
+    if (pEntry != NULL) {
+        *ppEntry = pEntry;
+        return 0;
+    }
+
+    if (len > (size_t)-1 - sizeof(cstr_interner_entry) - CSTR_INTERNER_BLOCK_HEADER_SIZE - 8 - CSTR_ALLOCATION_SLACK - CSTR_TAIL_PADDING) {
+        return ENOMEM;
+    }
+
+    result = cstr_interner_shard_reserve(pShard);
+    if (result != 0) {
+        return result;
+    }
+
+    pEntry = (cstr_interner_entry*)cstr_interner_shard_alloc(pShard, CSTR_ALLOCATION_SLACK + offsetof(cstr_interner_entry, header) + CSTR_HEADER_SIZE_IN_BYTES + len + 1 + CSTR_TAIL_PADDING);
+    if (pEntry == NULL) {
+        return ENOMEM;
+    }
+
+    pEntry = cstr_interner_entry_place(pEntry);
+
+    pEntry->hash             = (cstr_uint32)hash;
+    pEntry->header.refcount  = CSTR_INTERNER_REFCOUNT;
+    pEntry->header.flags     = 0;
+#if !defined(CSTR_NO_HASH_CACHE)
+    pEntry->header.flags    |= CSTR8_FLAG_HASH_VALID;   /* Interned strings are always shared so cstr_hash() can't cache it later. */
+    pEntry->header.hash      = hash;
+#endif
+    pEntry->header.cap       = len;
+    pEntry->header.len       = len;
+    CSTR_COPY_MEMORY(cstr_interner_entry_get_str(pEntry), pStr, len);
+    cstr_interner_entry_get_str(pEntry)[len] = '\0';
+#if CSTR_TAIL_PADDING > 0
+    CSTR_ZERO_MEMORY(cstr_interner_entry_get_str(pEntry) + len + 1, CSTR_TAIL_PADDING);
+#endif
+
+    /* For the same reason as the hash, this needs to be done now. Checking for ASCII is cheap compared to the hash that has already been computed. */
+    if (utf8_is_ascii(pStr, len)) {
+        pEntry->header.flags |= CSTR8_FLAG_ASCII_KNOWN | CSTR8_FLAG_ASCII | CSTR8_FLAG_UTF8_KNOWN | CSTR8_FLAG_UTF8;
+    } else {
+        pEntry->header.flags |= CSTR8_FLAG_ASCII_KNOWN;
+    }
+
+    result = cstr_interner_assign_id(pInterner, pEntry);
+    if (result != 0) {
+        return result;  /* The memory for the entry will be freed with the block. */
+    }
+
+    /* This is the store that makes the entry visible to readers so it must come last. */
+    cstr_interner_table_insert((cstr_interner_table*)pShard->pTable, pEntry);
+    pShard->count += 1;
+    cstr_atomic_fetch_add_32(&pInterner->count, 1);
+
+    *ppEntry = pEntry;
+    return 0;
+}
+
+CSTR_API int cstr_interner_init(cstr_interner* pInterner)
+{
+    if (pInterner == NULL) {
+        return EINVAL;
+    }
+
+    CSTR_ZERO_OBJECT(pInterner);
+
+    return 0;
+}
+
+CSTR_API void cstr_interner_uninit(cstr_interner* pInterner)
+{
+    size_t iShard;
+    size_t iBlock;
+
+    if (pInterner == NULL) {
+        return;
+    }
+
+    for (iShard = 0; iShard < CSTR_INTERNER_SHARD_COUNT; iShard += 1) {
+        cstr_interner_shard* pShard = &pInterner->shards[iShard];
+        cstr_interner_table* pTable;
+        cstr_interner_block* pBlock;
+
+        CSTR_FREE(pShard->pTable);
+
+        pTable = (cstr_interner_table*)pShard->pRetiredTables;
+        while (pTable != NULL) {
+            cstr_interner_table* pNext = pTable->pNext;
+            CSTR_FREE(pTable);
+            pTable = pNext;
+        }
+
+        pBlock = (cstr_interner_block*)pShard->pBlocks;
+        while (pBlock != NULL) {
+            cstr_interner_block* pNext = pBlock->pNext;
+            CSTR_FREE(pBlock);
+            pBlock = pNext;
+        }
+    }
+
+    for (iBlock = 0; iBlock < CSTR_INTERNER_ID_BLOCK_COUNT; iBlock += 1) {
+        CSTR_FREE(pInterner->pIDBlocks[iBlock]);
+    }
+
+    CSTR_ZERO_OBJECT(pInterner);
+}
+
+CSTR_API int cstr_interner_intern(cstr_interner* pInterner, const char* pStr, size_t len, cstr* pInterned, cstr_uint32* pID)
+{
+    cstr_interner_shard* pShard;
+    cstr_interner_entry* pEntry;
+    cstr_uint64 hash;
+    int result;
+
+    if (pInterned != NULL) {
+        *pInterned = NULL;
+    }
+
+    if (pID != NULL) {
+        *pID = CSTR_INTERNER_INVALID_ID;
+    }
+
+    if (pInterner == NULL || pStr == NULL) {
+        return EINVAL;
+    }
+
+    if (len == (size_t)-1) {
+        len = utf8_strlen(pStr);
+    }
+
+    hash = cstr_hash64(pStr, len, 0);
+
+    /* Fast path. Strings that have already been interned are found without taking a lock. */
+    pEntry = cstr_interner_find_hashed(pInterner, pStr, len, hash);
+    if (pEntry == NULL) {
+        pShard = cstr_interner_get_shard(pInterner, hash);
+
+        cstr_spinlock_lock(&pShard->lock);
+        {
+            result = cstr_interner_shard_intern(pInterner, pShard, pStr, len, hash, &pEntry);
+        }
+        cstr_spinlock_unlock(&pShard->lock);
+
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    if (pInterned != NULL) {
+        *pInterned = cstr_interner_entry_get_str(pEntry);
+    }
+
+    if (pID != NULL) {
+        *pID = pEntry->id;
+    }
+
+    return 0;
+}
+
+CSTR_API int cstr_interner_intern_bulk(cstr_interner* pInterner, const char* const* ppStrs, const size_t* pLens, size_t count, cstr* pInterned, cstr_uint32* pIDs)
+{
+    cstr_interner_entry* pEntries[CSTR_INTERNER_BATCH_SIZE];
+    size_t lens[CSTR_INTERNER_BATCH_SIZE];
+    cstr_uint64 hashes[CSTR_INTERNER_BATCH_SIZE];
+    cstr_uint32 shardMask[(CSTR_INTERNER_SHARD_COUNT + 31) / 32];   /* The shards that have at least one string that needs to be inserted. */
+    size_t batchOffset;
+    size_t i;
+
+    if (pInterned != NULL) {
+        for (i = 0; i < count; i += 1) {
+            pInterned[i] = NULL;
+        }
+    }
+
+    if (pIDs != NULL) {
+        for (i = 0; i < count; i += 1) {
+            pIDs[i] = CSTR_INTERNER_INVALID_ID;
+        }
+    }
+
+    if (pInterner == NULL || (ppStrs == NULL && count > 0)) {
+        return EINVAL;
+    }
+
+    for (i = 0; i < count; i += 1) {
+        if (ppStrs[i] == NULL) {
+            return EINVAL;
+        }
+    }
+
+    for (batchOffset = 0; batchOffset < count; batchOffset += CSTR_INTERNER_BATCH_SIZE) {
+        size_t batchSize = count - batchOffset;
+        size_t iShard;
+        int result = 0;
+
+        if (batchSize > CSTR_INTERNER_BATCH_SIZE) {
+            batchSize = CSTR_INTERNER_BATCH_SIZE;
+        }
+
+        CSTR_ZERO_MEMORY(shardMask, sizeof(shardMask));
+
+        /* First pass. Look everything up without a lock and make note of which shards will need to be locked. */
+        for (i = 0; i < batchSize; i += 1) {
+            const char* pStr = ppStrs[batchOffset + i];
+
+            lens[i] = (pLens != NULL) ? pLens[batchOffset + i] : (size_t)-1;
+            if (lens[i] == (size_t)-1) {
+                lens[i] = utf8_strlen(pStr);
+            }
+
+            hashes[i] = cstr_hash64(pStr, lens[i], 0);
+
+            pEntries[i] = cstr_interner_find_hashed(pInterner, pStr, lens[i], hashes[i]);
+            if (pEntries[i] == NULL) {
+                iShard = cstr_interner_get_shard(pInterner, hashes[i]) - pInterner->shards;
+                shardMask[iShard / 32] |= (cstr_uint32)1 << (iShard % 32);
+            }
+        }
+
+        /* Second pass. Insert the missing strings one shard at a time so each lock is only taken once. */
+        for (iShard = 0; iShard < CSTR_INTERNER_SHARD_COUNT && result == 0; iShard += 1) {
+            cstr_interner_shard* pShard = &pInterner->shards[iShard];
+
+            if ((shardMask[iShard / 32] & ((cstr_uint32)1 << (iShard % 32))) == 0) {
+                continue;
+            }
+
+            cstr_spinlock_lock(&pShard->lock);
+            {
+                for (i = 0; i < batchSize; i += 1) {
+                    if (pEntries[i] == NULL && cstr_interner_get_shard(pInterner, hashes[i]) == pShard) {
+                        result = cstr_interner_shard_intern(pInterner, pShard, ppStrs[batchOffset + i], lens[i], hashes[i], &pEntries[i]);
+                        if (result != 0) {
+                            break;
+                        }
+                    }
+                }
+            }
+            cstr_spinlock_unlock(&pShard->lock);
+        }
+
+        for (i = 0; i < batchSize; i += 1) {
+            if (pEntries[i] == NULL) {
+                continue;
+            }
+
+            if (pInterned != NULL) {
+                pInterned[batchOffset + i] = cstr_interner_entry_get_str(pEntries[i]);
+            }
+
+            if (pIDs != NULL) {
+                pIDs[batchOffset + i] = pEntries[i]->id;
+            }
+        }
+
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+CSTR_API int cstr_interner_find(const cstr_interner* pInterner, const char* pStr, size_t len, cstr* pInterned, cstr_uint32* pID)
+{
+    cstr_interner_entry* pEntry;
+
+    if (pInterned != NULL) {
+        *pInterned = NULL;
+    }
+
+    if (pID != NULL) {
+        *pID = CSTR_INTERNER_INVALID_ID;
+    }
+
+    if (pInterner == NULL || pStr == NULL) {
+        return EINVAL;
+    }
+
+    if (len == (size_t)-1) {
+        len = utf8_strlen(pStr);
+    }
+
+    pEntry = cstr_interner_find_hashed(pInterner, pStr, len, cstr_hash64(pStr, len, 0));
+    if (pEntry == NULL) {
+        return ENOENT;
+    }
+
+    if (pInterned != NULL) {
+        *pInterned = cstr_interner_entry_get_str(pEntry);
+    }
+
+    if (pID != NULL) {
+        *pID = pEntry->id;
+    }
+
+    return 0;
+}
+
+CSTR_API cstr cstr_interner_get(const cstr_interner* pInterner, cstr_uint32 id)
+{
+    void* volatile* pIDBlock;
+    cstr_interner_entry* pEntry;
+    size_t blockIndex;
+    size_t offset;
+
+    if (pInterner == NULL || id == CSTR_INTERNER_INVALID_ID) {
+        return NULL;
+    }
+
+    cstr_interner_get_id_location(id, &blockIndex, &offset);
+
+    pIDBlock = (void* volatile*)cstr_atomic_load_ptr((void* volatile*)&pInterner->pIDBlocks[blockIndex]);
+    if (pIDBlock == NULL) {
+        return NULL;
+    }
+
+    pEntry = (cstr_interner_entry*)cstr_atomic_load_ptr(&pIDBlock[offset]);
+    if (pEntry == NULL) {
+        return NULL;
+    }
+
+    return cstr_interner_entry_get_str(pEntry);
+}
+
+CSTR_API cstr_uint32 cstr_interner_id_of(cstr interned)
+{
+    if (interned == NULL) {
+        return CSTR_INTERNER_INVALID_ID;
+    }
+
+    return cstr_interner_entry_from_str(interned)->id;
+}
+
+CSTR_API cstr_uint32 cstr_interner_get_count(const cstr_interner* pInterner)
+{
+    if (pInterner == NULL) {
+        return 0;
+    }
+
+    return cstr_atomic_load_32((volatile cstr_uint32*)&pInterner->count);
+}
+#endif /* CSTR_NO_UTF8 */
+
+
+#ifndef CSTR_NO_UTF8
+#define CSTR_SORT_INSERTION_THRESHOLD   16      /* Groups this small are finished with an insertion sort. */
+#define CSTR_SORT_RADIX_THRESHOLD       1024    /* Groups this large are split with a radix sort. Anything in between uses a three-way quicksort. */
+
+typedef struct
+{
+    cstr_uint64 key;                /* The 8 bytes of the string starting at the depth of its group, big endian so they compare in byte order. Zero padded. */
+    const char* p;
+    size_t len;
+} cstr_sort_item;
+
+typedef struct
+{
+    size_t first;
+    size_t count;
+    size_t depth;                   /* The number of leading bytes that are the same for every string in the group. */
+    cstr_uint32 keyByte;            /* The number of leading bytes of the key that are the same for every string in the group. 8 means the whole key. */
+} cstr_sort_task;
+
+typedef struct
+{
+    cstr_sort_item* pItems;
+    cstr_sort_item* pTemp;          /* For the radix sort. Can be NULL in which case only the quicksort is used. */
+    cstr_sort_task* pTasks;
+    size_t taskCount;
+    size_t taskCap;
+} cstr_sort_state;
+
+static CSTR_INLINE cstr_uint64 cstr_sort_load_key(const char* p, size_t len, size_t depth)
+{
+    cstr_uint64 key;
+    size_t i;
+
+    if (len - depth >= 8) {
+        CSTR_COPY_MEMORY(&key, p + depth, 8);
+        return cstr_be2host_64(key);
+    }
+
+    key = 0;
+    for (i = depth; i < len; i += 1) {
+        key |= (cstr_uint64)(cstr_uint8)p[i] << (56 - ((i - depth) * 8));
+    }
+
+    return key;
+}
+
+static CSTR_INLINE void cstr_sort_swap_items(cstr_sort_item* pItems, size_t a, size_t b)
+{
+    cstr_sort_item temp = pItems[a];
+    pItems[a] = pItems[b];
+    pItems[b] = temp;
+}
+
+static int cstr_sort_compare_items(const cstr_sort_item* a, const cstr_sort_item* b, size_t depth)
+{
+    if (a->key != b->key) {
+        return (a->key < b->key) ? -1 : 1;
+    }
+
+    /* The keys are the same. If either string ended within the key, it's a prefix of the other one and the lengths decide the order. */
+    if (a->len - depth > 8 && b->len - depth > 8) {
+        size_t aRemaining = a->len - depth - 8;
+        size_t bRemaining = b->len - depth - 8;
+        int result = CSTR_COMPARE_MEMORY(a->p + depth + 8, b->p + depth + 8, (aRemaining < bRemaining) ? aRemaining : bRemaining);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    if (a->len != b->len) {
+        return (a->len < b->len) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static int cstr_sort_push_task(cstr_sort_state* pState, size_t first, size_t count, size_t depth, cstr_uint32 keyByte)
+{
+    if (count < 2) {
+        return 0;   /* Nothing to sort. */
+    }
+
+    if (pState->taskCount == pState->taskCap) {
+        size_t newCap = (pState->taskCap == 0) ? 64 : pState->taskCap * 2;
+        cstr_sort_task* pNewTasks = (cstr_sort_task*)CSTR_REALLOC(pState->pTasks, newCap * sizeof(*pNewTasks));
+        if (pNewTasks == NULL) {
+            return ENOMEM;
+        }
+
+        pState->pTasks  = pNewTasks;
+        pState->taskCap = newCap;
+    }
+
+    pState->pTasks[pState->taskCount].first   = first;
+    pState->pTasks[pState->taskCount].count   = count;
+    pState->pTasks[pState->taskCount].depth   = depth;
+    pState->pTasks[pState->taskCount].keyByte = keyByte;
+    pState->taskCount += 1;
+
+    return 0;
+}
+
+static void cstr_sort_insertion(cstr_sort_item* pItems, size_t count, size_t depth)
+{
+    size_t i;
+
+    for (i = 1; i < count; i += 1) {
+        cstr_sort_item item = pItems[i];
+        size_t j = i;
+
+        while (j > 0 && cstr_sort_compare_items(&item, &pItems[j - 1], depth) < 0) {
+            pItems[j] = pItems[j - 1];
+            j -= 1;
+        }
+
+        pItems[j] = item;
+    }
+}
+
+/* Every string in the group has the same key. The ones that end within the key come first, ordered by length, and the rest move on to the next 8 bytes. */
+static int cstr_sort_equal_keys(cstr_sort_state* pState, size_t first, size_t count, size_t depth)
+{
+    cstr_sort_item* pItems = pState->pItems + first;
+    size_t ended = 0;
+    size_t i;
+    size_t remainder;
+
+    for (i = 0; i < count; i += 1) {
+        if (pItems[i].len - depth <= 8) {
+            cstr_sort_swap_items(pItems, ended, i);
+            ended += 1;
+        }
+    }
+
+    /* The strings that ended can only differ by the number of trailing zero bytes so they're ordered with one pass for each possible length. */
+    if (ended > 1) {
+        size_t sorted = 0;
+        for (remainder = 0; remainder <= 8 && sorted < ended; remainder += 1) {
+            for (i = sorted; i < ended; i += 1) {
+                if (pItems[i].len - depth == remainder) {
+                    cstr_sort_swap_items(pItems, sorted, i);
+                    sorted += 1;
+                }
+            }
+        }
+    }
+
+    if (count - ended < 2) {
+        return 0;
+    }
+
+    for (i = ended; i < count; i += 1) {
+        pItems[i].key = cstr_sort_load_key(pItems[i].p, pItems[i].len, depth + 8);
+    }
+
+    return cstr_sort_push_task(pState, first + ended, count - ended, depth + 8, 0);
+}
+
+static int cstr_sort_radix(cstr_sort_state* pState, size_t first, size_t count, size_t depth, cstr_uint32 keyByte)
+{
+    cstr_sort_item* pItems = pState->pItems + first;
+    size_t counts[256];
+    size_t offsets[256];
+    cstr_uint32 shift = 56 - (keyByte * 8);
+    size_t i;
+    int result;
+
+    CSTR_ZERO_MEMORY(counts, sizeof(counts));
+    for (i = 0; i < count; i += 1) {
+        counts[(pItems[i].key >> shift) & 0xFF] += 1;
+    }
+
+    offsets[0] = 0;
+    for (i = 1; i < 256; i += 1) {
+        offsets[i] = offsets[i - 1] + counts[i - 1];
+    }
+
+    /* If every string has the same byte there's nothing to move. This is common for strings with a shared prefix. */
+    if (counts[(pItems[0].key >> shift) & 0xFF] != count) {
+        for (i = 0; i < count; i += 1) {
+            pState->pTemp[offsets[(pItems[i].key >> shift) & 0xFF]++] = pItems[i];
+        }
+
+        CSTR_COPY_MEMORY(pItems, pState->pTemp, count * sizeof(*pItems));
+    } else {
+        for (i = 0; i < 256; i += 1) {
+            offsets[i] += counts[i];
+        }
+    }
+
+    /* The offsets are now at the end of each bucket. */
+    for (i = 0; i < 256; i += 1) {
+        result = cstr_sort_push_task(pState, first + (offsets[i] - counts[i]), counts[i], depth, keyByte + 1);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+static int cstr_sort_quicksort(cstr_sort_state* pState, size_t first, size_t count, size_t depth, cstr_uint32 keyByte)
+{
+    cstr_sort_item* pItems = pState->pItems + first;
+    cstr_uint64 a = pItems[0].key;
+    cstr_uint64 b = pItems[count / 2].key;
+    cstr_uint64 c = pItems[count - 1].key;
+    cstr_uint64 pivot;
+    size_t lt = 0;
+    size_t gt = count;
+    size_t i  = 0;
+    int result;
+
+    /* Median of three. */
+    if (a < b) {
+        pivot = (b < c) ? b : ((a < c) ? c : a);
+    } else {
+        pivot = (a < c) ? a : ((b < c) ? c : b);
+    }
+
+    while (i < gt) {
+        cstr_uint64 key = pItems[i].key;
+        if (key < pivot) {
+            cstr_sort_swap_items(pItems, lt, i);
+            lt += 1;
+            i  += 1;
+        } else if (key > pivot) {
+            gt -= 1;
+            cstr_sort_swap_items(pItems, i, gt);
+        } else {
+            i  += 1;
+        }
+    }
+
+    result = cstr_sort_push_task(pState, first, lt, depth, keyByte);
+    if (result != 0) {
+        return result;
+    }
+
+    result = cstr_sort_push_task(pState, first + gt, count - gt, depth, keyByte);
+    if (result != 0) {
+        return result;
+    }
+
+    return cstr_sort_push_task(pState, first + lt, gt - lt, depth, 8);
+}
+
+/* The keys of the items must have been loaded at the given depth. */
+static int cstr_sort_items(cstr_sort_item* pItems, size_t count, size_t depth)
+{
+    cstr_sort_state state;
+    int result;
+
+    if (count < 2) {
+        return 0;
+    }
+
+    CSTR_ZERO_OBJECT(&state);
+    state.pItems = pItems;
+
+    /* The radix sort is only an optimization. If the memory for it can't be allocated, everything is done with the quicksort instead. */
+    if (count >= CSTR_SORT_RADIX_THRESHOLD) {
+        state.pTemp = (cstr_sort_item*)CSTR_MALLOC(count * sizeof(*state.pTemp));
+    }
+
+    /* Groups are processed from an explicit stack rather than recursively so that long shared prefixes can't overflow the call stack. */
+    result = cstr_sort_push_task(&state, 0, count, depth, 0);
+    while (result == 0 && state.taskCount > 0) {
+        cstr_sort_task task = state.pTasks[--state.taskCount];
+
+        if (task.keyByte == 8) {
+            result = cstr_sort_equal_keys(&state, task.first, task.count, task.depth);
+        } else if (task.count <= CSTR_SORT_INSERTION_THRESHOLD) {
+            cstr_sort_insertion(pItems + task.first, task.count, task.depth);
+        } else if (task.count >= CSTR_SORT_RADIX_THRESHOLD && state.pTemp != NULL) {
+            result = cstr_sort_radix(&state, task.first, task.count, task.depth, task.keyByte);
+        } else {
+            result = cstr_sort_quicksort(&state, task.first, task.count, task.depth, task.keyByte);
+        }
+    }
+
+    CSTR_FREE(state.pTemp);
+    CSTR_FREE(state.pTasks);
+
+    return result;
+}
+
+static cstr_sort_item* cstr_sort_alloc_items(size_t count)
+{
+    if (count > (size_t)-1 / sizeof(cstr_sort_item)) {
+        return NULL;
+    }
+
+    return (cstr_sort_item*)CSTR_MALLOC(count * sizeof(cstr_sort_item));
+}
+
+CSTR_API int cstr_sort(cstr_view* pViews, size_t count)
+{
+    return cstr_sort_ex(pViews, count, 0);
+}
+
+CSTR_API int cstr_sort_ex(cstr_view* pViews, size_t count, size_t depth)
+{
+    cstr_sort_item* pItems;
+    size_t i;
+    int result;
+
+    if (pViews == NULL && count > 0) {
+        return EINVAL;
+    }
+
+    if (count < 2) {
+        return 0;
+    }
+
+    pItems = cstr_sort_alloc_items(count);
+    if (pItems == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < count; i += 1) {
+        CSTR_ASSERT(pViews[i].len >= depth);
+        pItems[i].key = cstr_sort_load_key(pViews[i].p, pViews[i].len, depth);
+        pItems[i].p   = pViews[i].p;
+        pItems[i].len = pViews[i].len;
+    }
+
+    result = cstr_sort_items(pItems, count, depth);
+    if (result == 0) {
+        for (i = 0; i < count; i += 1) {
+            pViews[i].p   = pItems[i].p;
+            pViews[i].len = pItems[i].len;
+        }
+    }
+
+    CSTR_FREE(pItems);
+    return result;
+}
+
+static CSTR_INLINE size_t cstr_sort_get_partition(cstr_view view)
+{
+    return (view.len == 0) ? 0 : (size_t)(cstr_uint8)view.p[0] + 1;
+}
+
+CSTR_API void cstr_sort_partition(cstr_view* pViews, size_t count, size_t pOffsets[CSTR_SORT_PARTITION_COUNT + 1])
+{
+    size_t next[CSTR_SORT_PARTITION_COUNT];
+    size_t i;
+
+    if (pOffsets == NULL) {
+        return;
+    }
+
+    CSTR_ZERO_MEMORY(next, sizeof(next));
+
+    if (pViews != NULL) {
+        for (i = 0; i < count; i += 1) {
+            next[cstr_sort_get_partition(pViews[i])] += 1;
+        }
+    }
+
+    pOffsets[0] = 0;
+    for (i = 0; i < CSTR_SORT_PARTITION_COUNT; i += 1) {
+        pOffsets[i + 1] = pOffsets[i] + next[i];
+        next[i] = pOffsets[i];
+    }
+
+    if (pViews == NULL) {
+        return;
+    }
+
+    /* In place, American flag style. Each view is swapped directly into the next free slot of its partition. */
+    for (i = 0; i < CSTR_SORT_PARTITION_COUNT; i += 1) {
+        while (next[i] < pOffsets[i + 1]) {
+            cstr_view view = pViews[next[i]];
+            size_t partition = cstr_sort_get_partition(view);
+
+            while (partition != i) {
+                cstr_view temp = pViews[next[partition]];
+                pViews[next[partition]] = view;
+                next[partition] += 1;
+
+                view = temp;
+                partition = cstr_sort_get_partition(view);
+            }
+
+            pViews[next[i]] = view;
+            next[i] += 1;
+        }
+    }
+}
+
+CSTR_API int cstr_sort_strings(cstr* pStrs, size_t count)
+{
+    cstr_sort_item* pItems;
+    size_t i;
+    int result;
+
+    if (pStrs == NULL && count > 0) {
+        return EINVAL;
+    }
+
+    if (count < 2) {
+        return 0;
+    }
+
+    pItems = cstr_sort_alloc_items(count);
+    if (pItems == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < count; i += 1) {
+        pItems[i].p   = pStrs[i];
+        pItems[i].len = (pStrs[i] != NULL) ? cstr8_get_len(pStrs[i]) : 0;
+        pItems[i].key = cstr_sort_load_key(pItems[i].p, pItems[i].len, 0);
+    }
+
+    result = cstr_sort_items(pItems, count, 0);
+    if (result == 0) {
+        for (i = 0; i < count; i += 1) {
+            pStrs[i] = (cstr)pItems[i].p;
+        }
+    }
+
+    CSTR_FREE(pItems);
+    return result;
+}
+#endif /* CSTR_NO_UTF8 */
+
+
+#ifndef CSTR_NO_UTF8
+/* Serialized layout: "cstA", version (uint32), count (uint64), data size (uint64), the end offset of each string (uint64), the content. All little endian. */
+#define CSTR_ARRAY_SERIALIZED_VERSION       1
+#define CSTR_ARRAY_SERIALIZED_HEADER_SIZE   24
+
+static void cstr_array_write_uint64(cstr_uint8* pDst, cstr_uint64 n)
+{
+    int i;
+    for (i = 0; i < 8; i += 1) {
+        pDst[i] = (cstr_uint8)(n >> (i * 8));
+    }
+}
+
+static cstr_uint64 cstr_array_read_uint64(const cstr_uint8* pSrc)
+{
+    cstr_uint64 n = 0;
+    int i;
+    for (i = 0; i < 8; i += 1) {
+        n |= (cstr_uint64)pSrc[i] << (i * 8);
+    }
+
+    return n;
+}
+
+static int cstr_array_resize_offsets(cstr_array* pArray, size_t countCap)
+{
+    size_t* pNewOffsets;
+
+    if (countCap > ((size_t)-1 / sizeof(*pNewOffsets)) - 1) {
+        return ENOMEM;
+    }
+
+    pNewOffsets = (size_t*)CSTR_REALLOC(pArray->pOffsets, (countCap + 1) * sizeof(*pNewOffsets));
+    if (pNewOffsets == NULL) {
+        return ENOMEM;
+    }
+
+    if (pArray->pOffsets == NULL) {
+        pNewOffsets[0] = 0;
+    }
+
+    pArray->pOffsets = pNewOffsets;
+    pArray->countCap = countCap;
+
+    return 0;
+}
+
+static int cstr_array_resize_data(cstr_array* pArray, size_t dataCap)
+{
+    char* pNewData = (char*)CSTR_REALLOC(pArray->pData, dataCap);
+    if (pNewData == NULL) {
+        return ENOMEM;
+    }
+
+    pArray->pData   = pNewData;
+    pArray->dataCap = dataCap;
+
+    return 0;
+}
+
+static int cstr_array_grow(cstr_array* pArray, size_t extraCount, size_t extraData)
+{
+    if (extraCount > (size_t)-1 - pArray->count || extraData > (size_t)-1 - pArray->dataSize) {
+        return ENOMEM;
+    }
+
+    /* Both buffers grow geometrically so that appending one string at a time is amortized constant time. */
+    if (pArray->count + extraCount > pArray->countCap || pArray->pOffsets == NULL) {
+        size_t newCap = pArray->countCap * 2;
+        if (newCap < 16) {
+            newCap = 16;
+        }
+        if (newCap < pArray->count + extraCount) {
+            newCap = pArray->count + extraCount;
+        }
+
+        if (cstr_array_resize_offsets(pArray, newCap) != 0) {
+            return ENOMEM;
+        }
+    }
+
+    if (pArray->dataSize + extraData > pArray->dataCap) {
+        size_t newCap = pArray->dataCap * 2;
+        if (newCap < 256) {
+            newCap = 256;
+        }
+        if (newCap < pArray->dataSize + extraData) {
+            newCap = pArray->dataSize + extraData;
+        }
+
+        if (cstr_array_resize_data(pArray, newCap) != 0) {
+            return ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+CSTR_API int cstr_array_init(cstr_array* pArray)
+{
+    if (pArray == NULL) {
+        return EINVAL;
+    }
+
+    CSTR_ZERO_OBJECT(pArray);
+
+    return 0;
+}
+
+CSTR_API void cstr_array_uninit(cstr_array* pArray)
+{
+    if (pArray == NULL) {
+        return;
+    }
+
+    CSTR_FREE(pArray->pData);
+    CSTR_FREE(pArray->pOffsets);
+    CSTR_ZERO_OBJECT(pArray);
+}
+
+CSTR_API int cstr_array_reserve(cstr_array* pArray, size_t count, size_t dataSize)
+{
+    if (pArray == NULL) {
+        return EINVAL;
+    }
+
+    if (count > pArray->countCap || pArray->pOffsets == NULL) {
+        if (cstr_array_resize_offsets(pArray, count) != 0) {
+            return ENOMEM;
+        }
+    }
+
+    /* Every string has a null terminator which needs to be accounted for. */
+    if (dataSize > (size_t)-1 - count) {
+        return ENOMEM;
+    }
+
+    if (dataSize + count > pArray->dataCap) {
+        if (cstr_array_resize_data(pArray, dataSize + count) != 0) {
+            return ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+CSTR_API int cstr_array_append(cstr_array* pArray, const char* pStr, size_t len)
+{
+    int result;
+
+    if (pArray == NULL || pStr == NULL) {
+        return EINVAL;
+    }
+
+    if (len == (size_t)-1) {
+        len = utf8_strlen(pStr);
+    }
+
+    result = cstr_array_grow(pArray, 1, len + 1);
+    if (result != 0) {
+        return result;
+    }
+
+    CSTR_COPY_MEMORY(pArray->pData + pArray->dataSize, pStr, len);
+    pArray->pData[pArray->dataSize + len] = '\0';
+    pArray->dataSize += len + 1;
+    pArray->count    += 1;
+    pArray->pOffsets[pArray->count] = pArray->dataSize;
+
+    return 0;
+}
+
+CSTR_API int cstr_array_append_split(cstr_array* pArray, const char* pStr, size_t len, cstr_view delimiter)
+{
+    cstr_split_iterator iterator;
+    cstr_view token;
+    int result;
+
+    if (pArray == NULL || pStr == NULL) {
+        return EINVAL;
+    }
+
+    if (len == (size_t)-1) {
+        len = utf8_strlen(pStr);
+    }
+
+    /*
+    There is one more token than there are delimiters, and each token needs one byte for its null terminator. Since every delimiter is at least one byte, the
+    tokens can never need more than `len + 1` bytes, so reserving that means the content buffer is only ever resized once.
+    */
+    result = cstr_array_grow(pArray, 1, (len < (size_t)-1) ? len + 1 : len);
+    if (result != 0) {
+        return result;
+    }
+
+    utf8_split_init(&iterator, pStr, len, delimiter.p, delimiter.len, 0);
+    while (utf8_split_next(&iterator, &token)) {
+        result = cstr_array_append(pArray, token.p, token.len);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return 0;
+}
+
+CSTR_API size_t cstr_array_get_count(const cstr_array* pArray)
+{
+    if (pArray == NULL) {
+        return 0;
+    }
+
+    return pArray->count;
+}
+
+CSTR_API cstr_view cstr_array_get(const cstr_array* pArray, size_t index)
+{
+    if (pArray == NULL || index >= pArray->count) {
+        return cstr_view_init(NULL, 0);
+    }
+
+    return cstr_view_init(pArray->pData + pArray->pOffsets[index], pArray->pOffsets[index + 1] - pArray->pOffsets[index] - 1);
+}
+
+CSTR_API void cstr_array_clear(cstr_array* pArray)
+{
+    if (pArray == NULL) {
+        return;
+    }
+
+    pArray->count    = 0;
+    pArray->dataSize = 0;
+}
+
+CSTR_API int cstr_array_sort(cstr_array* pArray)
+{
+    cstr_sort_item* pItems;
+    char* pNewData;
+    size_t i;
+    int result;
+
+    if (pArray == NULL) {
+        return EINVAL;
+    }
+
+    if (pArray->count < 2) {
+        return 0;
+    }
+
+    pItems = cstr_sort_alloc_items(pArray->count);
+    if (pItems == NULL) {
+        return ENOMEM;
+    }
+
+    pNewData = (char*)CSTR_MALLOC(pArray->dataCap);
+    if (pNewData == NULL) {
+        CSTR_FREE(pItems);
+        return ENOMEM;
+    }
+
+    for (i = 0; i < pArray->count; i += 1) {
+        pItems[i].p   = pArray->pData + pArray->pOffsets[i];
+        pItems[i].len = pArray->pOffsets[i + 1] - pArray->pOffsets[i] - 1;
+        pItems[i].key = cstr_sort_load_key(pItems[i].p, pItems[i].len, 0);
+    }
+
+    result = cstr_sort_items(pItems, pArray->count, 0);
+    if (result != 0) {
+        CSTR_FREE(pNewData);
+        CSTR_FREE(pItems);
+        return result;
+    }
+
+    /* The content is rebuilt in sorted order so that iterating over the sorted array is sequential in memory. */
+    for (i = 0; i < pArray->count; i += 1) {
+        CSTR_COPY_MEMORY(pNewData + pArray->pOffsets[i], pItems[i].p, pItems[i].len + 1);
+        pArray->pOffsets[i + 1] = pArray->pOffsets[i] + pItems[i].len + 1;
+    }
+
+    CSTR_FREE(pArray->pData);
+    CSTR_FREE(pItems);
+    pArray->pData = pNewData;
+
+    return 0;
+}
+
+CSTR_API int cstr_array_serialize(const cstr_array* pArray, void* pDst, size_t dstCap, size_t* pSize)
+{
+    cstr_uint8* pBytes = (cstr_uint8*)pDst;
+    size_t size;
+    size_t i;
+
+    if (pSize != NULL) {
+        *pSize = 0;
+    }
+
+    if (pArray == NULL || (pDst == NULL && pSize == NULL)) {
+        return EINVAL;
+    }
+
+    if (pArray->count > ((size_t)-1 - CSTR_ARRAY_SERIALIZED_HEADER_SIZE - pArray->dataSize) / 8) {
+        return ENOMEM;
+    }
+
+    size = CSTR_ARRAY_SERIALIZED_HEADER_SIZE + (pArray->count * 8) + pArray->dataSize;
+
+    if (pSize != NULL) {
+        *pSize = size;
+    }
+
+    if (pDst == NULL) {
+        return 0;
+    }
+
+    if (dstCap < size) {
+        return ENOMEM;
+    }
+
+    pBytes[0] = 'c';
+    pBytes[1] = 's';
+    pBytes[2] = 't';
+    pBytes[3] = 'A';
+    pBytes[4] = (cstr_uint8)CSTR_ARRAY_SERIALIZED_VERSION;
+    pBytes[5] = 0;
+    pBytes[6] = 0;
+    pBytes[7] = 0;
+    cstr_array_write_uint64(pBytes +  8, pArray->count);
+    cstr_array_write_uint64(pBytes + 16, pArray->dataSize);
+    pBytes += CSTR_ARRAY_SERIALIZED_HEADER_SIZE;
+
+    for (i = 0; i < pArray->count; i += 1) {
+        cstr_array_write_uint64(pBytes, pArray->pOffsets[i + 1]);
+        pBytes += 8;
+    }
+
+    if (pArray->dataSize > 0) {
+        CSTR_COPY_MEMORY(pBytes, pArray->pData, pArray->dataSize);
+    }
+
+    return 0;
+}
+
+CSTR_API int cstr_array_deserialize(cstr_array* pArray, const void* pData, size_t dataSize)
+{
+    const cstr_uint8* pBytes = (const cstr_uint8*)pData;
+    const cstr_uint8* pContent;
+    cstr_uint64 count;
+    cstr_uint64 contentSize;
+    cstr_array newArray;
+    size_t i;
+
+    if (pArray == NULL || pData == NULL) {
+        return EINVAL;
+    }
+
+    if (dataSize < CSTR_ARRAY_SERIALIZED_HEADER_SIZE) {
+        return EINVAL;
+    }
+
+    if (pBytes[0] != 'c' || pBytes[1] != 's' || pBytes[2] != 't' || pBytes[3] != 'A') {
+        return EINVAL;
+    }
+
+    if (pBytes[4] != CSTR_ARRAY_SERIALIZED_VERSION || pBytes[5] != 0 || pBytes[6] != 0 || pBytes[7] != 0) {
+        return EINVAL;
+    }
+
+    count       = cstr_array_read_uint64(pBytes +  8);
+    contentSize = cstr_array_read_uint64(pBytes + 16);
+    dataSize   -= CSTR_ARRAY_SERIALIZED_HEADER_SIZE;
+    pBytes     += CSTR_ARRAY_SERIALIZED_HEADER_SIZE;
+
+    /* Checked in this order so none of the calculations can overflow. */
+    if (count > dataSize / 8 || contentSize != dataSize - (size_t)count * 8 || contentSize < count) {
+        return EINVAL;
+    }
+
+    pContent = pBytes + (size_t)count * 8;
+
+    cstr_array_init(&newArray);
+    if (cstr_array_reserve(&newArray, (size_t)count, (size_t)contentSize - (size_t)count) != 0) {
+        cstr_array_uninit(&newArray);
+        return ENOMEM;
+    }
+
+    /* Each string must end after the previous one and must end with a null terminator. The last string must end at the end of the content. */
+    for (i = 0; i < (size_t)count; i += 1) {
+        cstr_uint64 end = cstr_array_read_uint64(pBytes + (i * 8));
+        if (end <= newArray.pOffsets[i] || end > contentSize || pContent[end - 1] != '\0') {
+            cstr_array_uninit(&newArray);
+            return EINVAL;
+        }
+
+        newArray.pOffsets[i + 1] = (size_t)end;
+    }
+
+    if (newArray.pOffsets[(size_t)count] != contentSize) {
+        cstr_array_uninit(&newArray);
+        return EINVAL;
+    }
+
+    if (contentSize > 0) {
+        CSTR_COPY_MEMORY(newArray.pData, pContent, (size_t)contentSize);
+    }
+
+    newArray.count    = (size_t)count;
+    newArray.dataSize = (size_t)contentSize;
+
+    cstr_array_uninit(pArray);
+    *pArray = newArray;
+
+    return 0;
+}
+#endif /* CSTR_NO_UTF8 */
+
+
+/**************************************************************************************************************************************************************
+
+Escaping
+
+**************************************************************************************************************************************************************/
+#ifndef CSTR_NO_UTF8
+static const char cstr_hex_digits_lower[] = "0123456789abcdef";
+
+/* Returns the offset of the first byte that needs to be escaped in a JSON string, or `len` if there are none. */
+static size_t cstr_json_find_escape(const cstr_uint8* pSrc, size_t len)
+{
+    size_t i = 0;
+
+#if defined(CSTR_SUPPORT_SSE2)
+    for (; i + 16 <= len; i += 16) {
+        __m128i block   = _mm_loadu_si128((const __m128i*)(pSrc + i));
+        __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(block, _mm_set1_epi8(0x1F)), _mm_set1_epi8(0x1F));    /* <= 0x1F */
+        __m128i quote   = _mm_cmpeq_epi8(block, _mm_set1_epi8('"'));
+        __m128i slash   = _mm_cmpeq_epi8(block, _mm_set1_epi8('\\'));
+        int mask = _mm_movemask_epi8(_mm_or_si128(control, _mm_or_si128(quote, slash)));
+
+        if (mask != 0) {
+            return i + cstr_ctz32((cstr_uint32)mask);
+        }
+    }
+#endif
+
+    for (; i < len; i += 1) {
+        if (pSrc[i] < 0x20 || pSrc[i] == '"' || pSrc[i] == '\\') {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+/* Escapes `pSrc` into `pDst` and returns the length of the output. `pDst` can be NULL to only measure. */
+static size_t cstr_json_escape(const char* pSrc, size_t srcLen, char* pDst)
+{
+    size_t srcOffset = 0;
+    size_t dstLen = 0;
+
+    for (;;) {
+        size_t runLen = cstr_json_find_escape((const cstr_uint8*)pSrc + srcOffset, srcLen - srcOffset);
+        cstr_uint8 c;
+        char shortEscape;
+
+        if (pDst != NULL) {
+            CSTR_COPY_MEMORY(pDst + dstLen, pSrc + srcOffset, runLen);
+        }
+
+        dstLen    += runLen;
+        srcOffset += runLen;
+
+        if (srcOffset == srcLen) {
+            break;
+        }
+
+        c = (cstr_uint8)pSrc[srcOffset];
+        srcOffset += 1;
+
+        switch (c) {
+            case '"':  shortEscape = '"';  break;
+            case '\\': shortEscape = '\\'; break;
+            case '\b': shortEscape = 'b';  break;
+            case '\f': shortEscape = 'f';  break;
+            case '\n': shortEscape = 'n';  break;
+            case '\r': shortEscape = 'r';  break;
+            case '\t': shortEscape = 't';  break;
+            default:   shortEscape = 0;    break;
+        }
+
+        if (shortEscape != 0) {
+            if (pDst != NULL) {
+                pDst[dstLen + 0] = '\\';
+                pDst[dstLen + 1] = shortEscape;
+            }
+
+            dstLen += 2;
+        } else {
+            if (pDst != NULL) {
+                pDst[dstLen + 0] = '\\';
+                pDst[dstLen + 1] = 'u';
+                pDst[dstLen + 2] = '0';
+                pDst[dstLen + 3] = '0';
+                pDst[dstLen + 4] = cstr_hex_digits_lower[c >> 4];
+                pDst[dstLen + 5] = cstr_hex_digits_lower[c & 0xF];
+            }
+
+            dstLen += 6;
+        }
+    }
+
+    return dstLen;
+}
+
+CSTR_API cstr8 cstr8_cat_json_escaped(cstr8 str, const char* pSrc, size_t srcLen)
+{
+    size_t len;
+    size_t escapedLen;
+
+    if (pSrc == NULL) {
+        return str;
+    }
+
+    if (srcLen == (size_t)-1) {
+        srcLen = utf8_strlen(pSrc);
+    }
+
+    escapedLen = cstr_json_escape(pSrc, srcLen, NULL);
+
+    str = cstr8_reserve_append(str, escapedLen, &pSrc, "cat_json_escaped");
+    if (str == NULL) {
+        return NULL;
+    }
+
+    len = cstr8_get_len(str);
+
+    cstr_json_escape(pSrc, srcLen, str + len);
+    CSTR_STATS_ADD(bytesCopied, escapedLen);
+    str[len + escapedLen] = '\0';
+    cstr8_set_len(str, len + escapedLen);
+
+    return str;
+}
+
+
+/* The value of each hex digit, or 0xFF for bytes that aren't hex digits. */
+static const cstr_uint8 cstr_hex_digit_table[256] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/* Returns the value of a hex digit, or -1 if it's not a hex digit. */
+static CSTR_INLINE int cstr_hex_digit_value(char c)
+{
+    cstr_uint8 value = cstr_hex_digit_table[(cstr_uint8)c];
+
+    if (value == 0xFF) {
+        return -1;
+    }
+
+    return value;
+}
+
+/* Parses the four hex digits of a \u escape. Returns CSTR_FALSE if there aren't four hex digits. */
+static cstr_bool32 cstr_json_parse_hex4(const cstr_utf8* pSrc, size_t srcLen, cstr_utf16* pValue)
+{
+    cstr_utf16 value = 0;
+    size_t i;
+
+    if (srcLen < 4) {
+        return CSTR_FALSE;
+    }
+
+    for (i = 0; i < 4; i += 1) {
+        int digit = cstr_hex_digit_value(pSrc[i]);
+        if (digit < 0) {
+            return CSTR_FALSE;
+        }
+
+        value = (cstr_utf16)((value << 4) | digit);
+    }
+
+    *pValue = value;
+    return CSTR_TRUE;
+}
+
+CSTR_API errno_t utf8_json_unescape(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
+{
+    size_t srcOffset = 0;
+    size_t dstLen = 0;
+
+    if (pDstLen != NULL) {
+        *pDstLen = 0;
+    }
+
+    if (pSrc == NULL) {
+        return EINVAL;
+    }
+
+    if (srcLen == (size_t)-1) {
+        srcLen = utf8_strlen(pSrc);
+    }
+
+    for (;;) {
+        const cstr_utf8* pSlash = (const cstr_utf8*)memchr(pSrc + srcOffset, '\\', srcLen - srcOffset);
+        size_t runLen = (pSlash == NULL) ? srcLen - srcOffset : (size_t)(pSlash - (pSrc + srcOffset));
+        cstr_utf8 escaped[4];
+        size_t escapedLen = 1;
+
+        if (pDst != NULL) {
+            if (dstCap - dstLen < runLen) {
+                return ENOMEM;
+            }
+
+            CSTR_MOVE_MEMORY(pDst + dstLen, pSrc + srcOffset, runLen);
+        }
+
+        dstLen    += runLen;
+        srcOffset += runLen;
+
+        if (srcOffset == srcLen) {
+            break;
+        }
+
+        /* We're sitting on a backslash. */
+        if (srcOffset + 1 == srcLen) {
+            return EINVAL;
+        }
+
+        switch (pSrc[srcOffset + 1]) {
+            case '"':  escaped[0] = '"';  srcOffset += 2; break;
+            case '\\': escaped[0] = '\\'; srcOffset += 2; break;
+            case '/':  escaped[0] = '/';  srcOffset += 2; break;
+            case 'b':  escaped[0] = '\b'; srcOffset += 2; break;
+            case 'f':  escaped[0] = '\f'; srcOffset += 2; break;
+            case 'n':  escaped[0] = '\n'; srcOffset += 2; break;
+            case 'r':  escaped[0] = '\r'; srcOffset += 2; break;
+            case 't':  escaped[0] = '\t'; srcOffset += 2; break;
+            case 'u':
+            {
+                cstr_utf16 utf16[2];
+                cstr_utf32 utf32;
+
+                if (!cstr_json_parse_hex4(pSrc + srcOffset + 2, srcLen - (srcOffset + 2), &utf16[0])) {
+                    return EINVAL;
+                }
+
+                srcOffset += 6;
+                utf32 = utf16[0];
+
+                /* A high surrogate must be followed by a low surrogate in another \u escape. */
+                if (utf16[0] >= 0xD800 && utf16[0] <= 0xDBFF && srcLen - srcOffset >= 6 && pSrc[srcOffset] == '\\' && pSrc[srcOffset + 1] == 'u' &&
+                    cstr_json_parse_hex4(pSrc + srcOffset + 2, srcLen - (srcOffset + 2), &utf16[1]) && utf16[1] >= 0xDC00 && utf16[1] <= 0xDFFF) {
+                    srcOffset += 6;
+                    utf32 = utf16_pair_to_utf32_cp(utf16);
+                }
+
+                if (cstr_is_cp_in_surrogate_pair_range(utf32)) {
+                    if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                        return CSTR_ECODEPOINT;
+                    }
+
+                    utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+                }
+
+                escapedLen = utf32_cp_to_utf8(utf32, escaped, sizeof(escaped));
+            } break;
+
+            default: return EINVAL;
+        }
+
+        if (pDst != NULL) {
+            if (dstCap - dstLen < escapedLen) {
+                return ENOMEM;
+            }
+
+            CSTR_COPY_MEMORY(pDst + dstLen, escaped, escapedLen);
+        }
+
+        dstLen += escapedLen;
+    }
+
+    /* Null terminate if there's room for it. */
+    if (pDst != NULL && dstLen < dstCap) {
+        pDst[dstLen] = '\0';
+    }
+
+    if (pDstLen != NULL) {
+        *pDstLen = dstLen;
+    }
+
+    return 0;
+}
+
+
+/* Returns the offset of the first byte that needs to be replaced with an entity, or `len` if there are none. */
+static size_t cstr_html_find_escape(const cstr_uint8* pSrc, size_t len)
+{
+    size_t i = 0;
+
+#if defined(CSTR_SUPPORT_SSE2)
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(pSrc + i));
+        __m128i matches;
+        int mask;
+
+        matches = _mm_cmpeq_epi8(block, _mm_set1_epi8('&'));
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, _mm_set1_epi8('<')));
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, _mm_set1_epi8('>')));
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, _mm_set1_epi8('"')));
+        matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, _mm_set1_epi8('\'')));
+
+        mask = _mm_movemask_epi8(matches);
+        if (mask != 0) {
+            return i + cstr_ctz32((cstr_uint32)mask);
+        }
+    }
+#endif
+
+    for (; i < len; i += 1) {
+        if (pSrc[i] == '&' || pSrc[i] == '<' || pSrc[i] == '>' || pSrc[i] == '"' || pSrc[i] == '\'') {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+/* Escapes `pSrc` into `pDst` and returns the length of the output. `pDst` can be NULL to only measure. */
+static size_t cstr_html_escape(const char* pSrc, size_t srcLen, char* pDst)
+{
+    size_t srcOffset = 0;
+    size_t dstLen = 0;
+
+    for (;;) {
+        size_t runLen = cstr_html_find_escape((const cstr_uint8*)pSrc + srcOffset, srcLen - srcOffset);
+        const char* pEntity;
+        size_t entityLen;
+
+        if (pDst != NULL) {
+            CSTR_COPY_MEMORY(pDst + dstLen, pSrc + srcOffset, runLen);
+        }
+
+        dstLen    += runLen;
+        srcOffset += runLen;
+
+        if (srcOffset == srcLen) {
+            break;
+        }
+
+        switch (pSrc[srcOffset]) {
+            case '&': pEntity = "&amp;";  entityLen = 5; break;
+            case '<': pEntity = "&lt;";   entityLen = 4; break;
+            case '>': pEntity = "&gt;";   entityLen = 4; break;
+            case '"': pEntity = "&quot;"; entityLen = 6; break;
+            default:  pEntity = "&#39;";  entityLen = 5; break;
+        }
+
+        srcOffset += 1;
+
+        if (pDst != NULL) {
+            CSTR_COPY_MEMORY(pDst + dstLen, pEntity, entityLen);
+        }
+
+        dstLen += entityLen;
+    }
+
+    return dstLen;
+}
+
+CSTR_API cstr8 cstr8_cat_html_escaped(cstr8 str, const char* pSrc, size_t srcLen)
+{
+    size_t len;
+    size_t escapedLen;
+
+    if (pSrc == NULL) {
+        return str;
+    }
+
+    if (srcLen == (size_t)-1) {
+        srcLen = utf8_strlen(pSrc);
+    }
+
+    escapedLen = cstr_html_escape(pSrc, srcLen, NULL);
+
+    str = cstr8_reserve_append(str, escapedLen, &pSrc, "cat_html_escaped");
+    if (str == NULL) {
+        return NULL;
+    }
+
+    len = cstr8_get_len(str);
+
+    cstr_html_escape(pSrc, srcLen, str + len);
+    CSTR_STATS_ADD(bytesCopied, escapedLen);
+    str[len + escapedLen] = '\0';
+    cstr8_set_len(str, len + escapedLen);
+
+    return str;
+}
+
+
+/*
+Decodes the entity at the start of `pSrc`, which must be an `&`. On success, the decoded text is written to `pOut`, which must have room for 4 bytes, and the
+length of the entity and the output are returned through the last two parameters.
+*/
+static errno_t cstr_xml_decode_entity(const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags, cstr_utf8* pOut, size_t* pEntityLen, size_t* pOutLen)
+{
+    const cstr_utf8* pSemicolon;
+    size_t nameLen;
+
+    CSTR_ASSERT(srcLen > 0 && pSrc[0] == '&');
+
+    pSemicolon = (const cstr_utf8*)memchr(pSrc + 1, ';', srcLen - 1);
+    if (pSemicolon == NULL) {
+        return EINVAL;
+    }
+
+    nameLen     = (size_t)(pSemicolon - (pSrc + 1));
+    *pEntityLen = nameLen + 2;
+
+    if (nameLen >= 2 && pSrc[1] == '#') {
+        cstr_utf32 utf32 = 0;
+        size_t i;
+
+        if (pSrc[2] == 'x' || pSrc[2] == 'X') {
+            if (nameLen == 2) {
+                return EINVAL;
+            }
+
+            for (i = 3; i <= nameLen; i += 1) {
+                int digit = cstr_hex_digit_value(pSrc[i]);
+                if (digit < 0) {
+                    return EINVAL;
+                }
+
+                if (utf32 <= CSTR_UNICODE_MAX_CODE_POINT) {
+                    utf32 = (utf32 << 4) | (cstr_utf32)digit;
+                }
+            }
+        } else {
+            for (i = 2; i <= nameLen; i += 1) {
+                if (!cstr_is_ascii_digit(pSrc[i])) {
+                    return EINVAL;
+                }
+
+                if (utf32 <= CSTR_UNICODE_MAX_CODE_POINT) {
+                    utf32 = (utf32 * 10) + (cstr_utf32)(pSrc[i] - '0');
+                }
+            }
+        }
+
+        if (!cstr_is_valid_code_point(utf32)) {
+            if ((flags & CSTR_ERROR_ON_INVALID_CODE_POINT) != 0) {
+                return CSTR_ECODEPOINT;
+            }
+
+            utf32 = CSTR_UNICODE_REPLACEMENT_CODE_POINT;
+        }
+
+        *pOutLen = utf32_cp_to_utf8(utf32, pOut, 4);
+        return 0;
+    }
+
+    if (nameLen == 3 && pSrc[1] == 'a' && pSrc[2] == 'm' && pSrc[3] == 'p') {
+        pOut[0] = '&';
+    } else if (nameLen == 2 && pSrc[1] == 'l' && pSrc[2] == 't') {
+        pOut[0] = '<';
+    } else if (nameLen == 2 && pSrc[1] == 'g' && pSrc[2] == 't') {
+        pOut[0] = '>';
+    } else if (nameLen == 4 && pSrc[1] == 'q' && pSrc[2] == 'u' && pSrc[3] == 'o' && pSrc[4] == 't') {
+        pOut[0] = '"';
+    } else if (nameLen == 4 && pSrc[1] == 'a' && pSrc[2] == 'p' && pSrc[3] == 'o' && pSrc[4] == 's') {
+        pOut[0] = '\'';
+    } else {
+        return EINVAL;
+    }
+
+    *pOutLen = 1;
+    return 0;
+}
+
+CSTR_API errno_t utf8_xml_unescape(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
+{
+    size_t srcOffset = 0;
+    size_t dstLen = 0;
+
+    if (pDstLen != NULL) {
+        *pDstLen = 0;
+    }
+
+    if (pSrc == NULL) {
+        return EINVAL;
+    }
+
+    if (srcLen == (size_t)-1) {
+        srcLen = utf8_strlen(pSrc);
+    }
+
+    for (;;) {
+        const cstr_utf8* pAmpersand = (const cstr_utf8*)memchr(pSrc + srcOffset, '&', srcLen - srcOffset);
+        size_t runLen = (pAmpersand == NULL) ? srcLen - srcOffset : (size_t)(pAmpersand - (pSrc + srcOffset));
+        cstr_utf8 decoded[4];
+        size_t decodedLen;
+        size_t entityLen;
+        errno_t result;
+
+        if (pDst != NULL) {
+            if (dstCap - dstLen < runLen) {
+                return ENOMEM;
+            }
+
+            CSTR_MOVE_MEMORY(pDst + dstLen, pSrc + srcOffset, runLen);
+        }
+
+        dstLen    += runLen;
+        srcOffset += runLen;
+
+        if (srcOffset == srcLen) {
+            break;
+        }
+
+        result = cstr_xml_decode_entity(pSrc + srcOffset, srcLen - srcOffset, flags, decoded, &entityLen, &decodedLen);
+        if (result != 0) {
+            return result;
+        }
+
+        if (pDst != NULL) {
+            if (dstCap - dstLen < decodedLen) {
+                return ENOMEM;
+            }
+
+            CSTR_COPY_MEMORY(pDst + dstLen, decoded, decodedLen);
+        }
+
+        dstLen    += decodedLen;
+        srcOffset += entityLen;
+    }
+
+    /* Null terminate if there's room for it. */
+    if (pDst != NULL && dstLen < dstCap) {
+        pDst[dstLen] = '\0';
+    }
+
+    if (pDstLen != NULL) {
+        *pDstLen = dstLen;
+    }
+
+    return 0;
+}
+
+
+static const char cstr_hex_digits_upper[] = "0123456789ABCDEF";
+
+/* Builds the set of bytes that don't need to be percent-encoded. This is always the unreserved characters, plus anything in `pSafe`. */
+static void cstr_url_init_safe_set(cstr_uint32 safe[8], const char* pSafe)
+{
+    const char* pUnreserved = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~";
+    size_t i;
+
+    for (i = 0; i < 8; i += 1) {
+        safe[i] = 0;
+    }
+
+    for (; *pUnreserved != '\0'; pUnreserved += 1) {
+        safe[(cstr_uint8)*pUnreserved >> 5] |= 1U << ((cstr_uint8)*pUnreserved & 31);
+    }
+
+    if (pSafe != NULL) {
+        for (; *pSafe != '\0'; pSafe += 1) {
+            if (*pSafe != '%') {
+                safe[(cstr_uint8)*pSafe >> 5] |= 1U << ((cstr_uint8)*pSafe & 31);
+            }
+        }
+    }
+}
+
+static CSTR_INLINE cstr_bool32 cstr_url_is_safe(const cstr_uint32 safe[8], cstr_uint8 c)
+{
+    return (safe[c >> 5] & (1U << (c & 31))) != 0;
+}
+
+/*
+Returns the offset of the first byte that needs to be encoded, or `len` if there are none. Runs of unreserved characters, which is most of a typical URL,
+are classified 16 bytes at a time. Anything else is checked against the safe set one byte at a time.
+*/
+static size_t cstr_url_find_unsafe(const cstr_uint8* pSrc, size_t len, const cstr_uint32 safe[8])
+{
+    size_t i = 0;
+
+    for (;;) {
+    #if defined(CSTR_SUPPORT_SSE2)
+        while (i + 16 <= len) {
+            __m128i block = _mm_loadu_si128((const __m128i*)(pSrc + i));
+            __m128i unreserved;
+            cstr_uint32 mask;
+
+            /* Bytes above 0x7F are negative as signed bytes so they fail every range check. */
+            unreserved = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('z' + 1)));
+            unreserved = _mm_or_si128(unreserved, _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('Z' + 1))));
+            unreserved = _mm_or_si128(unreserved, _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(block, _mm_set1_epi8('9' + 1))));
+            unreserved = _mm_or_si128(unreserved, _mm_cmpeq_epi8(block, _mm_set1_epi8('-')));
+            unreserved = _mm_or_si128(unreserved, _mm_cmpeq_epi8(block, _mm_set1_epi8('.')));
+            unreserved = _mm_or_si128(unreserved, _mm_cmpeq_epi8(block, _mm_set1_epi8('_')));
+            unreserved = _mm_or_si128(unreserved, _mm_cmpeq_epi8(block, _mm_set1_epi8('~')));
+
+            mask = ~(cstr_uint32)_mm_movemask_epi8(unreserved) & 0xFFFF;
+            if (mask != 0) {
+                i += cstr_ctz32(mask);
+                break;
+            }
+
+            i += 16;
+        }
+    #endif
+
+        if (i == len) {
+            return len;
+        }
+
+        if (!cstr_url_is_safe(safe, pSrc[i])) {
+            return i;
+        }
+
+        i += 1;
+    }
+}
+
+/* Encodes `pSrc` into `pDst` and returns the length of the output. `pDst` can be NULL to only measure. */
+static size_t cstr_url_encode(const char* pSrc, size_t srcLen, const cstr_uint32 safe[8], cstr_uint32 flags, char* pDst)
+{
+    size_t srcOffset = 0;
+    size_t dstLen = 0;
+
+    for (;;) {
+        size_t runLen = cstr_url_find_unsafe((const cstr_uint8*)pSrc + srcOffset, srcLen - srcOffset, safe);
+        cstr_uint8 c;
+
+        if (pDst != NULL) {
+            CSTR_COPY_MEMORY(pDst + dstLen, pSrc + srcOffset, runLen);
+        }
+
+        dstLen    += runLen;
+        srcOffset += runLen;
+
+        if (srcOffset == srcLen) {
+            break;
+        }
+
+        c = (cstr_uint8)pSrc[srcOffset];
+        srcOffset += 1;
+
+        if (c == ' ' && (flags & CSTR_URL_SPACE_AS_PLUS) != 0) {
+            if (pDst != NULL) {
+                pDst[dstLen] = '+';
+            }
+
+            dstLen += 1;
+        } else {
+            if (pDst != NULL) {
+                pDst[dstLen + 0] = '%';
+                pDst[dstLen + 1] = cstr_hex_digits_upper[c >> 4];
+                pDst[dstLen + 2] = cstr_hex_digits_upper[c & 0xF];
+            }
+
+            dstLen += 3;
+        }
+    }
+
+    return dstLen;
+}
+
+CSTR_API cstr8 cstr8_cat_url_encoded_ex(cstr8 str, const char* pSrc, size_t srcLen, const char* pSafe, cstr_uint32 flags)
+{
+    cstr_uint32 safe[8];
+    size_t len;
+    size_t encodedLen;
+
+    if (pSrc == NULL) {
+        return str;
+    }
+
+    if (srcLen == (size_t)-1) {
+        srcLen = utf8_strlen(pSrc);
+    }
+
+    cstr_url_init_safe_set(safe, pSafe);
+
+    /* A space can't be output as-is if it's being used for `+`, and a literal `+` must be encoded so it's not decoded as a space. */
+    if ((flags & CSTR_URL_SPACE_AS_PLUS) != 0) {
+        safe[' ' >> 5] &= ~(1U << (' ' & 31));
+        safe['+' >> 5] &= ~(1U << ('+' & 31));
+    }
+
+    encodedLen = cstr_url_encode(pSrc, srcLen, safe, flags, NULL);
+
+    str = cstr8_reserve_append(str, encodedLen, &pSrc, "cat_url_encoded");
+    if (str == NULL) {
+        return NULL;
+    }
+
+    len = cstr8_get_len(str);
+
+    cstr_url_encode(pSrc, srcLen, safe, flags, str + len);
+    CSTR_STATS_ADD(bytesCopied, encodedLen);
+    str[len + encodedLen] = '\0';
+    cstr8_set_len(str, len + encodedLen);
+
+    return str;
+}
+
+CSTR_API cstr8 cstr8_cat_url_encoded(cstr8 str, const char* pSrc, size_t srcLen, cstr_uint32 component)
+{
+    const char* pSafe;
+
+    switch (component & CSTR_URL_COMPONENT_MASK) {
+        case CSTR_URL_COMPONENT_PATH_SEGMENT: pSafe = "!$&'()*+,;=:@";   break;
+        case CSTR_URL_COMPONENT_PATH:         pSafe = "!$&'()*+,;=:@/";  break;
+        case CSTR_URL_COMPONENT_QUERY:
+        case CSTR_URL_COMPONENT_FRAGMENT:     pSafe = "!$&'()*+,;=:@/?"; break;
+        default:                              pSafe = NULL;              break;
+    }
+
+    return cstr8_cat_url_encoded_ex(str, pSrc, srcLen, pSafe, component & ~(cstr_uint32)CSTR_URL_COMPONENT_MASK);
+}
+
+
+/* Returns the offset of the first `%`, or `+` if `findPlus` is set, or `len` if there are none. */
+static size_t cstr_url_find_encoded(const cstr_uint8* pSrc, size_t len, cstr_bool32 findPlus)
+{
+    size_t i = 0;
+    cstr_uint8 plus = findPlus ? '+' : '%';
+
+#if defined(CSTR_SUPPORT_SSE2)
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(pSrc + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('%')), _mm_cmpeq_epi8(block, _mm_set1_epi8((char)plus))));
+
+        if (mask != 0) {
+            return i + cstr_ctz32((cstr_uint32)mask);
+        }
+    }
+#endif
+
+    for (; i < len; i += 1) {
+        if (pSrc[i] == '%' || pSrc[i] == plus) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+CSTR_API errno_t utf8_url_decode(cstr_utf8* pDst, size_t dstCap, size_t* pDstLen, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
+{
+    size_t srcOffset = 0;
+    size_t dstLen = 0;
+    cstr_bool32 plusIsSpace = (flags & CSTR_URL_SPACE_AS_PLUS) != 0;
+
+    if (pDstLen != NULL) {
+        *pDstLen = 0;
+    }
+
+    if (pSrc == NULL) {
+        return EINVAL;
+    }
 
-                        /* If the next character is between 1 and 7 it means we have an octal constant. Otherwise we need to fall through and treat it as a decimal literal. */
-                        if (txt[newOff] >= '1' && txt[newOff] <= '7') {
-                            /* It's an octal integer literal. */
-                            off = newOff;
-                            while (off < len && (txt[off] >= '0' && txt[off] <= '7')) {
-                                off += 1;
-                            }
+    if (srcLen == (size_t)-1) {
+        srcLen = utf8_strlen(pSrc);
+    }
 
-                            /* We've reached the end of the literal. */
-                            return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_integer_literal_oct, off);
-                        } else {
-                            /* It's not an octal literal. Just fall through and treat it as a decimal literal. Note that we have not incremented 'off' at this point. */
-                        }
-                    }
-                }
-            } /* fallthrough */;
+    for (;;) {
+        size_t runLen = cstr_url_find_encoded((const cstr_uint8*)pSrc + srcOffset, srcLen - srcOffset, plusIsSpace);
+        cstr_utf8 decoded;
 
-            case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
-            {
-                /* Decimal integer or float literal. We keep looping until we find something that's not a number. If it is a '.', 'e' or 'E' it means we're looking at a floating-point literal. */
-                size_t tokenBeg = off;  /* <-- Will be used to calculate the length of the token. */
-                off += 1;
-                while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
-                    off += 1;
-                }
+        if (pDst != NULL) {
+            if (dstCap - dstLen < runLen) {
+                return ENOMEM;
+            }
 
-                /* Not a digit. If it's a dot it means we're processing a floating point literal. */
-                if (txt[off] == '.' || txt[off] == 'e' || txt[off] == 'E') {
-                    /* It's a floating point literal. We need to do another digit iteration. */
-                    if (txt[off] == '.') {
-                        off += 1;
-                        while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
-                            off += 1;
-                        }
-                    }
+            CSTR_MOVE_MEMORY(pDst + dstLen, pSrc + srcOffset, runLen);
+        }
 
-                    /* If our next character is an 'e' or 'E' it means we're using scientific notation. */
-                    if (txt[off] == 'e' || txt[off] == 'E') {
-                        /* Scientific notation. */
-                        off += 1;
-                        if (off < len && (txt[off] == '-' || txt[off] == '+')) {
-                            off += 1;
-                        }
+        dstLen    += runLen;
+        srcOffset += runLen;
 
-                        /* We must have at least one digit. */
-                        if (txt[off] >= '0' && txt[off] <= '9') {
-                            off += 1;
-                        } else {
-                            /* Invalid float literal. */
-                            return cstr_lexer_set_error(pLexer, (off - tokenBeg));
-                        }
+        if (srcOffset == srcLen) {
+            break;
+        }
 
-                        /* Now we just need to go until we hit the last digit. */
-                        while (off < len && (txt[off] >= '0' && txt[off] <= '9')) {
-                            off += 1;
-                        }
-                    }
+        if (pSrc[srcOffset] == '+') {
+            decoded = ' ';
+            srcOffset += 1;
+        } else {
+            cstr_uint8 hi;
+            cstr_uint8 lo;
 
-                    /* We've reached the end of the literal. Check for a suffix and set the token. */
-                    return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_float_literal_dec, off);
-                } else {
-                    /* It's a decimal integer literal. Check fo a suffix and set the token. */
-                    return cstr_lexer_parse_suffix_and_set_token(pLexer, cstr_token_type_integer_literal_dec, off);
-                }
-            } break;
+            if (srcLen - srcOffset < 3) {
+                return EINVAL;
+            }
 
-            case '=':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_eqeq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+            hi = cstr_hex_digit_table[(cstr_uint8)pSrc[srcOffset + 1]];
+            lo = cstr_hex_digit_table[(cstr_uint8)pSrc[srcOffset + 2]];
+            if ((hi | lo) == 0xFF) {
+                return EINVAL;
+            }
 
-            case '!':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_noteq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+            decoded = (cstr_utf8)((hi << 4) | lo);
+            srcOffset += 3;
+        }
 
-            case '<':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_lteq, 2);
-                    }
-                    if (txt[off+1] == '<') {
-                        if (off+2 < len) {
-                            if (txt[off+2] == '=') {
-                                return cstr_lexer_set_token(pLexer, cstr_token_type_shleq, 3);
-                            }
-                        }
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_shl, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+        if (pDst != NULL) {
+            if (dstLen == dstCap) {
+                return ENOMEM;
+            }
 
-            case '>':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_gteq, 2);
-                    }
-                    if (txt[off+1] == '>') {
-                        if (off+2 < len) {
-                            if (txt[off+2] == '=') {
-                                return cstr_lexer_set_token(pLexer, cstr_token_type_shreq, 3);
-                            }
-                        }
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_shr, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+            pDst[dstLen] = decoded;
+        }
 
-            case '&':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '&') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_andand, 2);
-                    }
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_andeq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+        dstLen += 1;
+    }
 
-            case '|':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '|') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_oror, 2);
-                    }
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_oreq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+    /* Null terminate if there's room for it. */
+    if (pDst != NULL && dstLen < dstCap) {
+        pDst[dstLen] = '\0';
+    }
 
-            case '+':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '+') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_plusplus, 2);
-                    }
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_pluseq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+    if (pDstLen != NULL) {
+        *pDstLen = dstLen;
+    }
 
-            case '-':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '-') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_minusminus, 2);
-                    }
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_minuseq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+    return 0;
+}
 
-            case '*':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_muleq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
 
-            case '/':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_diveq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);   /* Should never hit this because the '/' character is handled when handling comments. */
-            };
+static const char cstr_base64_alphabet[]     = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char cstr_base64_alphabet_url[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/* The value of each character in the base64 alphabets, or 0xFF for characters that aren't in the alphabet. */
+static const cstr_uint8 cstr_base64_decode_table[256] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static const cstr_uint8 cstr_base64_decode_table_url[256] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0x3F,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+static CSTR_INLINE cstr_bool32 cstr_is_decode_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static size_t cstr_base64_encoded_len(size_t dataSize, cstr_uint32 flags)
+{
+    if ((flags & CSTR_BASE64_NO_PADDING) != 0) {
+        return (dataSize / 3) * 4 + ((dataSize % 3 == 0) ? 0 : (dataSize % 3) + 1);
+    } else {
+        return ((dataSize + 2) / 3) * 4;
+    }
+}
 
-            case '%':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_modeq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+CSTR_API cstr8 cstr8_cat_base64(cstr8 str, const void* pData, size_t dataSize, cstr_uint32 flags)
+{
+    const char* pAlphabet = ((flags & CSTR_BASE64_URL) != 0) ? cstr_base64_alphabet_url : cstr_base64_alphabet;
+    const char* pSrc = (const char*)pData;
+    const cstr_uint8* pBytes;
+    char* pDst;
+    size_t len;
+    size_t encodedLen;
+    size_t i;
 
-            case '^':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == '=') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_xoreq, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+    if (pData == NULL) {
+        return str;
+    }
 
-            case ':':
-            {
-                if (off+1 < len) {
-                    if (txt[off+1] == ':') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_coloncolon, 2);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+    encodedLen = cstr_base64_encoded_len(dataSize, flags);
 
-            case '.':
-            {
-                if (off+2 < len) {
-                    if(txt[off+1] == '.' && txt[off+2] == '.') {
-                        return cstr_lexer_set_token(pLexer, cstr_token_type_ellipsis, 3);
-                    }
-                }
-                return cstr_lexer_set_single_char(pLexer, txt[off]);
-            };
+    str = cstr8_reserve_append(str, encodedLen, &pSrc, "cat_base64");
+    if (str == NULL) {
+        return NULL;
+    }
 
-            /*
-            By default we must have an identifier. In our lexer, all special operators are represented using ASCII characters. This means we can use *most* Unicode code points
-            in our identifiers. What we cannot use, however, is any of the Unicode defined whitespace characters (these encompass new line characters). We know that it won't
-            start with a whitespace character because we checked that at the top. However, we need to make sure we don't include any Unicode whitespace characters.
-            */
-            default:
-            {
-                /* We just need to loop until we hit the first disallowed character. We support "_", "a-z", "A-Z", "0-9" and all Unicode characters outside of ASCII except whitespace. */
-                if ((txt[off] >= 'a' && txt[off] <= 'z') ||
-                    (txt[off] >= 'A' && txt[off] <= 'Z') ||
-                    (txt[off] == '_')                    ||
-                    (txt[off] >= 0x80)) {
-                    size_t tokenMaxLen = utf8_next_whitespace(txt + off, (len - off));   /* <-- We'll be using this to ensure we don't include any Unicode whitespace characters. */
-                    size_t tokenLen = 0;
+    len    = cstr8_get_len(str);
+    pBytes = (const cstr_uint8*)pSrc;
+    pDst   = str + len;
 
-                    while (tokenLen < (len - off)) {
-                        tokenLen += 1;
-                        if (tokenLen == tokenMaxLen) {
-                            break;
-                        }
+    for (i = 0; i + 3 <= dataSize; i += 3) {
+        cstr_uint32 group = ((cstr_uint32)pBytes[i] << 16) | ((cstr_uint32)pBytes[i + 1] << 8) | (cstr_uint32)pBytes[i + 2];
 
-                        if ((txt[off+tokenLen] >= 'a' && txt[off+tokenLen] <= 'z')                 ||
-                            (txt[off+tokenLen] >= 'A' && txt[off+tokenLen] <= 'Z')                 ||
-                            (txt[off+tokenLen] >= '0' && txt[off+tokenLen] <= '9')                 ||
-                            (txt[off+tokenLen] == '_')                                             ||
-                            (txt[off+tokenLen] == '-' && pLexer->options.allowDashesInIdentifiers) ||   /* Enables support for kabab-case. */
-                            (txt[off+tokenLen] >= 0x80)) {
-                            continue;   /* Still valid. */
-                        } else {
-                            break;      /* Not a valid character for an identifier. We're done. */
-                        }
-                    }
+        pDst[0] = pAlphabet[(group >> 18) & 0x3F];
+        pDst[1] = pAlphabet[(group >> 12) & 0x3F];
+        pDst[2] = pAlphabet[(group >>  6) & 0x3F];
+        pDst[3] = pAlphabet[(group >>  0) & 0x3F];
+        pDst += 4;
+    }
 
-                    return cstr_lexer_set_token(pLexer, cstr_token_type_identifier, tokenLen);
-                } else {
-                    return cstr_lexer_set_single_char(pLexer, txt[off]);
-                }
-            };
+    if (i < dataSize) {
+        cstr_uint32 group = (cstr_uint32)pBytes[i] << 16;
+        if (i + 1 < dataSize) {
+            group |= (cstr_uint32)pBytes[i + 1] << 8;
+        }
+
+        pDst[0] = pAlphabet[(group >> 18) & 0x3F];
+        pDst[1] = pAlphabet[(group >> 12) & 0x3F];
+        pDst += 2;
+
+        if (i + 1 < dataSize) {
+            *pDst++ = pAlphabet[(group >> 6) & 0x3F];
+        }
+
+        if ((flags & CSTR_BASE64_NO_PADDING) == 0) {
+            *pDst++ = '=';
+            if (i + 1 == dataSize) {
+                *pDst++ = '=';
+            }
         }
     }
 
-    /* Shouldn't get here. */
-    /*return 0;*/
+    CSTR_ASSERT((size_t)(pDst - (str + len)) == encodedLen);
+
+    str[len + encodedLen] = '\0';
+    cstr8_set_len(str, len + encodedLen);
+
+    return str;
 }
 
-CSTR_API int cstr_lexer_transform_string(const char* pToken, size_t tokenLen, cstr* pStr)
+CSTR_API errno_t utf8_base64_decode(void* pDst, size_t dstCap, size_t* pDstSize, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
 {
-    cstr str = NULL;
+    const cstr_uint8* pTable = ((flags & CSTR_BASE64_URL) != 0) ? cstr_base64_decode_table_url : cstr_base64_decode_table;
+    cstr_uint8* pOut = (cstr_uint8*)pDst;
+    size_t srcOffset = 0;
+    size_t dstSize = 0;
+    cstr_uint32 group = 0;
+    cstr_uint32 groupLen = 0;   /* The number of characters in `group`. */
+    cstr_uint32 paddingLen = 0;
 
-    if (pStr == NULL) {
-        return EINVAL;
+    if (pDstSize != NULL) {
+        *pDstSize = 0;
     }
 
-    *pStr = NULL;
-
-    if (pToken == NULL || pStr == NULL) {
+    if (pSrc == NULL) {
         return EINVAL;
     }
 
-    /* We need to remove the surrounding quotes. */
-    if (pToken[0] == '\"' || pToken[0] == '\'' && tokenLen >= 2) {
-        str = cstr_newn(pToken + 1, tokenLen - 2);
-    } else {
-        str = cstr_newn(pToken, tokenLen);
+    if (srcLen == (size_t)-1) {
+        srcLen = utf8_strlen(pSrc);
     }
 
-    if (str == NULL) {
-        return ENOMEM;
-    }
+    for (;;) {
+        cstr_uint8 value;
+        char c;
+
+        /* Whole groups of 4 characters that are all in the alphabet are the common case and are decoded directly. */
+        if (groupLen == 0 && paddingLen == 0) {
+            while (srcLen - srcOffset >= 4) {
+                cstr_uint8 a = pTable[(cstr_uint8)pSrc[srcOffset + 0]];
+                cstr_uint8 b = pTable[(cstr_uint8)pSrc[srcOffset + 1]];
+                cstr_uint8 d = pTable[(cstr_uint8)pSrc[srcOffset + 2]];
+                cstr_uint8 e = pTable[(cstr_uint8)pSrc[srcOffset + 3]];
+                cstr_uint32 bits;
+
+                if (((a | b | d | e) & 0x80) != 0) {
+                    break;  /* Padding, whitespace or an error. Handled below. */
+                }
 
+                bits = ((cstr_uint32)a << 18) | ((cstr_uint32)b << 12) | ((cstr_uint32)d << 6) | (cstr_uint32)e;
 
-    /*
-    From here on we won't ever be making the string smaller. We can therefore do an efficient iteration with the assumption that we won't ever need to expand. We need
-    to transform the following:
+                if (pOut != NULL) {
+                    if (dstCap - dstSize < 3) {
+                        return ENOMEM;
+                    }
 
-        \\r -> \r
-        \\n -> \n
-        \\t -> \t
-        \\f -> \f
-        \\" -> \"
-        \\' -> \'
-        \\\ -> \\
-        \\0 -> \0
-    */
-    {
-        size_t i = 0;
-        while (i < cstr_len(str)) {
-            if (str[i] == '\\' && i+1 < cstr_len(str)) {
-                if (str[i+1] == '\r' ||
-                    str[i+1] == '\n' ||
-                    str[i+1] == '\t' ||
-                    str[i+1] == '\f' ||
-                    str[i+1] == '\"' ||
-                    str[i+1] == '\'' ||
-                    str[i+1] == '\\' ||
-                    str[i+1] == '\0') {
-                    cstr8_remove_at(str, i);
-                    continue;   /* Continue without incrementing the counter. */
+                    pOut[dstSize + 0] = (cstr_uint8)(bits >> 16);
+                    pOut[dstSize + 1] = (cstr_uint8)(bits >>  8);
+                    pOut[dstSize + 2] = (cstr_uint8)(bits >>  0);
                 }
+
+                dstSize   += 3;
+                srcOffset += 4;
             }
+        }
 
-            i += 1;
+        if (srcOffset == srcLen) {
+            break;
         }
-    }
 
-    /* TODO: Handle unicode constants with '\u'. */
-    /* TODO: Handle hex constants with '\x'. */
-    /* TODO: Handle octal constants with '\0[0..7]'. */
+        c     = pSrc[srcOffset];
+        value = pTable[(cstr_uint8)c];
+        srcOffset += 1;
 
-    /* We're done. */
-    *pStr = str;
-    return 0;
-}
+        if (value != 0xFF) {
+            if (paddingLen > 0) {
+                return EINVAL;  /* Data after padding. */
+            }
 
-CSTR_API int cstr_lexer_transform_comment(const char* pToken, size_t tokenLen, cstr* pStr)
-{
-    cstr str = NULL;
+            group     = (group << 6) | value;
+            groupLen += 1;
 
-    if (pStr == NULL) {
-        return EINVAL;
+            if (groupLen == 4) {
+                if (pOut != NULL) {
+                    if (dstCap - dstSize < 3) {
+                        return ENOMEM;
+                    }
+
+                    pOut[dstSize + 0] = (cstr_uint8)(group >> 16);
+                    pOut[dstSize + 1] = (cstr_uint8)(group >>  8);
+                    pOut[dstSize + 2] = (cstr_uint8)(group >>  0);
+                }
+
+                dstSize += 3;
+                group    = 0;
+                groupLen = 0;
+            }
+        } else if (c == '=') {
+            paddingLen += 1;
+            if (groupLen < 2 || groupLen + paddingLen > 4) {
+                return EINVAL;
+            }
+        } else if (cstr_is_decode_whitespace(c) && (flags & CSTR_DECODE_IGNORE_WHITESPACE) != 0) {
+            continue;
+        } else {
+            return EINVAL;
+        }
     }
 
-    *pStr = NULL;
+    if (paddingLen > 0 && groupLen + paddingLen != 4) {
+        return EINVAL;
+    }
 
-    if (pToken == NULL || pStr == NULL) {
+    /* A partial group of 2 or 3 characters holds 1 or 2 bytes. The leftover bits must be zero. */
+    if (groupLen == 1) {
         return EINVAL;
     }
 
-    /* We need to remove the surrounding comment tokens. */
-    if (pToken[0] == '/') {
-        if (pToken[1] == '/') {
-            /* Line comment. */
-            str = cstr_newn(pToken + 2, tokenLen - 2);
-        } else if (pToken[1] == '*' && tokenLen >= 4) {
-            /* Block comment. */
-            str = cstr_newn(pToken + 2, tokenLen - 4);
+    if (groupLen > 1) {
+        cstr_uint32 byteCount = groupLen - 1;
+        cstr_uint32 extraBits = (groupLen * 6) - (byteCount * 8);
+
+        if ((group & ((1U << extraBits) - 1)) != 0) {
+            return EINVAL;
         }
-    } else {
-        str = cstr_newn(pToken, tokenLen);
+
+        group >>= extraBits;
+
+        if (pOut != NULL) {
+            if (dstCap - dstSize < byteCount) {
+                return ENOMEM;
+            }
+
+            if (byteCount == 2) {
+                pOut[dstSize + 0] = (cstr_uint8)(group >> 8);
+                pOut[dstSize + 1] = (cstr_uint8)(group >> 0);
+            } else {
+                pOut[dstSize + 0] = (cstr_uint8)(group >> 0);
+            }
+        }
+
+        dstSize += byteCount;
     }
 
-    if (str == NULL) {
-        return ENOMEM;
+    if (pDstSize != NULL) {
+        *pDstSize = dstSize;
     }
 
-    /* We're done. */
-    *pStr = str;
     return 0;
 }
 
 
-/**************************************************************************************************************************************************************
-
-Key/Value Parser
-
-**************************************************************************************************************************************************************/
-CSTR_API int cstr_keyvalue_parser_init(const char* pText, size_t textLen, cstr_keyvalue_parser* pParser)
+CSTR_API cstr8 cstr8_cat_hex(cstr8 str, const void* pData, size_t dataSize, cstr_uint32 flags)
 {
-    int result;
+    const char* pDigits = ((flags & CSTR_HEX_UPPERCASE) != 0) ? cstr_hex_digits_upper : cstr_hex_digits_lower;
+    const char* pSrc = (const char*)pData;
+    const cstr_uint8* pBytes;
+    char* pDst;
+    size_t len;
+    size_t i = 0;
 
-    if (pParser == NULL) {
-        return EINVAL;  /* Invalid arguments. */
+    if (pData == NULL) {
+        return str;
     }
 
-    CSTR_ZERO_OBJECT(pParser);
+    str = cstr8_reserve_append(str, dataSize * 2, &pSrc, "cat_hex");
+    if (str == NULL) {
+        return NULL;
+    }
 
-    result = cstr_lexer_init(pText, textLen, &pParser->lexer);
-    if (result != 0) {
-        return result;  /* Failed to initialize the lexer. */
+    len    = cstr8_get_len(str);
+    pBytes = (const cstr_uint8*)pSrc;
+    pDst   = str + len;
+
+#if defined(CSTR_SUPPORT_SSE2)
+    {
+        /* The distance from '9' + 1 to the first letter. */
+        __m128i letterOffset = _mm_set1_epi8((char)(pDigits[10] - '0' - 10));
+
+        for (; i + 16 <= dataSize; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(pBytes + i));
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0F));
+            __m128i lo = _mm_and_si128(bytes, _mm_set1_epi8(0x0F));
+            __m128i nibbles0 = _mm_unpacklo_epi8(hi, lo);
+            __m128i nibbles1 = _mm_unpackhi_epi8(hi, lo);
+
+            nibbles0 = _mm_add_epi8(nibbles0, _mm_add_epi8(_mm_set1_epi8('0'), _mm_and_si128(_mm_cmpgt_epi8(nibbles0, _mm_set1_epi8(9)), letterOffset)));
+            nibbles1 = _mm_add_epi8(nibbles1, _mm_add_epi8(_mm_set1_epi8('0'), _mm_and_si128(_mm_cmpgt_epi8(nibbles1, _mm_set1_epi8(9)), letterOffset)));
+
+            _mm_storeu_si128((__m128i*)(pDst + i*2 +  0), nibbles0);
+            _mm_storeu_si128((__m128i*)(pDst + i*2 + 16), nibbles1);
+        }
+    }
+#endif
+
+    for (; i < dataSize; i += 1) {
+        pDst[i*2 + 0] = pDigits[pBytes[i] >> 4];
+        pDst[i*2 + 1] = pDigits[pBytes[i] & 0xF];
     }
 
-    pParser->lexer.options.allowDashesInIdentifiers = CSTR_TRUE;    /* Enables kabab-case. */
+    str[len + dataSize*2] = '\0';
+    cstr8_set_len(str, len + dataSize*2);
 
-    return 0;
+    return str;
 }
 
-CSTR_API int cstr_keyvalue_parser_next(cstr_keyvalue_parser* pParser)
+CSTR_API errno_t utf8_hex_decode(void* pDst, size_t dstCap, size_t* pDstSize, const cstr_utf8* pSrc, size_t srcLen, cstr_uint32 flags)
 {
-    int result;
-    const char* pKey = NULL;
-    size_t keyLen = 0;
-    const char* pVal = NULL;
-    size_t valLen = 0;
+    cstr_uint8* pOut = (cstr_uint8*)pDst;
+    size_t srcOffset = 0;
+    size_t dstSize = 0;
+    cstr_uint8 hi = 0;
+    cstr_bool32 hasHi = CSTR_FALSE;
 
-    if (pParser == NULL) {
+    if (pDstSize != NULL) {
+        *pDstSize = 0;
+    }
+
+    if (pSrc == NULL) {
         return EINVAL;
     }
 
-    /* Extract the key. */
+    if (srcLen == (size_t)-1) {
+        srcLen = utf8_strlen(pSrc);
+    }
+
     for (;;) {
-        result = cstr_lexer_next(&pParser->lexer);
-        if (result != 0) {
-            return result;  /* Probably reached the end. */
-        }
+        cstr_uint8 value;
+        char c;
 
-        /* The key needs to be an identifier or a string. If it's not we just skip it and try again. */
-        switch (pParser->lexer.token) {
-            case cstr_token_type_identifier:
-            case cstr_token_type_string_double:
-            case cstr_token_type_string_single:
-            {
-                pKey   = pParser->lexer.pTokenStr;
-                keyLen = pParser->lexer.tokenLen;
-            } break;
+    #if defined(CSTR_SUPPORT_SSE2)
+        /*
+        Runs of 32 hex digits are decoded 16 bytes at a time. The value of each digit is calculated from its range, after which adjacent digits are combined
+        in 16-bit lanes and packed down to bytes. Anything that isn't a hex digit, including whitespace, falls through to the loop below.
+        */
+        if (!hasHi) {
+            while (srcLen - srcOffset >= 32 && (pOut == NULL || dstCap - dstSize >= 16)) {
+                __m128i packed[2];
+                cstr_uint32 iBlock;
+                int valid = 0xFFFF;
+
+                for (iBlock = 0; iBlock < 2; iBlock += 1) {
+                    __m128i chars  = _mm_loadu_si128((const __m128i*)(pSrc + srcOffset + iBlock*16));
+                    __m128i lower  = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+                    __m128i digit  = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+                    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+                    __m128i values;
+
+                    valid &= _mm_movemask_epi8(_mm_or_si128(digit, letter));
+
+                    values = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))), _mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+                    packed[iBlock] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0x00FF)), 4), _mm_srli_epi16(values, 8));
+                }
 
-            /* Whitespace, newline and comment tokens are allowed. These are just skipped. */
-            case cstr_token_type_whitespace:
-            case cstr_token_type_newline:
-            case cstr_token_type_comment:
-            {
-                /* Do nothing and continue. */
-            } continue;
+                if (valid != 0xFFFF) {
+                    break;
+                }
 
-            default:
-            {
-                /* The ';' token is allowed. This is just a statement terminator. */
-                if (pParser->lexer.token == ';') {
-                    continue;
+                if (pOut != NULL) {
+                    _mm_storeu_si128((__m128i*)(pOut + dstSize), _mm_packus_epi16(packed[0], packed[1]));
                 }
 
-                /* Getting here means we have a syntax error. */
-                /* TODO: Post an error. */
-                return EINVAL;
-            };
+                dstSize   += 16;
+                srcOffset += 32;
+            }
         }
+    #endif
 
-        if (pKey != NULL) {
+        if (srcOffset == srcLen) {
             break;
         }
-    }
 
-    /* Getting here means we should have a key. Now we need to extract the value. */
-    for (;;) {
-        result = cstr_lexer_next(&pParser->lexer);
-        if (result != 0) {
-            return result;  /* Probably reached the end. */
-        }
+        c     = pSrc[srcOffset];
+        value = cstr_hex_digit_table[(cstr_uint8)c];
+        srcOffset += 1;
 
-        switch (pParser->lexer.token) {
-            case cstr_token_type_identifier:
-            case cstr_token_type_string_double:
-            case cstr_token_type_string_single:
-            {
-                pVal   = pParser->lexer.pTokenStr;
-                valLen = pParser->lexer.tokenLen;
-            } break;
+        if (value == 0xFF) {
+            if (cstr_is_decode_whitespace(c) && (flags & CSTR_DECODE_IGNORE_WHITESPACE) != 0) {
+                continue;
+            }
 
-            /* Whitespace, newline and comments can be ignored. */
-            case cstr_token_type_whitespace:
-            case cstr_token_type_newline:
-            case cstr_token_type_comment:
-            {
-                /* Do nothing and continue. */
-            } continue;
+            return EINVAL;
+        }
 
-            default:
-            {
-                /* We can allow an "=" sign for those who prefer an explicit assignment operator. This is optional in our key/value parser as whitespace gives enough context. */
-                if (pParser->lexer.token == '=') {
-                    continue;
+        if (!hasHi) {
+            hi    = value;
+            hasHi = CSTR_TRUE;
+        } else {
+            if (pOut != NULL) {
+                if (dstSize == dstCap) {
+                    return ENOMEM;
                 }
 
-                /* Getting here means we have a syntax error. */
-                /* TODO: Post an error. */
-                return EINVAL;
-            };
-        }
+                pOut[dstSize] = (cstr_uint8)((hi << 4) | value);
+            }
 
-        if (pVal != NULL) {
-            break;
+            dstSize += 1;
+            hasHi    = CSTR_FALSE;
         }
     }
 
-    /* If we get here we should have both a key and a value. We can now set the members of pParser and return. */
-    pParser->pKey     = pKey;
-    pParser->keyLen   = keyLen;
-    pParser->pValue   = pVal;
-    pParser->valueLen = valLen;
+    if (hasHi) {
+        return EINVAL;  /* Odd number of digits. */
+    }
+
+    if (pDstSize != NULL) {
+        *pDstSize = dstSize;
+    }
 
     return 0;
 }
+#endif /* CSTR_NO_UTF8 */
 
 #endif  /* libcstr_c */
 #endif  /* LIBCSTR_IMPLEMENTATION */